@@ -0,0 +1,643 @@
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sipc_lib.h>
+
+#define VERSION		"00.01"
+
+#define BENCH_TITLE				"sipc_bench"
+#define BENCH_DEFAULT_TOPOLOGY	"1:1,1:4,4:1,4:4"
+#define BENCH_DEFAULT_SIZES		"16,256,4096,65536,1048576"
+#define BENCH_DEFAULT_COUNT		1000
+#define BENCH_ROUND_BYTES		(32 * 1024 * 1024)	//per publisher per round
+#define BENCH_IDLE_TIMEOUT_MS	5000
+#define BENCH_MAX_LIST			16
+
+/*
+ * every message starts with this header, so the smallest message is 16 bytes
+ */
+struct bench_header {
+	unsigned long long stamp;
+	unsigned int round;
+	unsigned int seq;
+};
+
+struct bench_round {
+	unsigned int round;
+	unsigned int size;		//zero means exit
+	unsigned int count;
+	unsigned int publishers;
+};
+
+struct bench_sub_report {
+	unsigned long received;
+	unsigned long long first_rx;
+	unsigned long long last_rx;
+};
+
+struct bench_pub_report {
+	unsigned long sent;
+	unsigned long errors;
+	unsigned long long start;
+	unsigned long long end;
+};
+
+struct bench_proc {
+	pid_t pid;
+	int ctrl_fd;
+	int result_fd;
+};
+
+//subscriber state, written by the listener thread of libsipcc
+static unsigned int sub_round = 0;
+static unsigned long sub_expected = 0;
+static unsigned long sub_received = 0;
+static unsigned long long sub_first_rx = 0;
+static unsigned long long sub_last_rx = 0;
+static unsigned long long *sub_latencies = NULL;
+
+static char *daemon_path = "./daemon/sipcd";
+static char *topology_arg = BENCH_DEFAULT_TOPOLOGY;
+static char *size_arg = BENCH_DEFAULT_SIZES;
+static unsigned int message_count = BENCH_DEFAULT_COUNT;
+
+static struct option parameters[] = {
+	{ "help",				no_argument,		0,	'h'	},
+	{ "version",			no_argument,		0,	'v'	},
+	{ "daemon",				required_argument,	0,	'd'	},
+	{ "topology",			required_argument,	0,	't'	},
+	{ "sizes",				required_argument,	0,	's'	},
+	{ "count",				required_argument,	0,	'n'	},
+	{ NULL,					0,					0, 	0 	},
+};
+
+static void print_help_exit (char *arg)
+{
+	if (!arg) {
+		return;
+	}
+	printf("\n%s help:\n\n", arg);
+
+	printf("--version:\t('v')\n\t\treturns version\n\n");
+	printf("--daemon:\t('d')\n\t\tpath of sipcd, default %s\n\n", daemon_path);
+	printf("--topology:\t('t')\n\t\tcomma separated publishers:subscribers list, default %s\n\n", BENCH_DEFAULT_TOPOLOGY);
+	printf("--sizes:\t('s')\n\t\tcomma separated message sizes in bytes, default %s\n\n", BENCH_DEFAULT_SIZES);
+	printf("--count:\t('n')\n\t\tmessages per publisher per size, default %d\n\n", BENCH_DEFAULT_COUNT);
+	printf("results are written to stdout as one json object per line\n\n");
+
+	exit(OK);
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	ssize_t ret;
+	const char *ptr = (const char *)buf;
+
+	while (len) {
+		ret = write(fd, ptr, len);
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		} else if (ret <= 0) {
+			return NOK;
+		}
+		ptr += ret;
+		len -= ret;
+	}
+
+	return OK;
+}
+
+static int read_all(int fd, void *buf, size_t len)
+{
+	ssize_t ret;
+	char *ptr = (char *)buf;
+
+	while (len) {
+		ret = read(fd, ptr, len);
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		} else if (ret <= 0) {
+			return NOK;
+		}
+		ptr += ret;
+		len -= ret;
+	}
+
+	return OK;
+}
+
+static int bench_callback(void *data, unsigned int len)
+{
+	unsigned long index;
+	unsigned long long now = sipc_monotonic_ns();
+	struct bench_header header;
+
+	if (len < sizeof(header)) {
+		return OK;
+	}
+	memcpy(&header, data, sizeof(header));
+
+	//late data of an old round is ignored
+	if (header.round != __atomic_load_n(&sub_round, __ATOMIC_ACQUIRE)) {
+		return OK;
+	}
+
+	index = __atomic_fetch_add(&sub_received, 1, __ATOMIC_RELAXED);
+	if (index < sub_expected) {
+		sub_latencies[index] = now - header.stamp;
+	}
+	if (!index) {
+		sub_first_rx = now;
+	}
+	__atomic_store_n(&sub_last_rx, now, __ATOMIC_RELEASE);
+
+	return OK;
+}
+
+static int dummy_callback(void *data, unsigned int len)
+{
+	UNUSED(data);
+	UNUSED(len);
+
+	return OK;
+}
+
+static void subscriber_round(struct bench_round *round, int result_fd)
+{
+	unsigned long received = 0, last_received = 0;
+	unsigned long long idle_since = sipc_monotonic_ns();
+	struct bench_sub_report report;
+
+	for (;;) {
+		usleep(1000);
+		received = __atomic_load_n(&sub_received, __ATOMIC_RELAXED);
+		if (received >= sub_expected) {
+			break;
+		}
+		if (received != last_received) {
+			last_received = received;
+			idle_since = sipc_monotonic_ns();
+		} else if (sipc_monotonic_ns() - idle_since > BENCH_IDLE_TIMEOUT_MS * 1000000ULL) {
+			break;
+		}
+	}
+
+	//stop counting before reporting
+	__atomic_store_n(&sub_round, round->round + 1, __ATOMIC_RELEASE);
+
+	report.received = __atomic_load_n(&sub_received, __ATOMIC_RELAXED);
+	if (report.received > sub_expected) {
+		report.received = sub_expected;
+	}
+	report.first_rx = sub_first_rx;
+	report.last_rx = __atomic_load_n(&sub_last_rx, __ATOMIC_ACQUIRE);
+
+	if (write_all(result_fd, &report, sizeof(report)) == NOK ||
+			write_all(result_fd, sub_latencies, report.received * sizeof(unsigned long long)) == NOK) {
+		errorf("write_all() failed\n");
+	}
+}
+
+static int subscriber_main(int ctrl_fd, int result_fd, unsigned int id)
+{
+	struct bench_round round;
+
+	UNUSED(id);
+
+	if (sipc_register(BENCH_TITLE, bench_callback, 10) == NOK) {
+		errorf("sipc_register() failed\n");
+		return NOK;
+	}
+
+	(void) write_all(result_fd, "R", 1);
+
+	while (read_all(ctrl_fd, &round, sizeof(round)) == OK && round.size) {
+		FREE(sub_latencies);
+		sub_expected = (unsigned long)round.count * round.publishers;
+		sub_latencies = (unsigned long long *)calloc(sub_expected, sizeof(unsigned long long));
+		if (!sub_latencies) {
+			errorf("calloc failed\n");
+			return NOK;
+		}
+		__atomic_store_n(&sub_received, 0, __ATOMIC_RELAXED);
+		sub_first_rx = sub_last_rx = 0;
+		__atomic_store_n(&sub_round, round.round, __ATOMIC_RELEASE);
+
+		(void) write_all(result_fd, "R", 1);
+		subscriber_round(&round, result_fd);
+	}
+
+	sipc_unregister(BENCH_TITLE);
+	sipc_destroy();
+	FREE(sub_latencies);
+
+	return OK;
+}
+
+static int publisher_main(int ctrl_fd, int result_fd, unsigned int id)
+{
+	unsigned int i;
+	char title[64] = {0};
+	char *data = NULL;
+	struct bench_round round;
+	struct bench_header header;
+	struct bench_pub_report report;
+
+	//only registered applications may send, so publishers listen a title of their own
+	snprintf(title, sizeof(title), "%s_publisher_%u", BENCH_TITLE, id);
+	if (sipc_register(title, dummy_callback, 10) == NOK) {
+		errorf("sipc_register() failed\n");
+		return NOK;
+	}
+
+	(void) write_all(result_fd, "R", 1);
+
+	while (read_all(ctrl_fd, &round, sizeof(round)) == OK && round.size) {
+		FREE(data);
+		data = (char *)calloc(1, round.size);
+		if (!data) {
+			errorf("calloc failed\n");
+			return NOK;
+		}
+		memset(data, 'a' + (id % 26), round.size);
+
+		memset(&report, 0, sizeof(report));
+		report.start = sipc_monotonic_ns();
+		for (i = 0; i < round.count; i++) {
+			header.round = round.round;
+			header.seq = i;
+			header.stamp = sipc_monotonic_ns();
+			memcpy(data, &header, sizeof(header));
+			if (sipc_send_data(BENCH_TITLE, data, round.size, 0) == NOK) {
+				report.errors++;
+				continue;
+			}
+			report.sent++;
+		}
+		report.end = sipc_monotonic_ns();
+
+		(void) write_all(result_fd, &report, sizeof(report));
+	}
+
+	sipc_unregister(title);
+	sipc_destroy();
+	FREE(data);
+
+	return OK;
+}
+
+static int bench_fork(int (*worker)(int, int, unsigned int), unsigned int id, struct bench_proc *proc)
+{
+	int ctrl[2], result[2];
+
+	if (pipe(ctrl) == -1 || pipe(result) == -1) {
+		errorf("pipe() failed with %d: %s\n", errno, strerror(errno));
+		return NOK;
+	}
+
+	proc->pid = fork();
+	if (proc->pid < 0) {
+		errorf("fork() failed with %d: %s\n", errno, strerror(errno));
+		return NOK;
+	} else if (proc->pid == 0) {
+		close(ctrl[1]);
+		close(result[0]);
+		_exit(worker(ctrl[0], result[1], id));
+	}
+
+	close(ctrl[0]);
+	close(result[1]);
+	proc->ctrl_fd = ctrl[1];
+	proc->result_fd = result[0];
+
+	return OK;
+}
+
+static void bench_reap(struct bench_proc *procs, unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		if (procs[i].pid > 0) {
+			close(procs[i].ctrl_fd);
+			close(procs[i].result_fd);
+			waitpid(procs[i].pid, NULL, 0);
+			procs[i].pid = 0;
+		}
+	}
+}
+
+static pid_t start_daemon(void)
+{
+	int fd;
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) {
+		errorf("fork() failed with %d: %s\n", errno, strerror(errno));
+		return -1;
+	} else if (pid == 0) {
+		if ((fd = open("/dev/null", O_WRONLY)) >= 0) {
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+			close(fd);
+		}
+		execl(daemon_path, daemon_path, (char *)NULL);
+		_exit(NOK);
+	}
+
+	sleep(1);
+	if (waitpid(pid, NULL, WNOHANG) == pid) {
+		errorf("%s exited, is another sipcd running?\n", daemon_path);
+		return -1;
+	}
+
+	return pid;
+}
+
+static void stop_daemon(pid_t pid)
+{
+	if (pid > 0) {
+		kill(pid, SIGINT);
+		waitpid(pid, NULL, 0);
+	}
+}
+
+static int compare_latency(const void *a, const void *b)
+{
+	unsigned long long la = *(const unsigned long long *)a;
+	unsigned long long lb = *(const unsigned long long *)b;
+
+	return la < lb ? -1 : (la > lb ? 1 : 0);
+}
+
+static unsigned long long percentile(unsigned long long *latencies, unsigned long count, double p)
+{
+	unsigned long index;
+
+	if (!count) {
+		return 0;
+	}
+
+	index = (unsigned long)(count * p / 100.0);
+	if (index >= count) {
+		index = count - 1;
+	}
+
+	return latencies[index];
+}
+
+static int run_round(struct bench_proc *pubs, unsigned int pub_count, struct bench_proc *subs, unsigned int sub_count,
+	struct bench_round *round)
+{
+	int ret = OK;
+	unsigned int i;
+	char ack;
+	unsigned long sent = 0, errors = 0, received = 0, expected = 0;
+	unsigned long long start = ~0ULL, end = 0, *latencies = NULL;
+	double seconds;
+	struct bench_pub_report preport;
+	struct bench_sub_report sreport;
+
+	expected = (unsigned long)round->count * pub_count * sub_count;
+	latencies = (unsigned long long *)calloc(expected ? expected : 1, sizeof(unsigned long long));
+	if (!latencies) {
+		errorf("calloc failed\n");
+		return NOK;
+	}
+
+	for (i = 0; i < sub_count; i++) {
+		if (write_all(subs[i].ctrl_fd, round, sizeof(*round)) == NOK || read_all(subs[i].result_fd, &ack, 1) == NOK) {
+			errorf("subscriber %u is lost\n", i);
+			goto fail;
+		}
+	}
+
+	for (i = 0; i < pub_count; i++) {
+		if (write_all(pubs[i].ctrl_fd, round, sizeof(*round)) == NOK) {
+			errorf("publisher %u is lost\n", i);
+			goto fail;
+		}
+	}
+
+	for (i = 0; i < pub_count; i++) {
+		if (read_all(pubs[i].result_fd, &preport, sizeof(preport)) == NOK) {
+			errorf("publisher %u is lost\n", i);
+			goto fail;
+		}
+		sent += preport.sent;
+		errors += preport.errors;
+		if (preport.start < start) {
+			start = preport.start;
+		}
+	}
+
+	for (i = 0; i < sub_count; i++) {
+		if (read_all(subs[i].result_fd, &sreport, sizeof(sreport)) == NOK ||
+				read_all(subs[i].result_fd, latencies + received, sreport.received * sizeof(unsigned long long)) == NOK) {
+			errorf("subscriber %u is lost\n", i);
+			goto fail;
+		}
+		received += sreport.received;
+		if (sreport.last_rx > end) {
+			end = sreport.last_rx;
+		}
+	}
+
+	qsort(latencies, received, sizeof(unsigned long long), compare_latency);
+	seconds = end > start ? (end - start) / 1e9 : 0;
+
+	printf("{\"publishers\":%u,\"subscribers\":%u,\"size\":%u,\"sent\":%lu,\"send_errors\":%lu,\"received\":%lu,"
+		"\"lost\":%lu,\"seconds\":%.6f,\"msgs_per_sec\":%.1f,\"mb_per_sec\":%.3f,"
+		"\"latency_ns\":{\"p50\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu}}\n",
+		pub_count, sub_count, round->size, sent, errors, received, expected - received, seconds,
+		seconds ? received / seconds : 0, seconds ? (double)received * round->size / seconds / (1024 * 1024) : 0,
+		percentile(latencies, received, 50), percentile(latencies, received, 99), percentile(latencies, received, 99.9),
+		received ? latencies[received - 1] : 0);
+	fflush(stdout);
+
+	goto out;
+
+fail:
+	ret = NOK;
+
+out:
+	FREE(latencies);
+
+	return ret;
+}
+
+static int run_topology(unsigned int pub_count, unsigned int sub_count, unsigned int *sizes, unsigned int size_count)
+{
+	int ret = OK;
+	unsigned int i;
+	char ack;
+	pid_t daemon_pid = -1;
+	struct bench_round round;
+	struct bench_proc *pubs = NULL, *subs = NULL;
+
+	pubs = (struct bench_proc *)calloc(pub_count, sizeof(struct bench_proc));
+	subs = (struct bench_proc *)calloc(sub_count, sizeof(struct bench_proc));
+	if (!pubs || !subs) {
+		errorf("calloc failed\n");
+		goto fail;
+	}
+
+	if ((daemon_pid = start_daemon()) < 0) {
+		errorf("start_daemon() failed\n");
+		goto fail;
+	}
+
+	fprintf(stderr, "topology %u:%u, starting the applications\n", pub_count, sub_count);
+
+	for (i = 0; i < sub_count; i++) {
+		if (bench_fork(subscriber_main, i, &(subs[i])) == NOK || read_all(subs[i].result_fd, &ack, 1) == NOK) {
+			errorf("subscriber %u cannot be started\n", i);
+			goto fail;
+		}
+	}
+
+	for (i = 0; i < pub_count; i++) {
+		if (bench_fork(publisher_main, i, &(pubs[i])) == NOK || read_all(pubs[i].result_fd, &ack, 1) == NOK) {
+			errorf("publisher %u cannot be started\n", i);
+			goto fail;
+		}
+	}
+
+	//sipcd waits after every new registration, let it settle before measuring
+	sleep(6);
+
+	memset(&round, 0, sizeof(round));
+	round.publishers = pub_count;
+	for (i = 0; i < size_count; i++) {
+		round.round++;
+		round.size = sizes[i];
+		round.count = message_count;
+		if ((unsigned long long)round.count * round.size > BENCH_ROUND_BYTES) {
+			round.count = BENCH_ROUND_BYTES / round.size ? BENCH_ROUND_BYTES / round.size : 1;
+		}
+
+		fprintf(stderr, "topology %u:%u, %u messages of %u bytes per publisher\n", pub_count, sub_count, round.count, round.size);
+		if (run_round(pubs, pub_count, subs, sub_count, &round) == NOK) {
+			errorf("run_round() failed\n");
+			goto fail;
+		}
+	}
+
+	goto out;
+
+fail:
+	ret = NOK;
+
+out:
+	//zero sized round asks the applications to exit
+	memset(&round, 0, sizeof(round));
+	for (i = 0; pubs && i < pub_count; i++) {
+		if (pubs[i].pid > 0) {
+			(void) write_all(pubs[i].ctrl_fd, &round, sizeof(round));
+		}
+	}
+	for (i = 0; subs && i < sub_count; i++) {
+		if (subs[i].pid > 0) {
+			(void) write_all(subs[i].ctrl_fd, &round, sizeof(round));
+		}
+	}
+	if (pubs) {
+		bench_reap(pubs, pub_count);
+	}
+	if (subs) {
+		bench_reap(subs, sub_count);
+	}
+	stop_daemon(daemon_pid);
+	FREE(pubs);
+	FREE(subs);
+
+	return ret;
+}
+
+static unsigned int parse_sizes(char *arg, unsigned int *sizes)
+{
+	unsigned int count = 0;
+	char *token = NULL, *save = NULL;
+
+	for (token = strtok_r(arg, ",", &save); token && count < BENCH_MAX_LIST; token = strtok_r(NULL, ",", &save)) {
+		sizes[count] = strtoul(token, NULL, 10);
+		if (sizes[count] < sizeof(struct bench_header)) {
+			sizes[count] = sizeof(struct bench_header);
+		}
+		count++;
+	}
+
+	return count;
+}
+
+int main(int argc, char **argv)
+{
+	int ret = OK;
+	int c, o;
+	unsigned int sizes[BENCH_MAX_LIST];
+	unsigned int size_count, pub_count, sub_count;
+	char *topologies = NULL, *size_list = NULL;
+	char *token = NULL, *save = NULL;
+
+	while ((c = getopt_long(argc, argv, "hvd:t:s:n:", parameters, &o)) != -1) {
+		switch (c) {
+			case 'h':
+				print_help_exit(argv[0]);
+				break;
+			case 'v':
+				printf("%s version %s\n", argv[0], VERSION);
+				return OK;
+				break;
+			case 'd':
+				daemon_path = optarg;
+				break;
+			case 't':
+				topology_arg = optarg;
+				break;
+			case 's':
+				size_arg = optarg;
+				break;
+			case 'n':
+				message_count = strtoul(optarg, NULL, 10);
+				break;
+			default:
+				errorf("unknown argument\n");
+				goto fail;
+		}
+	}
+
+	topologies = strdup(topology_arg);
+	size_list = strdup(size_arg);
+	if (!topologies || !size_list) {
+		errorf("strdup failed\n");
+		goto fail;
+	}
+
+	if ((size_count = parse_sizes(size_list, sizes)) == 0 || !message_count) {
+		errorf("sizes and count cannot be empty\n");
+		goto fail;
+	}
+
+	for (token = strtok_r(topologies, ",", &save); token; token = strtok_r(NULL, ",", &save)) {
+		if (sscanf(token, "%u:%u", &pub_count, &sub_count) != 2 || !pub_count || !sub_count ||
+				pub_count + sub_count >= BACKLOG) {
+			errorf("invalid topology '%s'\n", token);
+			goto fail;
+		}
+		if (run_topology(pub_count, sub_count, sizes, size_count) == NOK) {
+			errorf("run_topology() failed\n");
+			goto fail;
+		}
+	}
+
+	goto out;
+
+fail:
+	ret = NOK;
+
+out:
+	FREE(topologies);
+	FREE(size_list);
+
+	return ret;
+}
@@ -0,0 +1,591 @@
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sipc_lib.h>
+
+#define VERSION		"00.01"
+
+#define LOAD_TITLE_FORMAT		"sipc_load/title_%u"
+#define LOAD_TITLE_SIZE			64
+#define LOAD_MAX_TITLES			8	//titles registered by a client at once
+
+/*
+ * counters shared by the supervisor, the sampler and all the client processes
+ */
+struct load_counters {
+	unsigned int alive;
+	bool daemon_alive;
+	bool stop;
+	unsigned long spawned;
+	unsigned long register_ok;
+	unsigned long register_failed;
+	unsigned long unregistered;
+	unsigned long published;
+	unsigned long publish_failed;
+	unsigned long received;
+	unsigned long abrupt_exits;
+	unsigned long clean_exits;
+};
+
+struct load_config {
+	char *daemon_path;
+	pid_t daemon_pid;
+	unsigned int clients;
+	unsigned int titles;
+	unsigned int rate;
+	unsigned int lifetime;
+	unsigned int abrupt_percent;
+	unsigned int churn_percent;
+	unsigned int spawn_rate;
+	unsigned int payload_size;
+	unsigned long duration;
+	unsigned int interval;
+};
+
+struct daemon_sample {
+	unsigned long rss_kb;
+	unsigned long fds;
+	unsigned long titles;
+	unsigned long retained;
+	unsigned long registered;
+	unsigned long pending;
+	unsigned long msgs_out;
+	unsigned long send_errors;
+};
+
+static struct load_counters *counters = NULL;
+static volatile sig_atomic_t stop_requested = 0;
+
+static struct load_config config = {
+	.daemon_path = NULL,
+	.daemon_pid = 0,
+	.clients = 64,
+	.titles = 1000,
+	.rate = 10,
+	.lifetime = 30,
+	.abrupt_percent = 50,
+	.churn_percent = 10,
+	.spawn_rate = 20,
+	.payload_size = 64,
+	.duration = 300,
+	.interval = 5,
+};
+
+static struct option parameters[] = {
+	{ "help",				no_argument,		0,	'h'	},
+	{ "version",			no_argument,		0,	'v'	},
+	{ "daemon",				required_argument,	0,	'd'	},
+	{ "pid",				required_argument,	0,	'p'	},
+	{ "clients",			required_argument,	0,	'c'	},
+	{ "titles",				required_argument,	0,	't'	},
+	{ "rate",				required_argument,	0,	'r'	},
+	{ "lifetime",			required_argument,	0,	'l'	},
+	{ "abrupt",				required_argument,	0,	'a'	},
+	{ "churn",				required_argument,	0,	'u'	},
+	{ "spawn-rate",			required_argument,	0,	's'	},
+	{ "size",				required_argument,	0,	'z'	},
+	{ "duration",			required_argument,	0,	'D'	},
+	{ "interval",			required_argument,	0,	'i'	},
+	{ NULL,					0,					0, 	0 	},
+};
+
+static void print_help_exit (char *arg)
+{
+	if (!arg) {
+		return;
+	}
+	printf("\n%s help:\n\n", arg);
+
+	printf("--version:\t('v')\n\t\treturns version\n\n");
+	printf("--daemon:\t('d')\n\t\tpath of sipcd to start, a running sipcd is used with --pid otherwise\n\n");
+	printf("--pid:\t\t('p')\n\t\tpid of the running sipcd to watch\n\n");
+	printf("--clients:\t('c')\n\t\tclient processes kept alive, default %u\n\n", config.clients);
+	printf("--titles:\t('t')\n\t\tnumber of titles used by the clients, default %u\n\n", config.titles);
+	printf("--rate:\t\t('r')\n\t\tmessages per second published by each client, default %u\n\n", config.rate);
+	printf("--lifetime:\t('l')\n\t\taverage lifetime of a client in seconds, default %u\n\n", config.lifetime);
+	printf("--abrupt:\t('a')\n\t\tpercent of the clients killed without sipc_destroy(), default %u\n\n", config.abrupt_percent);
+	printf("--churn:\t('u')\n\t\tpercent chance of a register or unregister per publish, default %u\n\n", config.churn_percent);
+	printf("--spawn-rate:\t('s')\n\t\tnew clients per second at most, default %u\n\n", config.spawn_rate);
+	printf("--size:\t\t('z')\n\t\tpayload size in bytes, default %u\n\n", config.payload_size);
+	printf("--duration:\t('D')\n\t\tlength of the run in seconds, default %lu\n\n", config.duration);
+	printf("--interval:\t('i')\n\t\tseconds between the samples, default %u\n\n", config.interval);
+	printf("samples are written to stdout as one json object per line\n\n");
+
+	exit(OK);
+}
+
+static void stop_handler(__attribute__((unused)) int sig_num)
+{
+	stop_requested = 1;
+}
+
+static int load_callback(void *data, unsigned int len)
+{
+	UNUSED(data);
+	UNUSED(len);
+
+	__atomic_add_fetch(&(counters->received), 1, __ATOMIC_RELAXED);
+
+	return OK;
+}
+
+static void random_title(char *title, unsigned int *seed)
+{
+	snprintf(title, LOAD_TITLE_SIZE, LOAD_TITLE_FORMAT, rand_r(seed) % config.titles);
+}
+
+/*
+ * a client registers to a random title, then publishes to random titles and
+ * registers to or unregisters from random titles until its lifetime ends
+ */
+static int client_main(unsigned int id)
+{
+	unsigned int i, count = 0, seed = id ^ (unsigned int)getpid();
+	unsigned long long end, next;
+	char titles[LOAD_MAX_TITLES][LOAD_TITLE_SIZE];
+	char title[LOAD_TITLE_SIZE];
+	char *data = NULL;
+
+	data = (char *)calloc(1, config.payload_size);
+	if (!data) {
+		errorf("calloc failed\n");
+		return NOK;
+	}
+	memset(data, 'l', config.payload_size);
+
+	random_title(titles[0], &seed);
+	if (sipc_register(titles[0], load_callback, 0) == NOK) {
+		__atomic_add_fetch(&(counters->register_failed), 1, __ATOMIC_RELAXED);
+		FREE(data);
+		return NOK;
+	}
+	__atomic_add_fetch(&(counters->register_ok), 1, __ATOMIC_RELAXED);
+	count = 1;
+
+	end = sipc_monotonic_ns() + (config.lifetime / 2 + rand_r(&seed) % (config.lifetime + 1)) * 1000000000ULL;
+	next = sipc_monotonic_ns();
+
+	while (sipc_monotonic_ns() < end) {
+		random_title(title, &seed);
+		if (sipc_send_data(title, data, config.payload_size, 0) == OK) {
+			__atomic_add_fetch(&(counters->published), 1, __ATOMIC_RELAXED);
+		} else {
+			__atomic_add_fetch(&(counters->publish_failed), 1, __ATOMIC_RELAXED);
+		}
+
+		if ((unsigned int)(rand_r(&seed) % 100) < config.churn_percent) {
+			if (count < LOAD_MAX_TITLES && rand_r(&seed) % 2) {
+				random_title(titles[count], &seed);
+				if (sipc_register(titles[count], load_callback, 0) == OK) {
+					__atomic_add_fetch(&(counters->register_ok), 1, __ATOMIC_RELAXED);
+					count++;
+				} else {
+					__atomic_add_fetch(&(counters->register_failed), 1, __ATOMIC_RELAXED);
+				}
+			} else if (count > 1) {
+				count--;
+				if (sipc_unregister(titles[count]) == OK) {
+					__atomic_add_fetch(&(counters->unregistered), 1, __ATOMIC_RELAXED);
+				}
+			}
+		}
+
+		if (config.rate) {
+			next += 1000000000ULL / config.rate;
+			while (sipc_monotonic_ns() < next) {
+				usleep(1000);
+			}
+		}
+	}
+
+	FREE(data);
+
+	if ((unsigned int)(rand_r(&seed) % 100) < config.abrupt_percent) {
+		__atomic_add_fetch(&(counters->abrupt_exits), 1, __ATOMIC_RELAXED);
+		kill(getpid(), SIGKILL);
+	}
+
+	for (i = 0; i < count; i++) {
+		sipc_unregister(titles[i]);
+	}
+	sipc_destroy();
+	__atomic_add_fetch(&(counters->clean_exits), 1, __ATOMIC_RELAXED);
+
+	return OK;
+}
+
+static pid_t start_daemon(char *path)
+{
+	int fd;
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) {
+		errorf("fork() failed with %d: %s\n", errno, strerror(errno));
+		return -1;
+	} else if (pid == 0) {
+		if ((fd = open("/dev/null", O_WRONLY)) >= 0) {
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+			close(fd);
+		}
+		execl(path, path, (char *)NULL);
+		_exit(NOK);
+	}
+
+	sleep(1);
+	if (waitpid(pid, NULL, WNOHANG) == pid) {
+		errorf("%s exited, is another sipcd running?\n", path);
+		return -1;
+	}
+
+	return pid;
+}
+
+static unsigned long read_rss_kb(pid_t pid)
+{
+	char path[64];
+	char line[256];
+	unsigned long rss = 0;
+	FILE *fp = NULL;
+
+	snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+	if ((fp = fopen(path, "r")) == NULL) {
+		return 0;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "VmRSS: %lu kB", &rss) == 1) {
+			break;
+		}
+	}
+
+	FCLOSE(fp);
+
+	return rss;
+}
+
+static unsigned long count_fds(pid_t pid)
+{
+	char path[64];
+	unsigned long count = 0;
+	DIR *dir = NULL;
+	struct dirent *entry = NULL;
+
+	snprintf(path, sizeof(path), "/proc/%d/fd", (int)pid);
+	if ((dir = opendir(path)) == NULL) {
+		return 0;
+	}
+
+	while ((entry = readdir(dir)) != NULL) {
+		count += entry->d_name[0] != '.';
+	}
+
+	closedir(dir);
+
+	return count;
+}
+
+static unsigned long field_value(const char *line, const char *key)
+{
+	const char *ptr = strstr(line, key);
+
+	return ptr ? strtoul(ptr + strlen(key), NULL, 10) : 0;
+}
+
+static int sample_daemon(pid_t pid, struct daemon_sample *sample)
+{
+	char *stats = NULL;
+	char *line = NULL;
+	char *save = NULL;
+
+	memset(sample, 0, sizeof(struct daemon_sample));
+
+	sample->rss_kb = read_rss_kb(pid);
+	sample->fds = count_fds(pid);
+
+	if ((stats = sipc_request_stats()) == NULL) {
+		return NOK;
+	}
+
+	for (line = strtok_r(stats, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+		if (strncmp(line, "title ", 6) == 0) {
+			sample->titles++;
+			sample->retained += field_value(line, " retained=");
+			sample->msgs_out += field_value(line, " msgs_out=");
+		} else if (strncmp(line, "client ", 7) == 0) {
+			sample->registered += field_value(line, " registered=");
+			sample->pending += field_value(line, " pending=");
+			sample->send_errors += field_value(line, " send_errors=");
+		}
+	}
+
+	FREE(stats);
+
+	return OK;
+}
+
+static void print_sample(unsigned long long started)
+{
+	bool stats_ok, daemon_alive;
+	struct daemon_sample sample;
+	unsigned long attempts;
+
+	daemon_alive = __atomic_load_n(&(counters->daemon_alive), __ATOMIC_RELAXED) && kill(config.daemon_pid, 0) == 0;
+	stats_ok = daemon_alive && sample_daemon(config.daemon_pid, &sample) == OK;
+	if (!stats_ok) {
+		memset(&sample, 0, sizeof(sample));
+	}
+	attempts = sample.msgs_out + sample.send_errors;
+
+	printf("{\"elapsed\":%llu,\"daemon_alive\":%s,\"daemon_stats\":%s,\"daemon_rss_kb\":%lu,\"daemon_fds\":%lu,"
+		"\"titles\":%lu,\"retained\":%lu,\"registered_ports\":%lu,\"pending\":%lu,\"daemon_msgs_out\":%lu,"
+		"\"daemon_send_errors\":%lu,\"delivery_success\":%.4f,\"clients_alive\":%u,\"spawned\":%lu,"
+		"\"register_ok\":%lu,\"register_failed\":%lu,\"unregistered\":%lu,\"published\":%lu,\"publish_failed\":%lu,"
+		"\"received\":%lu,\"abrupt_exits\":%lu,\"clean_exits\":%lu}\n",
+		(sipc_monotonic_ns() - started) / 1000000000ULL, daemon_alive ? "true" : "false", stats_ok ? "true" : "false",
+		sample.rss_kb, sample.fds, sample.titles, sample.retained, sample.registered, sample.pending, sample.msgs_out,
+		sample.send_errors, attempts ? (double)sample.msgs_out / attempts : 1.0,
+		__atomic_load_n(&(counters->alive), __ATOMIC_RELAXED),
+		__atomic_load_n(&(counters->spawned), __ATOMIC_RELAXED),
+		__atomic_load_n(&(counters->register_ok), __ATOMIC_RELAXED),
+		__atomic_load_n(&(counters->register_failed), __ATOMIC_RELAXED),
+		__atomic_load_n(&(counters->unregistered), __ATOMIC_RELAXED),
+		__atomic_load_n(&(counters->published), __ATOMIC_RELAXED),
+		__atomic_load_n(&(counters->publish_failed), __ATOMIC_RELAXED),
+		__atomic_load_n(&(counters->received), __ATOMIC_RELAXED),
+		__atomic_load_n(&(counters->abrupt_exits), __ATOMIC_RELAXED),
+		__atomic_load_n(&(counters->clean_exits), __ATOMIC_RELAXED));
+	fflush(stdout);
+}
+
+/*
+ * sampling runs in its own process, since a STATS request waits behind
+ * everything sipcd is busy with and should not hold the clients back
+ */
+static int sampler_main(unsigned long long started)
+{
+	unsigned long long next_sample = started;
+
+	while (!__atomic_load_n(&(counters->stop), __ATOMIC_RELAXED)) {
+		if (sipc_monotonic_ns() >= next_sample) {
+			print_sample(started);
+			next_sample += config.interval * 1000000000ULL;
+		}
+		usleep(10000);
+	}
+
+	//last sample after the clients are gone
+	print_sample(started);
+
+	return OK;
+}
+
+static bool is_daemon_alive(bool own_daemon)
+{
+	if (own_daemon) {
+		return waitpid(config.daemon_pid, NULL, WNOHANG) == 0;
+	}
+
+	return kill(config.daemon_pid, 0) == 0;
+}
+
+/*
+ * keeps 'clients' processes alive until the end of the run, dead ones are
+ * replaced at most 'spawn_rate' per second
+ */
+static int run_load(bool own_daemon)
+{
+	unsigned int i, spawned_now = 0;
+	unsigned long long started, end, next_second;
+	bool daemon_alive = true;
+	pid_t pid, sampler, *pids = NULL;
+
+	pids = (pid_t *)calloc(config.clients, sizeof(pid_t));
+	if (!pids) {
+		errorf("calloc failed\n");
+		return NOK;
+	}
+
+	started = sipc_monotonic_ns();
+	end = started + config.duration * 1000000000ULL;
+	next_second = started + 1000000000ULL;
+	counters->daemon_alive = true;
+
+	sampler = fork();
+	if (sampler < 0) {
+		errorf("fork() failed with %d: %s\n", errno, strerror(errno));
+		FREE(pids);
+		return NOK;
+	} else if (sampler == 0) {
+		FREE(pids);
+		_exit(sampler_main(started));
+	}
+
+	while (!stop_requested && sipc_monotonic_ns() < end) {
+		while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+			for (i = 0; i < config.clients; i++) {
+				if (pids[i] == pid) {
+					pids[i] = 0;
+					__atomic_sub_fetch(&(counters->alive), 1, __ATOMIC_RELAXED);
+					break;
+				}
+			}
+		}
+
+		if (!(daemon_alive = is_daemon_alive(own_daemon))) {
+			__atomic_store_n(&(counters->daemon_alive), false, __ATOMIC_RELAXED);
+			errorf("sipcd is not alive anymore\n");
+			break;
+		}
+
+		if (sipc_monotonic_ns() >= next_second) {
+			next_second += 1000000000ULL;
+			spawned_now = 0;
+		}
+
+		for (i = 0; i < config.clients && spawned_now < config.spawn_rate; i++) {
+			if (pids[i]) {
+				continue;
+			}
+			pid = fork();
+			if (pid < 0) {
+				errorf("fork() failed with %d: %s\n", errno, strerror(errno));
+				break;
+			} else if (pid == 0) {
+				FREE(pids);
+				_exit(client_main(i));
+			}
+			pids[i] = pid;
+			spawned_now++;
+			__atomic_add_fetch(&(counters->alive), 1, __ATOMIC_RELAXED);
+			__atomic_add_fetch(&(counters->spawned), 1, __ATOMIC_RELAXED);
+		}
+
+		usleep(10000);
+	}
+
+	for (i = 0; i < config.clients; i++) {
+		if (pids[i]) {
+			kill(pids[i], SIGKILL);
+			waitpid(pids[i], NULL, 0);
+			__atomic_sub_fetch(&(counters->alive), 1, __ATOMIC_RELAXED);
+		}
+	}
+
+	__atomic_store_n(&(counters->stop), true, __ATOMIC_RELAXED);
+	waitpid(sampler, NULL, 0);
+
+	FREE(pids);
+
+	return daemon_alive ? OK : NOK;
+}
+
+int main(int argc, char **argv)
+{
+	int ret = OK;
+	int c, o;
+	bool own_daemon = false;
+
+	while ((c = getopt_long(argc, argv, "hvd:p:c:t:r:l:a:u:s:z:D:i:", parameters, &o)) != -1) {
+		switch (c) {
+			case 'h':
+				print_help_exit(argv[0]);
+				break;
+			case 'v':
+				printf("%s version %s\n", argv[0], VERSION);
+				return OK;
+				break;
+			case 'd':
+				config.daemon_path = optarg;
+				break;
+			case 'p':
+				config.daemon_pid = (pid_t)strtoul(optarg, NULL, 10);
+				break;
+			case 'c':
+				config.clients = strtoul(optarg, NULL, 10);
+				break;
+			case 't':
+				config.titles = strtoul(optarg, NULL, 10);
+				break;
+			case 'r':
+				config.rate = strtoul(optarg, NULL, 10);
+				break;
+			case 'l':
+				config.lifetime = strtoul(optarg, NULL, 10);
+				break;
+			case 'a':
+				config.abrupt_percent = strtoul(optarg, NULL, 10);
+				break;
+			case 'u':
+				config.churn_percent = strtoul(optarg, NULL, 10);
+				break;
+			case 's':
+				config.spawn_rate = strtoul(optarg, NULL, 10);
+				break;
+			case 'z':
+				config.payload_size = strtoul(optarg, NULL, 10);
+				break;
+			case 'D':
+				config.duration = strtoul(optarg, NULL, 10);
+				break;
+			case 'i':
+				config.interval = strtoul(optarg, NULL, 10);
+				break;
+			default:
+				errorf("unknown argument\n");
+				goto fail;
+		}
+	}
+
+	if (!config.clients || !config.titles || !config.payload_size || !config.interval || !config.spawn_rate) {
+		errorf("clients, titles, size, interval and spawn rate cannot be zero\n");
+		goto fail;
+	}
+
+	if (!config.daemon_path && !config.daemon_pid) {
+		errorf("either --daemon or --pid should be given\n");
+		goto fail;
+	}
+
+	counters = (struct load_counters *)mmap(NULL, sizeof(struct load_counters), PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (counters == MAP_FAILED) {
+		errorf("mmap() failed with %d: %s\n", errno, strerror(errno));
+		counters = NULL;
+		goto fail;
+	}
+
+	signal(SIGINT, stop_handler);
+	signal(SIGTERM, stop_handler);
+
+	if (config.daemon_path) {
+		if ((config.daemon_pid = start_daemon(config.daemon_path)) < 0) {
+			errorf("start_daemon() failed\n");
+			goto fail;
+		}
+		own_daemon = true;
+	}
+
+	if (run_load(own_daemon) == NOK) {
+		errorf("run_load() failed\n");
+		goto fail;
+	}
+
+	goto out;
+
+fail:
+	ret = NOK;
+
+out:
+	if (own_daemon && config.daemon_pid > 0) {
+		kill(config.daemon_pid, SIGINT);
+		waitpid(config.daemon_pid, NULL, 0);
+	}
+	if (counters) {
+		munmap(counters, sizeof(struct load_counters));
+	}
+
+	return ret;
+}
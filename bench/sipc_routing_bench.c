@@ -0,0 +1,359 @@
+#include "sipc_common.h"
+#include "sipc_pool.h"
+#include "sipc_routing.h"
+
+#define VERSION		"00.01"
+
+#define ROUTING_DEFAULT_TITLES		"10,100,1000,10000,100000"
+#define ROUTING_DEFAULT_PORTS		"1,16,254"
+#define ROUTING_DEFAULT_MAX_ENTRIES	4000000
+#define ROUTING_MIN_TIME_NS			200000000ULL
+#define ROUTING_MAX_LIST			16
+#define ROUTING_TITLE_SIZE			32
+#define ROUTING_BATCH				256
+
+struct routing_table {
+	struct title_list title_list;
+	unsigned int title_count;
+	unsigned int port_count;
+	char (*titles)[ROUTING_TITLE_SIZE];
+	bool available_ports[BACKLOG];
+};
+
+struct routing_result {
+	unsigned long ops;
+	unsigned long long elapsed;
+};
+
+static bool json_output = false;
+static unsigned long max_entries = ROUTING_DEFAULT_MAX_ENTRIES;
+static unsigned long long random_state = 88172645463325252ULL;
+
+static struct option parameters[] = {
+	{ "help",				no_argument,		0,	'h'	},
+	{ "version",			no_argument,		0,	'v'	},
+	{ "json",				no_argument,		0,	'j'	},
+	{ "titles",				required_argument,	0,	't'	},
+	{ "ports",				required_argument,	0,	'p'	},
+	{ "max-entries",		required_argument,	0,	'm'	},
+	{ NULL,					0,					0, 	0 	},
+};
+
+static void print_help_exit (char *arg)
+{
+	if (!arg) {
+		return;
+	}
+	printf("\n%s help:\n\n", arg);
+
+	printf("--version:\t('v')\n\t\treturns version\n\n");
+	printf("--json:\t\t('j')\n\t\tprints one json object per line\n\n");
+	printf("--titles:\t('t')\n\t\tcomma separated title counts, default %s\n\n", ROUTING_DEFAULT_TITLES);
+	printf("--ports:\t('p')\n\t\tcomma separated ports per title, at most %d, default %s\n\n", BACKLOG, ROUTING_DEFAULT_PORTS);
+	printf("--max-entries:\t('m')\n\t\ttables with more title-port couples are skipped, default %d\n\n", ROUTING_DEFAULT_MAX_ENTRIES);
+
+	exit(OK);
+}
+
+static unsigned int next_random(unsigned int limit)
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 7;
+	random_state ^= random_state << 17;
+
+	return (unsigned int)(random_state % limit);
+}
+
+/*
+ * the table is built with the lower level helpers, so building it does not
+ * cost a title lookup per couple. port STARTING_PORT is left free to measure
+ * the registration of a new port
+ */
+static int build_table(struct routing_table *table, unsigned int title_count, unsigned int port_count)
+{
+	unsigned int i, j;
+	struct title_list_entry *entry = NULL;
+
+	memset(table, 0, sizeof(struct routing_table));
+	TAILQ_INIT(&(table->title_list));
+	table->title_count = title_count;
+	table->port_count = port_count;
+
+	table->titles = calloc(title_count, ROUTING_TITLE_SIZE);
+	if (!table->titles) {
+		errorf("calloc failed\n");
+		return NOK;
+	}
+
+	for (i = 0; i < title_count; i++) {
+		snprintf(table->titles[i], ROUTING_TITLE_SIZE, "routing/bench/title_%u", i);
+		if ((entry = add_empty_entry_to_title_list(table->titles[i], &(table->title_list))) == NULL) {
+			errorf("add_empty_entry_to_title_list() failed\n");
+			return NOK;
+		}
+		for (j = 1; j <= port_count; j++) {
+			if (add_new_entry_to_the_port_list(STARTING_PORT + j, &(entry->port_list)) == NOK) {
+				errorf("add_new_entry_to_the_port_list() failed\n");
+				return NOK;
+			}
+		}
+		if (retain_data(entry, NULL, table->titles[i], strlen(table->titles[i]) + 1, 0) == NOK) {
+			errorf("retain_data() failed\n");
+			return NOK;
+		}
+	}
+
+	for (j = 0; j < port_count && j < BACKLOG; j++) {
+		table->available_ports[j] = true;
+	}
+
+	return OK;
+}
+
+static void destroy_table(struct routing_table *table)
+{
+	title_data_structure_destroy(&(table->title_list));
+	FREE(table->titles);
+	sipc_routing_destroy();
+	sipc_pool_destroy();
+}
+
+/*
+ * the free port is added to a batch of consecutive titles, then it is removed
+ * from all of them without timing
+ */
+static void bench_add_port_title_couple(struct routing_table *table, struct routing_result *result)
+{
+	unsigned int i, first, count;
+	unsigned long long start;
+
+	count = table->title_count < ROUTING_BATCH ? table->title_count : ROUTING_BATCH;
+
+	while (result->elapsed < ROUTING_MIN_TIME_NS) {
+		first = next_random(table->title_count);
+
+		start = sipc_monotonic_ns();
+		for (i = 0; i < count; i++) {
+			(void) add_port_title_couple(table->titles[(first + i) % table->title_count], STARTING_PORT, &(table->title_list));
+		}
+		result->elapsed += sipc_monotonic_ns() - start;
+		result->ops += count;
+
+		(void) remove_port_from_all_title(STARTING_PORT, &(table->title_list));
+	}
+}
+
+static void bench_find_entry_in_title_list(struct routing_table *table, struct routing_result *result)
+{
+	unsigned int i;
+	unsigned long long start;
+	unsigned long found = 0;
+
+	while (result->elapsed < ROUTING_MIN_TIME_NS) {
+		start = sipc_monotonic_ns();
+		for (i = 0; i < 64; i++) {
+			found += find_entry_in_title_list(table->titles[next_random(table->title_count)], &(table->title_list)) != NULL;
+		}
+		result->elapsed += sipc_monotonic_ns() - start;
+		result->ops += 64;
+	}
+
+	if (found != result->ops) {
+		errorf("%lu titles are not found\n", result->ops - found);
+	}
+}
+
+static void bench_remove_port_from_all_title(struct routing_table *table, struct routing_result *result)
+{
+	unsigned long long start;
+	struct title_list_entry *entry = NULL;
+
+	while (result->elapsed < ROUTING_MIN_TIME_NS) {
+		//new ports are inserted at the head, so this mostly measures the walk over the titles
+		TAILQ_FOREACH(entry, &(table->title_list), entries) {
+			(void) add_new_entry_to_the_port_list(STARTING_PORT, &(entry->port_list));
+		}
+
+		start = sipc_monotonic_ns();
+		(void) remove_port_from_all_title(STARTING_PORT, &(table->title_list));
+		result->elapsed += sipc_monotonic_ns() - start;
+		result->ops++;
+	}
+}
+
+/*
+ * lookup part of send_retained_data_first(), the sockets are left out
+ */
+static void bench_retained_data_lookup(struct routing_table *table, struct routing_result *result)
+{
+	unsigned int i;
+	unsigned long long start;
+	unsigned long count = 0;
+	struct title_list_entry *tentry = NULL;
+	struct retained_list_entry *entry = NULL;
+
+	while (result->elapsed < ROUTING_MIN_TIME_NS) {
+		start = sipc_monotonic_ns();
+		for (i = 0; i < 64; i++) {
+			if ((tentry = find_entry_in_title_list(table->titles[next_random(table->title_count)], &(table->title_list))) == NULL) {
+				continue;
+			}
+			TAILQ_FOREACH(entry, &(tentry->retained_list), entries) {
+				count += entry->data_size;
+			}
+		}
+		result->elapsed += sipc_monotonic_ns() - start;
+		result->ops += 64;
+	}
+
+	UNUSED(count);
+}
+
+static void bench_next_available_port(struct routing_table *table, struct routing_result *result)
+{
+	unsigned int i;
+	unsigned long long start;
+	unsigned long sum = 0;
+
+	while (result->elapsed < ROUTING_MIN_TIME_NS) {
+		start = sipc_monotonic_ns();
+		for (i = 0; i < 1024; i++) {
+			sum += next_available_port(table->available_ports);
+		}
+		result->elapsed += sipc_monotonic_ns() - start;
+		result->ops += 1024;
+	}
+
+	UNUSED(sum);
+}
+
+static void print_result(const char *op, struct routing_table *table, struct routing_result *result)
+{
+	double ns_per_op = result->ops ? (double)result->elapsed / result->ops : 0;
+
+	if (json_output) {
+		printf("{\"op\":\"%s\",\"titles\":%u,\"ports_per_title\":%u,\"ops\":%lu,\"ns_per_op\":%.1f}\n",
+			op, table->title_count, table->port_count, result->ops, ns_per_op);
+	} else {
+		printf("%-32s %8u %8u %12lu %14.1f\n", op, table->title_count, table->port_count, result->ops, ns_per_op);
+	}
+	fflush(stdout);
+}
+
+static int run_table(unsigned int title_count, unsigned int port_count)
+{
+	unsigned int i;
+	struct routing_table table;
+	struct routing_result result;
+	struct {
+		const char *name;
+		void (*bench)(struct routing_table *, struct routing_result *);
+	} ops[] = {
+		{ "add_port_title_couple",		bench_add_port_title_couple		},
+		{ "find_entry_in_title_list",	bench_find_entry_in_title_list	},
+		{ "remove_port_from_all_title",	bench_remove_port_from_all_title	},
+		{ "retained_data_lookup",		bench_retained_data_lookup		},
+		{ "next_available_port",		bench_next_available_port		},
+	};
+
+	if ((unsigned long)title_count * port_count > max_entries) {
+		fprintf(stderr, "%u titles with %u ports is bigger than %lu entries, skipped\n", title_count, port_count, max_entries);
+		return OK;
+	}
+
+	if (build_table(&table, title_count, port_count) == NOK) {
+		errorf("build_table() failed\n");
+		destroy_table(&table);
+		return NOK;
+	}
+
+	for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+		memset(&result, 0, sizeof(result));
+		ops[i].bench(&table, &result);
+		print_result(ops[i].name, &table, &result);
+	}
+
+	destroy_table(&table);
+
+	return OK;
+}
+
+static unsigned int parse_list(char *arg, unsigned int *list, unsigned int max)
+{
+	unsigned int count = 0;
+	char *token = NULL, *save = NULL;
+
+	for (token = strtok_r(arg, ",", &save); token && count < ROUTING_MAX_LIST; token = strtok_r(NULL, ",", &save)) {
+		list[count] = strtoul(token, NULL, 10);
+		if (!list[count] || list[count] > max) {
+			errorf("'%s' should be between 1 and %u\n", token, max);
+			return 0;
+		}
+		count++;
+	}
+
+	return count;
+}
+
+int main(int argc, char **argv)
+{
+	int ret = OK;
+	int c, o;
+	unsigned int i, j, title_count, port_count;
+	unsigned int titles[ROUTING_MAX_LIST], ports[ROUTING_MAX_LIST];
+	char title_arg[BUFFER_SIZE] = ROUTING_DEFAULT_TITLES;
+	char port_arg[BUFFER_SIZE] = ROUTING_DEFAULT_PORTS;
+
+	while ((c = getopt_long(argc, argv, "hvjt:p:m:", parameters, &o)) != -1) {
+		switch (c) {
+			case 'h':
+				print_help_exit(argv[0]);
+				break;
+			case 'v':
+				printf("%s version %s\n", argv[0], VERSION);
+				return OK;
+				break;
+			case 'j':
+				json_output = true;
+				break;
+			case 't':
+				snprintf(title_arg, sizeof(title_arg), "%s", optarg);
+				break;
+			case 'p':
+				snprintf(port_arg, sizeof(port_arg), "%s", optarg);
+				break;
+			case 'm':
+				max_entries = strtoul(optarg, NULL, 10);
+				break;
+			default:
+				errorf("unknown argument\n");
+				goto fail;
+		}
+	}
+
+	if ((title_count = parse_list(title_arg, titles, ~0U)) == 0 ||
+			(port_count = parse_list(port_arg, ports, BACKLOG)) == 0) {
+		goto fail;
+	}
+
+	if (!json_output) {
+		printf("%-32s %8s %8s %12s %14s\n", "OP", "TITLES", "PORTS", "OPS", "NS/OP");
+	}
+
+	for (i = 0; i < title_count; i++) {
+		for (j = 0; j < port_count; j++) {
+			if (run_table(titles[i], ports[j]) == NOK) {
+				errorf("run_table() failed\n");
+				goto fail;
+			}
+		}
+	}
+
+	goto out;
+
+fail:
+	ret = NOK;
+
+out:
+	return ret;
+}
@@ -12,12 +12,17 @@
 #include <sys/queue.h>
 #include <poll.h>
 #include <netinet/ip.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <pthread.h>
 #include <signal.h>
 #include <netinet/in.h>
 #include <sys/un.h>
+#include <time.h>
+#include <limits.h>
+
+#include "sipc_log.h"
 
 #define UNUSED(__val__)		((void)__val__)
 
@@ -25,13 +30,33 @@
 #define NOK			1
 
 #define RECEIVE_TIMEOUT	30
+#define IDLE_TIMEOUT_MS	(RECEIVE_TIMEOUT * 1000)	//an accepted connection is closed after it is silent for so long
 
 #define BUFFER_SIZE	1024
 
+#define LANE_DRAIN_BUDGET	16
+
+#define PACKET_FLAG_COMPRESSED	0x01
+#define PACKET_FLAG_TIMESTAMPS	0x02
+#define PACKET_FLAG_PEER		0x04	//set by sipcd on the data of a peer link, never sent to the clients
+#define PACKET_FLAG_SCHEMA		0x08	//payload starts with struct sipc_schema_header
+#define PACKET_FLAG_DATAGRAM	0x10	//payload starts with struct sipc_datagram_header
+
+#define STREAM_CHUNK_SIZE	(64 * 1024)
+#define STREAM_CHUNK_FIRST	0x01
+#define STREAM_CHUNK_LAST	0x02
+
 #define BACKLOG		254
 
 #define PORT		    9191
-#define STARTING_PORT   9192
+#define STARTING_PORT   ((unsigned int)sipc_daemon_port() + 1)
+
+/*
+ * a client of several sipcd instances keeps the port given by the first one
+ * and registers it to the others too. sipcd routes the data to any port but
+ * keeps the state of the ports given by itself only
+ */
+#define IS_OWN_PORT(port)	((port) >= STARTING_PORT && (port) < STARTING_PORT + BACKLOG)
 
 #define IPV6_WILDCARD_ADDR		"::"
 #define IPV6_LOOPBACK_ADDR		"::1"
@@ -47,11 +72,11 @@
 #define ANSI_COLOR_RESET	"\x1b[0m"
 
 #ifdef OPEN_DEBUG
-#define debugf(...)		fprintf(stderr, "[%d]\t", __LINE__);fprintf(stdout, __VA_ARGS__)
+#define debugf(...)		sipc_logf(__VA_ARGS__)
 #else
 #define debugf(...)		
 #endif
-#define errorf(...)		fprintf(stderr, ANSI_COLOR_RED"[%d]\t", __LINE__);fprintf(stderr, __VA_ARGS__);fprintf(stderr, ANSI_COLOR_RESET)
+#define errorf(fmt, ...)	fprintf(stderr, ANSI_COLOR_RED"[%d]\t" fmt ANSI_COLOR_RESET, __LINE__, ##__VA_ARGS__)
 
 #define DUMMY_STRING	"dummyStr"
 
@@ -76,19 +101,168 @@ enum _packet_type
 	SENDATA,
 	UNREGISTER,
 	UNREGISTER_ALL,
-	DESTROY
+	DESTROY,
+	CONFLATE,
+	STREAM,
+	STATS,
+	PEER_HELLO,
+	PEER_INTEREST,
+	PING,
+	REGISTER_BULK,
+	LOOKUP,
+	INVALIDATE,
+	DIRECT_REPORT
+};
+
+enum _packet_priority
+{
+	PRIORITY_HIGH,
+	PRIORITY_NORMAL,
+	PRIORITY_LOW,
+	PRIORITY_COUNT
+};
+
+/*
+ * monotonic timestamps in nanoseconds. the first three are sent right after
+ * the flags when PACKET_FLAG_TIMESTAMPS is set, client_receive is only set
+ * locally by the receiving application
+ */
+struct sipc_timestamps
+{
+	unsigned long long publish;
+	unsigned long long daemon_receive;
+	unsigned long long daemon_forward;
+	unsigned long long client_receive;
 };
 
+#define PACKET_TIMESTAMPS_WIRE_SIZE	(3 * sizeof(unsigned long long))
+#define PACKET_FIELD_MAX_SIZE		(UINT_MAX - 1)	//of a key or a payload, the reader adds a trailing null
+
 struct _packet
 {
 	unsigned char packet_type;
+	unsigned char priority;
+	unsigned char flags;
+	struct sipc_timestamps timestamps;
 	unsigned int title_size;
-	unsigned int port;
+	unsigned int port;					//of the publisher of a datagram
+	unsigned long long sequence;		//of a datagram, see struct sipc_datagram_header
 	char *title;
+	unsigned int key_size;
+	char *key;
 	unsigned int payload_size;
 	char *payload;
 };
 
+/*
+ * a message of a schema is a fixed layout struct generated by sipcschema. its
+ * schema id is the message id and the version of the layout, a new version
+ * only appends fields, so a receiver reads the messages of its version and of
+ * the newer ones in place. the header keeps the message aligned to
+ * SCHEMA_ALIGNMENT in the receive buffer
+ */
+#define SCHEMA_ALIGNMENT	8
+
+#define SIPC_SCHEMA_ID(message, version)	((((unsigned int)(message) & 0xffff) << 16) | ((unsigned int)(version) & 0xffff))
+#define SIPC_SCHEMA_MESSAGE(schema_id)		((unsigned int)(schema_id) >> 16)
+#define SIPC_SCHEMA_VERSION(schema_id)		((unsigned int)(schema_id) & 0xffff)
+
+struct sipc_schema_header
+{
+	unsigned int schema_id;
+	unsigned int size;					//of the message
+};
+
+/*
+ * the data of a datagram title is a packed packet in one udp datagram, sent to
+ * the same port number as the tcp port of its receiver. nothing is resent, the
+ * publisher numbers the data of every title from 1 so that a receiver sees the
+ * gaps. the header is outside of the compressed data and before the schema
+ * header, its size keeps the payload aligned
+ */
+#define DATAGRAM_MAX_SIZE	65507		//of the udp payload
+#define DATAGRAM_BATCH		32			//datagrams of one recvmmsg() or sendmmsg()
+#define DATAGRAM_SOCKET_BUFFER	(4 * 1024 * 1024)
+
+struct sipc_datagram_header
+{
+	unsigned int port;					//of the publisher
+	unsigned int reserved;
+	unsigned long long sequence;		//per title of the publisher
+};
+
+/*
+ * payload of the STREAM packets starts with this header, chunk data follows it
+ */
+struct _stream_chunk_header
+{
+	unsigned int stream_id;
+	unsigned int flags;
+	unsigned long long offset;
+};
+
+/*
+ * payload of the DIRECT_REPORT packets starts with this header, the last data
+ * sent directly to the subscribers follows it. sipcd counts and retains it but
+ * does not send it to anyone
+ */
+struct sipc_direct_report
+{
+	unsigned int msgs;					//sent directly since the last report
+	unsigned int reserved;
+	unsigned long long bytes;
+};
+
+/*
+ * what has come of the next packet of a connection which is read without
+ * blocking. a packet is read as it arrives, so a sender which stops in the
+ * middle of it holds only its own connection
+ */
+struct sipc_conn_buffer {
+	char *buffer;
+	size_t size;
+	size_t used;
+};
+
+#define CONN_KEEP_SIZE		(64 * 1024)	//a larger receive buffer of a connection is freed after its packet
+
+struct packet_queue_entry {
+	struct _packet packet;
+	unsigned int port;
+	TAILQ_ENTRY(packet_queue_entry) entries;
+};
+
+TAILQ_HEAD(packet_queue, packet_queue_entry);
+
+struct packet_lanes {
+	struct packet_queue lanes[PRIORITY_COUNT];
+	unsigned int count[PRIORITY_COUNT];
+	unsigned int depth;
+};
+
+/*
+ * how a receive loop waits for its sockets. a thread which sleeps in select()
+ * is woken up by the scheduler, which adds its jitter to every data. spinning
+ * keeps the thread on its core and sees the data at once, at the cost of that
+ * core. the adaptive mode spins only for a while after the last data, so a
+ * burst is received without a wake up and an idle loop still sleeps
+ */
+enum sipc_wait_mode
+{
+	WAIT_BLOCK,
+	WAIT_SPIN,
+	WAIT_ADAPTIVE
+};
+
+#define WAIT_SPIN_US		50		//default spin window of WAIT_ADAPTIVE
+#define WAIT_BUSY_POLL_US	50		//SO_BUSY_POLL of the sockets of a spinning loop
+
+struct sipc_waiter {
+	enum sipc_wait_mode mode;
+	unsigned int spin_us;			//of WAIT_ADAPTIVE
+	unsigned long long last_ready;	//in nanoseconds
+};
+
 int sipc_socket_open_use_buf(const char *buff, int scktype, int flag);
 int sipc_fill_wildcard_sockstorage(unsigned short port, unsigned int scktype,
     struct sockaddr_storage *addr);
@@ -99,6 +273,34 @@ int sipc_socket_open_use_sockaddr(const struct sockaddr *addr, int scktype, int
 int sipc_bind_socket(int fd, const struct sockaddr *addr);
 int sipc_connect_socket(int sockfd, const struct sockaddr *addr);
 int sipc_socket_listen(int sockfd, int backlog);
+int sipc_socket_keepalive(int sockfd, unsigned int idle);
+int sipc_socket_busy_poll(int sockfd, unsigned int usec);
+int sipc_pin_thread(int cpu);
+int sipc_wait_select(struct sipc_waiter *waiter, int nfds, fd_set *set, struct timeval *tv);
 char *packet_type_beautiy(enum _packet_type type);
+unsigned long long sipc_monotonic_ns(void);
+unsigned short sipc_daemon_port(void);
+void sipc_set_daemon_port(unsigned short port);
+int sipc_write_packet(struct _packet *packet, int fd);
+int sipc_pack_packet(struct _packet *packet, FILE *fp);
+size_t sipc_packed_size(struct _packet *packet);
+int sipc_unpack_packet(char *buffer, size_t size, struct _packet *packet);
+size_t sipc_packet_need(const char *buffer, size_t size);
+int sipc_conn_recv(int sockfd, struct sipc_conn_buffer *conn, size_t want, bool *eof);
+int sipc_conn_fill(int sockfd, struct sipc_conn_buffer *conn, size_t trailer, size_t *packet_size, bool *eof);
+void sipc_conn_next(struct sipc_conn_buffer *conn);
+void sipc_conn_free(struct sipc_conn_buffer *conn);
+int sipc_copy_packet(const struct _packet *from, struct _packet *to);
+int sipc_open_datagram(unsigned short port);
+int sipc_recv_datagrams(int fd, char **buffers, size_t size, size_t *lengths, unsigned int count);
+unsigned int sipc_send_datagrams(int fd, char **data, size_t *lengths, unsigned int *ports, unsigned int count);
+int sipc_read_packet(int sockfd, struct _packet *packet);
+void sipc_free_packet(struct _packet *packet);
+char *sipc_request_stats(void);
+void sipc_lanes_init(struct packet_lanes *lanes);
+int sipc_lanes_push(struct packet_lanes *lanes, struct _packet *packet, unsigned int port);
+struct packet_queue_entry *sipc_lanes_pop(struct packet_lanes *lanes);
+void sipc_lanes_free_entry(struct packet_queue_entry *entry);
+void sipc_lanes_destroy(struct packet_lanes *lanes);
 
 #endif //__SIPC_COMMON
\ No newline at end of file
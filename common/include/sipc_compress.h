@@ -0,0 +1,27 @@
+#ifndef __SIPC_COMPRESS_
+#define __SIPC_COMPRESS_
+
+#include <limits.h>
+
+/*
+ * small LZ77 codec with an LZ4 like block format. compressed block starts with
+ * the original size (4 bytes, little endian), then the sequences follow:
+ * token (literal length << 4 | match length - COMPRESS_MIN_MATCH), extra literal
+ * length bytes, literals, 2 bytes little endian offset, extra match length bytes.
+ * the last sequence has literals only
+ */
+
+#define COMPRESS_MIN_SIZE	64
+#define COMPRESS_MIN_MATCH	4
+#define COMPRESS_HASH_LOG	12
+#define COMPRESS_MAX_OFFSET	65535
+#define COMPRESS_HEADER_SIZE	4
+#define COMPRESS_MAX_RATIO	255			//a byte of a block gives at most this many bytes
+#define COMPRESS_MAX_SIZE	(UINT_MAX - 1)	//room for the trailing null of the receiver
+
+unsigned int sipc_compress_bound(unsigned int len);
+int sipc_compress(const void *src, unsigned int src_len, void *dst, unsigned int dst_cap, unsigned int *dst_len);
+int sipc_decompressed_size(const void *src, unsigned int src_len, unsigned int *size);
+int sipc_decompress(const void *src, unsigned int src_len, void *dst, unsigned int dst_cap, unsigned int *dst_len);
+
+#endif //__SIPC_COMPRESS_
@@ -0,0 +1,115 @@
+#ifndef __SIPC_LOG_
+#define __SIPC_LOG_
+
+#include <string.h>
+
+/*
+ * asynchronous binary logger behind debugf(). the calling thread only stores
+ * a timestamp, the line, the format pointer and the raw arguments into its own
+ * single producer ring, a background thread formats the records and writes
+ * them to stderr or to the file given with SIPC_LOG_FILE. the thread sleeps
+ * while the rings are empty, the first record wakes it and the records of the
+ * next SIPC_LOG_FLUSH_US are written with it. strings are copied
+ * into the record since they may be freed before the record is formatted, long
+ * ones are truncated. when a ring is full the record is dropped, the caller
+ * never waits
+ */
+
+#define SIPC_LOG_RING_RECORDS	512		//per thread, power of two
+#define SIPC_LOG_MAX_ARGS		8
+#define SIPC_LOG_STRING_AREA	128
+#define SIPC_LOG_FLUSH_US		1000
+#define SIPC_LOG_NO_STRING		0xFFFFFFFFULL
+
+struct sipc_log_record {
+	unsigned long long stamp;
+	const char *format;
+	unsigned int line;
+	unsigned short argc;
+	unsigned short string_used;
+	unsigned long long args[SIPC_LOG_MAX_ARGS];
+	char strings[SIPC_LOG_STRING_AREA];
+};
+
+struct sipc_log_record *sipc_log_reserve(unsigned int line, const char *format);
+void sipc_log_commit(struct sipc_log_record *record);
+void sipc_log_flush(void);
+
+static inline void sipc_log_put_integer(struct sipc_log_record *record, unsigned long long value)
+{
+	if (record->argc < SIPC_LOG_MAX_ARGS) {
+		record->args[record->argc++] = value;
+	}
+}
+
+static inline void sipc_log_put_double(struct sipc_log_record *record, double value)
+{
+	unsigned long long bits;
+
+	memcpy(&bits, &value, sizeof(bits));
+	sipc_log_put_integer(record, bits);
+}
+
+static inline void sipc_log_put_pointer(struct sipc_log_record *record, const void *value)
+{
+	sipc_log_put_integer(record, (unsigned long long)(unsigned long)value);
+}
+
+/*
+ * the argument keeps the offset of the copy in the string area
+ */
+static inline void sipc_log_put_string(struct sipc_log_record *record, const char *value)
+{
+	size_t len;
+	unsigned int room = SIPC_LOG_STRING_AREA - record->string_used;
+
+	if (!value || room < 2) {
+		sipc_log_put_integer(record, SIPC_LOG_NO_STRING);
+		return;
+	}
+
+	len = strnlen(value, room - 1);
+	memcpy(record->strings + record->string_used, value, len);
+	record->strings[record->string_used + len] = '\0';
+	sipc_log_put_integer(record, record->string_used);
+	record->string_used += len + 1;
+}
+
+#define SIPC_LOG_ARG(r, x)	_Generic((x),								\
+								char *: sipc_log_put_string,			\
+								const char *: sipc_log_put_string,		\
+								void *: sipc_log_put_pointer,			\
+								const void *: sipc_log_put_pointer,		\
+								float: sipc_log_put_double,				\
+								double: sipc_log_put_double,			\
+								default: sipc_log_put_integer)(r, x)
+
+#define SIPC_LOG_FORMAT(fmt, ...)	fmt
+#define SIPC_LOG_NARGS(...)			SIPC_LOG_NARGS_(__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0, _)
+#define SIPC_LOG_NARGS_(fmt, a1, a2, a3, a4, a5, a6, a7, a8, n, ...)	n
+#define SIPC_LOG_CONCAT(a, b)		SIPC_LOG_CONCAT_(a, b)
+#define SIPC_LOG_CONCAT_(a, b)		a##b
+
+#define SIPC_LOG_ARGS_0(r, fmt)
+#define SIPC_LOG_ARGS_1(r, fmt, a)		SIPC_LOG_ARG(r, a)
+#define SIPC_LOG_ARGS_2(r, fmt, a, ...)	SIPC_LOG_ARG(r, a); SIPC_LOG_ARGS_1(r, fmt, __VA_ARGS__)
+#define SIPC_LOG_ARGS_3(r, fmt, a, ...)	SIPC_LOG_ARG(r, a); SIPC_LOG_ARGS_2(r, fmt, __VA_ARGS__)
+#define SIPC_LOG_ARGS_4(r, fmt, a, ...)	SIPC_LOG_ARG(r, a); SIPC_LOG_ARGS_3(r, fmt, __VA_ARGS__)
+#define SIPC_LOG_ARGS_5(r, fmt, a, ...)	SIPC_LOG_ARG(r, a); SIPC_LOG_ARGS_4(r, fmt, __VA_ARGS__)
+#define SIPC_LOG_ARGS_6(r, fmt, a, ...)	SIPC_LOG_ARG(r, a); SIPC_LOG_ARGS_5(r, fmt, __VA_ARGS__)
+#define SIPC_LOG_ARGS_7(r, fmt, a, ...)	SIPC_LOG_ARG(r, a); SIPC_LOG_ARGS_6(r, fmt, __VA_ARGS__)
+#define SIPC_LOG_ARGS_8(r, fmt, a, ...)	SIPC_LOG_ARG(r, a); SIPC_LOG_ARGS_7(r, fmt, __VA_ARGS__)
+
+/*
+ * at most SIPC_LOG_MAX_ARGS arguments, pointers other than strings should be
+ * cast to 'void *' as printf() wants for %p
+ */
+#define sipc_logf(...)		do {																	\
+								struct sipc_log_record *__record = NULL;							\
+								if ((__record = sipc_log_reserve(__LINE__, SIPC_LOG_FORMAT(__VA_ARGS__))) != NULL) {	\
+									SIPC_LOG_CONCAT(SIPC_LOG_ARGS_, SIPC_LOG_NARGS(__VA_ARGS__))(__record, __VA_ARGS__);	\
+									sipc_log_commit(__record);										\
+								}																	\
+							} while (0)
+
+#endif //__SIPC_LOG_
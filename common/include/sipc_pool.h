@@ -0,0 +1,71 @@
+#ifndef __SIPC_POOL_
+#define __SIPC_POOL_
+
+#include <stddef.h>
+
+/*
+ * size classed buffer pool. buffers are taken from per class free lists which
+ * are filled in arenas of 'grow count' buffers, so the steady state message
+ * path does not touch the heap. sizes bigger than the largest class fall back
+ * to the heap. buffers are reference counted, sipc_pool_free() drops one
+ * reference
+ */
+
+#define POOL_CLASS_COUNT	6
+#define POOL_ALIGNMENT		16
+
+#define POOL_OWNER_LIBRARY	0
+#define POOL_OWNER_LOANED	1		//lent to the application by a loaned callback
+
+#define POOL_FREE(p)	{										\
+							if (p) {							\
+								sipc_pool_free(p);				\
+								p = NULL;						\
+							}									\
+						}
+
+#define SLAB_FREE(s, p)	{										\
+							if (p) {							\
+								sipc_slab_free(s, p);			\
+								p = NULL;						\
+							}									\
+						}
+
+struct sipc_pool_stats {
+	unsigned long allocs;
+	unsigned long frees;
+	unsigned long heap_allocs;
+	unsigned long arenas;
+};
+
+struct slab_chunk;
+
+/*
+ * fixed size object cache, not thread safe. objects are zeroed on alloc
+ */
+struct sipc_slab {
+	size_t obj_size;
+	unsigned int grow_count;
+	void *free_list;
+	struct slab_chunk *chunks;
+	unsigned long allocs;
+	unsigned long arenas;
+};
+
+#define SIPC_SLAB_INITIALIZER(type, count)	{ sizeof(type), (count), NULL, NULL, 0, 0 }
+
+void *sipc_pool_alloc(unsigned int size);
+void *sipc_pool_calloc(unsigned int size);
+char *sipc_pool_strdup(const char *str);
+void sipc_pool_retain(void *ptr);
+void sipc_pool_set_owner(void *ptr, unsigned int owner);
+int sipc_pool_check(const void *ptr, unsigned int owner);
+void sipc_pool_free(void *ptr);
+void sipc_pool_get_stats(struct sipc_pool_stats *stats);
+void sipc_pool_destroy(void);
+
+void *sipc_slab_alloc(struct sipc_slab *slab);
+void sipc_slab_free(struct sipc_slab *slab, void *obj);
+void sipc_slab_destroy(struct sipc_slab *slab);
+
+#endif //__SIPC_POOL_
@@ -0,0 +1,77 @@
+#ifndef __SIPC_TIMER_
+#define __SIPC_TIMER_
+
+#include <sys/select.h>
+#include <sys/queue.h>
+
+/*
+ * hierarchical timer wheel. the first level has a slot per tick, every slot of
+ * the next level spans a whole turn of the level below, and a slot is moved
+ * one level down when the wheel comes to it. adding and removing a timer is a
+ * list operation, an expiry visits only the timers which are due or move down
+ */
+
+#define TIMER_TICK_MS		100
+#define TIMER_WHEEL_BITS	8
+#define TIMER_WHEEL_SIZE	(1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK	(TIMER_WHEEL_SIZE - 1)
+#define TIMER_WHEEL_LEVELS	3			//up to 2^24 ticks, about 19 days
+
+struct sipc_timer;
+
+TAILQ_HEAD(sipc_timer_list, sipc_timer);
+
+struct sipc_timer {
+	unsigned long long expires;			//in ticks
+	struct sipc_timer_list *slot;		//NULL if it is not armed
+	void *data;
+	TAILQ_ENTRY(sipc_timer) entries;
+};
+
+struct sipc_timer_wheel {
+	unsigned long long now;				//in ticks, the slots before it are expired
+	unsigned int count;
+	struct sipc_timer_list slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE];
+};
+
+typedef void (*sipc_timer_cb)(struct sipc_timer *timer, void *arg);
+
+/*
+ * idle deadlines of the accepted connections of a listener. a connection only
+ * stamps its last activity, its timer is moved when it fires and the
+ * connection turns out to be active. so the busy connections cost nothing
+ */
+struct sipc_idle_conn {
+	struct sipc_timer timer;
+	unsigned long long last_active;		//in milliseconds
+};
+
+typedef void (*sipc_idle_close_cb)(int fd);
+
+struct sipc_idle_table {
+	unsigned long long idle_ms;
+	unsigned long long now;				//in milliseconds, taken once per loop by sipc_idle_expire()
+	unsigned long closed;
+	fd_set *set;						//of the listener, idle connections are cleared from it
+	sipc_idle_close_cb on_close;		//told about every connection the table closes, may be NULL
+	struct sipc_timer_wheel wheel;
+	struct sipc_idle_conn conns[FD_SETSIZE];
+};
+
+unsigned long long sipc_timer_now_ms(void);
+void sipc_timer_wheel_init(struct sipc_timer_wheel *wheel, unsigned long long now_ms);
+void sipc_timer_add(struct sipc_timer_wheel *wheel, struct sipc_timer *timer, unsigned long long expires_ms);
+void sipc_timer_del(struct sipc_timer_wheel *wheel, struct sipc_timer *timer);
+void sipc_timer_expire(struct sipc_timer_wheel *wheel, unsigned long long now_ms, sipc_timer_cb expired, void *arg);
+unsigned long long sipc_timer_next_ms(struct sipc_timer_wheel *wheel, unsigned long long now_ms);
+
+void sipc_idle_init(struct sipc_idle_table *table, unsigned long long idle_ms, fd_set *set);
+void sipc_idle_on_close(struct sipc_idle_table *table, sipc_idle_close_cb on_close);
+void sipc_idle_add(struct sipc_idle_table *table, int fd);
+void sipc_idle_touch(struct sipc_idle_table *table, int fd);
+void sipc_idle_remove(struct sipc_idle_table *table, int fd);
+void sipc_idle_close_all(struct sipc_idle_table *table);
+void sipc_idle_expire(struct sipc_idle_table *table);
+unsigned long long sipc_idle_timeout_ms(struct sipc_idle_table *table, unsigned long long max_ms);
+
+#endif //__SIPC_TIMER_
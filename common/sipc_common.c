@@ -1,4 +1,9 @@
+#define _GNU_SOURCE		//cpu_set_t of sipc_pin_thread(), recvmmsg() and sendmmsg()
+
 #include "sipc_common.h"
+#include "sipc_pool.h"
+
+static unsigned short daemon_port = 0;
 
 static bool sipc_is_ipv6(const char *ipaddress)
 {
@@ -144,6 +149,36 @@ char *packet_type_beautiy(enum _packet_type type)
 	case DESTROY:
 		return "DESTROY";
 		break;
+	case CONFLATE:
+		return "CONFLATE";
+		break;
+	case STREAM:
+		return "STREAM";
+		break;
+	case STATS:
+		return "STATS";
+		break;
+	case PEER_HELLO:
+		return "PEER_HELLO";
+		break;
+	case PEER_INTEREST:
+		return "PEER_INTEREST";
+		break;
+	case PING:
+		return "PING";
+		break;
+	case REGISTER_BULK:
+		return "REGISTER_BULK";
+		break;
+	case LOOKUP:
+		return "LOOKUP";
+		break;
+	case INVALIDATE:
+		return "INVALIDATE";
+		break;
+	case DIRECT_REPORT:
+		return "DIRECT_REPORT";
+		break;
 	default:
 		break;
 	}
@@ -151,6 +186,44 @@ char *packet_type_beautiy(enum _packet_type type)
 	return "error";
 }
 
+unsigned long long sipc_monotonic_ns(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) {
+		return 0;
+	}
+
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * port of sipcd, PORT unless SIPC_DAEMON_PORT gives another one or sipcd sets
+ * its own. the ports of the clients start right after it
+ */
+unsigned short sipc_daemon_port(void)
+{
+	char *env = NULL;
+	unsigned long port = 0;
+
+	if (daemon_port) {
+		return daemon_port;
+	}
+
+	if ((env = getenv("SIPC_DAEMON_PORT")) != NULL) {
+		port = strtoul(env, NULL, 10);
+	}
+
+	daemon_port = port && port + BACKLOG + 1 <= 65535 ? (unsigned short)port : PORT;
+
+	return daemon_port;
+}
+
+void sipc_set_daemon_port(unsigned short port)
+{
+	daemon_port = port;
+}
+
 int sipc_socket_accept(int sockfd, struct sockaddr_storage *addr)
 {
 	int connfd;
@@ -214,3 +287,923 @@ int sipc_socket_listen(int sockfd, int backlog)
 
 	return OK;
 }
+
+/*
+ * the kernel probes a connection which is silent for 'idle' seconds and drops
+ * it when the other side does not answer 3 probes, so a connection to a dead
+ * host does not stay open
+ */
+int sipc_socket_keepalive(int sockfd, unsigned int idle)
+{
+	int enable = 1;
+	int count = 3;
+	int seconds = (int)idle;
+	int interval = idle / 3 ? (int)(idle / 3) : 1;
+
+	if (sockfd < 0 || !idle) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	if (setsockopt(sockfd, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(enable)) < 0 ||
+			setsockopt(sockfd, IPPROTO_TCP, TCP_KEEPIDLE, &seconds, sizeof(seconds)) < 0 ||
+			setsockopt(sockfd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval)) < 0 ||
+			setsockopt(sockfd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count)) < 0) {
+		errorf("setsockopt() failed with %d: %s\n", errno, strerror(errno));
+		return NOK;
+	}
+
+	return OK;
+}
+
+/*
+ * the kernel polls the device queue of the socket for a while before a read
+ * or a select() sleeps. it is a no-op where SO_BUSY_POLL is not supported
+ */
+int sipc_socket_busy_poll(int sockfd, unsigned int usec)
+{
+	int value = (int)usec;
+
+	if (sockfd < 0) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+#ifdef SO_BUSY_POLL
+	if (setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL, &value, sizeof(value)) < 0) {
+		debugf("SO_BUSY_POLL is not set, %d: %s\n", errno, strerror(errno));
+		return NOK;
+	}
+#else
+	UNUSED(value);
+#endif
+
+	return OK;
+}
+
+/*
+ * the calling thread runs on the given cpu only
+ */
+int sipc_pin_thread(int cpu)
+{
+	cpu_set_t set;
+
+	if (cpu < 0 || cpu >= CPU_SETSIZE) {
+		errorf("cpu %d is not valid\n", cpu);
+		return NOK;
+	}
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+		errorf("pthread_setaffinity_np() failed for the cpu %d\n", cpu);
+		return NOK;
+	}
+
+	return OK;
+}
+
+static inline void sipc_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+/*
+ * select() for the receive loops, see enum sipc_wait_mode. the spinning is
+ * done with select() calls which do not sleep, the loop gets the same result
+ * as with a blocking one. a NULL timeval waits forever
+ */
+int sipc_wait_select(struct sipc_waiter *waiter, int nfds, fd_set *set, struct timeval *tv)
+{
+	int ret = 0;
+	fd_set backup;
+	struct timeval zero, rest;
+	unsigned long long now, deadline, spin_until;
+
+	if (!waiter || !set || waiter->mode == WAIT_BLOCK) {
+		return select(nfds, set, NULL, NULL, tv);
+	}
+
+	now = sipc_monotonic_ns();
+	deadline = tv ? now + tv->tv_sec * 1000000000ULL + tv->tv_usec * 1000ULL : ~0ULL;
+	spin_until = waiter->mode == WAIT_SPIN ? deadline : waiter->last_ready + waiter->spin_us * 1000ULL;
+	if (spin_until > deadline) {
+		spin_until = deadline;
+	}
+
+	memcpy(&backup, set, sizeof(fd_set));
+
+	//polled once at least, a zero timeout does so with select() too
+	for (;;) {
+		memset(&zero, 0, sizeof(zero));
+		if ((ret = select(nfds, set, NULL, NULL, &zero)) != 0) {
+			goto out;
+		}
+		now = sipc_monotonic_ns();
+		if (now >= spin_until) {
+			break;
+		}
+		memcpy(set, &backup, sizeof(fd_set));
+		sipc_cpu_relax();
+	}
+
+	if (now >= deadline) {
+		return 0;
+	}
+
+	memcpy(set, &backup, sizeof(fd_set));
+
+	//the spin window is over, the rest of the timeout is slept
+	if (tv) {
+		rest.tv_sec = (deadline - now) / 1000000000ULL;
+		rest.tv_usec = ((deadline - now) % 1000000000ULL) / 1000;
+	}
+	ret = select(nfds, set, NULL, NULL, tv ? &rest : NULL);
+
+out:
+	if (ret > 0) {
+		waiter->last_ready = sipc_monotonic_ns();
+	}
+
+	return ret;
+}
+
+int sipc_write_packet(struct _packet *packet, int fd)
+{
+	if (!packet || !packet->title || fd < 0) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	errno = 0;
+	if (send(fd, &packet->packet_type, sizeof(packet->packet_type), MSG_NOSIGNAL) == -1) {
+		errorf("send() failed with %d: %s\n", errno, strerror(errno));
+		return NOK;
+	}
+
+	errno = 0;
+	if (send(fd, &packet->priority, sizeof(packet->priority), MSG_NOSIGNAL) == -1) {
+		errorf("send() failed with %d: %s\n", errno, strerror(errno));
+		return NOK;
+	}
+
+	errno = 0;
+	if (send(fd, &packet->flags, sizeof(packet->flags), MSG_NOSIGNAL) == -1) {
+		errorf("send() failed with %d: %s\n", errno, strerror(errno));
+		return NOK;
+	}
+
+	errno = 0;
+	if ((packet->flags & PACKET_FLAG_TIMESTAMPS) &&
+			send(fd, &packet->timestamps, PACKET_TIMESTAMPS_WIRE_SIZE, MSG_NOSIGNAL) == -1) {
+		errorf("send() failed with %d: %s\n", errno, strerror(errno));
+		return NOK;
+	}
+
+	errno = 0;
+	if (send(fd, &packet->title_size, sizeof(packet->title_size), MSG_NOSIGNAL) == -1) {
+		errorf("send() failed with %d: %s\n", errno, strerror(errno));
+		return NOK;
+	}
+
+	errno = 0;
+	if (packet->title_size && send(fd, packet->title, packet->title_size, MSG_NOSIGNAL) == -1) {
+		errorf("send() failed with %d: %s\n", errno, strerror(errno));
+		return NOK;
+	}
+
+	errno = 0;
+	if (send(fd, &packet->key_size, sizeof(packet->key_size), MSG_NOSIGNAL) == -1) {
+		errorf("send() failed with %d: %s\n", errno, strerror(errno));
+		return NOK;
+	}
+
+	errno = 0;
+	if (packet->key_size && packet->key && send(fd, packet->key, packet->key_size, MSG_NOSIGNAL) == -1) {
+		errorf("send() failed with %d: %s\n", errno, strerror(errno));
+		return NOK;
+	}
+
+	errno = 0;
+	if (send(fd, &packet->payload_size, sizeof(packet->payload_size), MSG_NOSIGNAL) == -1) {
+		errorf("send() failed with %d: %s\n", errno, strerror(errno));
+		return NOK;
+	}
+
+	errno = 0;
+	if (packet->payload_size && packet->payload && send(fd, packet->payload, packet->payload_size, MSG_NOSIGNAL) == -1) {
+		errorf("send() failed with %d: %s\n", errno, strerror(errno));
+		return NOK;
+	}
+
+	return OK;
+}
+
+/*
+ * same wire format with sipc_write_packet(), but into a stream. sipcd batches
+ * the packets of a peer link with it
+ */
+int sipc_pack_packet(struct _packet *packet, FILE *fp)
+{
+	if (!packet || !packet->title || !fp) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	if (fwrite(&packet->packet_type, sizeof(packet->packet_type), 1, fp) != 1 ||
+			fwrite(&packet->priority, sizeof(packet->priority), 1, fp) != 1 ||
+			fwrite(&packet->flags, sizeof(packet->flags), 1, fp) != 1) {
+		return NOK;
+	}
+
+	if ((packet->flags & PACKET_FLAG_TIMESTAMPS) && fwrite(&packet->timestamps, PACKET_TIMESTAMPS_WIRE_SIZE, 1, fp) != 1) {
+		return NOK;
+	}
+
+	if (fwrite(&packet->title_size, sizeof(packet->title_size), 1, fp) != 1 ||
+			(packet->title_size && fwrite(packet->title, packet->title_size, 1, fp) != 1)) {
+		return NOK;
+	}
+
+	if (fwrite(&packet->key_size, sizeof(packet->key_size), 1, fp) != 1 ||
+			(packet->key_size && packet->key && fwrite(packet->key, packet->key_size, 1, fp) != 1)) {
+		return NOK;
+	}
+
+	if (fwrite(&packet->payload_size, sizeof(packet->payload_size), 1, fp) != 1 ||
+			(packet->payload_size && packet->payload && fwrite(packet->payload, packet->payload_size, 1, fp) != 1)) {
+		return NOK;
+	}
+
+	return OK;
+}
+
+/*
+ * bytes written by sipc_pack_packet()
+ */
+size_t sipc_packed_size(struct _packet *packet)
+{
+	size_t size = sizeof(packet->packet_type) + sizeof(packet->priority) + sizeof(packet->flags);
+
+	if (packet->flags & PACKET_FLAG_TIMESTAMPS) {
+		size += PACKET_TIMESTAMPS_WIRE_SIZE;
+	}
+
+	return size + sizeof(packet->title_size) + packet->title_size + sizeof(packet->key_size) + packet->key_size +
+		sizeof(packet->payload_size) + packet->payload_size;
+}
+
+static int sipc_unpack_field(char *buffer, size_t size, size_t *offset, void *field, size_t len)
+{
+	if (size - *offset < len) {
+		return NOK;
+	}
+
+	memcpy(field, buffer + *offset, len);
+	*offset += len;
+
+	return OK;
+}
+
+static int sipc_unpack_ref(char *buffer, size_t size, size_t *offset, char **field, size_t len)
+{
+	if (size - *offset < len) {
+		return NOK;
+	}
+
+	*field = len ? buffer + *offset : NULL;
+	*offset += len;
+
+	return OK;
+}
+
+/*
+ * reverse of sipc_pack_packet() for a packet in a buffer, eg a datagram. the
+ * title, the key and the payload point into the buffer, nothing is copied
+ */
+int sipc_unpack_packet(char *buffer, size_t size, struct _packet *packet)
+{
+	size_t offset = 0;
+
+	if (!buffer || !packet) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	memset(packet, 0, sizeof(struct _packet));
+
+	if (sipc_unpack_field(buffer, size, &offset, &packet->packet_type, sizeof(packet->packet_type)) == NOK ||
+			sipc_unpack_field(buffer, size, &offset, &packet->priority, sizeof(packet->priority)) == NOK ||
+			sipc_unpack_field(buffer, size, &offset, &packet->flags, sizeof(packet->flags)) == NOK) {
+		return NOK;
+	}
+
+	if ((packet->flags & PACKET_FLAG_TIMESTAMPS) &&
+			sipc_unpack_field(buffer, size, &offset, &packet->timestamps, PACKET_TIMESTAMPS_WIRE_SIZE) == NOK) {
+		return NOK;
+	}
+
+	if (sipc_unpack_field(buffer, size, &offset, &packet->title_size, sizeof(packet->title_size)) == NOK ||
+			sipc_unpack_ref(buffer, size, &offset, &packet->title, packet->title_size) == NOK ||
+			sipc_unpack_field(buffer, size, &offset, &packet->key_size, sizeof(packet->key_size)) == NOK ||
+			sipc_unpack_ref(buffer, size, &offset, &packet->key, packet->key_size) == NOK ||
+			sipc_unpack_field(buffer, size, &offset, &packet->payload_size, sizeof(packet->payload_size)) == NOK ||
+			sipc_unpack_ref(buffer, size, &offset, &packet->payload, packet->payload_size) == NOK) {
+		return NOK;
+	}
+
+	if (!packet->title || packet->title[packet->title_size - 1] != '\0' || packet->priority >= PRIORITY_COUNT ||
+			packet->key_size > PACKET_FIELD_MAX_SIZE || packet->payload_size > PACKET_FIELD_MAX_SIZE) {
+		return NOK;
+	}
+
+	return OK;
+}
+
+/*
+ * bytes of the packet which starts the buffer, as far as its first 'size'
+ * bytes tell. while it is more than 'size', the packet is not complete and the
+ * result grows with the next fields, so a reader never reads past the packet
+ */
+size_t sipc_packet_need(const char *buffer, size_t size)
+{
+	unsigned char flags;
+	unsigned int i, field;
+	size_t need = sizeof(unsigned char) * 3;
+
+	if (!buffer || size < need) {
+		return need;
+	}
+
+	memcpy(&flags, buffer + 2, sizeof(flags));
+	if (flags & PACKET_FLAG_TIMESTAMPS) {
+		need += PACKET_TIMESTAMPS_WIRE_SIZE;
+	}
+
+	//title, key and payload, each is its size and its bytes
+	for (i = 0; i < 3; i++) {
+		need += sizeof(field);
+		if (size < need) {
+			return need;
+		}
+		memcpy(&field, buffer + need - sizeof(field), sizeof(field));
+		need += field;
+	}
+
+	return need;
+}
+
+/*
+ * reads at most up to 'want' bytes of the connection without blocking. *eof
+ * is set when the sender has closed it
+ */
+int sipc_conn_recv(int sockfd, struct sipc_conn_buffer *conn, size_t want, bool *eof)
+{
+	ssize_t ret;
+	char *buffer = NULL;
+
+	if (want > conn->size) {
+		if ((buffer = (char *)realloc(conn->buffer, want)) == NULL) {
+			errorf("realloc failed\n");
+			return NOK;
+		}
+		conn->buffer = buffer;
+		conn->size = want;
+	}
+
+	do {
+		ret = recv(sockfd, conn->buffer + conn->used, want - conn->used, MSG_DONTWAIT);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret == 0) {
+		if (conn->used) {
+			errorf("connection %d is closed in the middle of a packet\n", sockfd);
+		}
+		*eof = true;
+		return OK;
+	} else if (ret < 0) {
+		return (errno == EAGAIN || errno == EWOULDBLOCK) ? OK : NOK;
+	}
+
+	conn->used += ret;
+
+	return OK;
+}
+
+/*
+ * reads what is waiting of the next packet and the 'trailer' bytes after it,
+ * never more. *packet_size is set when both are in the buffer, it is 0 until
+ * then
+ */
+int sipc_conn_fill(int sockfd, struct sipc_conn_buffer *conn, size_t trailer, size_t *packet_size, bool *eof)
+{
+	size_t need, want, before;
+
+	*packet_size = 0;
+
+	for (;;) {
+		need = sipc_packet_need(conn->buffer, conn->used);
+		want = need > conn->used ? need : need + trailer;
+		if (conn->used >= want) {
+			*packet_size = need;
+			return OK;
+		}
+
+		before = conn->used;
+		if (sipc_conn_recv(sockfd, conn, want, eof) == NOK) {
+			return NOK;
+		}
+		if (*eof || conn->used == before) {
+			return OK;
+		}
+	}
+}
+
+/*
+ * the packet in the buffer is handled, the next one starts at its beginning
+ */
+void sipc_conn_next(struct sipc_conn_buffer *conn)
+{
+	conn->used = 0;
+	if (conn->size > CONN_KEEP_SIZE) {
+		FREE(conn->buffer);
+		conn->size = 0;
+	}
+}
+
+void sipc_conn_free(struct sipc_conn_buffer *conn)
+{
+	FREE(conn->buffer);
+	conn->size = 0;
+	conn->used = 0;
+}
+
+/*
+ * the title, the key and the payload of 'from' are copied into pool buffers,
+ * the key and the payload get a trailing null as sipc_read_packet() gives
+ */
+int sipc_copy_packet(const struct _packet *from, struct _packet *to)
+{
+	if (!from || !to || !from->title) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	memcpy(to, from, sizeof(struct _packet));
+	to->title = NULL;
+	to->key = NULL;
+	to->payload = NULL;
+
+	if ((to->title = (char *)sipc_pool_alloc(from->title_size)) == NULL) {
+		goto fail;
+	}
+	memcpy(to->title, from->title, from->title_size);
+
+	if (from->key_size && from->key) {
+		if ((to->key = (char *)sipc_pool_alloc(from->key_size + 1)) == NULL) {
+			goto fail;
+		}
+		memcpy(to->key, from->key, from->key_size);
+		to->key[from->key_size] = '\0';
+	}
+
+	if (from->payload_size && from->payload) {
+		if ((to->payload = (char *)sipc_pool_alloc(from->payload_size + 1)) == NULL) {
+			goto fail;
+		}
+		memcpy(to->payload, from->payload, from->payload_size);
+		to->payload[from->payload_size] = '\0';
+	}
+
+	return OK;
+
+fail:
+	errorf("sipc_pool_alloc() failed\n");
+	sipc_free_packet(to);
+
+	return NOK;
+}
+
+/*
+ * udp socket on the given port of all addresses, the tcp listener of the same
+ * port number is not affected
+ */
+int sipc_open_datagram(unsigned short port)
+{
+	int fd = -1;
+	int buffer_size = DATAGRAM_SOCKET_BUFFER;
+	struct sockaddr_storage address;
+
+	memset(&address, 0, sizeof(address));
+
+	if (sipc_fill_wildcard_sockstorage(port, AF_UNSPEC, &address) != 0) {
+		errorf("sipc_fill_wildcard_sockstorage() failed\n");
+		return -1;
+	}
+
+	if ((fd = sipc_socket_open_use_sockaddr((struct sockaddr *)&address, SOCK_DGRAM, 0)) == -1) {
+		errorf("socket() failed with %d: %s\n", errno, strerror(errno));
+		return -1;
+	}
+
+	//a burst waits in the kernel instead of being dropped, the size is capped by net.core.[rw]mem_max
+	(void) setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+	(void) setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+
+	if (sipc_bind_socket(fd, (struct sockaddr *)&address) == -1) {
+		errorf("bind() of the udp port %u failed with %d: %s\n", port, errno, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/*
+ * reads the datagrams which are waiting, up to 'count', with one recvmmsg().
+ * every buffer has 'size' bytes, returns the number of datagrams read
+ */
+int sipc_recv_datagrams(int fd, char **buffers, size_t size, size_t *lengths, unsigned int count)
+{
+	int ret, i;
+	struct mmsghdr messages[DATAGRAM_BATCH];
+	struct iovec iovecs[DATAGRAM_BATCH];
+
+	if (fd < 0 || !buffers || !lengths) {
+		errorf("args cannot be NULL\n");
+		return -1;
+	}
+
+	count = count > DATAGRAM_BATCH ? DATAGRAM_BATCH : count;
+	memset(messages, 0, sizeof(messages));
+	for (i = 0; i < (int)count; i++) {
+		iovecs[i].iov_base = buffers[i];
+		iovecs[i].iov_len = size;
+		messages[i].msg_hdr.msg_iov = &(iovecs[i]);
+		messages[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	do {
+		ret = recvmmsg(fd, messages, count, MSG_DONTWAIT, NULL);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0) {
+		return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+	}
+
+	for (i = 0; i < ret; i++) {
+		//a datagram larger than the buffer is cut, it is left to the parser
+		lengths[i] = messages[i].msg_len;
+	}
+
+	return ret;
+}
+
+/*
+ * sends data[i] to the loopback port ports[i] with as few sendmmsg() calls as
+ * the kernel lets. a datagram which cannot be sent is skipped, the number of
+ * the datagrams sent is returned
+ */
+unsigned int sipc_send_datagrams(int fd, char **data, size_t *lengths, unsigned int *ports, unsigned int count)
+{
+	int ret;
+	unsigned int i, batch, done = 0, sent = 0;
+	struct sockaddr_storage loopback;
+	struct sockaddr_storage addresses[DATAGRAM_BATCH];
+	struct mmsghdr messages[DATAGRAM_BATCH];
+	struct iovec iovecs[DATAGRAM_BATCH];
+
+	if (fd < 0 || !data || !lengths || !ports) {
+		errorf("args cannot be NULL\n");
+		return 0;
+	}
+
+	memset(&loopback, 0, sizeof(loopback));
+	if (sipc_buf_to_sockstorage(IPV6_LOOPBACK_ADDR, 0, &loopback) == NOK) {
+		errorf("sipc_buf_to_sockstorage() failed\n");
+		return 0;
+	}
+
+	while (done < count) {
+		batch = count - done > DATAGRAM_BATCH ? DATAGRAM_BATCH : count - done;
+		memset(messages, 0, sizeof(struct mmsghdr) * batch);
+		for (i = 0; i < batch; i++) {
+			memcpy(&(addresses[i]), &loopback, sizeof(loopback));
+			((struct sockaddr_in6 *)&(addresses[i]))->sin6_port = htons(ports[done + i]);
+			iovecs[i].iov_base = data[done + i];
+			iovecs[i].iov_len = lengths[done + i];
+			messages[i].msg_hdr.msg_name = &(addresses[i]);
+			messages[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in6);
+			messages[i].msg_hdr.msg_iov = &(iovecs[i]);
+			messages[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		ret = sendmmsg(fd, messages, batch, MSG_DONTWAIT);
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		} else if (ret <= 0) {
+			debugf("datagram to the port %u is dropped with %d: %s\n", ports[done], errno, strerror(errno));
+			done++;
+			continue;
+		}
+
+		done += ret;
+		sent += ret;
+	}
+
+	return sent;
+}
+
+/*
+ * waits until all 'len' bytes are received, a short read means that the peer
+ * closed the connection in the middle of a packet
+ */
+static int sipc_recv_all(int sockfd, void *buf, unsigned int len)
+{
+	ssize_t ret;
+
+	errno = 0;
+	ret = recv(sockfd, buf, len, MSG_WAITALL);
+	if (ret < 0) {
+		errorf("recv error from socket %d, errno: %d\n", sockfd, errno);
+		return NOK;
+	}
+
+	if ((unsigned int)ret != len) {
+		errorf("short read from socket %d, %zd of %u bytes\n", sockfd, ret, len);
+		return NOK;
+	}
+
+	return OK;
+}
+
+/*
+ * reads one packet from the socket. packet->title stays NULL if the sender
+ * did not give any title or closed the connection without sending anything,
+ * callers should skip such packets silently
+ */
+int sipc_read_packet(int sockfd, struct _packet *packet)
+{
+	ssize_t ret;
+
+	if (!packet || sockfd < 0) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	errno = 0;
+	ret = recv(sockfd, &packet->packet_type, sizeof(packet->packet_type), 0);
+	if (ret < 0) {
+		errorf("recv error from socket %d, errno: %d\n", sockfd, errno);
+		return NOK;
+	} else if (ret == 0) {
+		return OK;
+	}
+
+	if (sipc_recv_all(sockfd, &packet->priority, sizeof(packet->priority)) == NOK) {
+		return NOK;
+	}
+
+	if (packet->priority >= PRIORITY_COUNT) {
+		packet->priority = PRIORITY_NORMAL;
+	}
+
+	if (sipc_recv_all(sockfd, &packet->flags, sizeof(packet->flags)) == NOK) {
+		return NOK;
+	}
+
+	if ((packet->flags & PACKET_FLAG_TIMESTAMPS) &&
+			sipc_recv_all(sockfd, &packet->timestamps, PACKET_TIMESTAMPS_WIRE_SIZE) == NOK) {
+		return NOK;
+	}
+
+	if (sipc_recv_all(sockfd, &packet->title_size, sizeof(packet->title_size)) == NOK) {
+		return NOK;
+	}
+
+	if (!packet->title_size) {
+		errorf("packet title size should be greater than zero\n");
+		return OK;
+	}
+	packet->title = (char *)sipc_pool_alloc(packet->title_size);
+	if (!packet->title) {
+		errorf("sipc_pool_alloc() failed\n");
+		return NOK;
+	}
+	if (sipc_recv_all(sockfd, packet->title, packet->title_size) == NOK) {
+		return NOK;
+	}
+	packet->title[packet->title_size - 1] = '\0';
+
+	if (sipc_recv_all(sockfd, &packet->key_size, sizeof(packet->key_size)) == NOK) {
+		return NOK;
+	}
+
+	if (packet->key_size > PACKET_FIELD_MAX_SIZE) {
+		errorf("packet key size %u is not valid\n", packet->key_size);
+		return NOK;
+	}
+
+	if (packet->key_size) {
+		packet->key = (char *)sipc_pool_alloc(packet->key_size + 1);
+		if (!packet->key) {
+			errorf("sipc_pool_alloc() failed\n");
+			return NOK;
+		}
+		if (sipc_recv_all(sockfd, packet->key, packet->key_size) == NOK) {
+			return NOK;
+		}
+		packet->key[packet->key_size] = '\0';
+	}
+
+	if (sipc_recv_all(sockfd, &packet->payload_size, sizeof(packet->payload_size)) == NOK) {
+		return NOK;
+	}
+
+	if (!packet->payload_size) {
+		return OK;
+	}
+
+	if (packet->payload_size > PACKET_FIELD_MAX_SIZE) {
+		errorf("packet payload size %u is not valid\n", packet->payload_size);
+		return NOK;
+	}
+
+	packet->payload = (char *)sipc_pool_alloc(packet->payload_size + 1);
+	if (!packet->payload) {
+		errorf("sipc_pool_alloc() failed\n");
+		return NOK;
+	}
+	if (sipc_recv_all(sockfd, packet->payload, packet->payload_size) == NOK) {
+		return NOK;
+	}
+	packet->payload[packet->payload_size] = '\0';
+
+	return OK;
+}
+
+void sipc_free_packet(struct _packet *packet)
+{
+	if (!packet) {
+		return;
+	}
+
+	POOL_FREE(packet->title);
+	POOL_FREE(packet->key);
+	POOL_FREE(packet->payload);
+}
+
+/*
+ * asks the live statistics of sipcd, see sipc_send_stats_daemon(). returned
+ * text should be freed by the caller
+ */
+char *sipc_request_stats(void)
+{
+	int fd = -1;
+	unsigned int port = 0;
+	char *stats = NULL;
+	struct sockaddr_storage address;
+	struct _packet packet;
+
+	memset(&address, 0, sizeof(address));
+	memset(&packet, 0, sizeof(struct _packet));
+
+	if (sipc_buf_to_sockstorage(IPV6_LOOPBACK_ADDR, sipc_daemon_port(), &address) == NOK) {
+		errorf("sipc_buf_to_sockstorage() failed\n");
+		return NULL;
+	}
+
+	fd = sipc_socket_open_use_buf(IPV6_LOOPBACK_ADDR, SOCK_STREAM, 0);
+	if (fd == -1) {
+		errorf("socket() failed with %d: %s\n", errno, strerror(errno));
+		return NULL;
+	}
+
+	if (sipc_connect_socket(fd, (struct sockaddr*)&address) < 0) {
+		errorf("connect() failed with %d: %s, is sipcd running?\n", errno, strerror(errno));
+		goto out;
+	}
+
+	packet.packet_type = STATS;
+	packet.priority = PRIORITY_HIGH;
+	packet.title = DUMMY_STRING;
+	packet.title_size = strlen(DUMMY_STRING) + 1;
+
+	if (sipc_write_packet(&packet, fd) == NOK ||
+			send(fd, &port, sizeof(port), MSG_NOSIGNAL) != sizeof(port)) {
+		errorf("sending the stats request failed with %d: %s\n", errno, strerror(errno));
+		goto out;
+	}
+
+	memset(&packet, 0, sizeof(struct _packet));
+	if (sipc_read_packet(fd, &packet) == NOK || packet.packet_type != STATS || !packet.payload) {
+		errorf("sipc_read_packet() failed\n");
+		sipc_free_packet(&packet);
+		goto out;
+	}
+
+	stats = strdup(packet.payload);
+	sipc_free_packet(&packet);
+
+out:
+	close(fd);
+
+	return stats;
+}
+
+void sipc_lanes_init(struct packet_lanes *lanes)
+{
+	int i;
+
+	if (!lanes) {
+		return;
+	}
+
+	for (i = 0; i < PRIORITY_COUNT; i++) {
+		TAILQ_INIT(&(lanes->lanes[i]));
+		lanes->count[i] = 0;
+	}
+	lanes->depth = 0;
+}
+
+/*
+ * the packet is moved into the lane queue, the caller should not free it
+ * after a successful push
+ */
+int sipc_lanes_push(struct packet_lanes *lanes, struct _packet *packet, unsigned int port)
+{
+	struct packet_queue_entry *entry = NULL;
+
+	if (!lanes || !packet) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	entry = (struct packet_queue_entry *)sipc_pool_alloc(sizeof(struct packet_queue_entry));
+	if (!entry) {
+		errorf("sipc_pool_alloc() failed\n");
+		return NOK;
+	}
+
+	memcpy(&(entry->packet), packet, sizeof(struct _packet));
+	memset(packet, 0, sizeof(struct _packet));
+	entry->port = port;
+
+	TAILQ_INSERT_TAIL(&(lanes->lanes[entry->packet.priority]), entry, entries);
+	lanes->count[entry->packet.priority]++;
+	lanes->depth++;
+
+	return OK;
+}
+
+/*
+ * returns the oldest packet of the highest priority lane which is not empty
+ */
+struct packet_queue_entry *sipc_lanes_pop(struct packet_lanes *lanes)
+{
+	int i;
+	struct packet_queue_entry *entry = NULL;
+
+	if (!lanes || !lanes->depth) {
+		return NULL;
+	}
+
+	for (i = 0; i < PRIORITY_COUNT; i++) {
+		if ((entry = TAILQ_FIRST(&(lanes->lanes[i]))) != NULL) {
+			TAILQ_REMOVE(&(lanes->lanes[i]), entry, entries);
+			lanes->count[i]--;
+			lanes->depth--;
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+void sipc_lanes_free_entry(struct packet_queue_entry *entry)
+{
+	if (!entry) {
+		return;
+	}
+
+	sipc_free_packet(&(entry->packet));
+	POOL_FREE(entry);
+}
+
+void sipc_lanes_destroy(struct packet_lanes *lanes)
+{
+	struct packet_queue_entry *entry = NULL;
+
+	if (!lanes) {
+		return;
+	}
+
+	while ((entry = sipc_lanes_pop(lanes)) != NULL) {
+		sipc_lanes_free_entry(entry);
+	}
+}
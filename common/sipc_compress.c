@@ -0,0 +1,241 @@
+#include "sipc_common.h"
+#include "sipc_compress.h"
+
+static unsigned int sipc_hash4(const unsigned char *p)
+{
+	unsigned int v = 0;
+
+	memcpy(&v, p, sizeof(v));
+
+	return (v * 2654435761U) >> (32 - COMPRESS_HASH_LOG);
+}
+
+static unsigned char *sipc_write_length(unsigned char *op, unsigned char *oend, unsigned int len)
+{
+	while (len >= 255) {
+		if (op >= oend) {
+			return NULL;
+		}
+		*op++ = 255;
+		len -= 255;
+	}
+
+	if (op >= oend) {
+		return NULL;
+	}
+	*op++ = (unsigned char)len;
+
+	return op;
+}
+
+static unsigned char *sipc_write_sequence(unsigned char *op, unsigned char *oend, const unsigned char *literal,
+	unsigned int literal_len, unsigned int offset, unsigned int match_len)
+{
+	unsigned char *token = NULL;
+
+	if (op >= oend) {
+		return NULL;
+	}
+
+	token = op++;
+	*token = (unsigned char)((literal_len >= 15 ? 15 : literal_len) << 4);
+	if (literal_len >= 15 && (op = sipc_write_length(op, oend, literal_len - 15)) == NULL) {
+		return NULL;
+	}
+
+	if ((unsigned int)(oend - op) < literal_len) {
+		return NULL;
+	}
+	memcpy(op, literal, literal_len);
+	op += literal_len;
+
+	if (!match_len) {
+		return op;
+	}
+
+	if (oend - op < 2) {
+		return NULL;
+	}
+	*op++ = (unsigned char)(offset & 0xff);
+	*op++ = (unsigned char)(offset >> 8);
+
+	match_len -= COMPRESS_MIN_MATCH;
+	*token |= (unsigned char)(match_len >= 15 ? 15 : match_len);
+	if (match_len >= 15 && (op = sipc_write_length(op, oend, match_len - 15)) == NULL) {
+		return NULL;
+	}
+
+	return op;
+}
+
+unsigned int sipc_compress_bound(unsigned int len)
+{
+	return COMPRESS_HEADER_SIZE + len + (len / 255) + 16;
+}
+
+/*
+ * returns NOK if the data does not fit into dst, callers should send the data
+ * uncompressed in that case
+ */
+int sipc_compress(const void *src, unsigned int src_len, void *dst, unsigned int dst_cap, unsigned int *dst_len)
+{
+	unsigned int table[1 << COMPRESS_HASH_LOG];
+	const unsigned char *base = (const unsigned char *)src;
+	const unsigned char *ip = base;
+	const unsigned char *anchor = base;
+	const unsigned char *end = base + src_len;
+	const unsigned char *match = NULL;
+	unsigned char *op = (unsigned char *)dst;
+	unsigned char *oend = op + dst_cap;
+	unsigned int h, match_len;
+
+	if (!src || !dst || !dst_len || dst_cap < COMPRESS_HEADER_SIZE) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	*op++ = (unsigned char)(src_len & 0xff);
+	*op++ = (unsigned char)((src_len >> 8) & 0xff);
+	*op++ = (unsigned char)((src_len >> 16) & 0xff);
+	*op++ = (unsigned char)((src_len >> 24) & 0xff);
+
+	memset(table, 0, sizeof(table));
+
+	while (src_len >= COMPRESS_MIN_MATCH && ip <= end - COMPRESS_MIN_MATCH) {
+		h = sipc_hash4(ip);
+		match = table[h] ? base + table[h] - 1 : NULL;
+		table[h] = (unsigned int)(ip - base) + 1;
+
+		if (!match || ip - match > COMPRESS_MAX_OFFSET || memcmp(match, ip, COMPRESS_MIN_MATCH) != 0) {
+			ip++;
+			continue;
+		}
+
+		match_len = COMPRESS_MIN_MATCH;
+		while (ip + match_len < end && match[match_len] == ip[match_len]) {
+			match_len++;
+		}
+
+		op = sipc_write_sequence(op, oend, anchor, (unsigned int)(ip - anchor), (unsigned int)(ip - match), match_len);
+		if (!op) {
+			return NOK;
+		}
+
+		ip += match_len;
+		anchor = ip;
+	}
+
+	op = sipc_write_sequence(op, oend, anchor, (unsigned int)(end - anchor), 0, 0);
+	if (!op) {
+		return NOK;
+	}
+
+	*dst_len = (unsigned int)(op - (unsigned char *)dst);
+
+	return OK;
+}
+
+int sipc_decompressed_size(const void *src, unsigned int src_len, unsigned int *size)
+{
+	const unsigned char *ip = (const unsigned char *)src;
+
+	if (!src || !size || src_len < COMPRESS_HEADER_SIZE) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	*size = (unsigned int)ip[0] | ((unsigned int)ip[1] << 8) | ((unsigned int)ip[2] << 16) | ((unsigned int)ip[3] << 24);
+
+	//the header comes from the sender, a size the block cannot give is refused
+	if (*size > COMPRESS_MAX_SIZE || (unsigned long long)*size > (unsigned long long)src_len * COMPRESS_MAX_RATIO) {
+		errorf("decompressed size %u is not valid for %u bytes\n", *size, src_len);
+		return NOK;
+	}
+
+	return OK;
+}
+
+static const unsigned char *sipc_read_length(const unsigned char *ip, const unsigned char *iend, unsigned int *len)
+{
+	unsigned char c;
+
+	do {
+		if (ip >= iend) {
+			return NULL;
+		}
+		c = *ip++;
+		*len += c;
+	} while (c == 255);
+
+	return ip;
+}
+
+int sipc_decompress(const void *src, unsigned int src_len, void *dst, unsigned int dst_cap, unsigned int *dst_len)
+{
+	const unsigned char *ip = (const unsigned char *)src + COMPRESS_HEADER_SIZE;
+	const unsigned char *iend = (const unsigned char *)src + src_len;
+	unsigned char *op = (unsigned char *)dst;
+	unsigned char *oend = op + dst_cap;
+	unsigned int size, token, literal_len, match_len, offset;
+
+	if (!dst || !dst_len || sipc_decompressed_size(src, src_len, &size) == NOK) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	if (size > dst_cap) {
+		errorf("decompressed size %u does not fit into %u\n", size, dst_cap);
+		return NOK;
+	}
+
+	while (ip < iend) {
+		token = *ip++;
+
+		literal_len = token >> 4;
+		if (literal_len == 15 && (ip = sipc_read_length(ip, iend, &literal_len)) == NULL) {
+			return NOK;
+		}
+		if ((unsigned int)(iend - ip) < literal_len || (unsigned int)(oend - op) < literal_len) {
+			return NOK;
+		}
+		memcpy(op, ip, literal_len);
+		ip += literal_len;
+		op += literal_len;
+
+		if (ip == iend) {
+			break;
+		}
+
+		if (iend - ip < 2) {
+			return NOK;
+		}
+		offset = (unsigned int)ip[0] | ((unsigned int)ip[1] << 8);
+		ip += 2;
+		if (!offset || offset > (unsigned int)(op - (unsigned char *)dst)) {
+			return NOK;
+		}
+
+		match_len = token & 15;
+		if (match_len == 15 && (ip = sipc_read_length(ip, iend, &match_len)) == NULL) {
+			return NOK;
+		}
+		match_len += COMPRESS_MIN_MATCH;
+		if ((unsigned int)(oend - op) < match_len) {
+			return NOK;
+		}
+
+		//byte by byte, the match may overlap the output
+		while (match_len--) {
+			*op = *(op - offset);
+			op++;
+		}
+	}
+
+	*dst_len = (unsigned int)(op - (unsigned char *)dst);
+	if (*dst_len != size) {
+		errorf("decompressed size mismatch %u != %u\n", *dst_len, size);
+		return NOK;
+	}
+
+	return OK;
+}
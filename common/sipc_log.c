@@ -0,0 +1,343 @@
+#include "sipc_common.h"
+#include "sipc_log.h"
+
+#define LOG_SPEC_SIZE		32
+
+struct sipc_log_ring {
+	struct sipc_log_record records[SIPC_LOG_RING_RECORDS];
+	unsigned long head __attribute__((aligned(64)));	//written by the owner thread
+	unsigned long dropped;
+	unsigned long tail __attribute__((aligned(64)));	//written by the formatter
+	unsigned long dropped_reported;
+	bool orphan;										//owner thread is gone
+	struct sipc_log_ring *next;
+};
+
+static struct sipc_log_ring *log_rings = NULL;
+static __thread struct sipc_log_ring *log_ring = NULL;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_cond = PTHREAD_COND_INITIALIZER;
+static bool log_waiting = false;						//the formatter waits for log_cond
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+static pthread_key_t log_key;
+static bool log_thread_running = false;
+static FILE *log_output = NULL;
+
+static void sipc_log_format_record(FILE *fp, struct sipc_log_record *record)
+{
+	unsigned int arg = 0;
+	unsigned long long value;
+	size_t len;
+	double dvalue;
+	const char *ptr = NULL;
+	const char *start = NULL;
+	const char *modifier = NULL;
+	char spec[LOG_SPEC_SIZE];
+
+	fprintf(fp, "%llu.%06llu [%u]\t", record->stamp / 1000000000ULL, (record->stamp % 1000000000ULL) / 1000, record->line);
+
+	for (ptr = record->format; *ptr; ptr++) {
+		if (*ptr != '%') {
+			fputc(*ptr, fp);
+			continue;
+		}
+		if (ptr[1] == '%') {
+			fputc('%', fp);
+			ptr++;
+			continue;
+		}
+
+		start = ptr++;
+		ptr += strspn(ptr, "-+ #0123456789.");
+		modifier = ptr;
+		ptr += strspn(ptr, "hlLqjzt");
+		if (!*ptr) {
+			break;
+		}
+
+		len = modifier - start;
+		if (len + 3 >= sizeof(spec)) {
+			fwrite(start, 1, ptr - start + 1, fp);
+			continue;
+		}
+		memcpy(spec, start, len);
+		value = arg < record->argc ? record->args[arg++] : 0;
+
+		//the length modifier is rebuilt, integers are always printed as long long
+		switch (*ptr) {
+			case 'd':
+			case 'i':
+				snprintf(spec + len, sizeof(spec) - len, "ll%c", *ptr);
+				if (ptr - modifier == 0) {
+					value = (long long)(int)value;
+				} else if (*modifier == 'h') {
+					value = ptr - modifier == 1 ? (long long)(short)value : (long long)(signed char)value;
+				}
+				fprintf(fp, spec, (long long)value);
+				break;
+			case 'u':
+			case 'x':
+			case 'X':
+			case 'o':
+				snprintf(spec + len, sizeof(spec) - len, "ll%c", *ptr);
+				if (ptr - modifier == 0) {
+					value = (unsigned int)value;
+				} else if (*modifier == 'h') {
+					value = ptr - modifier == 1 ? (unsigned short)value : (unsigned char)value;
+				}
+				fprintf(fp, spec, value);
+				break;
+			case 'c':
+				snprintf(spec + len, sizeof(spec) - len, "%c", *ptr);
+				fprintf(fp, spec, (int)value);
+				break;
+			case 's':
+				snprintf(spec + len, sizeof(spec) - len, "%c", *ptr);
+				fprintf(fp, spec, value < record->string_used ? record->strings + value : "(null)");
+				break;
+			case 'p':
+				snprintf(spec + len, sizeof(spec) - len, "%c", *ptr);
+				fprintf(fp, spec, (void *)(unsigned long)value);
+				break;
+			case 'f':
+			case 'F':
+			case 'e':
+			case 'E':
+			case 'g':
+			case 'G':
+			case 'a':
+			case 'A':
+				snprintf(spec + len, sizeof(spec) - len, "%c", *ptr);
+				memcpy(&dvalue, &value, sizeof(dvalue));
+				fprintf(fp, spec, dvalue);
+				break;
+			default:
+				fwrite(start, 1, ptr - start + 1, fp);
+				break;
+		}
+	}
+}
+
+/*
+ * should be called with the log lock held
+ */
+static void sipc_log_drain(void)
+{
+	unsigned long head, dropped;
+	struct sipc_log_ring *ring = NULL;
+	struct sipc_log_ring **link = &log_rings;
+
+	while ((ring = *link) != NULL) {
+		head = __atomic_load_n(&(ring->head), __ATOMIC_ACQUIRE);
+		while (ring->tail != head) {
+			sipc_log_format_record(log_output, &(ring->records[ring->tail & (SIPC_LOG_RING_RECORDS - 1)]));
+			__atomic_store_n(&(ring->tail), ring->tail + 1, __ATOMIC_RELEASE);
+		}
+
+		dropped = __atomic_load_n(&(ring->dropped), __ATOMIC_RELAXED);
+		if (dropped != ring->dropped_reported) {
+			fprintf(log_output, "[log]\t%lu records dropped, ring is full\n", dropped - ring->dropped_reported);
+			ring->dropped_reported = dropped;
+		}
+
+		if (__atomic_load_n(&(ring->orphan), __ATOMIC_ACQUIRE) && ring->tail == __atomic_load_n(&(ring->head), __ATOMIC_ACQUIRE)) {
+			*link = ring->next;
+			FREE(ring);
+			continue;
+		}
+		link = &(ring->next);
+	}
+
+	fflush(log_output);
+}
+
+/*
+ * should be called with the log lock held
+ */
+static bool sipc_log_pending(void)
+{
+	struct sipc_log_ring *ring = NULL;
+
+	for (ring = log_rings; ring; ring = ring->next) {
+		if (ring->tail != __atomic_load_n(&(ring->head), __ATOMIC_SEQ_CST) ||
+				__atomic_load_n(&(ring->dropped), __ATOMIC_RELAXED) != ring->dropped_reported) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * log_waiting is set before the rings are checked and a producer reads it
+ * after its record is committed, so either the check sees the record or the
+ * producer wakes the formatter
+ */
+static void *sipc_log_thread(__attribute__((unused)) void *arg)
+{
+	pthread_mutex_lock(&log_lock);
+	while (true) {
+		sipc_log_drain();
+
+		__atomic_store_n(&log_waiting, true, __ATOMIC_SEQ_CST);
+		if (!sipc_log_pending()) {
+			pthread_cond_wait(&log_cond, &log_lock);
+		}
+		__atomic_store_n(&log_waiting, false, __ATOMIC_SEQ_CST);
+
+		//the records of a burst are formatted together
+		pthread_mutex_unlock(&log_lock);
+		usleep(SIPC_LOG_FLUSH_US);
+		pthread_mutex_lock(&log_lock);
+	}
+
+	return NULL;
+}
+
+/*
+ * should be called with the log lock held
+ */
+static void sipc_log_start_thread(void)
+{
+	pthread_t thread;
+	pthread_attr_t attr;
+
+	if (log_thread_running) {
+		return;
+	}
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, sipc_log_thread, NULL) == 0) {
+		__atomic_store_n(&log_thread_running, true, __ATOMIC_RELEASE);
+	}
+	pthread_attr_destroy(&attr);
+}
+
+static void sipc_log_thread_exit(void *arg)
+{
+	__atomic_store_n(&(((struct sipc_log_ring *)arg)->orphan), true, __ATOMIC_RELEASE);
+}
+
+static void sipc_log_prepare_fork(void)
+{
+	pthread_mutex_lock(&log_lock);
+}
+
+static void sipc_log_parent_fork(void)
+{
+	pthread_mutex_unlock(&log_lock);
+}
+
+/*
+ * only the forking thread exists in the child, the formatter is started again
+ * by the next record
+ */
+static void sipc_log_child_fork(void)
+{
+	struct sipc_log_ring *ring = NULL;
+
+	for (ring = log_rings; ring; ring = ring->next) {
+		if (ring != log_ring) {
+			ring->orphan = true;
+		}
+	}
+	log_thread_running = false;
+	log_waiting = false;
+	pthread_cond_init(&log_cond, NULL);
+
+	pthread_mutex_unlock(&log_lock);
+}
+
+static void sipc_log_init(void)
+{
+	char *path = getenv("SIPC_LOG_FILE");
+
+	if (!path || (log_output = fopen(path, "a")) == NULL) {
+		log_output = stderr;
+	}
+
+	pthread_key_create(&log_key, sipc_log_thread_exit);
+	pthread_atfork(sipc_log_prepare_fork, sipc_log_parent_fork, sipc_log_child_fork);
+	atexit(sipc_log_flush);
+}
+
+static struct sipc_log_ring *sipc_log_create_ring(void)
+{
+	struct sipc_log_ring *ring = NULL;
+
+	pthread_once(&log_once, sipc_log_init);
+
+	if (posix_memalign((void **)&ring, 64, sizeof(struct sipc_log_ring)) != 0) {
+		return NULL;
+	}
+	memset(ring, 0, sizeof(struct sipc_log_ring));
+
+	pthread_setspecific(log_key, ring);
+
+	pthread_mutex_lock(&log_lock);
+	ring->next = log_rings;
+	log_rings = ring;
+	pthread_mutex_unlock(&log_lock);
+
+	return ring;
+}
+
+/*
+ * returns the next free record of the calling thread, NULL if the ring is full
+ */
+struct sipc_log_record *sipc_log_reserve(unsigned int line, const char *format)
+{
+	struct sipc_log_ring *ring = log_ring;
+	struct sipc_log_record *record = NULL;
+
+	if (!ring && (ring = log_ring = sipc_log_create_ring()) == NULL) {
+		return NULL;
+	}
+
+	if (!__atomic_load_n(&log_thread_running, __ATOMIC_ACQUIRE)) {
+		pthread_mutex_lock(&log_lock);
+		sipc_log_start_thread();
+		pthread_mutex_unlock(&log_lock);
+	}
+
+	if (ring->head - __atomic_load_n(&(ring->tail), __ATOMIC_ACQUIRE) == SIPC_LOG_RING_RECORDS) {
+		__atomic_store_n(&(ring->dropped), ring->dropped + 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+
+	record = &(ring->records[ring->head & (SIPC_LOG_RING_RECORDS - 1)]);
+	record->stamp = sipc_monotonic_ns();
+	record->format = format;
+	record->line = line;
+	record->argc = 0;
+	record->string_used = 0;
+
+	return record;
+}
+
+void sipc_log_commit(__attribute__((unused)) struct sipc_log_record *record)
+{
+	__atomic_store_n(&(log_ring->head), log_ring->head + 1, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&log_waiting, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&log_lock);
+		pthread_cond_signal(&log_cond);
+		pthread_mutex_unlock(&log_lock);
+	}
+}
+
+/*
+ * formats everything recorded so far in the calling thread, it is also called
+ * at exit
+ */
+void sipc_log_flush(void)
+{
+	if (!log_output) {
+		return;
+	}
+
+	pthread_mutex_lock(&log_lock);
+	sipc_log_drain();
+	pthread_mutex_unlock(&log_lock);
+}
@@ -0,0 +1,347 @@
+#include "sipc_common.h"
+#include "sipc_pool.h"
+
+#define POOL_HEAP_CLASS		POOL_CLASS_COUNT
+#define POOL_ROUND_UP(x)	(((x) + POOL_ALIGNMENT - 1) & ~((size_t)POOL_ALIGNMENT - 1))
+
+#define POOL_MAGIC_USED		0x5ec0b0f1u
+#define POOL_MAGIC_FREE		0x5ec0deadu
+
+struct pool_header {
+	struct pool_header *next;
+	unsigned int pool_class;
+	unsigned int size;
+	unsigned int refs;
+	unsigned int magic;			//a pointer which is not a pool buffer in use has something else here
+	unsigned int owner;
+};
+
+struct pool_chunk {
+	struct pool_chunk *next;
+};
+
+struct pool_class {
+	unsigned int size;
+	unsigned int grow_count;
+	struct pool_header *free_list;
+	struct pool_chunk *chunks;
+	pthread_mutex_t lock;
+};
+
+struct slab_chunk {
+	struct slab_chunk *next;
+};
+
+static struct pool_class pool_classes[POOL_CLASS_COUNT] = {
+	{ 64,			32,	NULL, NULL, PTHREAD_MUTEX_INITIALIZER },
+	{ 256,			32,	NULL, NULL, PTHREAD_MUTEX_INITIALIZER },
+	{ 1024,			16,	NULL, NULL, PTHREAD_MUTEX_INITIALIZER },
+	{ 4 * 1024,		8,	NULL, NULL, PTHREAD_MUTEX_INITIALIZER },
+	{ 16 * 1024,	4,	NULL, NULL, PTHREAD_MUTEX_INITIALIZER },
+	{ 128 * 1024,	2,	NULL, NULL, PTHREAD_MUTEX_INITIALIZER },
+};
+
+static struct sipc_pool_stats pool_stats;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+/*
+ * should be called with the class lock held
+ */
+static int sipc_pool_grow(struct pool_class *pclass, unsigned int index)
+{
+	unsigned int i;
+	size_t slot_size = POOL_ROUND_UP(sizeof(struct pool_header)) + pclass->size;
+	char *base = NULL;
+	struct pool_chunk *chunk = NULL;
+	struct pool_header *header = NULL;
+
+	chunk = (struct pool_chunk *)calloc(1, POOL_ROUND_UP(sizeof(struct pool_chunk)) + slot_size * pclass->grow_count);
+	if (!chunk) {
+		errorf("calloc failed\n");
+		return NOK;
+	}
+
+	chunk->next = pclass->chunks;
+	pclass->chunks = chunk;
+
+	base = (char *)chunk + POOL_ROUND_UP(sizeof(struct pool_chunk));
+	for (i = 0; i < pclass->grow_count; i++) {
+		header = (struct pool_header *)(base + i * slot_size);
+		header->pool_class = index;
+		header->size = pclass->size;
+		header->magic = POOL_MAGIC_FREE;
+		header->next = pclass->free_list;
+		pclass->free_list = header;
+	}
+
+	__atomic_add_fetch(&(pool_stats.arenas), 1, __ATOMIC_RELAXED);
+
+	return OK;
+}
+
+static void sipc_pool_init(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < POOL_CLASS_COUNT; i++) {
+		pthread_mutex_lock(&(pool_classes[i].lock));
+		(void) sipc_pool_grow(&(pool_classes[i]), i);
+		pthread_mutex_unlock(&(pool_classes[i].lock));
+	}
+}
+
+/*
+ * returned buffer is not zeroed, use sipc_pool_calloc() if needed
+ */
+void *sipc_pool_alloc(unsigned int size)
+{
+	unsigned int i;
+	struct pool_class *pclass = NULL;
+	struct pool_header *header = NULL;
+
+	pthread_once(&pool_once, sipc_pool_init);
+
+	__atomic_add_fetch(&(pool_stats.allocs), 1, __ATOMIC_RELAXED);
+
+	for (i = 0; i < POOL_CLASS_COUNT; i++) {
+		if (size <= pool_classes[i].size) {
+			pclass = &(pool_classes[i]);
+			break;
+		}
+	}
+
+	if (!pclass) {
+		header = (struct pool_header *)malloc(POOL_ROUND_UP(sizeof(struct pool_header)) + size);
+		if (!header) {
+			errorf("malloc failed\n");
+			return NULL;
+		}
+		header->pool_class = POOL_HEAP_CLASS;
+		header->size = size;
+		header->refs = 1;
+		header->magic = POOL_MAGIC_USED;
+		header->owner = POOL_OWNER_LIBRARY;
+		__atomic_add_fetch(&(pool_stats.heap_allocs), 1, __ATOMIC_RELAXED);
+		return (char *)header + POOL_ROUND_UP(sizeof(struct pool_header));
+	}
+
+	pthread_mutex_lock(&(pclass->lock));
+	if (!pclass->free_list && sipc_pool_grow(pclass, i) == NOK) {
+		pthread_mutex_unlock(&(pclass->lock));
+		errorf("sipc_pool_grow() failed\n");
+		return NULL;
+	}
+	header = pclass->free_list;
+	pclass->free_list = header->next;
+	pthread_mutex_unlock(&(pclass->lock));
+	header->refs = 1;
+	header->magic = POOL_MAGIC_USED;
+	header->owner = POOL_OWNER_LIBRARY;
+
+	return (char *)header + POOL_ROUND_UP(sizeof(struct pool_header));
+}
+
+void *sipc_pool_calloc(unsigned int size)
+{
+	void *ptr = sipc_pool_alloc(size);
+
+	if (ptr) {
+		memset(ptr, 0, size);
+	}
+
+	return ptr;
+}
+
+char *sipc_pool_strdup(const char *str)
+{
+	char *ptr = NULL;
+	size_t len;
+
+	if (!str) {
+		return NULL;
+	}
+
+	len = strlen(str) + 1;
+	ptr = (char *)sipc_pool_alloc(len);
+	if (ptr) {
+		memcpy(ptr, str, len);
+	}
+
+	return ptr;
+}
+
+/*
+ * takes one more reference of a pool buffer, the buffer is released when
+ * sipc_pool_free() is called for every reference
+ */
+void sipc_pool_retain(void *ptr)
+{
+	struct pool_header *header = NULL;
+
+	if (!ptr) {
+		return;
+	}
+
+	header = (struct pool_header *)((char *)ptr - POOL_ROUND_UP(sizeof(struct pool_header)));
+	__atomic_add_fetch(&(header->refs), 1, __ATOMIC_RELAXED);
+}
+
+void sipc_pool_set_owner(void *ptr, unsigned int owner)
+{
+	struct pool_header *header = NULL;
+
+	if (!ptr) {
+		return;
+	}
+
+	header = (struct pool_header *)((char *)ptr - POOL_ROUND_UP(sizeof(struct pool_header)));
+	__atomic_store_n(&(header->owner), owner, __ATOMIC_RELEASE);
+}
+
+/*
+ * OK if 'ptr' is a pool buffer in use which belongs to 'owner'. only a pointer
+ * given out by the library should be checked, the bytes in front of it are read
+ */
+int sipc_pool_check(const void *ptr, unsigned int owner)
+{
+	const struct pool_header *header = NULL;
+
+	if (!ptr || ((unsigned long)ptr & (POOL_ALIGNMENT - 1))) {
+		return NOK;
+	}
+
+	header = (const struct pool_header *)((const char *)ptr - POOL_ROUND_UP(sizeof(struct pool_header)));
+	if (__atomic_load_n(&(header->magic), __ATOMIC_ACQUIRE) != POOL_MAGIC_USED ||
+			__atomic_load_n(&(header->owner), __ATOMIC_ACQUIRE) != owner ||
+			!__atomic_load_n(&(header->refs), __ATOMIC_ACQUIRE)) {
+		return NOK;
+	}
+
+	return OK;
+}
+
+void sipc_pool_free(void *ptr)
+{
+	struct pool_class *pclass = NULL;
+	struct pool_header *header = NULL;
+
+	if (!ptr) {
+		return;
+	}
+
+	header = (struct pool_header *)((char *)ptr - POOL_ROUND_UP(sizeof(struct pool_header)));
+	if (__atomic_sub_fetch(&(header->refs), 1, __ATOMIC_ACQ_REL) != 0) {
+		return;
+	}
+
+	__atomic_add_fetch(&(pool_stats.frees), 1, __ATOMIC_RELAXED);
+	header->magic = POOL_MAGIC_FREE;
+	header->owner = POOL_OWNER_LIBRARY;
+
+	if (header->pool_class >= POOL_CLASS_COUNT) {
+		free(header);
+		return;
+	}
+
+	pclass = &(pool_classes[header->pool_class]);
+	pthread_mutex_lock(&(pclass->lock));
+	header->next = pclass->free_list;
+	pclass->free_list = header;
+	pthread_mutex_unlock(&(pclass->lock));
+}
+
+void sipc_pool_get_stats(struct sipc_pool_stats *stats)
+{
+	if (!stats) {
+		return;
+	}
+
+	stats->allocs = __atomic_load_n(&(pool_stats.allocs), __ATOMIC_RELAXED);
+	stats->frees = __atomic_load_n(&(pool_stats.frees), __ATOMIC_RELAXED);
+	stats->heap_allocs = __atomic_load_n(&(pool_stats.heap_allocs), __ATOMIC_RELAXED);
+	stats->arenas = __atomic_load_n(&(pool_stats.arenas), __ATOMIC_RELAXED);
+}
+
+/*
+ * releases all arenas, no pool buffer should be in use anymore
+ */
+void sipc_pool_destroy(void)
+{
+	unsigned int i;
+	struct pool_chunk *chunk = NULL;
+
+	for (i = 0; i < POOL_CLASS_COUNT; i++) {
+		pthread_mutex_lock(&(pool_classes[i].lock));
+		while ((chunk = pool_classes[i].chunks) != NULL) {
+			pool_classes[i].chunks = chunk->next;
+			free(chunk);
+		}
+		pool_classes[i].free_list = NULL;
+		pthread_mutex_unlock(&(pool_classes[i].lock));
+	}
+}
+
+void *sipc_slab_alloc(struct sipc_slab *slab)
+{
+	unsigned int i;
+	size_t obj_size;
+	char *base = NULL;
+	void *obj = NULL;
+	struct slab_chunk *chunk = NULL;
+
+	if (!slab) {
+		errorf("args cannot be NULL\n");
+		return NULL;
+	}
+
+	obj_size = POOL_ROUND_UP(slab->obj_size);
+
+	if (!slab->free_list) {
+		chunk = (struct slab_chunk *)calloc(1, POOL_ROUND_UP(sizeof(struct slab_chunk)) + obj_size * slab->grow_count);
+		if (!chunk) {
+			errorf("calloc failed\n");
+			return NULL;
+		}
+		chunk->next = slab->chunks;
+		slab->chunks = chunk;
+		slab->arenas++;
+
+		base = (char *)chunk + POOL_ROUND_UP(sizeof(struct slab_chunk));
+		for (i = 0; i < slab->grow_count; i++) {
+			*(void **)(base + i * obj_size) = slab->free_list;
+			slab->free_list = base + i * obj_size;
+		}
+	}
+
+	obj = slab->free_list;
+	slab->free_list = *(void **)obj;
+	memset(obj, 0, slab->obj_size);
+	slab->allocs++;
+
+	return obj;
+}
+
+void sipc_slab_free(struct sipc_slab *slab, void *obj)
+{
+	if (!slab || !obj) {
+		return;
+	}
+
+	*(void **)obj = slab->free_list;
+	slab->free_list = obj;
+}
+
+void sipc_slab_destroy(struct sipc_slab *slab)
+{
+	struct slab_chunk *chunk = NULL;
+
+	if (!slab) {
+		return;
+	}
+
+	while ((chunk = slab->chunks) != NULL) {
+		slab->chunks = chunk->next;
+		free(chunk);
+	}
+	slab->free_list = NULL;
+}
@@ -0,0 +1,296 @@
+#include "sipc_common.h"
+#include "sipc_timer.h"
+
+unsigned long long sipc_timer_now_ms(void)
+{
+	return sipc_monotonic_ns() / 1000000ULL;
+}
+
+void sipc_timer_wheel_init(struct sipc_timer_wheel *wheel, unsigned long long now_ms)
+{
+	unsigned int level, i;
+
+	if (!wheel) {
+		errorf("args cannot be NULL\n");
+		return;
+	}
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		for (i = 0; i < TIMER_WHEEL_SIZE; i++) {
+			TAILQ_INIT(&(wheel->slots[level][i]));
+		}
+	}
+
+	wheel->now = now_ms / TIMER_TICK_MS;
+	wheel->count = 0;
+}
+
+/*
+ * the level is chosen by the distance to the expiry, the slot by the bits of
+ * the expiry at that level
+ */
+static void timer_place(struct sipc_timer_wheel *wheel, struct sipc_timer *timer)
+{
+	unsigned int level;
+	unsigned long long delta;
+
+	if (timer->expires < wheel->now) {
+		timer->expires = wheel->now;
+	}
+
+	delta = timer->expires - wheel->now;
+	if (delta >= 1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) {
+		timer->expires = wheel->now + (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+		delta = timer->expires - wheel->now;
+	}
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS - 1; level++) {
+		if (delta < 1ULL << (TIMER_WHEEL_BITS * (level + 1))) {
+			break;
+		}
+	}
+
+	timer->slot = &(wheel->slots[level][(timer->expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK]);
+	TAILQ_INSERT_TAIL(timer->slot, timer, entries);
+}
+
+/*
+ * the expiry is rounded up to a tick, so a timer never fires before it
+ */
+void sipc_timer_add(struct sipc_timer_wheel *wheel, struct sipc_timer *timer, unsigned long long expires_ms)
+{
+	if (!wheel || !timer) {
+		errorf("args cannot be NULL\n");
+		return;
+	}
+
+	if (timer->slot) {
+		sipc_timer_del(wheel, timer);
+	}
+
+	timer->expires = (expires_ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+	timer_place(wheel, timer);
+	wheel->count++;
+}
+
+void sipc_timer_del(struct sipc_timer_wheel *wheel, struct sipc_timer *timer)
+{
+	if (!wheel || !timer || !timer->slot) {
+		return;
+	}
+
+	TAILQ_REMOVE(timer->slot, timer, entries);
+	timer->slot = NULL;
+	wheel->count--;
+}
+
+static void timer_cascade(struct sipc_timer_wheel *wheel, unsigned int level)
+{
+	struct sipc_timer *timer = NULL;
+	struct sipc_timer_list *slot = &(wheel->slots[level][(wheel->now >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK]);
+	struct sipc_timer_list moving = TAILQ_HEAD_INITIALIZER(moving);
+
+	TAILQ_CONCAT(&moving, slot, entries);
+
+	while ((timer = TAILQ_FIRST(&moving)) != NULL) {
+		TAILQ_REMOVE(&moving, timer, entries);
+		timer_place(wheel, timer);
+	}
+}
+
+/*
+ * the callback may add the timer again, it is placed after the expired tick
+ */
+void sipc_timer_expire(struct sipc_timer_wheel *wheel, unsigned long long now_ms, sipc_timer_cb expired, void *arg)
+{
+	unsigned int level;
+	unsigned long long target = now_ms / TIMER_TICK_MS;
+	struct sipc_timer *timer = NULL;
+	struct sipc_timer_list due = TAILQ_HEAD_INITIALIZER(due);
+
+	if (!wheel || !expired) {
+		errorf("args cannot be NULL\n");
+		return;
+	}
+
+	while (wheel->now <= target) {
+		if (!wheel->count) {
+			wheel->now = target + 1;
+			break;
+		}
+
+		for (level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+			if (!(wheel->now & ((1ULL << (TIMER_WHEEL_BITS * level)) - 1))) {
+				timer_cascade(wheel, level);
+			}
+		}
+
+		TAILQ_CONCAT(&due, &(wheel->slots[0][wheel->now & TIMER_WHEEL_MASK]), entries);
+		wheel->now++;
+
+		while ((timer = TAILQ_FIRST(&due)) != NULL) {
+			TAILQ_REMOVE(&due, timer, entries);
+			timer->slot = NULL;
+			wheel->count--;
+			expired(timer, arg);
+		}
+	}
+}
+
+/*
+ * milliseconds until the next timer may fire, or until the next slot of an
+ * upper level moves down. ~0 if there is no timer
+ */
+unsigned long long sipc_timer_next_ms(struct sipc_timer_wheel *wheel, unsigned long long now_ms)
+{
+	unsigned int i;
+	unsigned long long tick;
+
+	if (!wheel || !wheel->count) {
+		return ~0ULL;
+	}
+
+	for (i = 0; i < TIMER_WHEEL_SIZE; i++) {
+		tick = wheel->now + i;
+		if (!(tick & TIMER_WHEEL_MASK) || !TAILQ_EMPTY(&(wheel->slots[0][tick & TIMER_WHEEL_MASK]))) {
+			break;
+		}
+	}
+
+	tick = (wheel->now + i) * TIMER_TICK_MS;
+
+	return tick > now_ms ? tick - now_ms : 0;
+}
+
+static void idle_expired(struct sipc_timer *timer, void *arg)
+{
+	int fd;
+	struct sipc_idle_table *table = (struct sipc_idle_table *)arg;
+	struct sipc_idle_conn *conn = (struct sipc_idle_conn *)timer->data;
+
+	//it was active meanwhile, the timer is moved to its new deadline only now
+	if (table->now - conn->last_active < table->idle_ms) {
+		sipc_timer_add(&(table->wheel), timer, conn->last_active + table->idle_ms);
+		return;
+	}
+
+	fd = (int)(conn - table->conns);
+	debugf("connection %d is idle for %llu ms, closed\n", fd, table->now - conn->last_active);
+	close(fd);
+	if (table->set) {
+		FD_CLR(fd, table->set);
+	}
+	if (table->on_close) {
+		table->on_close(fd);
+	}
+	table->closed++;
+}
+
+void sipc_idle_init(struct sipc_idle_table *table, unsigned long long idle_ms, fd_set *set)
+{
+	if (!table) {
+		errorf("args cannot be NULL\n");
+		return;
+	}
+
+	memset(table, 0, sizeof(struct sipc_idle_table));
+	table->idle_ms = idle_ms;
+	table->set = set;
+	table->now = sipc_timer_now_ms();
+	sipc_timer_wheel_init(&(table->wheel), table->now);
+}
+
+/*
+ * the owner of the connections frees what it keeps for a connection there
+ */
+void sipc_idle_on_close(struct sipc_idle_table *table, sipc_idle_close_cb on_close)
+{
+	if (!table) {
+		errorf("args cannot be NULL\n");
+		return;
+	}
+
+	table->on_close = on_close;
+}
+
+void sipc_idle_add(struct sipc_idle_table *table, int fd)
+{
+	struct sipc_idle_conn *conn = NULL;
+
+	if (!table || fd < 0 || fd >= FD_SETSIZE) {
+		return;
+	}
+
+	conn = &(table->conns[fd]);
+	conn->timer.data = conn;
+	conn->last_active = table->now;
+	sipc_timer_add(&(table->wheel), &(conn->timer), conn->last_active + table->idle_ms);
+}
+
+void sipc_idle_touch(struct sipc_idle_table *table, int fd)
+{
+	if (!table || fd < 0 || fd >= FD_SETSIZE) {
+		return;
+	}
+
+	table->conns[fd].last_active = table->now;
+}
+
+void sipc_idle_remove(struct sipc_idle_table *table, int fd)
+{
+	if (!table || fd < 0 || fd >= FD_SETSIZE) {
+		return;
+	}
+
+	sipc_timer_del(&(table->wheel), &(table->conns[fd].timer));
+}
+
+/*
+ * closes the connections which are still open, the listener itself is not
+ * in the table
+ */
+void sipc_idle_close_all(struct sipc_idle_table *table)
+{
+	int fd;
+
+	if (!table) {
+		return;
+	}
+
+	for (fd = 0; fd < FD_SETSIZE; fd++) {
+		if (!table->conns[fd].timer.slot) {
+			continue;
+		}
+		sipc_timer_del(&(table->wheel), &(table->conns[fd].timer));
+		close(fd);
+		if (table->set) {
+			FD_CLR(fd, table->set);
+		}
+		if (table->on_close) {
+			table->on_close(fd);
+		}
+	}
+}
+
+void sipc_idle_expire(struct sipc_idle_table *table)
+{
+	if (!table) {
+		return;
+	}
+
+	table->now = sipc_timer_now_ms();
+	sipc_timer_expire(&(table->wheel), table->now, idle_expired, table);
+}
+
+unsigned long long sipc_idle_timeout_ms(struct sipc_idle_table *table, unsigned long long max_ms)
+{
+	unsigned long long next;
+
+	if (!table) {
+		return max_ms;
+	}
+
+	next = sipc_timer_next_ms(&(table->wheel), table->now);
+
+	return next < max_ms ? next : max_ms;
+}
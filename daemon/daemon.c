@@ -1,38 +1,63 @@
 #include "sipc_common.h"
+#include "sipc_pool.h"
+#include "sipc_routing.h"
+#include "sipc_federation.h"
+#include "sipc_snapshot.h"
+#include "sipc_broadcast.h"
+#include "sipc_conflation.h"
+#include "sipc_datagram.h"
+#include "sipc_timer.h"
 
 #define VERSION		"00.04"
 
-struct port_list_entry {
-	unsigned int port;
-	TAILQ_ENTRY(port_list_entry) entries;
+struct client_stats {
+	unsigned long msgs_out;
+	unsigned long bytes_out;
+	unsigned long send_errors;
 };
 
-TAILQ_HEAD(port_list, port_list_entry);
-
-struct title_list_entry {
-	char *title;
-	struct port_list port_list;
-	TAILQ_ENTRY(title_list_entry) entries;
+/*
+ * an accepted connection, see struct sipc_conn_buffer
+ */
+struct daemon_conn {
+	struct sipc_conn_buffer in;
+	unsigned int confirm_port;		//given to a new client, it is reserved until the client echoes it
+	struct _packet held;			//registration of the new client, queued when its port is confirmed
 };
 
-TAILQ_HEAD(title_list, title_list_entry);
-
-struct orphan_list_entry {
-	char *title;
-	char *data;
-	struct port_list port_list;
-	TAILQ_ENTRY(orphan_list_entry) entries;
+struct daemon_stats {
+	time_t started;
+	unsigned long long instance;		//differs on every start, clients see a restart with it
+	unsigned long loops;
+	unsigned long packets_in;
+	unsigned long conflated;
+	unsigned long stats_requests;
+	unsigned long lookups;
+	unsigned long invalidations;
 };
 
-TAILQ_HEAD(orphan_list, orphan_list_entry);
-
 static struct title_list title_list;
-static struct orphan_list orphan_list;
+static struct title_list_entry *broadcast_title = NULL;	//title entries are never freed while sipcd runs
+static struct packet_lanes packet_lanes;
 static bool available_port_map[BACKLOG] = {0};
+static struct client_stats client_stats[BACKLOG];
+static struct daemon_stats daemon_stats;
+static struct sipc_idle_table idle_table;
+static struct daemon_conn conns[FD_SETSIZE];
+static unsigned int keepalive = 0;
+static int pinned_cpu = -1;
+static struct sipc_waiter waiter = { .mode = WAIT_BLOCK };
 
 static struct option parameters[] = {
 	{ "help",				no_argument,		0,	'h'	},
 	{ "version",			no_argument,		0,	'v'	},
+	{ "port",				required_argument,	0,	'p'	},
+	{ "peer",				required_argument,	0,	'P'	},
+	{ "snapshot",			required_argument,	0,	's'	},
+	{ "keepalive",			required_argument,	0,	'k'	},
+	{ "cpu",				required_argument,	0,	'c'	},
+	{ "busy-poll",			no_argument,		0,	'b'	},
+	{ "spin",				required_argument,	0,	'S'	},
 	{ NULL,					0,					0, 	0 	},
 };
 
@@ -44,681 +69,1019 @@ static void print_help_exit (char *arg)
 	printf("\n%s help:\n\n", arg);
 
 	printf("--version:\t('v')\n\t\treturns version\n\n");
+	printf("--port:\t\t('p')\n\t\tport to listen, default %d. clients find it with SIPC_DAEMON_PORT, their ports start after it\n\n", PORT);
+	printf("--peer:\t\t('P')\n\t\taddress:port of another sipcd to link, may be given up to %d times\n\n", FEDERATION_MAX_PEERS);
+	printf("--snapshot:\t('s')\n\t\tfile to keep the titles and the ports of the clients, a restarted sipcd goes on from it\n\n");
+	printf("--keepalive:\t('k')\n\t\tseconds of silence before the kernel probes the connections and the peer links, off by default\n\n");
+	printf("--cpu:\t\t('c')\n\t\tcpu to pin the loop of sipcd to, eg a core isolated for it\n\n");
+	printf("--busy-poll:\t('b')\n\t\tthe loop never sleeps, it keeps its core busy for the lowest latency\n\n");
+	printf("--spin:\t\t('S')\n\t\tmicroseconds to spin after every data before the loop sleeps, eg %d\n\n", WAIT_SPIN_US);
 
 	exit(OK);
 }
 
-static struct orphan_list_entry *find_entry_in_orphan_list(char *title, struct orphan_list *orphan_list)
+static int sipc_connect_port_daemon(unsigned int _port)
 {
-	struct orphan_list_entry *entry = NULL;
+	int fd = -1;
+	struct sockaddr_storage address;
 
-	if (!title || !orphan_list) {
-		errorf("args cannot be NULL\n");
-		return NULL;
+	memset((void *)&address, 0, sizeof(struct sockaddr_storage));
+
+	if (sipc_buf_to_sockstorage(IPV6_LOOPBACK_ADDR, _port, &address) == NOK) {
+		errorf("sipc_buf_to_sockstorage() failed\n");
+		return -1;
 	}
 
-	TAILQ_FOREACH(entry, orphan_list, entries) {
-		if (entry->title && strcmp(title, entry->title) == 0) {
-			return entry;
-		}
+	fd = sipc_socket_open_use_buf(IPV6_LOOPBACK_ADDR, SOCK_STREAM, 0);
+	if (fd == -1) {
+		errorf("socket() failed with %d: %s\n", errno, strerror(errno));
+		return -1;
+	}
+
+	if (sipc_connect_socket(fd, (struct sockaddr*)&address) < 0) {
+		errorf("connect() failed with %d: %s\n", errno, strerror(errno));
+		close(fd);
+		return -1;
 	}
 
-	return NULL;
+	return fd;
 }
 
-static struct title_list_entry *find_entry_in_title_list(char *title, struct title_list *title_list)
+/*
+ * data is sent as it is, it is neither copied nor decoded. so the compressed
+ * data is fanned out with its compressed size
+ */
+static void sipc_fill_packet_daemon(struct _packet *packet, char *title, enum _packet_type packet_type, unsigned char priority,
+	unsigned char flags, struct sipc_timestamps *timestamps, void *data, unsigned int len)
 {
-	struct title_list_entry *entry = NULL;
-
-	if (!title || !title_list) {
-		errorf("args cannot be NULL\n");
-		return NULL;
+	memset(packet, 0, sizeof(struct _packet));
+
+	packet->title = title;
+	packet->title_size = strlen(title) + 1;
+	packet->packet_type = (unsigned char)packet_type;
+	packet->priority = priority;
+	packet->flags = flags & ~PACKET_FLAG_PEER;
+	packet->payload_size = 0;
+
+	if (timestamps && (flags & PACKET_FLAG_TIMESTAMPS)) {
+		packet->timestamps = *timestamps;
+		packet->timestamps.daemon_forward = sipc_monotonic_ns();
+	} else {
+		packet->flags &= ~PACKET_FLAG_TIMESTAMPS;
 	}
+	packet->payload = NULL;
 
-	TAILQ_FOREACH(entry, title_list, entries) {
-		if (entry->title && strcmp(title, entry->title) == 0) {
-			return entry;
-		}
+	if (data && len) {
+		packet->payload = (char *)data;
+		packet->payload_size = len;
 	}
-
-	return NULL;
 }
 
-static bool is_port_int_the_list(unsigned int port, struct port_list *port_list)
+static int sipc_write_daemon(int fd, char *title, enum _packet_type packet_type, unsigned char priority, unsigned char flags,
+	struct sipc_timestamps *timestamps, void *data, unsigned int len)
 {
-	struct port_list_entry *entry = NULL;
+	struct _packet packet;
 
-	if (!port_list || port < STARTING_PORT || port > STARTING_PORT + BACKLOG) {
+	if (!title || fd < 0) {
 		errorf("args cannot be NULL\n");
-		return false;
+		return NOK;
 	}
 
-	TAILQ_FOREACH(entry, port_list, entries) {
-		if (entry->port == port) {
-			return true;
-		}
+	sipc_fill_packet_daemon(&packet, title, packet_type, priority, flags, timestamps, data, len);
+
+	if (sipc_write_packet(&packet, fd) == NOK) {
+		errorf("sipc_write_packet() failed with %d: %s\n", errno, strerror(errno));
+		return NOK;
 	}
 
-	return false;
+	return OK;
 }
 
-static int add_new_entry_to_the_port_list(unsigned int port, struct port_list *port_list)
+static int sipc_send_daemon(char *title, enum _packet_type packet_type, unsigned char priority, unsigned char flags,
+	struct sipc_timestamps *timestamps, void *data, unsigned int len, unsigned int _port)
 {
-	struct port_list_entry *entry = NULL;
+	int ret = OK;
+	int fd = -1;
 
-	if (!port_list || port < STARTING_PORT || port > STARTING_PORT + BACKLOG) {
-		errorf("args cannot be NULL\n");
+	if (!title) {
+		errorf("title cannot be NULL\n");
 		return NOK;
 	}
 
-	entry = (struct port_list_entry *)calloc(1, sizeof(struct port_list_entry));
-	if (!entry) {
-		errorf("data is null\n");
+	if ((fd = sipc_connect_port_daemon(_port)) < 0) {
 		return NOK;
 	}
 
-	entry->port = port;
+	if (data && len) {
+		debugf("send data with size '%u' to port '%d'\n", len, _port);
+	}
 
-	TAILQ_INSERT_HEAD(port_list, entry, entries);
+	ret = sipc_write_daemon(fd, title, packet_type, priority, flags, timestamps, data, len);
+	close(fd);
 
-	return OK;
+	return ret;
 }
 
-static int add_new_entry_to_title_list(char *title, unsigned int port, struct title_list *title_list)
+/*
+ * the data of the broadcast and of the conflated titles is packed once for all
+ * of its subscribers, see sipc_broadcast.h and sipc_conflation.h
+ */
+static int sipc_pack_data_daemon(char *title, enum _packet_type packet_type, unsigned char priority, unsigned char flags,
+	struct sipc_timestamps *timestamps, char *data, unsigned int len, char **buffer, size_t *size)
 {
-	struct title_list_entry *entry = NULL;
+	FILE *fp = NULL;
+	struct _packet packet;
 
-	if (!title || port < STARTING_PORT || port > STARTING_PORT + BACKLOG || !title_list) {
-		errorf("args cannot be NULL\n");
+	sipc_fill_packet_daemon(&packet, title, packet_type, priority, flags, timestamps, data, len);
+
+	if ((fp = open_memstream(buffer, size)) == NULL) {
+		errorf("open_memstream() failed with %d: %s\n", errno, strerror(errno));
 		return NOK;
 	}
 
-	entry = (struct title_list_entry *)calloc(1, sizeof(struct title_list_entry));
-	if (!entry) {
-		errorf("data is null\n");
+	if (sipc_pack_packet(&packet, fp) == NOK) {
+		errorf("sipc_pack_packet() failed\n");
+		FCLOSE(fp);
+		FREE(*buffer);
 		return NOK;
 	}
 
-	entry->title = calloc(strlen(title) + 1, sizeof(char));
-	if (!entry->title) {
-		errorf("calloc fail\n");
-		FREE(entry);
+	FCLOSE(fp);
+
+	return *buffer ? OK : NOK;
+}
+
+static int send_data_to_all_title(struct title_list_entry *entry, enum _packet_type packet_type, char *key, char *data,
+	unsigned int len, unsigned char priority, unsigned char flags, struct sipc_timestamps *timestamps)
+{
+	int ret;
+	bool broadcast = false;
+	bool conflate = false;
+	bool replaced = false;
+	char *buffer = NULL;
+	size_t size = 0;
+	struct port_list_entry *pentry = NULL;
+	struct client_stats *cstats = NULL;
+
+	if (!entry || !data) {
+		errorf("args cannot be NULL\n");
 		return NOK;
 	}
 
-	strncpy(entry->title, title, strlen(title));
-	TAILQ_INIT(&(entry->port_list));
+	if (entry == broadcast_title && !TAILQ_EMPTY(&(entry->port_list))) {
+		broadcast = sipc_pack_data_daemon(entry->title, packet_type, priority, flags, timestamps, data, len, &buffer,
+			&size) == OK;
+	} else if (entry->conflate && packet_type == SENDATA && !TAILQ_EMPTY(&(entry->port_list))) {
+		conflate = sipc_pack_data_daemon(entry->title, packet_type, priority, flags, timestamps, data, len, &buffer,
+			&size) == OK;
+	}
 
-	if (add_new_entry_to_the_port_list(port, &(entry->port_list)) == NOK) {
-		errorf("add_new_entry_to_the_port_list() failed\n");
-		FREE(entry->title);
-		FREE(entry);
-		return NOK;
+	TAILQ_FOREACH(pentry, &(entry->port_list), entries) {
+		cstats = IS_OWN_PORT(pentry->port) ? &(client_stats[pentry->port - STARTING_PORT]) : NULL;
+
+		if (broadcast && cstats) {
+			ret = broadcast_queue(pentry->port, buffer, size);
+		} else if (conflate && cstats && conflation_queue(pentry->port, entry->title, key, buffer, size, &replaced) == OK) {
+			//the older data of the key is never written, this one is counted in its place
+			if (replaced) {
+				daemon_stats.conflated++;
+				continue;
+			}
+			ret = OK;
+		} else {
+			ret = sipc_send_daemon(entry->title, packet_type, priority, flags, timestamps, (void *)data, len, pentry->port);
+		}
+
+		if (ret == NOK) {
+			errorf("sipc_send() failed\n");
+			if (cstats) {
+				cstats->send_errors++;
+			}
+			continue;
+		}
+
+		entry->stats.msgs_out++;
+		entry->stats.bytes_out += len;
+		if (cstats) {
+			cstats->msgs_out++;
+			cstats->bytes_out += len;
+		}
 	}
 
-	TAILQ_INSERT_HEAD(title_list, entry, entries);
+	FREE(buffer);
 
 	return OK;
 }
 
-static int add_port_title_couple(char *title, unsigned int port, struct title_list *title_list)
+static void client_data_lost(unsigned int port, unsigned int lost)
 {
-	struct title_list_entry *entry = NULL;
+	if (IS_OWN_PORT(port)) {
+		client_stats[port - STARTING_PORT].send_errors += lost;
+	}
+}
+
+/*
+ * the connection is opened with the first retained data and left open in
+ * *fd, so the retained data of many titles goes to a client in one batch
+ */
+static int send_retained_data_first(char *title, unsigned int port, struct title_list *title_list, int *fd)
+{
+	struct title_list_entry *tentry = NULL;
+	struct retained_list_entry *entry = NULL;
 
-	if (!title || port < STARTING_PORT || port > STARTING_PORT + BACKLOG || !title_list) {
+	if (!title || !port || !title_list || !fd) {
 		errorf("args cannot be NULL\n");
 		return NOK;
 	}
 
-	if ((entry = find_entry_in_title_list(title, title_list)) == NULL) {
-		debugf("add new entry to the title list\n");
-		return add_new_entry_to_title_list(title, port, title_list);
+	if ((tentry = find_entry_in_title_list(title, title_list)) == NULL) {
+		return OK;
 	}
 
-	if (is_port_int_the_list(port, &(entry->port_list)) == false) {
-		if (add_new_entry_to_the_port_list(port, &(entry->port_list)) == NOK) {
-			errorf("add_new_entry_to_the_port_list() failed\n");
-			return NOK;
+	TAILQ_FOREACH(entry, &(tentry->retained_list), entries) {
+		if ((*fd < 0 && (*fd = sipc_connect_port_daemon(port)) < 0) ||
+				sipc_write_daemon(*fd, title, SENDATA, PRIORITY_NORMAL, entry->flags, NULL, (void *)entry->data,
+				entry->data_size) == NOK) {
+			//the client may be gone already, it is a send error of that client, not of sipcd
+			errorf("sipc_send() failed\n");
+			if (IS_OWN_PORT(port)) {
+				client_stats[port - STARTING_PORT].send_errors++;
+			}
+			return OK;
 		}
-		debugf("port %d is registered for the title '%s'\n", port, title);
-	} else {
-		debugf("port %d is already registered for the title '%s'\n", port, title);
+		debugf("retained data send for the title '%s' to the port '%d'\n", title, port);
 	}
 
 	return OK;
 }
 
-static void port_data_structure_destroy(struct port_list *port_list)
+/*
+ * publishers which looked up the subscribers of the title send to them
+ * directly, they are told to look up again when the list is changed
+ */
+static void invalidate_title_watchers(struct title_list_entry *tentry)
 {
-	struct port_list_entry *entry1 = NULL;
-	struct port_list_entry *entry2 = NULL;
+	struct port_list_entry *pentry = NULL;
 
-	if (!port_list) {
+	if (!tentry) {
 		errorf("args cannot be NULL\n");
 		return;
 	}
 
-	if (TAILQ_EMPTY(port_list)) {
-		return;
-	}
-
-	entry1 = TAILQ_FIRST(port_list);
-	while (entry1 != NULL) {
-		entry2 = TAILQ_NEXT(entry1, entries);
-		FREE(entry1);
-		entry1 = entry2;
+	TAILQ_FOREACH(pentry, &(tentry->watcher_list), entries) {
+		debugf("subscribers of the title '%s' changed, invalidate port '%u'\n", tentry->title, pentry->port);
+		daemon_stats.invalidations++;
+		if (sipc_send_daemon(tentry->title, INVALIDATE, PRIORITY_HIGH, 0, NULL, NULL, 0, pentry->port) == NOK) {
+			errorf("sipc_send_daemon() failed for the port '%u'\n", pentry->port);
+		}
 	}
 
-	TAILQ_INIT(port_list); 
+	port_data_structure_destroy(&(tentry->watcher_list));
 }
 
-static int remove_port_from_orphan(char *title, unsigned int port, struct orphan_list *orphan_list)
+static void invalidate_port_watchers(unsigned int port, struct title_list *title_list)
 {
-	struct orphan_list_entry *entry = NULL;
+	struct title_list_entry *tentry = NULL;
 	struct port_list_entry *pentry = NULL;
 
-	if (!title || port < STARTING_PORT || port > STARTING_PORT + BACKLOG || !orphan_list) {
-		errorf("args cannot be NULL\n");
-		return NOK;
+	TAILQ_FOREACH(tentry, title_list, entries) {
+		TAILQ_FOREACH(pentry, &(tentry->port_list), entries) {
+			if (pentry->port == port) {
+				invalidate_title_watchers(tentry);
+				break;
+			}
+		}
 	}
+}
 
-	if ((entry = find_entry_in_orphan_list(title, orphan_list)) == NULL) {
-		return OK;
-	}
+/*
+ * every process subscribes to the broadcast title, so it is kept aside and
+ * its data does not walk the title list
+ */
+static struct title_list_entry *find_or_add_title_daemon(char *title, struct title_list *title_list)
+{
+	struct title_list_entry *tentry = NULL;
 
-	if (TAILQ_EMPTY(&(entry->port_list))) {
-		return OK;
+	if (broadcast_title && broadcast_is_title(title)) {
+		return broadcast_title;
 	}
 
-	TAILQ_FOREACH(pentry, &(entry->port_list), entries) {
-		if (pentry && port == pentry->port) {
-			TAILQ_REMOVE(&(entry->port_list), pentry, entries);
-			FREE(pentry);
-			break;
-		}
+	if ((tentry = find_entry_in_title_list(title, title_list)) == NULL &&
+			(tentry = add_empty_entry_to_title_list(title, title_list)) == NULL) {
+		errorf("add_empty_entry_to_title_list() failed\n");
+		return NULL;
 	}
 
-	if (entry && (&(entry->port_list)) && TAILQ_EMPTY(&(entry->port_list))) {
-		TAILQ_INIT(&(entry->port_list));
+	if (broadcast_is_title(title)) {
+		broadcast_title = tentry;
 	}
 
-	return OK;
+	return tentry;
 }
 
-static int remove_port_from_title(char *title, unsigned int port, struct title_list *title_list)
+static int register_port_daemon(char *title, unsigned int port, struct title_list *title_list, bool *available_ports,
+	int *fd)
 {
-	struct title_list_entry *entry = NULL;
-	struct port_list_entry *pentry = NULL;
-
-	if (!title || port < STARTING_PORT || port > STARTING_PORT + BACKLOG || !title_list) {
+	if (!title || !title_list || !available_ports || !fd) {
 		errorf("args cannot be NULL\n");
 		return NOK;
 	}
 
-	if ((entry = find_entry_in_title_list(title, title_list)) == NULL) {
-		return OK;
-	}
-
-	if (TAILQ_EMPTY(&(entry->port_list))) {
-		return OK;
+	debugf("try to add '%d' port for the title '%s'\n", port, title);
+	if (add_port_title_couple(title, port, title_list) == NOK) {
+		errorf("add_port_title_couple() failed\n");
+		return NOK;
 	}
-
-	TAILQ_FOREACH(pentry, &(entry->port_list), entries) {
-		if (pentry && port == pentry->port) {
-			TAILQ_REMOVE(&(entry->port_list), pentry, entries);
-			FREE(pentry);
-			break;
-		}
+	invalidate_title_watchers(find_entry_in_title_list(title, title_list));
+	debugf("title '%s' newly added, send retained data first\n", title);
+	if (send_retained_data_first(title, port, title_list, fd) == NOK) {
+		errorf("send_retained_data_first() failed\n");
+		return NOK;
 	}
-
-	if (entry && (&(entry->port_list)) && TAILQ_EMPTY(&(entry->port_list))) {
-		TAILQ_INIT(&(entry->port_list));
+	if (IS_OWN_PORT(port)) {
+		available_ports[port - STARTING_PORT] = true;
 	}
+	snapshot_register(title, port);
+	federation_mark_interest_dirty();
 
 	return OK;
 }
 
-static int remove_port_from_all_title(unsigned int port, struct title_list *title_list)
+static int sipc_packet_handler_daemon(struct _packet *packet, unsigned int port, struct title_list *title_list, bool *available_ports)
 {
-	struct title_list_entry *entry = NULL;
-	struct port_list_entry *pentry = NULL;
+	int ret = OK;
+	int fd = -1;
+	unsigned int lport = 0;
+	unsigned int offset = 0;
+	char *ptr = NULL;
+	struct sipc_direct_report report;
+	struct title_list_entry *tentry = NULL;
 
-	if (port < STARTING_PORT || port > STARTING_PORT + BACKLOG || !title_list) {
+	if (!packet) {
 		errorf("args cannot be NULL\n");
-		return NOK;
+		goto fail;
 	}
+	
+	debugf("incoming packet type '%s'\n", packet_type_beautiy((enum _packet_type)packet->packet_type));
 
-	if (TAILQ_EMPTY(title_list)) {
-		return OK;
-	}
+	switch (packet->packet_type) {
+		case REGISTER:
+			if (register_port_daemon(packet->title, port, title_list, available_ports, &fd) == NOK) {
+				errorf("register_port_daemon() failed\n");
+				goto fail;
+			}
+			break;
+		case REGISTER_BULK:
+			//payload is the null terminated titles of a client, their retained data goes in one connection
+			if (!packet->payload || !port) {
+				errorf("paload i null\n");
+				goto fail;
+			}
 
-	TAILQ_FOREACH(entry, title_list, entries) {
-		if (!entry || !(&(entry->port_list)) || TAILQ_EMPTY(&(entry->port_list))) {
+			while (offset < packet->payload_size) {
+				ptr = packet->payload + offset;
+				offset += strnlen(ptr, packet->payload_size - offset) + 1;
+				if (*ptr && offset <= packet->payload_size &&
+					register_port_daemon(ptr, port, title_list, available_ports, &fd) == NOK) {
+					errorf("register_port_daemon() failed for the title '%s'\n", ptr);
+				}
+			}
 			break;
-		}
-		TAILQ_FOREACH(pentry, &(entry->port_list), entries) {
-			if (!pentry) {
-				continue;
+		case UNREGISTER:
+			if (!packet->payload) {
+				errorf("paload i null\n");
+				goto fail;
 			}
-			if (port == pentry->port) {
-				TAILQ_REMOVE(&(entry->port_list), pentry, entries);
-				FREE(pentry);
+
+			lport = strtoul(packet->payload, &ptr, 10);
+			debugf("try to remove '%d' port for the title '%s'\n", lport, packet->title);
+
+			if (!lport || lport > 65535) {
+				debugf("port is incorrect, continue sliently\n");
 				break;
 			}
-		}
-		if (entry && (&(entry->port_list)) && TAILQ_EMPTY(&(entry->port_list))) {
-			TAILQ_INIT(&(entry->port_list));
-		}
+
+			if ((tentry = find_entry_in_title_list(packet->title, title_list)) != NULL) {
+				invalidate_title_watchers(tentry);
+			}
+			if (remove_port_from_title(packet->title, lport, title_list) == NOK) {
+				errorf("remove_port_from_title() failed\n");
+				goto fail;
+			}
+			if (broadcast_is_title(packet->title)) {
+				broadcast_forget(lport);
+			}
+			if (IS_OWN_PORT(lport)) {
+				available_ports[lport - STARTING_PORT] = false;
+			}
+			snapshot_unregister(packet->title, lport);
+			federation_mark_interest_dirty();
+			break;
+		case UNREGISTER_ALL:
+			if (!packet->payload) {
+				errorf("paload i null\n");
+				goto fail;
+			}
+
+			lport = strtoul(packet->payload, &ptr, 10);
+			debugf("remove '%d' port from all titles\n",  lport);
+
+			if (!lport || lport > 65535) {
+				debugf("port is incorrect, continue sliently\n");
+				break;
+			}
+
+			remove_watcher_from_all_title(lport, title_list);
+			invalidate_port_watchers(lport, title_list);
+			if (remove_port_from_all_title(lport, title_list) == NOK) {
+				errorf("remove_port_from_all_title() failed\n");
+				goto fail;
+			}
+			broadcast_forget(lport);
+			conflation_forget(lport);
+			if (IS_OWN_PORT(lport)) {
+				available_ports[lport - STARTING_PORT] = false;
+			}
+			snapshot_unregister_all(lport);
+			federation_mark_interest_dirty();
+			break;
+		case SENDATA:
+			if (!packet->payload) {
+				errorf("paload i null\n");
+				goto fail;
+			}
+
+			debugf("send data with size '%u' to title '%s'\n",  packet->payload_size, packet->title);
+			if ((tentry = find_or_add_title_daemon(packet->title, title_list)) == NULL) {
+				errorf("find_or_add_title_daemon() failed\n");
+				goto fail;
+			}
+			tentry->stats.msgs_in++;
+			tentry->stats.bytes_in += packet->payload_size;
+			if (send_data_to_all_title(tentry, SENDATA, packet->key, packet->payload, packet->payload_size, packet->priority,
+					packet->flags, &(packet->timestamps)) == NOK) {
+				errorf("send_data_to_all_title() failed\n");
+			}
+			federation_forward(tentry, packet);
+			if (retain_data(tentry, packet->key, packet->payload, packet->payload_size, packet->flags) == NOK) {
+				errorf("retain_data() failed\n");
+				goto fail;
+			}
+			break;
+		case STREAM:
+			if (!packet->payload) {
+				errorf("paload i null\n");
+				goto fail;
+			}
+
+			//chunks are forwarded one by one and never retained
+			if ((tentry = find_entry_in_title_list(packet->title, title_list)) == NULL) {
+				debugf("no one listens the stream of the title '%s', chunk dropped\n", packet->title);
+				break;
+			}
+			tentry->stats.msgs_in++;
+			tentry->stats.bytes_in += packet->payload_size;
+			if (send_data_to_all_title(tentry, STREAM, NULL, packet->payload, packet->payload_size, packet->priority,
+					packet->flags, &(packet->timestamps)) == NOK) {
+				errorf("send_data_to_all_title() failed\n");
+			}
+			federation_forward(tentry, packet);
+			break;
+		case DIRECT_REPORT:
+			if (!packet->payload || packet->payload_size <= sizeof(report)) {
+				errorf("invalid report of the title '%s'\n", packet->title);
+				goto fail;
+			}
+
+			//the data itself reached the subscribers directly, it is only counted and retained
+			memcpy(&report, packet->payload, sizeof(report));
+			if ((tentry = find_or_add_title_daemon(packet->title, title_list)) == NULL) {
+				errorf("find_or_add_title_daemon() failed\n");
+				goto fail;
+			}
+			tentry->stats.msgs_in += report.msgs;
+			tentry->stats.bytes_in += report.bytes;
+			if (retain_data(tentry, packet->key, packet->payload + sizeof(report), packet->payload_size - sizeof(report),
+					packet->flags) == NOK) {
+				errorf("retain_data() failed\n");
+				goto fail;
+			}
+			break;
+		case CONFLATE:
+			if (!packet->payload) {
+				errorf("paload i null\n");
+				goto fail;
+			}
+
+			if ((tentry = find_entry_in_title_list(packet->title, title_list)) != NULL) {
+				invalidate_title_watchers(tentry);
+			}
+			if (set_title_conflation(packet->title, strtoul(packet->payload, &ptr, 10) != 0, title_list) == NOK) {
+				errorf("set_title_conflation() failed\n");
+				goto fail;
+			}
+			snapshot_conflate(packet->title, strtoul(packet->payload, &ptr, 10) != 0);
+			break;
+		default:
+			break;
 	}
 
-	return OK;
+	goto out;
+
+fail:
+	ret = NOK;
+
+out:
+	if (fd >= 0) {
+		close(fd);
+	}
+
+	return ret;
 }
 
-static int sipc_send_packet_daemon(struct _packet *packet, int fd)
+/*
+ * conflated titles keep only the newest undelivered data per key in the lanes,
+ * the old one is replaced in place
+ */
+static int conflate_data_in_lanes(struct _packet *packet, struct title_list *title_list, struct packet_lanes *lanes)
 {
-	if (!packet || !packet->title || fd < 0) {
+	int i;
+	char *payload = NULL;
+	struct title_list_entry *tentry = NULL;
+	struct packet_queue_entry *entry = NULL;
+
+	if (!packet || !title_list || !lanes) {
 		errorf("args cannot be NULL\n");
 		return NOK;
 	}
 
-	errno = 0;
-	if (send(fd, &packet->packet_type, sizeof(packet->packet_type), MSG_NOSIGNAL) == -1) {
-		errorf("send() failed with %d: %s\n", errno, strerror(errno));
+	if (packet->packet_type != SENDATA || !packet->key || !packet->payload) {
 		return NOK;
 	}
 
-	errno = 0;
-	if (send(fd, &packet->title_size, sizeof(packet->title_size), MSG_NOSIGNAL) == -1) {
-		errorf("send() failed with %d: %s\n", errno, strerror(errno));
+	if ((tentry = find_entry_in_title_list(packet->title, title_list)) == NULL || !tentry->conflate) {
 		return NOK;
 	}
 
-	errno = 0;
-	if (packet->title_size && send(fd, packet->title, packet->title_size, MSG_NOSIGNAL) == -1) {
-		errorf("send() failed with %d: %s\n", errno, strerror(errno));
-		return NOK;
+	for (i = 0; i < PRIORITY_COUNT; i++) {
+		TAILQ_FOREACH(entry, &(lanes->lanes[i]), entries) {
+			if (entry->packet.packet_type == SENDATA && entry->packet.key &&
+					strcmp(packet->key, entry->packet.key) == 0 &&
+					strcmp(packet->title, entry->packet.title) == 0) {
+				payload = entry->packet.payload;
+				entry->packet.payload = packet->payload;
+				entry->packet.payload_size = packet->payload_size;
+				entry->packet.flags = packet->flags;
+				entry->packet.timestamps = packet->timestamps;
+				packet->payload = payload;
+				debugf("conflate queued data of the key '%s' for the title '%s'\n", packet->key, packet->title);
+				return OK;
+			}
+		}
 	}
 
-	errno = 0;
-	if (send(fd, &packet->payload_size, sizeof(packet->payload_size), MSG_NOSIGNAL) == -1) {
-		errorf("send() failed with %d: %s\n", errno, strerror(errno));
-		return NOK;
-	}
+	return NOK;
+}
 
-	errno = 0;
-	if (packet->payload_size && packet->payload && send(fd, packet->payload, packet->payload_size, MSG_NOSIGNAL) == -1) {
-		errorf("send() failed with %d: %s\n", errno, strerror(errno));
-		return NOK;
+static unsigned int count_retained_data(struct title_list_entry *tentry)
+{
+	unsigned int count = 0;
+	struct retained_list_entry *rentry = NULL;
+
+	TAILQ_FOREACH(rentry, &(tentry->retained_list), entries) {
+		count++;
 	}
 
-	return OK;
+	return count;
 }
 
-static int sipc_send_daemon(char *title, enum _packet_type packet_type, void *data, unsigned int len, unsigned int _port)
+/*
+ * packets waiting in the lanes are counted for every subscriber of their
+ * title, this is the queue depth of a client in sipcd
+ */
+static void count_pending_data(struct title_list *title_list, struct packet_lanes *lanes, unsigned int *pending)
 {
-	int ret = OK;
-	int fd = 0;
-	struct sockaddr_storage address;
-	struct _packet packet;
+	int i;
+	struct packet_queue_entry *entry = NULL;
+	struct title_list_entry *tentry = NULL;
+	struct port_list_entry *pentry = NULL;
 
-	if (!title) {
-		errorf("title cannot be NULL\n");
-		goto fail;
+	for (i = 0; i < PRIORITY_COUNT; i++) {
+		TAILQ_FOREACH(entry, &(lanes->lanes[i]), entries) {
+			if (entry->packet.packet_type != SENDATA && entry->packet.packet_type != STREAM) {
+				continue;
+			}
+			if ((tentry = find_entry_in_title_list(entry->packet.title, title_list)) == NULL) {
+				continue;
+			}
+			TAILQ_FOREACH(pentry, &(tentry->port_list), entries) {
+				if (IS_OWN_PORT(pentry->port)) {
+					pending[pentry->port - STARTING_PORT]++;
+				}
+			}
+		}
 	}
 
-	memset((void *)&address, 0, sizeof(struct sockaddr_in6));
-	memset(&packet, 0, sizeof(struct _packet));
+	for (i = 0; i < BACKLOG; i++) {
+		pending[i] += conflation_pending(i + STARTING_PORT);
+	}
+}
 
-	if (sipc_buf_to_sockstorage(IPV6_LOOPBACK_ADDR, _port, &address) == NOK) {
-		errorf("sipc_buf_to_sockstorage() failed\n");
+/*
+ * stats are sent as the payload of a STATS packet, one 'key=value' record per
+ * line. the name of a title is the last field since it may contain spaces
+ */
+static int sipc_send_stats_daemon(int sockfd, struct title_list *title_list, struct packet_lanes *lanes)
+{
+	int ret = OK;
+	unsigned int i;
+	unsigned int subscribers;
+	unsigned int watchers;
+	unsigned int pending[BACKLOG] = {0};
+	char *buffer = NULL;
+	size_t size = 0;
+	FILE *fp = NULL;
+	struct _packet packet;
+	struct sipc_pool_stats pstats;
+	struct title_list_entry *tentry = NULL;
+	struct port_list_entry *pentry = NULL;
+
+	if (sockfd < 0 || !title_list || !lanes) {
+		errorf("args cannot be NULL\n");
 		return NOK;
 	}
 
-	fd = sipc_socket_open_use_buf(IPV6_LOOPBACK_ADDR, SOCK_STREAM, 0);
-	if (fd == -1) {
-		errorf("socket() failed with %d: %s\n", errno, strerror(errno));
+	daemon_stats.stats_requests++;
+
+	if ((fp = open_memstream(&buffer, &size)) == NULL) {
+		errorf("open_memstream() failed with %d: %s\n", errno, strerror(errno));
 		return NOK;
 	}
 
-	if (sipc_connect_socket(fd, (struct sockaddr*)&address) < 0) {
-		errorf("connect() failed with %d: %s\n", errno, strerror(errno));
-		goto fail;
-	}
+	sipc_pool_get_stats(&pstats);
+	fprintf(fp, "daemon uptime=%ld loops=%lu packets_in=%lu conflated=%lu stats_requests=%lu lane_high=%u lane_normal=%u "
+		"lane_low=%u pool_allocs=%lu pool_frees=%lu pool_heap_allocs=%lu pool_arenas=%lu lookups=%lu invalidations=%lu\n",
+		(long)(time(NULL) - daemon_stats.started), daemon_stats.loops, daemon_stats.packets_in, daemon_stats.conflated,
+		daemon_stats.stats_requests, lanes->count[PRIORITY_HIGH], lanes->count[PRIORITY_NORMAL],
+		lanes->count[PRIORITY_LOW], pstats.allocs, pstats.frees, pstats.heap_allocs, pstats.arenas,
+		daemon_stats.lookups, daemon_stats.invalidations);
 
-	packet.title = strdup(title);
-	if (!packet.title) {
-		errorf("strdup failed\n");
-		goto fail;
+	TAILQ_FOREACH(tentry, title_list, entries) {
+		subscribers = 0;
+		TAILQ_FOREACH(pentry, &(tentry->port_list), entries) {
+			subscribers++;
+		}
+		watchers = 0;
+		TAILQ_FOREACH(pentry, &(tentry->watcher_list), entries) {
+			watchers++;
+		}
+		fprintf(fp, "title subscribers=%u retained=%u conflate=%d msgs_in=%lu msgs_out=%lu bytes_in=%lu bytes_out=%lu "
+			"watchers=%u name=%s\n",
+			subscribers, count_retained_data(tentry), tentry->conflate ? 1 : 0, tentry->stats.msgs_in, tentry->stats.msgs_out,
+			tentry->stats.bytes_in, tentry->stats.bytes_out, watchers,
+			strcmp(tentry->title, BROADCAST_UNIQUE_TITLE) ? tentry->title : "<broadcast>");
 	}
-	packet.title_size = strlen(title) + 1;
-	packet.packet_type = (unsigned char)packet_type;
-	packet.payload_size = 0;
-	packet.payload = NULL;
 
-	if (data && len) {
-		packet.payload = (void *)calloc(1, len + 1);
-		if (!packet.payload) {
-			errorf("calloc failed\n");
-			goto fail;
+	count_pending_data(title_list, lanes, pending);
+	for (i = 0; i < BACKLOG; i++) {
+		if (!available_port_map[i] && !client_stats[i].msgs_out && !client_stats[i].send_errors) {
+			continue;
 		}
-		strncpy(packet.payload, data, len);
-		packet.payload_size = len + 1;
-
-		debugf("send data '%s' to port '%d'\n", packet.payload, _port);
+		fprintf(fp, "client port=%u registered=%d pending=%u msgs_out=%lu bytes_out=%lu send_errors=%lu\n",
+			i + STARTING_PORT, available_port_map[i] ? 1 : 0, pending[i], client_stats[i].msgs_out,
+			client_stats[i].bytes_out, client_stats[i].send_errors);
 	}
 
-	if (sipc_send_packet_daemon(&packet, fd) == NOK) {
-		errorf("sipc_send_packet_daemon() failed with %d: %s\n", errno, strerror(errno));
-		goto fail;
-	}
+	federation_print_stats(fp, title_list);
+	broadcast_print_stats(fp);
+	conflation_print_stats(fp);
+	datagram_print_stats(fp);
 
-	goto out;
+	FCLOSE(fp);
+	if (!buffer) {
+		errorf("stats buffer is NULL\n");
+		return NOK;
+	}
 
-fail:
-	ret = NOK;
+	memset(&packet, 0, sizeof(struct _packet));
+	packet.packet_type = STATS;
+	packet.priority = PRIORITY_NORMAL;
+	packet.title = DUMMY_STRING;
+	packet.title_size = strlen(DUMMY_STRING) + 1;
+	packet.payload = buffer;
+	packet.payload_size = size + 1;
 
-out:
-	if (fd) {
-		close(fd);
+	if (sipc_write_packet(&packet, sockfd) == NOK) {
+		errorf("sipc_write_packet() failed with %d: %s\n", errno, strerror(errno));
+		ret = NOK;
 	}
-	FREE(packet.title);
-	FREE(packet.payload);
+
+	FREE(buffer);
 
 	return ret;
 }
 
-static int send_data_to_all_title(char *title, char *data, struct title_list *title_list)
+/*
+ * the reply carries the instance of sipcd, a client registers everything
+ * again when it changes
+ */
+static int sipc_send_ping_reply_daemon(int sockfd)
 {
-	struct title_list_entry *entry = NULL;
-	struct port_list_entry *pentry = NULL;
-
-	if (!title || !title_list || !data) {
-		errorf("args cannot be NULL\n");
-		return NOK;
-	}
+	char buffer[32];
+	struct _packet packet;
 
-	if ((entry = find_entry_in_title_list(title, title_list)) == NULL) {
-		return NOK;
-	}
+	snprintf(buffer, sizeof(buffer), "%llu", daemon_stats.instance);
 
-	TAILQ_FOREACH(pentry, &(entry->port_list), entries) {
-		if (sipc_send_daemon(title, SENDATA, (void *)data, strlen(data), pentry->port) == NOK) {
-			errorf("sipc_send() failed\n");
-		}
+	memset(&packet, 0, sizeof(struct _packet));
+	packet.packet_type = PING;
+	packet.priority = PRIORITY_NORMAL;
+	packet.title = DUMMY_STRING;
+	packet.title_size = strlen(DUMMY_STRING) + 1;
+	packet.payload = buffer;
+	packet.payload_size = strlen(buffer) + 1;
+
+	if (sipc_write_packet(&packet, sockfd) == NOK) {
+		errorf("sipc_write_packet() failed with %d: %s\n", errno, strerror(errno));
+		return NOK;
 	}
 
 	return OK;
 }
 
-static int add_data_to_orphan_list(char *title, char *data, struct orphan_list *orphan_list)
+/*
+ * the reply is "1 port port ..." when the publisher may send to the
+ * subscribers of the title by itself, or "0" when the data has to pass through
+ * sipcd. conflated titles and titles wanted by peers stay on sipcd, and so do
+ * publishers without a port since they could not hear about a change. the
+ * publisher is kept as a watcher of the title and gets INVALIDATE with the next
+ * change of its subscribers. the publisher reports the last data which it sent
+ * directly, see DIRECT_REPORT, so the retained data stays
+ */
+static int sipc_send_lookup_reply_daemon(int sockfd, struct _packet *lookup, unsigned int port,
+	struct title_list *title_list)
 {
 	int ret = OK;
-	struct orphan_list_entry *entry = NULL;
+	bool direct = false;
+	char *buffer = NULL;
+	size_t size = 0;
+	FILE *fp = NULL;
+	struct _packet packet;
+	struct title_list_entry *tentry = NULL;
+	struct port_list_entry *pentry = NULL;
 
-	if (!orphan_list || !title || !data) {
+	if (sockfd < 0 || !lookup || !title_list) {
 		errorf("args cannot be NULL\n");
 		return NOK;
 	}
 
-	entry = (struct orphan_list_entry *)calloc(1, sizeof(struct orphan_list_entry));
-	if (!entry) {
-		errorf("data is null\n");
+	daemon_stats.lookups++;
+
+	if ((tentry = find_entry_in_title_list(lookup->title, title_list)) == NULL &&
+			(tentry = add_empty_entry_to_title_list(lookup->title, title_list)) == NULL) {
+		errorf("add_empty_entry_to_title_list() failed\n");
 		return NOK;
 	}
 
-	entry->data = strdup(data);
-	if (!entry->data) {
-		goto fail;
+	if (port && !tentry->conflate && !tentry->peer_mask && !TAILQ_EMPTY(&(tentry->port_list))) {
+		direct = true;
 	}
 
-	entry->title = strdup(title);
-	if (!entry->title) {
-		errorf("strdup failed\n");
-		goto fail;
+	if (port && !is_port_int_the_list(port, &(tentry->watcher_list)) &&
+			add_new_entry_to_the_port_list(port, &(tentry->watcher_list)) == NOK) {
+		errorf("add_new_entry_to_the_port_list() failed\n");
+		return NOK;
 	}
 
-	TAILQ_INIT(&(entry->port_list));
+	if ((fp = open_memstream(&buffer, &size)) == NULL) {
+		errorf("open_memstream() failed with %d: %s\n", errno, strerror(errno));
+		return NOK;
+	}
 
-	TAILQ_INSERT_HEAD(orphan_list, entry, entries);
+	fprintf(fp, "%d", direct ? 1 : 0);
+	if (direct) {
+		TAILQ_FOREACH(pentry, &(tentry->port_list), entries) {
+			fprintf(fp, " %u", pentry->port);
+		}
+	}
 
-	goto success;
+	FCLOSE(fp);
+	if (!buffer) {
+		errorf("lookup buffer is NULL\n");
+		return NOK;
+	}
 
-fail:
-	ret = NOK;
+	debugf("lookup of the title '%s' by the port '%u': %s\n", lookup->title, port, buffer);
+
+	memset(&packet, 0, sizeof(struct _packet));
+	packet.packet_type = LOOKUP;
+	packet.priority = PRIORITY_NORMAL;
+	packet.title = lookup->title;
+	packet.title_size = lookup->title_size;
+	packet.payload = buffer;
+	packet.payload_size = size + 1;
 
-	FREE(entry->data);
-	FREE(entry->title);
-	FREE(entry);
+	if (sipc_write_packet(&packet, sockfd) == NOK) {
+		errorf("sipc_write_packet() failed with %d: %s\n", errno, strerror(errno));
+		ret = NOK;
+	}
 
-success:
+	FREE(buffer);
 
 	return ret;
 }
 
-static int send_orphan_data_first(char *title, unsigned int port, struct orphan_list *orphan_list)
+/*
+ * the packet is moved into the lanes or conflated with a waiting one, the
+ * caller frees what is left
+ */
+static int sipc_queue_packet_daemon(struct _packet *packet, unsigned int port, struct title_list *title_list,
+	struct packet_lanes *lanes)
 {
-	bool should_send = true;
-	struct orphan_list_entry *entry = NULL;
-	struct port_list_entry *pentry = NULL;
-
-	if (!title || port < STARTING_PORT || port > STARTING_PORT + BACKLOG || !orphan_list) {
-		errorf("args cannot be NULL\n");
-		return NOK;
+	if (conflate_data_in_lanes(packet, title_list, lanes) == OK) {
+		daemon_stats.conflated++;
+		return OK;
 	}
 
-	TAILQ_FOREACH(entry, orphan_list, entries) {
-		if (entry->title && strcmp(title, entry->title) == 0) {
-			if (entry->data) {
-				should_send = true;
-				TAILQ_FOREACH(pentry, &(entry->port_list), entries) {
-					if (should_send && pentry && port == pentry->port) {
-						should_send = false;
-					}
-					debugf("port %d is '%d'\n", i++, pentry->port);
-				}
-				if (should_send) {
-					if (sipc_send_daemon(title, SENDATA, (void *)entry->data, strlen(entry->data), port) == NOK) {
-						errorf("sipc_send() failed\n");
-						return NOK;
-					}
-					debugf("orphan data '%s' send for the title '%s' to the port '%d'\n", entry->data, entry->title, port);
-					if (add_new_entry_to_the_port_list(port, &(entry->port_list)) == NOK) {
-						errorf("add_new_entry_to_the_port_list() failed\n");
-						return NOK;
-					}
-				}
-			}
-		}
+	if (sipc_lanes_push(lanes, packet, port) == NOK) {
+		errorf("sipc_lanes_push() failed\n");
+		return NOK;
 	}
 
 	return OK;
 }
 
-static int sipc_packet_handler_daemon(struct _packet *packet, unsigned int port, struct title_list *title_list, struct orphan_list *orphan_list, bool *available_ports)
+/*
+ * a datagram is sent to the local subscribers and to the peers at once
+ */
+static struct title_list_entry *sipc_route_datagram_daemon(struct _packet *packet, struct title_list *title_list)
 {
-	int ret = OK;
-	unsigned int lport = 0;
-	char *ptr = NULL;
-
-	if (!packet) {
-		errorf("args cannot be NULL\n");
-		goto fail;
-	}
-	
-	debugf("incoming packet type '%s'\n", packet_type_beautiy((enum _packet_type)packet->packet_type));
+	struct title_list_entry *tentry = NULL;
 
-	switch (packet->packet_type) {
-		case REGISTER:
-			debugf("try to add '%d' port for the title '%s'\n", port, packet->title);
-			if (add_port_title_couple(packet->title, port, title_list) == NOK) {
-				errorf("add_port_title_couple() failed\n");
-				goto fail;
-			}
-			debugf("title '%s' newly added, send orphan data first\n",  packet->title);
-			if (send_orphan_data_first(packet->title, port, orphan_list) == NOK) {
-				errorf("send_orphan_data_first() failed\n");
-				goto fail;
-			}
-			available_ports[port - STARTING_PORT] = true;
-			break;
-		case UNREGISTER:
-			if (!packet->payload) {
-				errorf("paload i null\n");
-				goto fail;
-			}
+	daemon_stats.packets_in++;
 
-			lport = strtoul(packet->payload, &ptr, 10);
-			debugf("try to remove '%d' port for the title '%s'\n", lport, packet->title);
+	if ((tentry = find_or_add_title_daemon(packet->title, title_list)) == NULL) {
+		errorf("find_or_add_title_daemon() failed\n");
+		return NULL;
+	}
 
-			if (!lport || lport < STARTING_PORT || lport > STARTING_PORT + BACKLOG) {
-				debugf("port is incorrect, continue sliently\n");
-				break;
-			}
+	tentry->stats.msgs_in++;
+	tentry->stats.bytes_in += packet->payload_size;
+	federation_forward(tentry, packet);
 
-			if (remove_port_from_title(packet->title, lport, title_list) == NOK) {
-				errorf("remove_port_from_title() failed\n");
-				goto fail;
-			}
-			available_ports[lport - STARTING_PORT] = false;
+	return tentry;
+}
 
-			if (remove_port_from_orphan(packet->title, lport, orphan_list) == NOK) {
-				errorf("remove_port_from_orphan() failed\n");
-				goto fail;
-			}
-			break;
-		case UNREGISTER_ALL:
-			if (!packet->payload) {
-				errorf("paload i null\n");
-				goto fail;
-			}
+static int sipc_queue_peer_packet_daemon(struct _packet *packet, struct title_list *title_list, struct packet_lanes *lanes)
+{
+	daemon_stats.packets_in++;
 
-			lport = strtoul(packet->payload, &ptr, 10);
-			debugf("remove '%d' port from all titles\n",  lport);
+	return sipc_queue_packet_daemon(packet, 0, title_list, lanes);
+}
 
-			if (!lport || lport < STARTING_PORT || lport > STARTING_PORT + BACKLOG) {
-				debugf("port is incorrect, continue sliently\n");
-				break;
-			}
+/*
+ * a port which the client did not confirm is given to the next client
+ */
+static void sipc_conn_reset_daemon(int fd)
+{
+	struct daemon_conn *conn = NULL;
 
-			if (remove_port_from_all_title(lport, title_list) == NOK) {
-				errorf("remove_port_from_all_title() failed\n");
-				goto fail;
-			}
-			available_ports[lport - STARTING_PORT] = false;
-			break;
-		case SENDATA:
-			debugf("send data '%s' to title '%s'\n",  packet->payload, packet->title);
-			if (send_data_to_all_title(packet->title, packet->payload, title_list) == NOK) {
-				debugf("send_data_to_all_title() failed\n");
-				if (add_data_to_orphan_list(packet->title, packet->payload, orphan_list) == NOK) {
-					errorf("add_data_to_orphan() failed\n");
-					goto fail;
-				} else {
-					debugf("data added to the orphan list\n");
-				}
-			}
-			break;
-		default:
-			break;
+	if (fd < 0 || fd >= FD_SETSIZE) {
+		return;
 	}
 
-	goto out;
-
-fail:
-	ret = NOK;
+	conn = &(conns[fd]);
+	if (conn->confirm_port) {
+		available_port_map[conn->confirm_port - STARTING_PORT] = false;
+		snapshot_unregister_all(conn->confirm_port);
+		conn->confirm_port = 0;
+	}
+	sipc_free_packet(&(conn->held));
 
-out:
-	return ret;
+	sipc_conn_free(&(conn->in));
 }
 
-static unsigned int next_available_port(bool *available_ports)
+/*
+ * the client listens on the new port before it echoes the port back, so the
+ * retained data of its first titles can be sent once the echo is here. a
+ * wrong echo drops the connection and the registration with it
+ */
+static int sipc_conn_confirm_daemon(int sockfd, struct daemon_conn *conn, struct title_list *title_list,
+	struct packet_lanes *lanes, bool *eof)
 {
-	unsigned int i = 0;
+	unsigned int ready = 0;
 
-	if (!available_ports) {
-		return 0;
+	if (sipc_conn_recv(sockfd, &(conn->in), sizeof(ready), eof) == NOK) {
+		return NOK;
 	}
 
-	for (i = 0; i < BACKLOG; i++) {
-		if (available_ports[i] == false) {
-			return i + STARTING_PORT;
-		}
+	if (*eof || conn->in.used < sizeof(ready)) {
+		return OK;
+	}
+
+	memcpy(&ready, conn->in.buffer, sizeof(ready));
+	conn->in.used = 0;
+
+	if (ready != conn->confirm_port) {
+		errorf("port '%u' is not confirmed by the client, it sent '%u'\n", conn->confirm_port, ready);
+		return NOK;
+	}
+
+	if (sipc_queue_packet_daemon(&(conn->held), conn->confirm_port, title_list, lanes) == NOK) {
+		errorf("sipc_queue_packet_daemon() failed\n");
+		return NOK;
 	}
+	conn->confirm_port = 0;
+	sipc_free_packet(&(conn->held));
 
-	return 0;
+	return OK;
 }
 
-static int sipc_read_data_daemon(int sockfd, struct title_list *title_list, struct orphan_list *orphan_list, bool *available_ports)
+/*
+ * one packet and the port of its sender are taken at a time, the connection
+ * stays open for the next one until *eof is set
+ */
+static int sipc_read_data_daemon(int sockfd, struct title_list *title_list, bool *available_ports, struct packet_lanes *lanes,
+	bool *eof)
 {
 	int ret = OK;
 	int byte_write;
-	struct _packet packet;
+	size_t packet_size = 0;
+	struct _packet packet, wire;
+	struct daemon_conn *conn = NULL;
 	unsigned int old_port = 0;
 	unsigned int next_port = 0;
 
-	if (!title_list || !orphan_list || !available_ports || sockfd < 0) {
+	memset(&packet, 0, sizeof(struct _packet));
+
+	if (!title_list || !available_ports || !lanes || !eof || sockfd < 0 || sockfd >= FD_SETSIZE) {
 		errorf("args cannot be NULL\n");
 		goto fail;
 	}
 
-	memset(&packet, 0, sizeof(struct _packet));
+	conn = &(conns[sockfd]);
 
-	errno = 0;
-	if (recv(sockfd, &packet.packet_type, sizeof(packet.packet_type), 0) < 0) {
-		errorf("recv error from socket %d, errno: %d\n", sockfd, errno);
-		goto fail;
+	if (conn->confirm_port) {
+		if (sipc_conn_confirm_daemon(sockfd, conn, title_list, lanes, eof) == NOK) {
+			goto fail;
+		}
+		goto out;
 	}
 
 	errno = 0;
-	if (recv(sockfd, &packet.title_size, sizeof(packet.title_size), 0) < 0) {
+	//the port of the sender follows every packet
+	if (sipc_conn_fill(sockfd, &(conn->in), sizeof(old_port), &packet_size, eof) == NOK) {
 		errorf("recv error from socket %d, errno: %d\n", sockfd, errno);
 		goto fail;
 	}
 
-	if (!packet.title_size) {
-		errorf("packet title size should be greater than zero\n");
+	if (!packet_size) {
 		goto out;
 	}
-	packet.title = (char *)calloc(packet.title_size, sizeof(char));
-	if (!packet.title) {
-		errorf("calloc failed\n");
-		goto fail;
-	}
-	errno = 0;
-	if (recv(sockfd, packet.title, packet.title_size, 0) < 0) {
-		errorf("recv error from socket %d, errno: %d\n", sockfd, errno);
+
+	if (sipc_unpack_packet(conn->in.buffer, packet_size, &wire) == NOK || sipc_copy_packet(&wire, &packet) == NOK) {
+		errorf("invalid packet from socket %d\n", sockfd);
 		goto fail;
 	}
+	memcpy(&old_port, conn->in.buffer + packet_size, sizeof(old_port));
+	sipc_conn_next(&(conn->in));
 
-	errno = 0;
-	if (recv(sockfd, &packet.payload_size, sizeof(packet.payload_size), 0) < 0) {
-		errorf("recv error from socket %d, errno: %d\n", sockfd, errno);
-		goto fail;
+	if (packet.flags & PACKET_FLAG_TIMESTAMPS) {
+		packet.timestamps.daemon_receive = sipc_monotonic_ns();
 	}
 
-	if (!packet.payload_size) {
-		goto proceed;
+	daemon_stats.packets_in++;
+
+	//stats are answered at once on the same connection, they never wait in the lanes
+	if (packet.packet_type == STATS) {
+		if (sipc_send_stats_daemon(sockfd, title_list, lanes) == NOK) {
+			errorf("sipc_send_stats_daemon() failed\n");
+		}
+		goto out;
 	}
 
-	packet.payload = (char *)calloc(packet.payload_size + 1, sizeof(char));
-	if (!packet.payload) {
-		errorf("calloc failed\n");
-		goto fail;
+	if (packet.packet_type == PING) {
+		if (sipc_send_ping_reply_daemon(sockfd) == NOK) {
+			errorf("sipc_send_ping_reply_daemon() failed\n");
+		}
+		goto out;
 	}
-	errno = 0;
-	if (recv(sockfd, packet.payload, packet.payload_size, 0) < 0) {
-		errorf("recv error from socket %d, errno: %d\n", sockfd, errno);
-		goto fail;
+
+	if (packet.packet_type == LOOKUP) {
+		if (sipc_send_lookup_reply_daemon(sockfd, &packet, old_port, title_list) == NOK) {
+			errorf("sipc_send_lookup_reply_daemon() failed\n");
+		}
+		goto out;
 	}
 
-proceed:
-	errno = 0;
-	if (recv(sockfd, &old_port, sizeof(old_port), 0) < 0) {
-		errorf("recv error from socket %d, errno: %d\n", sockfd, errno);
-		goto fail;
+	//the connection stays open as a peer link
+	if (packet.packet_type == PEER_HELLO) {
+		if (federation_accept_link(sockfd, title_list) == NOK) {
+			errorf("federation_accept_link() failed\n");
+		}
+		goto out;
 	}
 
-	if (!old_port && packet.packet_type == REGISTER) {
+	if (!old_port && (packet.packet_type == REGISTER || packet.packet_type == REGISTER_BULK)) {
 		next_port = next_available_port(available_ports);
 		byte_write = send(sockfd, &next_port, sizeof(next_port), MSG_NOSIGNAL);
 		if (byte_write != sizeof(next_port)) {
@@ -726,12 +1089,19 @@ proceed:
 			goto fail;
 		}
 		old_port = next_port;
-
-		sleep(5); //give time to caller to create server thread
+		if (next_port) {
+			//reserve it now, the packet waits on the connection until the port is confirmed
+			available_ports[next_port - STARTING_PORT] = true;
+			snapshot_reserve_port(next_port);
+			conn->confirm_port = next_port;
+			memcpy(&(conn->held), &packet, sizeof(struct _packet));
+			memset(&packet, 0, sizeof(struct _packet));
+			goto out;
+		}
 	}
 
-	if (sipc_packet_handler_daemon(&packet, old_port, title_list, orphan_list, available_ports) == NOK) {
-		errorf("sipc_packet_handler() failed\n");
+	if (sipc_queue_packet_daemon(&packet, old_port, title_list, lanes) == NOK) {
+		errorf("sipc_queue_packet_daemon() failed\n");
 		goto fail;
 	}
 
@@ -741,66 +1111,82 @@ fail:
 	ret = NOK;
 
 out:
-	FREE(packet.title);
-	FREE(packet.payload);
+	sipc_free_packet(&packet);
 
 	return ret;
 }
 
-static void dump_title_list(struct title_list *title_list)
+/*
+ * high priority lane is always drained completely, the others are served
+ * up to LANE_DRAIN_BUDGET packets to look for new high priority packets
+ */
+static int sipc_drain_lanes_daemon(struct packet_lanes *lanes, struct title_list *title_list, bool *available_ports)
 {
-	struct title_list_entry *entry = NULL;
-	struct port_list_entry *pentry = NULL;
+	int ret = OK;
+	unsigned int budget = LANE_DRAIN_BUDGET;
+	struct packet_queue_entry *entry = NULL;
 
-	if (!title_list) {
+	if (!lanes || !title_list || !available_ports) {
 		errorf("args cannot be NULL\n");
-		return;
+		return NOK;
 	}
 
-	debugf("dump title list\n");
-	TAILQ_FOREACH(entry, title_list, entries) {
-		if (entry && entry->title) {
-			debugf("\tdump title: %s\n", entry->title);
+	while (budget && (entry = sipc_lanes_pop(lanes)) != NULL) {
+		if (entry->packet.priority != PRIORITY_HIGH) {
+			budget--;
 		}
-		TAILQ_FOREACH(pentry, &(entry->port_list), entries) {
-			if (pentry) {
-				debugf("\t\tdump port: %d\n", pentry->port);
-			}
+
+		if (sipc_packet_handler_daemon(&(entry->packet), entry->port, title_list, available_ports) == NOK) {
+			errorf("sipc_packet_handler() failed\n");
+			ret = NOK;
+		}
+
+		sipc_lanes_free_entry(entry);
+
+		if (ret == NOK) {
+			break;
 		}
 	}
+
+	return ret;
 }
 
-static void dump_orphan_list(struct orphan_list *orphan_list)
+static void dump_title_list(struct title_list *title_list)
 {
-	struct orphan_list_entry *entry = NULL;
+	struct title_list_entry *entry = NULL;
 	struct port_list_entry *pentry = NULL;
+	struct retained_list_entry *rentry = NULL;
 
-	if (!orphan_list) {
+	if (!title_list) {
 		errorf("args cannot be NULL\n");
 		return;
 	}
 
-	debugf("dump orphan list\n");
-	TAILQ_FOREACH(entry, orphan_list, entries) {
+	debugf("dump title list\n");
+	TAILQ_FOREACH(entry, title_list, entries) {
 		if (entry && entry->title) {
 			debugf("\tdump title: %s\n", entry->title);
 		}
-		if (entry && entry->data) {
-			debugf("\tdump data: %s\n", entry->data);
-		}
 		TAILQ_FOREACH(pentry, &(entry->port_list), entries) {
 			if (pentry) {
 				debugf("\t\tdump port: %d\n", pentry->port);
 			}
 		}
+		TAILQ_FOREACH(rentry, &(entry->retained_list), entries) {
+			if (rentry && rentry->data) {
+				debugf("\t\tdump retained data: %s\n", rentry->data);
+			}
+		}
 	}
 }
 
-static int sipc_create_server_daemon(struct title_list *title_list, struct orphan_list *orphan_list, bool *available_ports)
+static int sipc_create_server_daemon(struct title_list *title_list, bool *available_ports, struct packet_lanes *lanes)
 {
 	int ret = OK;
 	int enable = 1;
-	int listen_fd, conn_fd, max_fd = 1, ret_val, i;
+	int listen_fd = -1, datagram_fd = -1, conn_fd, max_fd = 1, select_fd, ret_val, i;
+	bool eof = false;
+	unsigned long long timeout_ms;
 	struct sockaddr_storage client_addr, server_addr;
 	char c_ip_addr[INET6_ADDRSTRLEN] = {0};
 	fd_set backup_set, client_set;
@@ -810,7 +1196,7 @@ static int sipc_create_server_daemon(struct title_list *title_list, struct orpha
 	memset(&server_addr, 0, sizeof(server_addr));
 	memset(&client_addr, 0, sizeof(client_addr));
 
-	if (sipc_fill_wildcard_sockstorage(PORT, AF_UNSPEC, &server_addr) != 0) {
+	if (sipc_fill_wildcard_sockstorage(sipc_daemon_port(), AF_UNSPEC, &server_addr) != 0) {
 		errorf("sipc_fill_wildcard_sockstorage() failed\n");
 		goto fail;
 	}
@@ -835,35 +1221,64 @@ static int sipc_create_server_daemon(struct title_list *title_list, struct orpha
 		goto fail;
 	}
 
+	if ((datagram_fd = datagram_open(sipc_daemon_port())) < 0) {
+		errorf("datagram_open() failed\n");
+		goto fail;
+	}
+	if (waiter.mode != WAIT_BLOCK) {
+		(void) sipc_socket_busy_poll(datagram_fd, WAIT_BUSY_POLL_US);
+	}
+
 	FD_ZERO(&backup_set);
-	max_fd = listen_fd;
+	max_fd = listen_fd > datagram_fd ? listen_fd : datagram_fd;
 	FD_SET(listen_fd, &backup_set);
-	tv.tv_usec = 0;
+	FD_SET(datagram_fd, &backup_set);
+	sipc_idle_init(&idle_table, IDLE_TIMEOUT_MS, &backup_set);
+	sipc_idle_on_close(&idle_table, sipc_conn_reset_daemon);
 
 	for (;;) {
-		tv.tv_sec = RECEIVE_TIMEOUT;
+		daemon_stats.loops++;
+		federation_connect_peers(title_list);
+		federation_sync_interest(title_list);
+		federation_flush(title_list);
+		broadcast_flush(sipc_connect_port_daemon, client_data_lost);
+		conflation_flush(sipc_connect_port_daemon, client_data_lost);
+		sipc_idle_expire(&idle_table);
+
+		timeout_ms = lanes->depth ? 0 : (federation_has_down_peers() ? FEDERATION_RETRY_INTERVAL : RECEIVE_TIMEOUT) * 1000ULL;
+		timeout_ms = sipc_idle_timeout_ms(&idle_table, timeout_ms);
+		if (broadcast_has_pending() && timeout_ms > BROADCAST_RETRY_MS) {
+			timeout_ms = BROADCAST_RETRY_MS;
+		}
+		if (conflation_has_pending() && timeout_ms > CONFLATION_RETRY_MS) {
+			timeout_ms = CONFLATION_RETRY_MS;
+		}
+		tv.tv_sec = timeout_ms / 1000;
+		tv.tv_usec = (timeout_ms % 1000) * 1000;
 		memcpy(&client_set, &backup_set, sizeof(backup_set));
+		select_fd = federation_fill_fd_set(&client_set, max_fd);
 
-		ret_val = select(max_fd + 1, &client_set, NULL, NULL, &tv);
+		ret_val = sipc_wait_select(&waiter, select_fd + 1, &client_set, &tv);
 
 		if (ret_val < 0) {
 			errorf("select error\n");
 			continue;
+		} else if (ret_val == 0 && lanes->depth) {
+			if (sipc_drain_lanes_daemon(lanes, title_list, available_ports) == NOK) {
+				errorf("sipc_drain_lanes_daemon() failed\n");
+				goto fail;
+			}
+			continue;
 		} else if (ret_val == 0) {
-			//dump title and orphan list
+			//dump title list
 			dump_title_list(title_list);
-			dump_orphan_list(orphan_list);
-
-			for (i = 0; i <= max_fd; i++) {
-				if (FD_ISSET(i, &backup_set) && i != listen_fd) {
-						close(i);
-						FD_CLR(i, &backup_set);
-				}
-			}
-			max_fd = listen_fd;
 			continue;
 		}
 
+		if (FD_ISSET(datagram_fd, &client_set)) {
+			datagram_read(title_list, sipc_route_datagram_daemon);
+		}
+
 		if (FD_ISSET(listen_fd, &client_set)) {
 			conn_fd = sipc_socket_accept(listen_fd, &client_addr);
 			if (conn_fd < 0) {
@@ -875,23 +1290,57 @@ static int sipc_create_server_daemon(struct title_list *title_list, struct orpha
 				goto fail;
 			}
 
+			if (conn_fd >= FD_SETSIZE) {
+				errorf("too many connections, %d is refused\n", conn_fd);
+				close(conn_fd);
+				continue;
+			}
+			if (keepalive) {
+				(void) sipc_socket_keepalive(conn_fd, keepalive);
+			}
+			if (waiter.mode != WAIT_BLOCK) {
+				(void) sipc_socket_busy_poll(conn_fd, WAIT_BUSY_POLL_US);
+			}
+
+			sipc_conn_reset_daemon(conn_fd);
 			FD_SET(conn_fd, &backup_set);
+			sipc_idle_add(&idle_table, conn_fd);
 			if (conn_fd > max_fd) {
 				max_fd = conn_fd;
 			}
 			continue;
 		}
 
+		federation_read_links(&client_set, title_list, lanes, sipc_queue_peer_packet_daemon);
+
 		for (i = 0; i <= max_fd; i++) {
-			if (FD_ISSET(i, &client_set) && i != listen_fd) {
-				if (sipc_read_data_daemon(i, title_list, orphan_list, available_ports) == NOK) {
+			if (FD_ISSET(i, &client_set) && i != listen_fd && !datagram_is_fd(i) && FD_ISSET(i, &backup_set)) {
+				eof = false;
+				if (sipc_read_data_daemon(i, title_list, available_ports, lanes, &eof) == NOK) {
+					//a broken connection of a client, sipcd goes on with the others
 					errorf("sipc_read_data_daemon() failed\n");
-					goto fail;
+					eof = true;
+				}
+				if (federation_is_link(i)) {
+					//the link is watched by the federation from now on
+					sipc_idle_remove(&idle_table, i);
+					sipc_conn_reset_daemon(i);
+					FD_CLR(i, &backup_set);
+				} else if (eof) {
+					sipc_idle_remove(&idle_table, i);
+					sipc_conn_reset_daemon(i);
+					close(i);
+					FD_CLR(i, &backup_set);
+				} else {
+					sipc_idle_touch(&idle_table, i);
 				}
-				close(i);
-				FD_CLR(i, &backup_set);
 			}
 		}
+
+		if (sipc_drain_lanes_daemon(lanes, title_list, available_ports) == NOK) {
+			errorf("sipc_drain_lanes_daemon() failed\n");
+			goto fail;
+		}
 	}
 
 	goto out;
@@ -900,71 +1349,25 @@ fail:
 	ret = NOK;
 
 out:
-	for (i = 0; i <= max_fd; i++) {
-		close(i);
-		FD_CLR(i, &backup_set);
+	sipc_idle_close_all(&idle_table);
+	if (listen_fd >= 0) {
+		close(listen_fd);
 	}
 
 	return ret;
 }
 
-static void title_data_structure_destroy(struct title_list *title_list)
-{
-	struct title_list_entry *entry1 = NULL;
-	struct title_list_entry *entry2 = NULL;
-
-	if (!title_list) {
-		errorf("args cannot be NULL\n");
-		return;
-	}
-
-	if (TAILQ_EMPTY(title_list)) {
-		return;
-	}
-
-	entry1 = TAILQ_FIRST(title_list);
-	while (entry1 != NULL) {
-		entry2 = TAILQ_NEXT(entry1, entries);
-		FREE(entry1->title);
-		port_data_structure_destroy(&(entry1->port_list));
-		FREE(entry1);
-		entry1 = entry2;
-	}
-
-	TAILQ_INIT(title_list); 
-}
-
-static void orphan_data_structure_destroy(struct orphan_list *orphan_list)
-{
-	struct orphan_list_entry *entry1 = NULL;
-	struct orphan_list_entry *entry2 = NULL;
-
-	if (!orphan_list) {
-		errorf("args cannot be NULL\n");
-		return;
-	}
-
-	if (TAILQ_EMPTY(orphan_list)) {
-		return;
-	}
-
-	entry1 = TAILQ_FIRST(orphan_list);
-	while (entry1 != NULL) {
-		entry2 = TAILQ_NEXT(entry1, entries);
-		port_data_structure_destroy(&(entry1->port_list));
-		FREE(entry1->title);
-		FREE(entry1->data);
-		FREE(entry1);
-		entry1 = entry2;
-	}
-
-	TAILQ_INIT(orphan_list);
-}
-
 static void sigint_handler(__attribute__((unused)) int sig_num)
 {
 	title_data_structure_destroy(&title_list);
-	orphan_data_structure_destroy(&orphan_list);
+	sipc_lanes_destroy(&packet_lanes);
+	federation_destroy();
+	broadcast_destroy();
+	conflation_destroy();
+	datagram_destroy();
+	snapshot_close();
+	sipc_routing_destroy();
+	sipc_pool_destroy();
 
 	exit(NOK);
 }
@@ -973,10 +1376,12 @@ int main(int argc, char **argv)
 {
 	int ret = OK;
 	int c, o;
+	unsigned long port;
+	char *snapshot_path = NULL;
 
 	signal(SIGINT, sigint_handler);
 
-	while ((c = getopt_long(argc, argv, "hv", parameters, &o)) != -1) {
+	while ((c = getopt_long(argc, argv, "hvp:P:s:k:c:bS:", parameters, &o)) != -1) {
 		switch (c) {
 			case 'h':
 				print_help_exit(argv[0]);
@@ -985,6 +1390,49 @@ int main(int argc, char **argv)
 				debugf("%s version %s\n", argv[0], VERSION);
 				return OK;
 				break;
+			case 'p':
+				port = strtoul(optarg, NULL, 10);
+				if (!port || port + BACKLOG + 1 > 65535) {
+					errorf("port '%s' is not valid\n", optarg);
+					goto fail;
+				}
+				sipc_set_daemon_port((unsigned short)port);
+				break;
+			case 'P':
+				if (federation_add_peer(optarg) == NOK) {
+					errorf("federation_add_peer() failed\n");
+					goto fail;
+				}
+				break;
+			case 's':
+				snapshot_path = optarg;
+				break;
+			case 'k':
+				keepalive = strtoul(optarg, NULL, 10);
+				if (!keepalive) {
+					errorf("keepalive '%s' is not valid\n", optarg);
+					goto fail;
+				}
+				federation_set_keepalive(keepalive);
+				break;
+			case 'c':
+				pinned_cpu = (int)strtol(optarg, NULL, 10);
+				if (pinned_cpu < 0) {
+					errorf("cpu '%s' is not valid\n", optarg);
+					goto fail;
+				}
+				break;
+			case 'b':
+				waiter.mode = WAIT_SPIN;
+				break;
+			case 'S':
+				waiter.mode = WAIT_ADAPTIVE;
+				waiter.spin_us = strtoul(optarg, NULL, 10);
+				if (!waiter.spin_us) {
+					errorf("spin '%s' is not valid\n", optarg);
+					goto fail;
+				}
+				break;
 			default:
 				debugf("unknown argument\n");
 				goto fail;
@@ -992,10 +1440,24 @@ int main(int argc, char **argv)
 	}
 
 	TAILQ_INIT(&title_list);
-	TAILQ_INIT(&orphan_list);
+	sipc_lanes_init(&packet_lanes);
+	federation_set_interest_hook(invalidate_title_watchers);
 	memset(available_port_map, 0, sizeof(bool) * BACKLOG);
+	daemon_stats.started = time(NULL);
+	daemon_stats.instance = ((unsigned long long)daemon_stats.started << 32) ^ sipc_monotonic_ns() ^ (unsigned long long)getpid();
+
+	//after the port is known, the ports of the clients depend on it
+	if (snapshot_path && snapshot_open(snapshot_path, &title_list, available_port_map) == NOK) {
+		errorf("snapshot_open() failed\n");
+		goto fail;
+	}
+
+	if (pinned_cpu >= 0 && sipc_pin_thread(pinned_cpu) == NOK) {
+		errorf("sipc_pin_thread() failed\n");
+		goto fail;
+	}
 
-	if (sipc_create_server_daemon(&title_list, &orphan_list, available_port_map) == NOK) {
+	if (sipc_create_server_daemon(&title_list, available_port_map, &packet_lanes) == NOK) {
 		errorf("sipc_create_server_daemon() failed\n");
 		goto fail;
 	}
@@ -1007,7 +1469,14 @@ fail:
 
 out:
 	title_data_structure_destroy(&title_list);
-	orphan_data_structure_destroy(&orphan_list);
+	sipc_lanes_destroy(&packet_lanes);
+	federation_destroy();
+	broadcast_destroy();
+	conflation_destroy();
+	datagram_destroy();
+	snapshot_close();
+	sipc_routing_destroy();
+	sipc_pool_destroy();
 
 	return ret;
 }
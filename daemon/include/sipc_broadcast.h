@@ -0,0 +1,56 @@
+#ifndef __SIPC_BROADCAST_
+#define __SIPC_BROADCAST_
+
+#include "sipc_common.h"
+
+/*
+ * fan out of the broadcast title. sipcd keeps a connection open to every
+ * subscriber of it on its own ports, the data is packed once and appended to
+ * the batch of every connection, and a batch is written with one send() per
+ * loop of sipcd. all connections are checked with one poll() before the
+ * writes, and a connection is opened again before the client closes it as
+ * idle, so a data is never written to a connection which is closed already.
+ * the connections do not block, what a subscriber does not take yet is
+ * written in the next loops, so a slow subscriber never stops sipcd
+ */
+
+#define BROADCAST_REFRESH_MS	(IDLE_TIMEOUT_MS / 2)	//a connection silent for so long is opened again
+#define BROADCAST_STALL_MS		2000					//a subscriber which takes nothing for so long loses its data
+#define BROADCAST_RETRY_MS		10						//sipcd loop while a data is not written completely
+#define BROADCAST_MAX_PENDING	(4 * 1024 * 1024)		//bytes waiting for a subscriber, the data beyond is dropped
+#define BROADCAST_ATTEMPTS		2						//connections tried for a packet
+
+struct broadcast_stats {
+	unsigned long msgs_out;
+	unsigned long batches;
+	unsigned long connects;
+	unsigned long errors;
+};
+
+struct broadcast_link {
+	int fd;
+	unsigned long long last_used;		//in milliseconds
+	FILE *batch;
+	char *batch_buffer;
+	size_t batch_size;
+	unsigned int batch_count;
+	char *out;							//the batch which is written
+	size_t out_size;
+	size_t out_sent;
+	size_t out_mark;					//the start of the first packet which is not written completely
+	unsigned int out_count;				//packets from out_mark
+	unsigned int attempts;
+};
+
+typedef int (*broadcast_connect_cb)(unsigned int port);
+typedef void (*broadcast_error_cb)(unsigned int port, unsigned int lost);
+
+bool broadcast_is_title(const char *title);
+int broadcast_queue(unsigned int port, const char *data, size_t len);
+void broadcast_flush(broadcast_connect_cb connect, broadcast_error_cb error);
+bool broadcast_has_pending(void);
+void broadcast_forget(unsigned int port);
+void broadcast_print_stats(FILE *fp);
+void broadcast_destroy(void);
+
+#endif //__SIPC_BROADCAST_
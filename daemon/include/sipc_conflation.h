@@ -0,0 +1,62 @@
+#ifndef __SIPC_CONFLATION_
+#define __SIPC_CONFLATION_
+
+#include "sipc_common.h"
+
+/*
+ * fan out of the conflated titles. sipcd keeps a connection open to every
+ * subscriber of them on its own ports, like the broadcast one. the data of a
+ * subscriber waits in one slot per title and key, and a newer data of the key
+ * replaces the one in its slot. the slots are packed and written together
+ * once the data before them is written completely, so a slow subscriber gets
+ * the newest data of every key instead of a backlog of the older ones
+ */
+
+#define CONFLATION_REFRESH_MS	(IDLE_TIMEOUT_MS / 2)	//a connection silent for so long is opened again
+#define CONFLATION_STALL_MS		2000					//a subscriber which takes nothing for so long loses the written data
+#define CONFLATION_RETRY_MS		10						//sipcd loop while a data is not written completely
+#define CONFLATION_ATTEMPTS		2						//connections tried for a batch
+
+struct conflation_stats {
+	unsigned long msgs_out;
+	unsigned long replaced;
+	unsigned long batches;
+	unsigned long connects;
+	unsigned long errors;
+};
+
+struct conflation_slot {
+	char *title;
+	char *key;							//NULL for the data without a key
+	char *data;							//the packed packet
+	size_t size;
+	TAILQ_ENTRY(conflation_slot) entries;
+};
+
+TAILQ_HEAD(conflation_slots, conflation_slot);
+
+struct conflation_link {
+	int fd;
+	unsigned long long last_used;		//in milliseconds
+	struct conflation_slots slots;
+	unsigned int slot_count;
+	char *out;							//the slots which are written
+	size_t out_size;
+	size_t out_sent;
+	size_t out_mark;					//the start of the first packet which is not written completely
+	unsigned int out_count;				//packets from out_mark
+	unsigned int attempts;
+};
+
+typedef int (*conflation_connect_cb)(unsigned int port);
+typedef void (*conflation_error_cb)(unsigned int port, unsigned int lost);
+
+int conflation_queue(unsigned int port, const char *title, const char *key, const char *data, size_t len, bool *replaced);
+void conflation_flush(conflation_connect_cb connect, conflation_error_cb error);
+bool conflation_has_pending(void);
+unsigned int conflation_pending(unsigned int port);
+void conflation_forget(unsigned int port);
+void conflation_print_stats(FILE *fp);
+void conflation_destroy(void);
+
+#endif //__SIPC_CONFLATION_
@@ -0,0 +1,34 @@
+#ifndef __SIPC_DATAGRAM_
+#define __SIPC_DATAGRAM_
+
+#include "sipc_common.h"
+#include "sipc_routing.h"
+
+/*
+ * datagram titles of sipcd. the datagrams waiting on the udp port of sipcd
+ * are read with one recvmmsg(), and every datagram is sent as it is to the udp
+ * ports of the subscribers of its title, many of them with one sendmmsg().
+ * a datagram never waits in the lanes and it is not retained, a datagram which
+ * does not fit into the socket buffers is dropped
+ */
+
+#define DATAGRAM_FANOUT_MAX			(DATAGRAM_BATCH * 8)	//datagrams collected before they are sent
+#define DATAGRAM_TIMESTAMPS_OFFSET	3						//type, priority and flags come before the timestamps
+
+struct datagram_stats {
+	unsigned long reads;
+	unsigned long msgs_in;
+	unsigned long msgs_out;
+	unsigned long dropped;
+	unsigned long invalid;
+};
+
+typedef struct title_list_entry *(*datagram_route_cb)(struct _packet *packet, struct title_list *title_list);
+
+int datagram_open(unsigned short port);
+bool datagram_is_fd(int fd);
+void datagram_read(struct title_list *title_list, datagram_route_cb route);
+void datagram_print_stats(FILE *fp);
+void datagram_destroy(void);
+
+#endif //__SIPC_DATAGRAM_
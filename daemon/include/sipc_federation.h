@@ -0,0 +1,73 @@
+#ifndef __SIPC_FEDERATION_
+#define __SIPC_FEDERATION_
+
+#include "sipc_common.h"
+#include "sipc_routing.h"
+
+/*
+ * sipcd to sipcd links. a link is one persistent connection carrying packets
+ * in both directions, so it is given with --peer on one of the two daemons
+ * only. each side tells the other the titles which have local subscribers
+ * with PEER_INTEREST packets, and only the data of those titles is forwarded.
+ * forwarded packets are batched per link and written once per loop of sipcd.
+ * data received from a link goes to the local subscribers only, it is never
+ * forwarded to another link, so the daemons should form a full mesh
+ */
+
+#define FEDERATION_MAX_PEERS		16
+#define FEDERATION_RETRY_INTERVAL	5		//seconds between the connection attempts of a peer
+#define FEDERATION_IO_TIMEOUT		2		//seconds, a link slower than this is dropped
+#define FEDERATION_READ_BUDGET		256		//packets read from a link per loop
+
+/*
+ * PEER_INTEREST payload is a list of NUL terminated entries, an entry is an
+ * operation character followed by a title. FEDERATION_INTEREST_RESET has no
+ * title and drops everything the link wanted before
+ */
+#define FEDERATION_INTEREST_ADD		'+'
+#define FEDERATION_INTEREST_REMOVE	'-'
+#define FEDERATION_INTEREST_RESET	'*'
+
+struct federation_stats {
+	unsigned long links_up;
+	unsigned long msgs_in;
+	unsigned long msgs_out;
+	unsigned long bytes_out;
+	unsigned long batches;
+	unsigned long errors;
+};
+
+struct federation_peer {
+	bool used;
+	bool configured;			//given with --peer, reconnected when it is down
+	char address[INET6_ADDRSTRLEN];
+	unsigned short port;
+	int fd;
+	time_t last_attempt;
+	FILE *batch;
+	char *batch_buffer;
+	size_t batch_size;
+	unsigned int batch_count;
+	struct federation_stats stats;
+};
+
+typedef int (*federation_queue_cb)(struct _packet *packet, struct title_list *title_list, struct packet_lanes *lanes);
+typedef void (*federation_interest_cb)(struct title_list_entry *tentry);
+
+int federation_add_peer(const char *peer);
+bool federation_has_down_peers(void);
+void federation_connect_peers(struct title_list *title_list);
+int federation_accept_link(int fd, struct title_list *title_list);
+bool federation_is_link(int fd);
+int federation_fill_fd_set(fd_set *set, int max_fd);
+void federation_read_links(fd_set *set, struct title_list *title_list, struct packet_lanes *lanes, federation_queue_cb queue);
+void federation_set_interest_hook(federation_interest_cb hook);
+void federation_set_keepalive(unsigned int idle);
+void federation_mark_interest_dirty(void);
+void federation_sync_interest(struct title_list *title_list);
+void federation_forward(struct title_list_entry *tentry, struct _packet *packet);
+void federation_flush(struct title_list *title_list);
+void federation_print_stats(FILE *fp, struct title_list *title_list);
+void federation_destroy(void);
+
+#endif //__SIPC_FEDERATION_
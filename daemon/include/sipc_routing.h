@@ -0,0 +1,70 @@
+#ifndef __SIPC_ROUTING_
+#define __SIPC_ROUTING_
+
+#include "sipc_common.h"
+
+/*
+ * routing tables of sipcd: titles, the ports registered to them and their
+ * retained data. nothing here touches the sockets, so the tables can be
+ * benchmarked on their own, see bench/sipc_routing_bench.c
+ */
+
+#define SLAB_GROW_COUNT	64
+
+struct port_list_entry {
+	unsigned int port;
+	TAILQ_ENTRY(port_list_entry) entries;
+};
+
+TAILQ_HEAD(port_list, port_list_entry);
+
+struct retained_list_entry {
+	char *key;
+	char *data;
+	unsigned int data_size;
+	unsigned char flags;
+	TAILQ_ENTRY(retained_list_entry) entries;
+};
+
+TAILQ_HEAD(retained_list, retained_list_entry);
+
+struct title_stats {
+	unsigned long msgs_in;
+	unsigned long msgs_out;
+	unsigned long bytes_in;
+	unsigned long bytes_out;
+};
+
+struct title_list_entry {
+	char *title;
+	bool conflate;
+	bool advertised;			//peers are told that it has local subscribers
+	unsigned int peer_mask;		//peer links which want its data
+	struct title_stats stats;
+	struct port_list port_list;
+	struct port_list watcher_list;	//ports which looked up its subscribers, they get INVALIDATE on a change
+	struct retained_list retained_list;
+	TAILQ_ENTRY(title_list_entry) entries;
+};
+
+TAILQ_HEAD(title_list, title_list_entry);
+
+struct title_list_entry *find_entry_in_title_list(char *title, struct title_list *title_list);
+bool is_port_int_the_list(unsigned int port, struct port_list *port_list);
+int add_new_entry_to_the_port_list(unsigned int port, struct port_list *port_list);
+struct title_list_entry *add_empty_entry_to_title_list(char *title, struct title_list *title_list);
+int add_new_entry_to_title_list(char *title, unsigned int port, struct title_list *title_list);
+int add_port_title_couple(char *title, unsigned int port, struct title_list *title_list);
+void port_data_structure_destroy(struct port_list *port_list);
+int remove_port_from_title(char *title, unsigned int port, struct title_list *title_list);
+int remove_port_from_all_title(unsigned int port, struct title_list *title_list);
+void remove_watcher_from_all_title(unsigned int port, struct title_list *title_list);
+void retained_data_structure_destroy(struct retained_list *retained_list);
+struct retained_list_entry *find_entry_in_retained_list(char *key, struct retained_list *retained_list);
+int retain_data(struct title_list_entry *tentry, char *key, char *data, unsigned int len, unsigned char flags);
+int set_title_conflation(char *title, bool enable, struct title_list *title_list);
+unsigned int next_available_port(bool *available_ports);
+void title_data_structure_destroy(struct title_list *title_list);
+void sipc_routing_destroy(void);
+
+#endif //__SIPC_ROUTING_
@@ -0,0 +1,58 @@
+#ifndef __SIPC_SNAPSHOT_
+#define __SIPC_SNAPSHOT_
+
+#include "sipc_common.h"
+#include "sipc_routing.h"
+
+/*
+ * routing state of sipcd kept in a memory mapped file, so a restarted sipcd
+ * goes on with the titles and the ports of its clients instead of waiting for
+ * them to register again. every change of the routing tables appends a small
+ * record to the mapped file, which is a memcpy without any system call, and
+ * the record is published by moving the end offset of the header after it.
+ * a record cut by a crash is never seen. when the file is full it is
+ * rewritten with the current tables only, and the same is done after loading
+ * it. the retained data is not kept, it is renewed by the next publish
+ */
+
+#define SNAPSHOT_MAGIC		0x53495043		//"SIPC"
+#define SNAPSHOT_VERSION	1
+#define SNAPSHOT_MIN_SIZE	(1024 * 1024)
+#define SNAPSHOT_ALIGN		8
+
+enum snapshot_op
+{
+	SNAPSHOT_REGISTER,
+	SNAPSHOT_UNREGISTER,
+	SNAPSHOT_UNREGISTER_ALL,
+	SNAPSHOT_RESERVE_PORT,
+	SNAPSHOT_CONFLATE
+};
+
+struct snapshot_header {
+	unsigned int magic;
+	unsigned int version;
+	unsigned int daemon_port;
+	unsigned int backlog;
+	unsigned long long size;			//of the file
+	unsigned long long end;				//first byte after the last complete record
+};
+
+struct snapshot_record {
+	unsigned int length;				//of the whole record with the title and the padding
+	unsigned int port;
+	unsigned char op;
+	unsigned char value;
+	unsigned short title_size;			//with the trailing null, 0 if there is no title
+	char title[];
+};
+
+int snapshot_open(const char *path, struct title_list *title_list, bool *available_ports);
+void snapshot_register(char *title, unsigned int port);
+void snapshot_unregister(char *title, unsigned int port);
+void snapshot_unregister_all(unsigned int port);
+void snapshot_reserve_port(unsigned int port);
+void snapshot_conflate(char *title, bool enable);
+void snapshot_close(void);
+
+#endif //__SIPC_SNAPSHOT_
@@ -0,0 +1,333 @@
+#include <fcntl.h>
+
+#include "sipc_common.h"
+#include "sipc_timer.h"
+#include "sipc_broadcast.h"
+
+static struct broadcast_link links[BACKLOG];
+static struct broadcast_stats stats;
+static bool links_initialized = false;
+
+static void broadcast_init(void)
+{
+	unsigned int i;
+
+	if (links_initialized) {
+		return;
+	}
+
+	memset(links, 0, sizeof(links));
+	for (i = 0; i < BACKLOG; i++) {
+		links[i].fd = -1;
+	}
+	links_initialized = true;
+}
+
+static void broadcast_drop_batch(struct broadcast_link *link)
+{
+	FCLOSE(link->batch);
+	FREE(link->batch_buffer);
+	link->batch_size = 0;
+	link->batch_count = 0;
+}
+
+static void broadcast_close_link(struct broadcast_link *link)
+{
+	if (link->fd >= 0) {
+		close(link->fd);
+		link->fd = -1;
+	}
+}
+
+static void broadcast_drop_out(struct broadcast_link *link)
+{
+	FREE(link->out);
+	link->out_size = 0;
+	link->out_sent = 0;
+	link->out_mark = 0;
+	link->out_count = 0;
+	link->attempts = 0;
+}
+
+/*
+ * the client drops the cut packet of a broken link, so the writing goes on
+ * from the start of that packet on a new link. the packets which are written
+ * completely are never written again
+ */
+static void broadcast_break_link(struct broadcast_link *link)
+{
+	broadcast_close_link(link);
+	link->out_sent = link->out_mark;
+}
+
+static void broadcast_advance_mark(struct broadcast_link *link)
+{
+	size_t need;
+
+	while (link->out_count) {
+		need = sipc_packet_need(link->out + link->out_mark, link->out_sent - link->out_mark);
+		if (link->out_mark + need > link->out_sent) {
+			break;
+		}
+		link->out_mark += need;
+		link->out_count--;
+		link->attempts = 0;
+		stats.msgs_out++;
+	}
+}
+
+static int broadcast_take_batch(struct broadcast_link *link, unsigned long long now)
+{
+	FCLOSE(link->batch);
+	if (!link->batch_buffer) {
+		return NOK;
+	}
+
+	link->out = link->batch_buffer;
+	link->out_size = link->batch_size;
+	link->out_sent = 0;
+	link->out_mark = 0;
+	link->out_count = link->batch_count;
+	link->attempts = 0;
+	link->last_used = now;
+
+	link->batch_buffer = NULL;
+	link->batch_size = 0;
+	link->batch_count = 0;
+
+	return OK;
+}
+
+static int broadcast_set_nonblock(int fd)
+{
+	int flags;
+
+	if ((flags = fcntl(fd, F_GETFL, 0)) < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		errorf("fcntl() failed with %d: %s\n", errno, strerror(errno));
+		return NOK;
+	}
+
+	return OK;
+}
+
+/*
+ * writes as much of the batch as the link takes without blocking, the rest is
+ * written once the link is writable again. NOK is returned when the packets
+ * which are not written are lost
+ */
+static int broadcast_write_out(unsigned int index, broadcast_connect_cb connect, unsigned long long now)
+{
+	ssize_t ret;
+	struct broadcast_link *link = &(links[index]);
+
+	while (link->out_sent < link->out_size) {
+		if (link->fd < 0) {
+			if (link->attempts >= BROADCAST_ATTEMPTS) {
+				return NOK;
+			}
+			link->attempts++;
+			if ((link->fd = connect(index + STARTING_PORT)) < 0) {
+				return NOK;
+			}
+			stats.connects++;
+			if (broadcast_set_nonblock(link->fd) == NOK) {
+				broadcast_close_link(link);
+				return NOK;
+			}
+		}
+
+		ret = send(link->fd, link->out + link->out_sent, link->out_size - link->out_sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (ret > 0) {
+			link->out_sent += ret;
+			link->last_used = now;
+			broadcast_advance_mark(link);
+			continue;
+		} else if (ret < 0 && errno == EINTR) {
+			continue;
+		} else if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			if (now - link->last_used < BROADCAST_STALL_MS) {
+				return OK;
+			}
+			errorf("the port '%u' takes no broadcast data for %u ms\n", index + STARTING_PORT, BROADCAST_STALL_MS);
+			broadcast_close_link(link);
+			return NOK;
+		}
+
+		errorf("broadcast to the port '%u' failed with %d: %s\n", index + STARTING_PORT, errno, strerror(errno));
+		broadcast_break_link(link);
+	}
+
+	stats.batches++;
+	broadcast_drop_out(link);
+
+	return OK;
+}
+
+bool broadcast_is_title(const char *title)
+{
+	return title && strcmp(title, BROADCAST_UNIQUE_TITLE) == 0;
+}
+
+/*
+ * only the ports of this sipcd have a link, NOK is returned for the others
+ */
+int broadcast_queue(unsigned int port, const char *data, size_t len)
+{
+	size_t pending;
+	struct broadcast_link *link = NULL;
+
+	if (!data || !len || !IS_OWN_PORT(port)) {
+		return NOK;
+	}
+
+	broadcast_init();
+	link = &(links[port - STARTING_PORT]);
+
+	pending = link->out_size - link->out_sent + (link->batch ? (size_t)ftell(link->batch) : 0);
+	if (pending + len > BROADCAST_MAX_PENDING) {
+		errorf("the port '%u' has %zu bytes of broadcast data pending, the data is dropped\n", port, pending);
+		return NOK;
+	}
+
+	if (!link->batch && (link->batch = open_memstream(&(link->batch_buffer), &(link->batch_size))) == NULL) {
+		errorf("open_memstream() failed with %d: %s\n", errno, strerror(errno));
+		return NOK;
+	}
+
+	if (fwrite(data, len, 1, link->batch) != 1) {
+		errorf("packing the broadcast for the port '%u' failed\n", port);
+		broadcast_drop_batch(link);
+		return NOK;
+	}
+	link->batch_count++;
+
+	return OK;
+}
+
+/*
+ * 'error' is told the data lost by a subscriber, its link is opened again with
+ * the next batch
+ */
+void broadcast_flush(broadcast_connect_cb connect, broadcast_error_cb error)
+{
+	unsigned int i, count = 0;
+	unsigned long long now;
+	unsigned int index[BACKLOG];
+	struct pollfd fds[BACKLOG];
+	struct broadcast_link *link = NULL;
+
+	if (!links_initialized || !connect) {
+		return;
+	}
+
+	now = sipc_timer_now_ms();
+
+	for (i = 0; i < BACKLOG; i++) {
+		link = &(links[i]);
+		if ((!link->batch_count && !link->out) || link->fd < 0) {
+			continue;
+		}
+		if (!link->out && now - link->last_used >= BROADCAST_REFRESH_MS) {
+			broadcast_close_link(link);
+			continue;
+		}
+		fds[count].fd = link->fd;
+		fds[count].events = POLLIN;
+		fds[count].revents = 0;
+		index[count++] = i;
+	}
+
+	//a client never writes to its link, so a readable link is closed by the client
+	if (count && poll(fds, count, 0) > 0) {
+		for (i = 0; i < count; i++) {
+			if (fds[i].revents) {
+				debugf("broadcast link of the port '%u' is closed by the client\n", index[i] + STARTING_PORT);
+				broadcast_break_link(&(links[index[i]]));
+			}
+		}
+	}
+
+	for (i = 0; i < BACKLOG; i++) {
+		link = &(links[i]);
+		if (!link->out && link->batch_count && broadcast_take_batch(link, now) == NOK) {
+			stats.errors++;
+			if (error) {
+				error(i + STARTING_PORT, link->batch_count);
+			}
+			broadcast_drop_batch(link);
+			continue;
+		}
+		if (!link->out) {
+			continue;
+		}
+
+		if (broadcast_write_out(i, connect, now) == NOK) {
+			stats.errors++;
+			if (error && link->out_count) {
+				error(i + STARTING_PORT, link->out_count);
+			}
+			broadcast_drop_out(link);
+		}
+	}
+}
+
+/*
+ * sipcd does not wait for a socket long while a batch is not written
+ * completely
+ */
+bool broadcast_has_pending(void)
+{
+	unsigned int i;
+
+	for (i = 0; links_initialized && i < BACKLOG; i++) {
+		if (links[i].out || links[i].batch_count) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * the port is unregistered, the next client on it gets a new link
+ */
+void broadcast_forget(unsigned int port)
+{
+	struct broadcast_link *link = NULL;
+
+	if (!links_initialized || !IS_OWN_PORT(port)) {
+		return;
+	}
+
+	link = &(links[port - STARTING_PORT]);
+	broadcast_close_link(link);
+	broadcast_drop_batch(link);
+	broadcast_drop_out(link);
+}
+
+void broadcast_print_stats(FILE *fp)
+{
+	unsigned int i, open = 0;
+
+	if (!fp || !links_initialized) {
+		return;
+	}
+
+	for (i = 0; i < BACKLOG; i++) {
+		open += links[i].fd >= 0;
+	}
+
+	fprintf(fp, "broadcast links=%u msgs_out=%lu batches=%lu connects=%lu errors=%lu\n", open, stats.msgs_out,
+		stats.batches, stats.connects, stats.errors);
+}
+
+void broadcast_destroy(void)
+{
+	unsigned int i;
+
+	for (i = 0; links_initialized && i < BACKLOG; i++) {
+		broadcast_close_link(&(links[i]));
+		broadcast_drop_batch(&(links[i]));
+		broadcast_drop_out(&(links[i]));
+	}
+}
@@ -0,0 +1,386 @@
+#include <fcntl.h>
+
+#include "sipc_common.h"
+#include "sipc_timer.h"
+#include "sipc_conflation.h"
+
+static struct conflation_link links[BACKLOG];
+static struct conflation_stats stats;
+static bool links_initialized = false;
+
+static void conflation_init(void)
+{
+	unsigned int i;
+
+	if (links_initialized) {
+		return;
+	}
+
+	memset(links, 0, sizeof(links));
+	for (i = 0; i < BACKLOG; i++) {
+		links[i].fd = -1;
+		TAILQ_INIT(&(links[i].slots));
+	}
+	links_initialized = true;
+}
+
+static void conflation_free_slot(struct conflation_slot *slot)
+{
+	if (!slot) {
+		return;
+	}
+
+	FREE(slot->title);
+	FREE(slot->key);
+	FREE(slot->data);
+	FREE(slot);
+}
+
+static void conflation_drop_slots(struct conflation_link *link)
+{
+	struct conflation_slot *slot = NULL;
+
+	while ((slot = TAILQ_FIRST(&(link->slots))) != NULL) {
+		TAILQ_REMOVE(&(link->slots), slot, entries);
+		conflation_free_slot(slot);
+	}
+	link->slot_count = 0;
+}
+
+static void conflation_close_link(struct conflation_link *link)
+{
+	if (link->fd >= 0) {
+		close(link->fd);
+		link->fd = -1;
+	}
+}
+
+static void conflation_drop_out(struct conflation_link *link)
+{
+	FREE(link->out);
+	link->out_size = 0;
+	link->out_sent = 0;
+	link->out_mark = 0;
+	link->out_count = 0;
+	link->attempts = 0;
+}
+
+/*
+ * the client drops the cut packet of a broken link, so the writing goes on
+ * from the start of that packet on a new link
+ */
+static void conflation_break_link(struct conflation_link *link)
+{
+	conflation_close_link(link);
+	link->out_sent = link->out_mark;
+}
+
+static void conflation_advance_mark(struct conflation_link *link)
+{
+	size_t need;
+
+	while (link->out_count) {
+		need = sipc_packet_need(link->out + link->out_mark, link->out_sent - link->out_mark);
+		if (link->out_mark + need > link->out_sent) {
+			break;
+		}
+		link->out_mark += need;
+		link->out_count--;
+		link->attempts = 0;
+		stats.msgs_out++;
+	}
+}
+
+/*
+ * the slots are packed in the order of their keys and emptied, the next data
+ * of a key takes a new slot
+ */
+static int conflation_take_slots(struct conflation_link *link, unsigned long long now)
+{
+	size_t size = 0;
+	struct conflation_slot *slot = NULL;
+
+	TAILQ_FOREACH(slot, &(link->slots), entries) {
+		size += slot->size;
+	}
+
+	if ((link->out = (char *)malloc(size)) == NULL) {
+		errorf("malloc failed\n");
+		return NOK;
+	}
+
+	TAILQ_FOREACH(slot, &(link->slots), entries) {
+		memcpy(link->out + link->out_size, slot->data, slot->size);
+		link->out_size += slot->size;
+	}
+	link->out_sent = 0;
+	link->out_mark = 0;
+	link->out_count = link->slot_count;
+	link->attempts = 0;
+	link->last_used = now;
+
+	conflation_drop_slots(link);
+
+	return OK;
+}
+
+static int conflation_set_nonblock(int fd)
+{
+	int flags;
+
+	if ((flags = fcntl(fd, F_GETFL, 0)) < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		errorf("fcntl() failed with %d: %s\n", errno, strerror(errno));
+		return NOK;
+	}
+
+	return OK;
+}
+
+/*
+ * writes as much of the slots as the link takes without blocking, the rest is
+ * written once the link is writable again. NOK is returned when the packets
+ * which are not written are lost
+ */
+static int conflation_write_out(unsigned int index, conflation_connect_cb connect, unsigned long long now)
+{
+	ssize_t ret;
+	struct conflation_link *link = &(links[index]);
+
+	while (link->out_sent < link->out_size) {
+		if (link->fd < 0) {
+			if (link->attempts >= CONFLATION_ATTEMPTS) {
+				return NOK;
+			}
+			link->attempts++;
+			if ((link->fd = connect(index + STARTING_PORT)) < 0) {
+				return NOK;
+			}
+			stats.connects++;
+			if (conflation_set_nonblock(link->fd) == NOK) {
+				conflation_close_link(link);
+				return NOK;
+			}
+		}
+
+		ret = send(link->fd, link->out + link->out_sent, link->out_size - link->out_sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (ret > 0) {
+			link->out_sent += ret;
+			link->last_used = now;
+			conflation_advance_mark(link);
+			continue;
+		} else if (ret < 0 && errno == EINTR) {
+			continue;
+		} else if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			if (now - link->last_used < CONFLATION_STALL_MS) {
+				return OK;
+			}
+			errorf("the port '%u' takes no conflated data for %u ms\n", index + STARTING_PORT, CONFLATION_STALL_MS);
+			conflation_close_link(link);
+			return NOK;
+		}
+
+		errorf("conflated data to the port '%u' failed with %d: %s\n", index + STARTING_PORT, errno, strerror(errno));
+		conflation_break_link(link);
+	}
+
+	stats.batches++;
+	conflation_drop_out(link);
+
+	return OK;
+}
+
+/*
+ * only the ports of this sipcd have a link, NOK is returned for the others.
+ * 'replaced' tells that an older data of the key was waiting and is dropped
+ */
+int conflation_queue(unsigned int port, const char *title, const char *key, const char *data, size_t len, bool *replaced)
+{
+	char *copy = NULL;
+	struct conflation_link *link = NULL;
+	struct conflation_slot *slot = NULL;
+
+	if (!title || !data || !len || !replaced || !IS_OWN_PORT(port)) {
+		return NOK;
+	}
+
+	conflation_init();
+	link = &(links[port - STARTING_PORT]);
+	*replaced = false;
+
+	if ((copy = (char *)malloc(len)) == NULL) {
+		errorf("malloc failed\n");
+		return NOK;
+	}
+	memcpy(copy, data, len);
+
+	TAILQ_FOREACH(slot, &(link->slots), entries) {
+		if (strcmp(slot->title, title) == 0 && (key ? slot->key && strcmp(slot->key, key) == 0 : !slot->key)) {
+			FREE(slot->data);
+			slot->data = copy;
+			slot->size = len;
+			stats.replaced++;
+			*replaced = true;
+			return OK;
+		}
+	}
+
+	slot = (struct conflation_slot *)calloc(1, sizeof(struct conflation_slot));
+	if (!slot || (slot->title = strdup(title)) == NULL || (key && (slot->key = strdup(key)) == NULL)) {
+		errorf("alloc failed\n");
+		conflation_free_slot(slot);
+		FREE(copy);
+		return NOK;
+	}
+	slot->data = copy;
+	slot->size = len;
+
+	TAILQ_INSERT_TAIL(&(link->slots), slot, entries);
+	link->slot_count++;
+
+	return OK;
+}
+
+/*
+ * 'error' is told the data lost by a subscriber, its link is opened again with
+ * the next slots
+ */
+void conflation_flush(conflation_connect_cb connect, conflation_error_cb error)
+{
+	unsigned int i, count = 0;
+	unsigned long long now;
+	unsigned int index[BACKLOG];
+	struct pollfd fds[BACKLOG];
+	struct conflation_link *link = NULL;
+
+	if (!links_initialized || !connect) {
+		return;
+	}
+
+	now = sipc_timer_now_ms();
+
+	for (i = 0; i < BACKLOG; i++) {
+		link = &(links[i]);
+		if ((!link->slot_count && !link->out) || link->fd < 0) {
+			continue;
+		}
+		if (!link->out && now - link->last_used >= CONFLATION_REFRESH_MS) {
+			conflation_close_link(link);
+			continue;
+		}
+		fds[count].fd = link->fd;
+		fds[count].events = POLLIN;
+		fds[count].revents = 0;
+		index[count++] = i;
+	}
+
+	//a client never writes to its link, so a readable link is closed by the client
+	if (count && poll(fds, count, 0) > 0) {
+		for (i = 0; i < count; i++) {
+			if (fds[i].revents) {
+				debugf("conflation link of the port '%u' is closed by the client\n", index[i] + STARTING_PORT);
+				conflation_break_link(&(links[index[i]]));
+			}
+		}
+	}
+
+	for (i = 0; i < BACKLOG; i++) {
+		link = &(links[i]);
+		if (!link->out && link->slot_count && conflation_take_slots(link, now) == NOK) {
+			stats.errors++;
+			if (error) {
+				error(i + STARTING_PORT, link->slot_count);
+			}
+			conflation_drop_slots(link);
+			continue;
+		}
+		if (!link->out) {
+			continue;
+		}
+
+		if (conflation_write_out(i, connect, now) == NOK) {
+			stats.errors++;
+			if (error && link->out_count) {
+				error(i + STARTING_PORT, link->out_count);
+			}
+			conflation_drop_out(link);
+		}
+	}
+}
+
+/*
+ * sipcd does not wait for a socket long while the slots are not written
+ * completely
+ */
+bool conflation_has_pending(void)
+{
+	unsigned int i;
+
+	for (i = 0; links_initialized && i < BACKLOG; i++) {
+		if (links[i].out || links[i].slot_count) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * data of the port which is not written completely, one per key
+ */
+unsigned int conflation_pending(unsigned int port)
+{
+	struct conflation_link *link = NULL;
+
+	if (!links_initialized || !IS_OWN_PORT(port)) {
+		return 0;
+	}
+
+	link = &(links[port - STARTING_PORT]);
+
+	return link->slot_count + link->out_count;
+}
+
+/*
+ * the port is unregistered, the next client on it gets a new link
+ */
+void conflation_forget(unsigned int port)
+{
+	struct conflation_link *link = NULL;
+
+	if (!links_initialized || !IS_OWN_PORT(port)) {
+		return;
+	}
+
+	link = &(links[port - STARTING_PORT]);
+	conflation_close_link(link);
+	conflation_drop_slots(link);
+	conflation_drop_out(link);
+}
+
+void conflation_print_stats(FILE *fp)
+{
+	unsigned int i, open = 0, slots = 0;
+
+	if (!fp || !links_initialized) {
+		return;
+	}
+
+	for (i = 0; i < BACKLOG; i++) {
+		open += links[i].fd >= 0;
+		slots += links[i].slot_count;
+	}
+
+	fprintf(fp, "conflation links=%u slots=%u msgs_out=%lu replaced=%lu batches=%lu connects=%lu errors=%lu\n", open,
+		slots, stats.msgs_out, stats.replaced, stats.batches, stats.connects, stats.errors);
+}
+
+void conflation_destroy(void)
+{
+	unsigned int i;
+
+	for (i = 0; links_initialized && i < BACKLOG; i++) {
+		conflation_close_link(&(links[i]));
+		conflation_drop_slots(&(links[i]));
+		conflation_drop_out(&(links[i]));
+	}
+}
@@ -0,0 +1,145 @@
+#include "sipc_common.h"
+#include "sipc_routing.h"
+#include "sipc_datagram.h"
+
+static int datagram_fd = -1;
+static char *buffer = NULL;
+static char *buffers[DATAGRAM_BATCH];
+static struct datagram_stats stats;
+
+/*
+ * one block for all the buffers, it is taken with the first datagram
+ */
+static int datagram_alloc(void)
+{
+	unsigned int i;
+
+	if (buffer) {
+		return OK;
+	}
+
+	if ((buffer = (char *)malloc(DATAGRAM_BATCH * (DATAGRAM_MAX_SIZE + 1))) == NULL) {
+		errorf("malloc failed\n");
+		return NOK;
+	}
+
+	for (i = 0; i < DATAGRAM_BATCH; i++) {
+		buffers[i] = buffer + i * (DATAGRAM_MAX_SIZE + 1);
+	}
+
+	return OK;
+}
+
+static void datagram_send(char **data, size_t *lengths, unsigned int *ports, unsigned int count)
+{
+	unsigned int sent;
+
+	if (!count) {
+		return;
+	}
+
+	sent = sipc_send_datagrams(datagram_fd, data, lengths, ports, count);
+	stats.msgs_out += sent;
+	stats.dropped += count - sent;
+}
+
+int datagram_open(unsigned short port)
+{
+	if ((datagram_fd = sipc_open_datagram(port)) < 0) {
+		errorf("sipc_open_datagram() failed\n");
+		return -1;
+	}
+
+	return datagram_fd;
+}
+
+bool datagram_is_fd(int fd)
+{
+	return fd >= 0 && fd == datagram_fd;
+}
+
+/*
+ * 'route' gives the title of a datagram, or NULL to drop it
+ */
+void datagram_read(struct title_list *title_list, datagram_route_cb route)
+{
+	int i, count;
+	unsigned int fanout = 0;
+	unsigned long long now;
+	size_t lengths[DATAGRAM_BATCH];
+	char *out_data[DATAGRAM_FANOUT_MAX];
+	size_t out_lengths[DATAGRAM_FANOUT_MAX];
+	unsigned int out_ports[DATAGRAM_FANOUT_MAX];
+	struct _packet packet;
+	struct title_list_entry *tentry = NULL;
+	struct port_list_entry *pentry = NULL;
+
+	if (datagram_fd < 0 || !title_list || !route) {
+		errorf("args cannot be NULL\n");
+		return;
+	}
+
+	if (datagram_alloc() == NOK) {
+		return;
+	}
+
+	if ((count = sipc_recv_datagrams(datagram_fd, buffers, DATAGRAM_MAX_SIZE + 1, lengths, DATAGRAM_BATCH)) <= 0) {
+		return;
+	}
+	stats.reads++;
+	now = sipc_monotonic_ns();
+
+	for (i = 0; i < count; i++) {
+		if (lengths[i] > DATAGRAM_MAX_SIZE || sipc_unpack_packet(buffers[i], lengths[i], &packet) == NOK ||
+				packet.packet_type != SENDATA || !(packet.flags & PACKET_FLAG_DATAGRAM)) {
+			stats.invalid++;
+			continue;
+		}
+		stats.msgs_in++;
+
+		//the datagram is forwarded as it is, only its timestamps are written in place
+		if (packet.flags & PACKET_FLAG_TIMESTAMPS) {
+			packet.timestamps.daemon_receive = now;
+			packet.timestamps.daemon_forward = now;
+			memcpy(buffers[i] + DATAGRAM_TIMESTAMPS_OFFSET, &(packet.timestamps), PACKET_TIMESTAMPS_WIRE_SIZE);
+		}
+
+		if ((tentry = route(&packet, title_list)) == NULL) {
+			continue;
+		}
+
+		TAILQ_FOREACH(pentry, &(tentry->port_list), entries) {
+			if (fanout == DATAGRAM_FANOUT_MAX) {
+				datagram_send(out_data, out_lengths, out_ports, fanout);
+				fanout = 0;
+			}
+			out_data[fanout] = buffers[i];
+			out_lengths[fanout] = lengths[i];
+			out_ports[fanout++] = pentry->port;
+			tentry->stats.msgs_out++;
+			tentry->stats.bytes_out += packet.payload_size;
+		}
+	}
+
+	datagram_send(out_data, out_lengths, out_ports, fanout);
+}
+
+void datagram_print_stats(FILE *fp)
+{
+	if (!fp || datagram_fd < 0) {
+		return;
+	}
+
+	fprintf(fp, "datagram reads=%lu msgs_in=%lu msgs_out=%lu dropped=%lu invalid=%lu\n", stats.reads, stats.msgs_in,
+		stats.msgs_out, stats.dropped, stats.invalid);
+}
+
+void datagram_destroy(void)
+{
+	if (datagram_fd >= 0) {
+		close(datagram_fd);
+		datagram_fd = -1;
+	}
+
+	FREE(buffer);
+}
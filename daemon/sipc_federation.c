@@ -0,0 +1,671 @@
+#include "sipc_common.h"
+#include "sipc_pool.h"
+#include "sipc_routing.h"
+#include "sipc_federation.h"
+
+static struct federation_peer peers[FEDERATION_MAX_PEERS];
+static bool peers_initialized = false;
+static bool interest_dirty = false;
+static federation_interest_cb interest_hook = NULL;
+static unsigned int keepalive = 0;
+
+static void federation_init(void)
+{
+	unsigned int i;
+
+	if (peers_initialized) {
+		return;
+	}
+
+	memset(peers, 0, sizeof(peers));
+	for (i = 0; i < FEDERATION_MAX_PEERS; i++) {
+		peers[i].fd = -1;
+	}
+	peers_initialized = true;
+}
+
+static FILE *federation_batch(struct federation_peer *peer)
+{
+	if (!peer->batch && (peer->batch = open_memstream(&(peer->batch_buffer), &(peer->batch_size))) == NULL) {
+		errorf("open_memstream() failed with %d: %s\n", errno, strerror(errno));
+	}
+
+	return peer->batch;
+}
+
+static void federation_drop_batch(struct federation_peer *peer)
+{
+	FCLOSE(peer->batch);
+	FREE(peer->batch_buffer);
+	peer->batch_size = 0;
+	peer->batch_count = 0;
+}
+
+static int federation_send_all(int fd, const char *data, size_t len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = send(fd, data, len, MSG_NOSIGNAL);
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		} else if (ret <= 0) {
+			return NOK;
+		}
+		data += ret;
+		len -= ret;
+	}
+
+	return OK;
+}
+
+static void federation_link_down(unsigned int index, struct title_list *title_list)
+{
+	struct federation_peer *peer = &(peers[index]);
+	struct title_list_entry *tentry = NULL;
+
+	errorf("peer link %s:%u is down\n", peer->address, peer->port);
+
+	close(peer->fd);
+	peer->fd = -1;
+	federation_drop_batch(peer);
+
+	if (title_list) {
+		TAILQ_FOREACH(tentry, title_list, entries) {
+			tentry->peer_mask &= ~(1U << index);
+		}
+	}
+
+	if (!peer->configured) {
+		peer->used = false;
+	}
+}
+
+static int federation_pack(struct federation_peer *peer, struct _packet *packet)
+{
+	FILE *fp = NULL;
+
+	if ((fp = federation_batch(peer)) == NULL || sipc_pack_packet(packet, fp) == NOK) {
+		errorf("packing for the peer %s:%u failed\n", peer->address, peer->port);
+		peer->stats.errors++;
+		return NOK;
+	}
+	peer->batch_count++;
+
+	return OK;
+}
+
+static int federation_pack_interest(struct federation_peer *peer, char *payload, size_t size)
+{
+	struct _packet packet;
+
+	memset(&packet, 0, sizeof(struct _packet));
+	packet.packet_type = PEER_INTEREST;
+	packet.priority = PRIORITY_HIGH;
+	packet.title = DUMMY_STRING;
+	packet.title_size = strlen(DUMMY_STRING) + 1;
+	packet.payload = payload;
+	packet.payload_size = size;
+
+	return federation_pack(peer, &packet);
+}
+
+/*
+ * a new link learns everything which is advertised so far, later changes are
+ * sent to all links by federation_sync_interest()
+ */
+static int federation_send_full_interest(struct federation_peer *peer, struct title_list *title_list)
+{
+	int ret = OK;
+	char *buffer = NULL;
+	size_t size = 0;
+	FILE *fp = NULL;
+	struct title_list_entry *tentry = NULL;
+
+	if ((fp = open_memstream(&buffer, &size)) == NULL) {
+		errorf("open_memstream() failed with %d: %s\n", errno, strerror(errno));
+		return NOK;
+	}
+
+	fputc(FEDERATION_INTEREST_RESET, fp);
+	fputc('\0', fp);
+	TAILQ_FOREACH(tentry, title_list, entries) {
+		if (tentry->advertised) {
+			fputc(FEDERATION_INTEREST_ADD, fp);
+			fwrite(tentry->title, strlen(tentry->title) + 1, 1, fp);
+		}
+	}
+
+	FCLOSE(fp);
+	if (!buffer) {
+		return NOK;
+	}
+
+	ret = federation_pack_interest(peer, buffer, size);
+	FREE(buffer);
+
+	return ret;
+}
+
+/*
+ * the link sends its PEER_HELLO first, then it carries packets without the
+ * trailing client port
+ */
+static int federation_link_up(unsigned int index, int fd, struct title_list *title_list)
+{
+	struct timeval tv = { .tv_sec = FEDERATION_IO_TIMEOUT, .tv_usec = 0 };
+	struct federation_peer *peer = &(peers[index]);
+
+	(void) setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	(void) setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	if (keepalive) {
+		(void) sipc_socket_keepalive(fd, keepalive);
+	}
+
+	peer->fd = fd;
+	peer->stats.links_up++;
+	federation_drop_batch(peer);
+
+	federation_sync_interest(title_list);
+	if (federation_send_full_interest(peer, title_list) == NOK) {
+		errorf("federation_send_full_interest() failed\n");
+		return NOK;
+	}
+
+	debugf("peer link %s:%u is up\n", peer->address, peer->port);
+
+	return OK;
+}
+
+static int federation_connect_peer(unsigned int index, struct title_list *title_list)
+{
+	int fd = -1;
+	unsigned int port = 0;
+	struct timeval tv = { .tv_sec = FEDERATION_IO_TIMEOUT, .tv_usec = 0 };
+	struct sockaddr_storage address;
+	struct _packet packet;
+	struct federation_peer *peer = &(peers[index]);
+
+	memset(&address, 0, sizeof(address));
+	memset(&packet, 0, sizeof(struct _packet));
+
+	if (sipc_buf_to_sockstorage(peer->address, peer->port, &address) == NOK) {
+		errorf("sipc_buf_to_sockstorage() failed\n");
+		return NOK;
+	}
+
+	if ((fd = sipc_socket_open_use_sockaddr((struct sockaddr *)&address, SOCK_STREAM, 0)) == -1) {
+		errorf("socket() failed with %d: %s\n", errno, strerror(errno));
+		return NOK;
+	}
+
+	//connect() gives up after the send timeout
+	(void) setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	if (sipc_connect_socket(fd, (struct sockaddr *)&address) < 0) {
+		errorf("connect() to the peer %s:%u failed with %d: %s\n", peer->address, peer->port, errno, strerror(errno));
+		goto fail;
+	}
+
+	packet.packet_type = PEER_HELLO;
+	packet.priority = PRIORITY_HIGH;
+	packet.title = DUMMY_STRING;
+	packet.title_size = strlen(DUMMY_STRING) + 1;
+
+	if (sipc_write_packet(&packet, fd) == NOK || send(fd, &port, sizeof(port), MSG_NOSIGNAL) != sizeof(port)) {
+		errorf("sending the hello to the peer %s:%u failed\n", peer->address, peer->port);
+		goto fail;
+	}
+
+	if (federation_link_up(index, fd, title_list) == NOK) {
+		federation_link_down(index, title_list);
+		return NOK;
+	}
+
+	return OK;
+
+fail:
+	close(fd);
+	peer->stats.errors++;
+
+	return NOK;
+}
+
+/*
+ * 'address:port', ipv6 addresses may be given in brackets
+ */
+int federation_add_peer(const char *peer)
+{
+	unsigned int i;
+	unsigned long port;
+	char buffer[INET6_ADDRSTRLEN + 8];
+	char *address = buffer;
+	char *ptr = NULL;
+	struct sockaddr_storage storage;
+
+	if (!peer) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	federation_init();
+
+	snprintf(buffer, sizeof(buffer), "%s", peer);
+	if ((ptr = strrchr(buffer, ':')) == NULL) {
+		errorf("peer '%s' should be given as address:port\n", peer);
+		return NOK;
+	}
+	*ptr++ = '\0';
+	port = strtoul(ptr, NULL, 10);
+
+	if (*address == '[') {
+		address++;
+		if ((ptr = strchr(address, ']')) != NULL) {
+			*ptr = '\0';
+		}
+	}
+
+	memset(&storage, 0, sizeof(storage));
+	if (!port || port > 65535 || sipc_buf_to_sockstorage(address, (unsigned short)port, &storage) == NOK) {
+		errorf("peer '%s' is not a valid address:port\n", peer);
+		return NOK;
+	}
+
+	for (i = 0; i < FEDERATION_MAX_PEERS; i++) {
+		if (!peers[i].used) {
+			peers[i].used = true;
+			peers[i].configured = true;
+			strncpy(peers[i].address, address, sizeof(peers[i].address) - 1);
+			peers[i].port = (unsigned short)port;
+			return OK;
+		}
+	}
+
+	errorf("at most %d peers are supported\n", FEDERATION_MAX_PEERS);
+
+	return NOK;
+}
+
+bool federation_has_down_peers(void)
+{
+	unsigned int i;
+
+	for (i = 0; peers_initialized && i < FEDERATION_MAX_PEERS; i++) {
+		if (peers[i].used && peers[i].configured && peers[i].fd < 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void federation_connect_peers(struct title_list *title_list)
+{
+	unsigned int i;
+	time_t now = time(NULL);
+
+	for (i = 0; peers_initialized && i < FEDERATION_MAX_PEERS; i++) {
+		if (!peers[i].used || !peers[i].configured || peers[i].fd >= 0 ||
+				now - peers[i].last_attempt < FEDERATION_RETRY_INTERVAL) {
+			continue;
+		}
+		peers[i].last_attempt = now;
+		(void) federation_connect_peer(i, title_list);
+	}
+}
+
+/*
+ * called for an accepted connection which sent PEER_HELLO, the caller should
+ * not close the connection after a successful return
+ */
+int federation_accept_link(int fd, struct title_list *title_list)
+{
+	unsigned int i;
+	struct sockaddr_storage address;
+	socklen_t len = sizeof(address);
+
+	if (fd < 0 || !title_list) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	federation_init();
+
+	for (i = 0; i < FEDERATION_MAX_PEERS; i++) {
+		if (!peers[i].used) {
+			break;
+		}
+	}
+
+	if (i == FEDERATION_MAX_PEERS) {
+		errorf("at most %d peers are supported, link refused\n", FEDERATION_MAX_PEERS);
+		return NOK;
+	}
+
+	memset(&(peers[i]), 0, sizeof(struct federation_peer));
+	peers[i].used = true;
+	peers[i].fd = -1;
+
+	memset(&address, 0, sizeof(address));
+	if (getpeername(fd, (struct sockaddr *)&address, &len) == 0) {
+		if (address.ss_family == AF_INET6) {
+			inet_ntop(AF_INET6, &(((struct sockaddr_in6 *)&address)->sin6_addr), peers[i].address, sizeof(peers[i].address));
+			peers[i].port = ntohs(((struct sockaddr_in6 *)&address)->sin6_port);
+		} else {
+			inet_ntop(AF_INET, &(((struct sockaddr_in *)&address)->sin_addr), peers[i].address, sizeof(peers[i].address));
+			peers[i].port = ntohs(((struct sockaddr_in *)&address)->sin_port);
+		}
+	}
+
+	if (federation_link_up(i, fd, title_list) == NOK) {
+		peers[i].fd = -1;
+		federation_drop_batch(&(peers[i]));
+		peers[i].used = false;
+		return NOK;
+	}
+
+	return OK;
+}
+
+bool federation_is_link(int fd)
+{
+	unsigned int i;
+
+	for (i = 0; peers_initialized && i < FEDERATION_MAX_PEERS; i++) {
+		if (peers[i].used && peers[i].fd == fd) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+int federation_fill_fd_set(fd_set *set, int max_fd)
+{
+	unsigned int i;
+
+	for (i = 0; peers_initialized && i < FEDERATION_MAX_PEERS; i++) {
+		if (peers[i].used && peers[i].fd >= 0) {
+			FD_SET(peers[i].fd, set);
+			if (peers[i].fd > max_fd) {
+				max_fd = peers[i].fd;
+			}
+		}
+	}
+
+	return max_fd;
+}
+
+/*
+ * '+title' data of the title is sent to the link from now on, the retained
+ * data is sent at once. data retained from another link is left to that link
+ */
+static void federation_apply_interest(unsigned int index, struct _packet *packet, struct title_list *title_list)
+{
+	char *ptr = packet->payload;
+	char *end = packet->payload + packet->payload_size;
+	struct title_list_entry *tentry = NULL;
+	struct retained_list_entry *rentry = NULL;
+	struct _packet retained;
+
+	while (ptr < end && *ptr) {
+		switch (*ptr) {
+			case FEDERATION_INTEREST_RESET:
+				TAILQ_FOREACH(tentry, title_list, entries) {
+					tentry->peer_mask &= ~(1U << index);
+				}
+				break;
+			case FEDERATION_INTEREST_ADD:
+				if ((tentry = find_entry_in_title_list(ptr + 1, title_list)) == NULL &&
+						(tentry = add_empty_entry_to_title_list(ptr + 1, title_list)) == NULL) {
+					errorf("add_empty_entry_to_title_list() failed\n");
+					break;
+				}
+				if (!tentry->peer_mask && interest_hook) {
+					interest_hook(tentry);
+				}
+				tentry->peer_mask |= 1U << index;
+				TAILQ_FOREACH(rentry, &(tentry->retained_list), entries) {
+					if (rentry->flags & PACKET_FLAG_PEER) {
+						continue;
+					}
+					memset(&retained, 0, sizeof(struct _packet));
+					retained.packet_type = SENDATA;
+					retained.priority = PRIORITY_NORMAL;
+					retained.flags = rentry->flags & ~PACKET_FLAG_TIMESTAMPS;
+					retained.title = tentry->title;
+					retained.title_size = strlen(tentry->title) + 1;
+					retained.key = rentry->key;
+					retained.key_size = rentry->key ? strlen(rentry->key) + 1 : 0;
+					retained.payload = rentry->data;
+					retained.payload_size = rentry->data_size;
+					if (federation_pack(&(peers[index]), &retained) == OK) {
+						peers[index].stats.msgs_out++;
+						peers[index].stats.bytes_out += rentry->data_size;
+					}
+				}
+				break;
+			case FEDERATION_INTEREST_REMOVE:
+				if ((tentry = find_entry_in_title_list(ptr + 1, title_list)) != NULL) {
+					tentry->peer_mask &= ~(1U << index);
+				}
+				break;
+			default:
+				break;
+		}
+		ptr += strnlen(ptr, end - ptr) + 1;
+	}
+}
+
+/*
+ * a readable link is read until it has no more data or the budget is spent.
+ * data packets are marked with PACKET_FLAG_PEER and queued like the packets
+ * of the clients
+ */
+static int federation_read_link(unsigned int index, struct title_list *title_list, struct packet_lanes *lanes,
+	federation_queue_cb queue)
+{
+	unsigned int budget = FEDERATION_READ_BUDGET;
+	struct pollfd pfd;
+	struct _packet packet;
+	struct federation_peer *peer = &(peers[index]);
+
+	pfd.fd = peer->fd;
+	pfd.events = POLLIN;
+
+	do {
+		memset(&packet, 0, sizeof(struct _packet));
+		if (sipc_read_packet(peer->fd, &packet) == NOK || !packet.title) {
+			sipc_free_packet(&packet);
+			return NOK;
+		}
+
+		switch (packet.packet_type) {
+			case PEER_INTEREST:
+				if (packet.payload) {
+					federation_apply_interest(index, &packet, title_list);
+				}
+				break;
+			case SENDATA:
+			case STREAM:
+				peer->stats.msgs_in++;
+				packet.flags |= PACKET_FLAG_PEER;
+				if (queue(&packet, title_list, lanes) == NOK) {
+					errorf("queueing the packet of the peer %s:%u failed\n", peer->address, peer->port);
+				}
+				break;
+			default:
+				debugf("packet type '%s' is not expected on a peer link\n", packet_type_beautiy(packet.packet_type));
+				break;
+		}
+
+		sipc_free_packet(&packet);
+	} while (--budget && poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN));
+
+	return OK;
+}
+
+void federation_read_links(fd_set *set, struct title_list *title_list, struct packet_lanes *lanes, federation_queue_cb queue)
+{
+	unsigned int i;
+
+	if (!set || !title_list || !lanes || !queue) {
+		errorf("args cannot be NULL\n");
+		return;
+	}
+
+	for (i = 0; peers_initialized && i < FEDERATION_MAX_PEERS; i++) {
+		if (!peers[i].used || peers[i].fd < 0 || !FD_ISSET(peers[i].fd, set)) {
+			continue;
+		}
+		if (federation_read_link(i, title_list, lanes, queue) == NOK) {
+			federation_link_down(i, title_list);
+		}
+	}
+}
+
+/*
+ * the hook is called when a title is wanted by a peer for the first time
+ */
+void federation_set_interest_hook(federation_interest_cb hook)
+{
+	interest_hook = hook;
+}
+
+/*
+ * a link to a host which is gone without closing it is found by the kernel
+ * after 'idle' seconds of silence, 0 leaves it to the system defaults
+ */
+void federation_set_keepalive(unsigned int idle)
+{
+	keepalive = idle;
+}
+
+void federation_mark_interest_dirty(void)
+{
+	interest_dirty = true;
+}
+
+/*
+ * titles which got their first or lost their last local subscriber are sent
+ * to all links in one PEER_INTEREST packet
+ */
+void federation_sync_interest(struct title_list *title_list)
+{
+	unsigned int i;
+	bool local;
+	char *buffer = NULL;
+	size_t size = 0;
+	FILE *fp = NULL;
+	struct title_list_entry *tentry = NULL;
+
+	if (!interest_dirty || !title_list) {
+		return;
+	}
+	interest_dirty = false;
+
+	if ((fp = open_memstream(&buffer, &size)) == NULL) {
+		errorf("open_memstream() failed with %d: %s\n", errno, strerror(errno));
+		return;
+	}
+
+	TAILQ_FOREACH(tentry, title_list, entries) {
+		local = !TAILQ_EMPTY(&(tentry->port_list));
+		if (local == tentry->advertised) {
+			continue;
+		}
+		tentry->advertised = local;
+		fputc(local ? FEDERATION_INTEREST_ADD : FEDERATION_INTEREST_REMOVE, fp);
+		fwrite(tentry->title, strlen(tentry->title) + 1, 1, fp);
+	}
+
+	FCLOSE(fp);
+
+	for (i = 0; size && buffer && peers_initialized && i < FEDERATION_MAX_PEERS; i++) {
+		if (peers[i].used && peers[i].fd >= 0) {
+			(void) federation_pack_interest(&(peers[i]), buffer, size + 1);
+		}
+	}
+
+	FREE(buffer);
+}
+
+void federation_forward(struct title_list_entry *tentry, struct _packet *packet)
+{
+	unsigned int i;
+
+	if (!tentry || !packet || !tentry->peer_mask || (packet->flags & PACKET_FLAG_PEER)) {
+		return;
+	}
+
+	for (i = 0; i < FEDERATION_MAX_PEERS; i++) {
+		if (!(tentry->peer_mask & (1U << i)) || !peers[i].used || peers[i].fd < 0) {
+			continue;
+		}
+		if (federation_pack(&(peers[i]), packet) == OK) {
+			peers[i].stats.msgs_out++;
+			peers[i].stats.bytes_out += packet->payload_size;
+		}
+	}
+}
+
+/*
+ * every link writes its batch with one send() call as far as the socket lets
+ */
+void federation_flush(struct title_list *title_list)
+{
+	unsigned int i;
+	struct federation_peer *peer = NULL;
+
+	for (i = 0; peers_initialized && i < FEDERATION_MAX_PEERS; i++) {
+		peer = &(peers[i]);
+		if (!peer->used || peer->fd < 0 || !peer->batch_count) {
+			continue;
+		}
+
+		FCLOSE(peer->batch);
+		if (!peer->batch_buffer || federation_send_all(peer->fd, peer->batch_buffer, peer->batch_size) == NOK) {
+			errorf("sending the batch to the peer %s:%u failed with %d: %s\n", peer->address, peer->port, errno, strerror(errno));
+			peer->stats.errors++;
+			federation_link_down(i, title_list);
+			continue;
+		}
+
+		peer->stats.batches++;
+		federation_drop_batch(peer);
+	}
+}
+
+void federation_print_stats(FILE *fp, struct title_list *title_list)
+{
+	unsigned int i, interest;
+	struct title_list_entry *tentry = NULL;
+
+	for (i = 0; fp && title_list && peers_initialized && i < FEDERATION_MAX_PEERS; i++) {
+		if (!peers[i].used) {
+			continue;
+		}
+		interest = 0;
+		TAILQ_FOREACH(tentry, title_list, entries) {
+			interest += (tentry->peer_mask >> i) & 1;
+		}
+		fprintf(fp, "peer port=%u up=%d outbound=%d interest=%u links_up=%lu msgs_in=%lu msgs_out=%lu bytes_out=%lu batches=%lu "
+			"errors=%lu name=%s\n", peers[i].port, peers[i].fd >= 0 ? 1 : 0, peers[i].configured ? 1 : 0, interest,
+			peers[i].stats.links_up, peers[i].stats.msgs_in, peers[i].stats.msgs_out, peers[i].stats.bytes_out,
+			peers[i].stats.batches, peers[i].stats.errors, peers[i].address);
+	}
+}
+
+void federation_destroy(void)
+{
+	unsigned int i;
+
+	for (i = 0; peers_initialized && i < FEDERATION_MAX_PEERS; i++) {
+		if (peers[i].fd >= 0) {
+			close(peers[i].fd);
+			peers[i].fd = -1;
+		}
+		federation_drop_batch(&(peers[i]));
+		peers[i].used = false;
+	}
+}
@@ -0,0 +1,449 @@
+#include "sipc_common.h"
+#include "sipc_pool.h"
+#include "sipc_routing.h"
+
+static struct sipc_slab port_slab = SIPC_SLAB_INITIALIZER(struct port_list_entry, SLAB_GROW_COUNT);
+static struct sipc_slab title_slab = SIPC_SLAB_INITIALIZER(struct title_list_entry, SLAB_GROW_COUNT);
+static struct sipc_slab retained_slab = SIPC_SLAB_INITIALIZER(struct retained_list_entry, SLAB_GROW_COUNT);
+
+struct title_list_entry *find_entry_in_title_list(char *title, struct title_list *title_list)
+{
+	struct title_list_entry *entry = NULL;
+
+	if (!title || !title_list) {
+		errorf("args cannot be NULL\n");
+		return NULL;
+	}
+
+	TAILQ_FOREACH(entry, title_list, entries) {
+		if (entry->title && strcmp(title, entry->title) == 0) {
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+bool is_port_int_the_list(unsigned int port, struct port_list *port_list)
+{
+	struct port_list_entry *entry = NULL;
+
+	if (!port_list || !port) {
+		errorf("args cannot be NULL\n");
+		return false;
+	}
+
+	TAILQ_FOREACH(entry, port_list, entries) {
+		if (entry->port == port) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+int add_new_entry_to_the_port_list(unsigned int port, struct port_list *port_list)
+{
+	struct port_list_entry *entry = NULL;
+
+	if (!port_list || !port) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	entry = (struct port_list_entry *)sipc_slab_alloc(&port_slab);
+	if (!entry) {
+		errorf("data is null\n");
+		return NOK;
+	}
+
+	entry->port = port;
+
+	TAILQ_INSERT_HEAD(port_list, entry, entries);
+
+	return OK;
+}
+
+struct title_list_entry *add_empty_entry_to_title_list(char *title, struct title_list *title_list)
+{
+	struct title_list_entry *entry = NULL;
+
+	if (!title || !title_list) {
+		errorf("args cannot be NULL\n");
+		return NULL;
+	}
+
+	entry = (struct title_list_entry *)sipc_slab_alloc(&title_slab);
+	if (!entry) {
+		errorf("data is null\n");
+		return NULL;
+	}
+
+	entry->title = sipc_pool_strdup(title);
+	if (!entry->title) {
+		errorf("sipc_pool_strdup() fail\n");
+		SLAB_FREE(&title_slab, entry);
+		return NULL;
+	}
+
+	TAILQ_INIT(&(entry->port_list));
+	TAILQ_INIT(&(entry->watcher_list));
+	TAILQ_INIT(&(entry->retained_list));
+
+	TAILQ_INSERT_HEAD(title_list, entry, entries);
+
+	return entry;
+}
+
+int add_new_entry_to_title_list(char *title, unsigned int port, struct title_list *title_list)
+{
+	struct title_list_entry *entry = NULL;
+
+	if (!title || !port || !title_list) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	if ((entry = add_empty_entry_to_title_list(title, title_list)) == NULL) {
+		errorf("add_empty_entry_to_title_list() failed\n");
+		return NOK;
+	}
+
+	if (add_new_entry_to_the_port_list(port, &(entry->port_list)) == NOK) {
+		errorf("add_new_entry_to_the_port_list() failed\n");
+		TAILQ_REMOVE(title_list, entry, entries);
+		POOL_FREE(entry->title);
+		SLAB_FREE(&title_slab, entry);
+		return NOK;
+	}
+
+	return OK;
+}
+
+int add_port_title_couple(char *title, unsigned int port, struct title_list *title_list)
+{
+	struct title_list_entry *entry = NULL;
+
+	if (!title || !port || !title_list) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	if ((entry = find_entry_in_title_list(title, title_list)) == NULL) {
+		debugf("add new entry to the title list\n");
+		return add_new_entry_to_title_list(title, port, title_list);
+	}
+
+	if (is_port_int_the_list(port, &(entry->port_list)) == false) {
+		if (add_new_entry_to_the_port_list(port, &(entry->port_list)) == NOK) {
+			errorf("add_new_entry_to_the_port_list() failed\n");
+			return NOK;
+		}
+		debugf("port %d is registered for the title '%s'\n", port, title);
+	} else {
+		debugf("port %d is already registered for the title '%s'\n", port, title);
+	}
+
+	return OK;
+}
+
+void port_data_structure_destroy(struct port_list *port_list)
+{
+	struct port_list_entry *entry1 = NULL;
+	struct port_list_entry *entry2 = NULL;
+
+	if (!port_list) {
+		errorf("args cannot be NULL\n");
+		return;
+	}
+
+	if (TAILQ_EMPTY(port_list)) {
+		return;
+	}
+
+	entry1 = TAILQ_FIRST(port_list);
+	while (entry1 != NULL) {
+		entry2 = TAILQ_NEXT(entry1, entries);
+		SLAB_FREE(&port_slab, entry1);
+		entry1 = entry2;
+	}
+
+	TAILQ_INIT(port_list); 
+}
+
+int remove_port_from_title(char *title, unsigned int port, struct title_list *title_list)
+{
+	struct title_list_entry *entry = NULL;
+	struct port_list_entry *pentry = NULL;
+
+	if (!title || !port || !title_list) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	if ((entry = find_entry_in_title_list(title, title_list)) == NULL) {
+		return OK;
+	}
+
+	if (TAILQ_EMPTY(&(entry->port_list))) {
+		return OK;
+	}
+
+	TAILQ_FOREACH(pentry, &(entry->port_list), entries) {
+		if (pentry && port == pentry->port) {
+			TAILQ_REMOVE(&(entry->port_list), pentry, entries);
+			SLAB_FREE(&port_slab, pentry);
+			break;
+		}
+	}
+
+	if (entry && TAILQ_EMPTY(&(entry->port_list))) {
+		TAILQ_INIT(&(entry->port_list));
+	}
+
+	return OK;
+}
+
+int remove_port_from_all_title(unsigned int port, struct title_list *title_list)
+{
+	struct title_list_entry *entry = NULL;
+	struct port_list_entry *pentry = NULL;
+
+	if (!port || !title_list) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	if (TAILQ_EMPTY(title_list)) {
+		return OK;
+	}
+
+	TAILQ_FOREACH(entry, title_list, entries) {
+		if (!entry || TAILQ_EMPTY(&(entry->port_list))) {
+			continue;
+		}
+		TAILQ_FOREACH(pentry, &(entry->port_list), entries) {
+			if (!pentry) {
+				continue;
+			}
+			if (port == pentry->port) {
+				TAILQ_REMOVE(&(entry->port_list), pentry, entries);
+				SLAB_FREE(&port_slab, pentry);
+				break;
+			}
+		}
+		if (entry && TAILQ_EMPTY(&(entry->port_list))) {
+			TAILQ_INIT(&(entry->port_list));
+		}
+	}
+
+	return OK;
+}
+
+void remove_watcher_from_all_title(unsigned int port, struct title_list *title_list)
+{
+	struct title_list_entry *entry = NULL;
+	struct port_list_entry *pentry = NULL;
+
+	if (!port || !title_list) {
+		errorf("args cannot be NULL\n");
+		return;
+	}
+
+	TAILQ_FOREACH(entry, title_list, entries) {
+		TAILQ_FOREACH(pentry, &(entry->watcher_list), entries) {
+			if (port == pentry->port) {
+				TAILQ_REMOVE(&(entry->watcher_list), pentry, entries);
+				SLAB_FREE(&port_slab, pentry);
+				break;
+			}
+		}
+	}
+}
+
+void retained_data_structure_destroy(struct retained_list *retained_list)
+{
+	struct retained_list_entry *entry1 = NULL;
+	struct retained_list_entry *entry2 = NULL;
+
+	if (!retained_list) {
+		errorf("args cannot be NULL\n");
+		return;
+	}
+
+	entry1 = TAILQ_FIRST(retained_list);
+	while (entry1 != NULL) {
+		entry2 = TAILQ_NEXT(entry1, entries);
+		POOL_FREE(entry1->key);
+		POOL_FREE(entry1->data);
+		SLAB_FREE(&retained_slab, entry1);
+		entry1 = entry2;
+	}
+
+	TAILQ_INIT(retained_list);
+}
+
+struct retained_list_entry *find_entry_in_retained_list(char *key, struct retained_list *retained_list)
+{
+	struct retained_list_entry *entry = NULL;
+
+	if (!retained_list) {
+		errorf("args cannot be NULL\n");
+		return NULL;
+	}
+
+	if (!key) {
+		return TAILQ_FIRST(retained_list);
+	}
+
+	TAILQ_FOREACH(entry, retained_list, entries) {
+		if (entry->key && strcmp(key, entry->key) == 0) {
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * only the latest data of a title is retained, conflated titles retain the
+ * latest data per key. the old data is replaced in place
+ */
+int retain_data(struct title_list_entry *tentry, char *key, char *data, unsigned int len, unsigned char flags)
+{
+	char *new_data = NULL;
+	struct retained_list_entry *entry = NULL;
+
+	if (!tentry || !data) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	if (!tentry->conflate) {
+		key = NULL;
+	}
+
+	new_data = (char *)sipc_pool_alloc(len + 1);
+	if (!new_data) {
+		errorf("sipc_pool_alloc() failed\n");
+		return NOK;
+	}
+	memcpy(new_data, data, len);
+	new_data[len] = '\0';
+
+	if ((entry = find_entry_in_retained_list(key, &(tentry->retained_list))) != NULL) {
+		POOL_FREE(entry->data);
+		entry->data = new_data;
+		entry->data_size = len;
+		entry->flags = flags;
+		return OK;
+	}
+
+	entry = (struct retained_list_entry *)sipc_slab_alloc(&retained_slab);
+	if (!entry) {
+		errorf("sipc_slab_alloc() failed\n");
+		POOL_FREE(new_data);
+		return NOK;
+	}
+
+	if (key) {
+		entry->key = sipc_pool_strdup(key);
+		if (!entry->key) {
+			errorf("sipc_pool_strdup() failed\n");
+			POOL_FREE(new_data);
+			SLAB_FREE(&retained_slab, entry);
+			return NOK;
+		}
+	}
+	entry->data = new_data;
+	entry->data_size = len;
+	entry->flags = flags;
+
+	TAILQ_INSERT_TAIL(&(tentry->retained_list), entry, entries);
+
+	return OK;
+}
+
+int set_title_conflation(char *title, bool enable, struct title_list *title_list)
+{
+	struct title_list_entry *entry = NULL;
+
+	if (!title || !title_list) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	if ((entry = find_entry_in_title_list(title, title_list)) == NULL) {
+		if (!enable) {
+			return OK;
+		}
+		if ((entry = add_empty_entry_to_title_list(title, title_list)) == NULL) {
+			errorf("add_empty_entry_to_title_list() failed\n");
+			return NOK;
+		}
+	}
+
+	if (entry->conflate != enable) {
+		retained_data_structure_destroy(&(entry->retained_list));
+	}
+
+	entry->conflate = enable;
+	debugf("conflation for the title '%s' is %s\n", title, enable ? "enabled" : "disabled");
+
+	return OK;
+}
+
+unsigned int next_available_port(bool *available_ports)
+{
+	unsigned int i = 0;
+
+	if (!available_ports) {
+		return 0;
+	}
+
+	for (i = 0; i < BACKLOG; i++) {
+		if (available_ports[i] == false) {
+			return i + STARTING_PORT;
+		}
+	}
+
+	return 0;
+}
+
+void title_data_structure_destroy(struct title_list *title_list)
+{
+	struct title_list_entry *entry1 = NULL;
+	struct title_list_entry *entry2 = NULL;
+
+	if (!title_list) {
+		errorf("args cannot be NULL\n");
+		return;
+	}
+
+	if (TAILQ_EMPTY(title_list)) {
+		return;
+	}
+
+	entry1 = TAILQ_FIRST(title_list);
+	while (entry1 != NULL) {
+		entry2 = TAILQ_NEXT(entry1, entries);
+		POOL_FREE(entry1->title);
+		port_data_structure_destroy(&(entry1->port_list));
+		port_data_structure_destroy(&(entry1->watcher_list));
+		retained_data_structure_destroy(&(entry1->retained_list));
+		SLAB_FREE(&title_slab, entry1);
+		entry1 = entry2;
+	}
+
+	TAILQ_INIT(title_list); 
+}
+
+/*
+ * releases the slabs, all tables should be destroyed before
+ */
+void sipc_routing_destroy(void)
+{
+	sipc_slab_destroy(&retained_slab);
+	sipc_slab_destroy(&title_slab);
+	sipc_slab_destroy(&port_slab);
+}
@@ -0,0 +1,482 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sipc_common.h"
+#include "sipc_routing.h"
+#include "sipc_snapshot.h"
+
+static struct snapshot_header *snapshot = NULL;
+static int snapshot_fd = -1;
+static char *snapshot_path = NULL;
+static struct title_list *snapshot_titles = NULL;
+static bool *snapshot_ports = NULL;
+
+static size_t snapshot_record_length(size_t title_size)
+{
+	return (sizeof(struct snapshot_record) + title_size + SNAPSHOT_ALIGN - 1) & ~((size_t)SNAPSHOT_ALIGN - 1);
+}
+
+static void snapshot_unmap(void)
+{
+	if (snapshot) {
+		munmap(snapshot, snapshot->size);
+		snapshot = NULL;
+	}
+
+	if (snapshot_fd >= 0) {
+		close(snapshot_fd);
+		snapshot_fd = -1;
+	}
+}
+
+/*
+ * the record is written first and published by moving the end offset, so a
+ * record cut in the middle is never replayed
+ */
+static int snapshot_write_record(struct snapshot_header *header, enum snapshot_op op, unsigned int port, unsigned char value,
+	const char *title)
+{
+	size_t title_size = title ? strlen(title) + 1 : 0;
+	size_t length = snapshot_record_length(title_size);
+	struct snapshot_record *record = NULL;
+
+	if (title_size > 0xFFFF) {
+		errorf("title is too long for the snapshot\n");
+		return NOK;
+	}
+
+	if (header->end + length > header->size) {
+		return NOK;
+	}
+
+	record = (struct snapshot_record *)((char *)header + header->end);
+	memset(record, 0, length);
+	record->length = (unsigned int)length;
+	record->port = port;
+	record->op = (unsigned char)op;
+	record->value = value;
+	record->title_size = (unsigned short)title_size;
+	if (title_size) {
+		memcpy(record->title, title, title_size);
+	}
+
+	__atomic_store_n(&(header->end), header->end + length, __ATOMIC_RELEASE);
+
+	return OK;
+}
+
+static size_t snapshot_needed_size(void)
+{
+	unsigned int i;
+	size_t size = sizeof(struct snapshot_header);
+	struct title_list_entry *tentry = NULL;
+	struct port_list_entry *pentry = NULL;
+
+	TAILQ_FOREACH(tentry, snapshot_titles, entries) {
+		if (tentry->conflate) {
+			size += snapshot_record_length(strlen(tentry->title) + 1);
+		}
+		TAILQ_FOREACH(pentry, &(tentry->port_list), entries) {
+			size += snapshot_record_length(strlen(tentry->title) + 1);
+		}
+	}
+
+	for (i = 0; i < BACKLOG; i++) {
+		if (snapshot_ports[i]) {
+			size += snapshot_record_length(0);
+		}
+	}
+
+	return size;
+}
+
+static int snapshot_write_tables(struct snapshot_header *header)
+{
+	unsigned int i;
+	struct title_list_entry *tentry = NULL;
+	struct port_list_entry *pentry = NULL;
+
+	for (i = 0; i < BACKLOG; i++) {
+		if (snapshot_ports[i] && snapshot_write_record(header, SNAPSHOT_RESERVE_PORT, i + STARTING_PORT, 0, NULL) == NOK) {
+			return NOK;
+		}
+	}
+
+	TAILQ_FOREACH(tentry, snapshot_titles, entries) {
+		if (tentry->conflate && snapshot_write_record(header, SNAPSHOT_CONFLATE, 0, 1, tentry->title) == NOK) {
+			return NOK;
+		}
+		TAILQ_FOREACH(pentry, &(tentry->port_list), entries) {
+			if (snapshot_write_record(header, SNAPSHOT_REGISTER, pentry->port, 0, tentry->title) == NOK) {
+				return NOK;
+			}
+		}
+	}
+
+	return OK;
+}
+
+/*
+ * the current tables are written to a new file which replaces the old one by
+ * rename(), a crash in the middle leaves the old file as it is
+ */
+static int snapshot_compact(void)
+{
+	int fd = -1;
+	size_t size = 0;
+	long page = sysconf(_SC_PAGESIZE);
+	char *temp_path = NULL;
+	struct snapshot_header *header = MAP_FAILED;
+
+	size = snapshot_needed_size() * 2;
+	if (size < SNAPSHOT_MIN_SIZE) {
+		size = SNAPSHOT_MIN_SIZE;
+	}
+	size = (size + page - 1) & ~((size_t)page - 1);
+
+	if ((temp_path = (char *)malloc(strlen(snapshot_path) + sizeof(".tmp"))) == NULL) {
+		errorf("malloc failed\n");
+		goto fail;
+	}
+	sprintf(temp_path, "%s.tmp", snapshot_path);
+
+	if ((fd = open(temp_path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+		errorf("open() failed for '%s' with %d: %s\n", temp_path, errno, strerror(errno));
+		goto fail;
+	}
+
+	if (ftruncate(fd, size) < 0) {
+		errorf("ftruncate() failed with %d: %s\n", errno, strerror(errno));
+		goto fail;
+	}
+
+	header = (struct snapshot_header *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (header == MAP_FAILED) {
+		errorf("mmap() failed with %d: %s\n", errno, strerror(errno));
+		goto fail;
+	}
+
+	header->magic = SNAPSHOT_MAGIC;
+	header->version = SNAPSHOT_VERSION;
+	header->daemon_port = sipc_daemon_port();
+	header->backlog = BACKLOG;
+	header->size = size;
+	header->end = sizeof(struct snapshot_header);
+
+	if (snapshot_write_tables(header) == NOK) {
+		errorf("snapshot_write_tables() failed\n");
+		goto fail;
+	}
+
+	if (rename(temp_path, snapshot_path) < 0) {
+		errorf("rename() failed with %d: %s\n", errno, strerror(errno));
+		goto fail;
+	}
+
+	snapshot_unmap();
+	snapshot = header;
+	snapshot_fd = fd;
+	FREE(temp_path);
+
+	debugf("snapshot '%s' is rewritten with %llu bytes\n", snapshot_path, header->end);
+
+	return OK;
+
+fail:
+	if (header != MAP_FAILED) {
+		munmap(header, size);
+	}
+	if (fd >= 0) {
+		close(fd);
+	}
+	if (temp_path) {
+		unlink(temp_path);
+	}
+	FREE(temp_path);
+
+	return NOK;
+}
+
+static void snapshot_append(enum snapshot_op op, unsigned int port, unsigned char value, char *title)
+{
+	if (!snapshot) {
+		return;
+	}
+
+	if (snapshot_write_record(snapshot, op, port, value, title) == OK) {
+		return;
+	}
+
+	//the tables are changed already, a rewrite has this record too
+	if (snapshot_compact() == NOK) {
+		errorf("snapshot_compact() failed, snapshot is disabled\n");
+		snapshot_unmap();
+	}
+}
+
+static int snapshot_apply(struct snapshot_record *record)
+{
+	char *title = record->title_size ? record->title : NULL;
+
+	switch (record->op) {
+		case SNAPSHOT_REGISTER:
+			if (!title || add_port_title_couple(title, record->port, snapshot_titles) == NOK) {
+				return NOK;
+			}
+			if (IS_OWN_PORT(record->port)) {
+				snapshot_ports[record->port - STARTING_PORT] = true;
+			}
+			break;
+		case SNAPSHOT_UNREGISTER:
+			if (!title || remove_port_from_title(title, record->port, snapshot_titles) == NOK) {
+				return NOK;
+			}
+			if (IS_OWN_PORT(record->port)) {
+				snapshot_ports[record->port - STARTING_PORT] = false;
+			}
+			break;
+		case SNAPSHOT_UNREGISTER_ALL:
+			if (remove_port_from_all_title(record->port, snapshot_titles) == NOK) {
+				return NOK;
+			}
+			if (IS_OWN_PORT(record->port)) {
+				snapshot_ports[record->port - STARTING_PORT] = false;
+			}
+			break;
+		case SNAPSHOT_RESERVE_PORT:
+			if (!IS_OWN_PORT(record->port)) {
+				return NOK;
+			}
+			snapshot_ports[record->port - STARTING_PORT] = true;
+			break;
+		case SNAPSHOT_CONFLATE:
+			if (!title || set_title_conflation(title, record->value != 0, snapshot_titles) == NOK) {
+				return NOK;
+			}
+			break;
+		default:
+			return NOK;
+	}
+
+	return OK;
+}
+
+static void snapshot_replay(struct snapshot_header *header)
+{
+	unsigned int count = 0;
+	unsigned long long offset = sizeof(struct snapshot_header);
+	struct snapshot_record *record = NULL;
+
+	while (offset + sizeof(struct snapshot_record) <= header->end) {
+		record = (struct snapshot_record *)((char *)header + offset);
+		if (record->length < sizeof(struct snapshot_record) || offset + record->length > header->end ||
+			record->length != snapshot_record_length(record->title_size) ||
+			(record->title_size && record->title[record->title_size - 1] != '\0')) {
+			errorf("snapshot record at %llu is broken, the rest is ignored\n", offset);
+			break;
+		}
+
+		if (snapshot_apply(record) == NOK) {
+			errorf("snapshot record at %llu cannot be applied\n", offset);
+		}
+
+		offset += record->length;
+		count++;
+	}
+
+	debugf("%u records of the snapshot are loaded\n", count);
+}
+
+/*
+ * a PING is sent instead of closing the connection at once, the listener of
+ * a client gives up on a connection without a packet
+ */
+static bool snapshot_port_alive(unsigned int port)
+{
+	int fd = -1;
+	bool alive = false;
+	struct sockaddr_storage address;
+	struct _packet packet;
+
+	memset(&address, 0, sizeof(address));
+	memset(&packet, 0, sizeof(packet));
+
+	if (sipc_buf_to_sockstorage(IPV6_LOOPBACK_ADDR, port, &address) == NOK) {
+		return false;
+	}
+
+	if ((fd = sipc_socket_open_use_buf(IPV6_LOOPBACK_ADDR, SOCK_STREAM, 0)) == -1) {
+		return false;
+	}
+
+	if (sipc_connect_socket(fd, (struct sockaddr *)&address) < 0) {
+		goto out;
+	}
+
+	packet.title = DUMMY_STRING;
+	packet.title_size = strlen(DUMMY_STRING) + 1;
+	packet.packet_type = PING;
+	packet.priority = PRIORITY_NORMAL;
+
+	alive = sipc_write_packet(&packet, fd) == OK;
+
+out:
+	close(fd);
+
+	return alive;
+}
+
+/*
+ * every port of the loaded tables is probed once, the ones without a
+ * listener are removed as if their clients unregistered everything
+ */
+static void snapshot_drop_dead_ports(void)
+{
+	unsigned int i, alive = 0, dead = 0;
+	unsigned char *state = NULL;			//0 not probed, 1 alive, 2 dead
+	struct title_list_entry *tentry = NULL;
+	struct port_list_entry *pentry = NULL;
+
+	if ((state = (unsigned char *)calloc(65536, sizeof(unsigned char))) == NULL) {
+		errorf("calloc failed\n");
+		return;
+	}
+
+	for (i = 0; i < BACKLOG; i++) {
+		if (snapshot_ports[i]) {
+			state[i + STARTING_PORT] = snapshot_port_alive(i + STARTING_PORT) ? 1 : 2;
+		}
+	}
+
+	TAILQ_FOREACH(tentry, snapshot_titles, entries) {
+		TAILQ_FOREACH(pentry, &(tentry->port_list), entries) {
+			if (pentry->port < 65536 && !state[pentry->port]) {
+				state[pentry->port] = snapshot_port_alive(pentry->port) ? 1 : 2;
+			}
+		}
+	}
+
+	for (i = 1; i < 65536; i++) {
+		if (state[i] == 1) {
+			alive++;
+		} else if (state[i] == 2) {
+			dead++;
+			remove_port_from_all_title(i, snapshot_titles);
+			if (IS_OWN_PORT(i)) {
+				snapshot_ports[i - STARTING_PORT] = false;
+			}
+		}
+	}
+
+	debugf("%u ports of the snapshot are alive, %u are dropped\n", alive, dead);
+
+	FREE(state);
+}
+
+static void snapshot_load(void)
+{
+	int fd = -1;
+	struct stat st;
+	struct snapshot_header *header = MAP_FAILED;
+
+	if ((fd = open(snapshot_path, O_RDONLY)) < 0) {
+		debugf("there is no snapshot at '%s'\n", snapshot_path);
+		return;
+	}
+
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct snapshot_header)) {
+		errorf("snapshot '%s' is too small, it is ignored\n", snapshot_path);
+		goto out;
+	}
+
+	header = (struct snapshot_header *)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (header == MAP_FAILED) {
+		errorf("mmap() failed with %d: %s\n", errno, strerror(errno));
+		goto out;
+	}
+
+	if (header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION || header->backlog != BACKLOG ||
+		header->size != (unsigned long long)st.st_size || header->end > header->size) {
+		errorf("snapshot '%s' is not valid, it is ignored\n", snapshot_path);
+		goto out;
+	}
+
+	//the ports of the clients follow the port of sipcd
+	if (header->daemon_port != sipc_daemon_port()) {
+		errorf("snapshot '%s' belongs to the sipcd on %u, it is ignored\n", snapshot_path, header->daemon_port);
+		goto out;
+	}
+
+	snapshot_replay(header);
+	snapshot_drop_dead_ports();
+
+out:
+	if (header != MAP_FAILED) {
+		munmap(header, st.st_size);
+	}
+	close(fd);
+}
+
+/*
+ * loads the given snapshot into the empty tables and keeps it up to date
+ * from now on
+ */
+int snapshot_open(const char *path, struct title_list *title_list, bool *available_ports)
+{
+	if (!path || !title_list || !available_ports) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	if ((snapshot_path = strdup(path)) == NULL) {
+		errorf("strdup failed\n");
+		return NOK;
+	}
+	snapshot_titles = title_list;
+	snapshot_ports = available_ports;
+
+	snapshot_load();
+
+	if (snapshot_compact() == NOK) {
+		errorf("snapshot_compact() failed\n");
+		FREE(snapshot_path);
+		return NOK;
+	}
+
+	return OK;
+}
+
+void snapshot_register(char *title, unsigned int port)
+{
+	snapshot_append(SNAPSHOT_REGISTER, port, 0, title);
+}
+
+void snapshot_unregister(char *title, unsigned int port)
+{
+	snapshot_append(SNAPSHOT_UNREGISTER, port, 0, title);
+}
+
+void snapshot_unregister_all(unsigned int port)
+{
+	snapshot_append(SNAPSHOT_UNREGISTER_ALL, port, 0, NULL);
+}
+
+void snapshot_reserve_port(unsigned int port)
+{
+	snapshot_append(SNAPSHOT_RESERVE_PORT, port, 0, NULL);
+}
+
+void snapshot_conflate(char *title, bool enable)
+{
+	snapshot_append(SNAPSHOT_CONFLATE, 0, enable ? 1 : 0, title);
+}
+
+/*
+ * the file stays, it is loaded by the next sipcd
+ */
+void snapshot_close(void)
+{
+	snapshot_unmap();
+	FREE(snapshot_path);
+}
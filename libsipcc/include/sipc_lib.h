@@ -3,12 +3,118 @@
 
 #include "sipc_common.h"
 
+#define SIPC_LATENCY_BUCKETS	40
+
+/*
+ * every sipcd in use is pinged by a background thread. when one is lost, it
+ * is tried again with a growing delay, and the data sent to it meanwhile waits
+ * in a buffer bounded by size and age. once it answers, the titles of this
+ * client are registered to it again with one REGISTER_BULK. the buffer is
+ * flushed SIPC_RECONNECT_MAX_MS later, when the other clients of that sipcd
+ * have registered again too, so the buffered data finds its subscribers
+ */
+#define SIPC_HEARTBEAT_MS		1000
+#define SIPC_HEARTBEAT_TIMEOUT	2		//seconds to wait for the answer of a ping
+#define SIPC_RECONNECT_MIN_MS	100
+#define SIPC_RECONNECT_MAX_MS	2000
+#define SIPC_SUPERVISOR_TICK_MS	100
+#define SIPC_SEND_BUFFER_BYTES	(4 * 1024 * 1024)
+#define SIPC_SEND_BUFFER_MS		10000
+
+enum sipc_latency_stage
+{
+	LATENCY_TO_DAEMON,
+	LATENCY_IN_DAEMON,
+	LATENCY_FROM_DAEMON,
+	LATENCY_END_TO_END,
+	LATENCY_STAGE_COUNT
+};
+
+/*
+ * log2 histogram, bucket 'i' counts the latencies in [2^i, 2^(i+1)) nanoseconds
+ */
+struct sipc_latency_histogram
+{
+	unsigned long count;
+	unsigned long long sum;
+	unsigned long long max;
+	unsigned long buckets[SIPC_LATENCY_BUCKETS];
+};
+
+/*
+ * one title of sipc_register_many()
+ */
+struct sipc_registration
+{
+	char *title;
+	int (*callback)(void *, unsigned int);
+};
+
+/*
+ * an endpoint with its own port, listener thread and callbacks. the calls
+ * without a context use a default one, a process can create more to receive
+ * on several threads, eg one per worker
+ */
+struct sipc_ctx;
+
+int sipc_set_daemon_ports(const char *ports);
 int sipc_destroy(void);
 int sipc_unregister(char *title);
 int sipc_broadcast_unregister(void);
 int sipc_send_bradcast_data(void *data, unsigned int len, ...);
 int sipc_send_data(char *title, void *data, unsigned int len, ...);
+int sipc_send_keyed_data(char *title, char *key, void *data, unsigned int len, ...);
+int sipc_set_conflation(char *title, bool enable);
+int sipc_set_priority(char *title, enum _packet_priority priority);
+int sipc_set_compression(char *title, bool enable);
+int sipc_set_timestamps(char *title, bool enable);
+int sipc_set_direct(char *title, bool enable);
+int sipc_set_datagram(char *title, bool enable);
+int sipc_set_receive_mode(enum sipc_wait_mode mode, unsigned int spin_us, int cpu);
 int sipc_broadcast_register(int (*callback)(void *, unsigned int), ...);
 int sipc_register(char *title, int (*callback)(void *, unsigned int), ...);
+int sipc_register_many(struct sipc_registration *registrations, unsigned int count, ...);
+int sipc_register_loaned(char *title, int (*callback)(const void *, unsigned int), ...);
+int sipc_buffer_retain(const void *data);
+int sipc_buffer_release(const void *data);
+int sipc_register_timed(char *title, int (*callback)(void *, unsigned int, const struct sipc_timestamps *), ...);
+int sipc_register_schema(char *title, unsigned int schema_id, int (*callback)(const void *, unsigned int, unsigned int), ...);
+int sipc_send_schema(char *title, unsigned int schema_id, const void *message, unsigned int size, ...);
+int sipc_register_datagram(char *title, int (*callback)(void *, unsigned int, unsigned long long, unsigned long), ...);
+int sipc_get_latency_histogram(char *title, enum sipc_latency_stage stage, struct sipc_latency_histogram *histogram);
+unsigned long long sipc_latency_percentile(const struct sipc_latency_histogram *histogram, double percentile);
+
+struct sipc_stream;
+
+int sipc_stream_register(char *title, int (*callback)(unsigned int, unsigned long long, void *, unsigned int, bool), ...);
+struct sipc_stream *sipc_stream_open(char *title);
+int sipc_stream_write(struct sipc_stream *stream, void *data, unsigned int len);
+int sipc_stream_close(struct sipc_stream *stream);
+
+struct sipc_ctx *sipc_ctx_create(void);
+int sipc_ctx_destroy(struct sipc_ctx *ctx);
+int sipc_ctx_register(struct sipc_ctx *ctx, char *title, int (*callback)(void *, unsigned int), ...);
+int sipc_ctx_register_many(struct sipc_ctx *ctx, struct sipc_registration *registrations, unsigned int count, ...);
+int sipc_ctx_register_loaned(struct sipc_ctx *ctx, char *title, int (*callback)(const void *, unsigned int), ...);
+int sipc_ctx_register_timed(struct sipc_ctx *ctx, char *title, int (*callback)(void *, unsigned int, const struct sipc_timestamps *), ...);
+int sipc_ctx_register_schema(struct sipc_ctx *ctx, char *title, unsigned int schema_id, int (*callback)(const void *, unsigned int, unsigned int), ...);
+int sipc_ctx_send_schema(struct sipc_ctx *ctx, char *title, unsigned int schema_id, const void *message, unsigned int size, ...);
+int sipc_ctx_register_datagram(struct sipc_ctx *ctx, char *title, int (*callback)(void *, unsigned int, unsigned long long, unsigned long), ...);
+int sipc_ctx_stream_register(struct sipc_ctx *ctx, char *title, int (*callback)(unsigned int, unsigned long long, void *, unsigned int, bool), ...);
+int sipc_ctx_broadcast_register(struct sipc_ctx *ctx, int (*callback)(void *, unsigned int), ...);
+int sipc_ctx_unregister(struct sipc_ctx *ctx, char *title);
+int sipc_ctx_broadcast_unregister(struct sipc_ctx *ctx);
+int sipc_ctx_send_data(struct sipc_ctx *ctx, char *title, void *data, unsigned int len, ...);
+int sipc_ctx_send_keyed_data(struct sipc_ctx *ctx, char *title, char *key, void *data, unsigned int len, ...);
+int sipc_ctx_send_broadcast_data(struct sipc_ctx *ctx, void *data, unsigned int len, ...);
+int sipc_ctx_set_conflation(struct sipc_ctx *ctx, char *title, bool enable);
+int sipc_ctx_set_priority(struct sipc_ctx *ctx, char *title, enum _packet_priority priority);
+int sipc_ctx_set_compression(struct sipc_ctx *ctx, char *title, bool enable);
+int sipc_ctx_set_timestamps(struct sipc_ctx *ctx, char *title, bool enable);
+int sipc_ctx_set_direct(struct sipc_ctx *ctx, char *title, bool enable);
+int sipc_ctx_set_datagram(struct sipc_ctx *ctx, char *title, bool enable);
+int sipc_ctx_set_receive_mode(struct sipc_ctx *ctx, enum sipc_wait_mode mode, unsigned int spin_us, int cpu);
+int sipc_ctx_get_latency_histogram(struct sipc_ctx *ctx, char *title, enum sipc_latency_stage stage, struct sipc_latency_histogram *histogram);
+struct sipc_stream *sipc_ctx_stream_open(struct sipc_ctx *ctx, char *title);
 
 #endif //__SIPC_LIB_
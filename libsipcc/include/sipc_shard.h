@@ -0,0 +1,38 @@
+#ifndef __SIPC_SHARD_
+#define __SIPC_SHARD_
+
+#include "sipc_common.h"
+
+/*
+ * titles are spread over several sipcd instances of the same host by
+ * consistent hashing. every sipcd is a shard and owns the titles whose hash
+ * falls into its arcs of the ring, the publishers and the subscribers of a
+ * title meet on the same sipcd since all of them compute the same shard.
+ * adding a shard to the list moves about 1/n of the titles only. the shards
+ * are given as a comma separated list of sipcd ports with SIPC_DAEMON_PORTS
+ * or sipc_set_daemon_ports(), without them sipc_daemon_port() is the only
+ * shard
+ */
+
+#define SHARD_MAX			16
+#define SHARD_VIRTUAL_NODES	64		//points of a shard on the ring
+
+struct shard_point {
+	unsigned int hash;
+	unsigned int shard;
+};
+
+struct shard_ring {
+	unsigned int count;
+	unsigned short ports[SHARD_MAX];
+	unsigned int point_count;
+	struct shard_point points[SHARD_MAX * SHARD_VIRTUAL_NODES];
+};
+
+int sipc_shard_configure(const char *ports);
+unsigned int sipc_shard_of(const char *title);
+unsigned short sipc_shard_port(const char *title);
+unsigned int sipc_shard_count(void);
+unsigned short sipc_shard_port_at(unsigned int shard);
+
+#endif //__SIPC_SHARD_
@@ -1,71 +1,240 @@
 #include "sipc_common.h"
+#include "sipc_compress.h"
+#include "sipc_pool.h"
+#include "sipc_lib.h"
+#include "sipc_shard.h"
+#include "sipc_timer.h"
 
-struct callback_list_entry {
+struct sipc_callbacks {
 	int (*callback)(void *, unsigned int);
+	int (*stream_callback)(unsigned int, unsigned long long, void *, unsigned int, bool);
+	int (*loaned_callback)(const void *, unsigned int);
+	int (*timed_callback)(void *, unsigned int, const struct sipc_timestamps *);
+	int (*schema_callback)(const void *, unsigned int, unsigned int);
+	int (*datagram_callback)(void *, unsigned int, unsigned long long, unsigned long);
+	unsigned int schema_id;			//of the schema callback
+};
+
+#define DATAGRAM_MAX_SOURCES	8		//publishers of a datagram title followed by a receiver
+
+struct datagram_source {
+	unsigned int port;				//of the publisher, 0 if the slot is free
+	unsigned long long next;		//sequence expected from it
+};
+
+#define STREAM_MAX_SOURCES		8		//streams of a title put in order by a receiver at the same time
+#define STREAM_REORDER_WINDOW	8		//chunks of a stream held while an earlier one is on the way
+
+struct stream_source {
+	unsigned int stream_id;			//0 if the slot is free
+	unsigned long long next;		//offset expected from it
+	unsigned int held;
+	char *chunks[STREAM_REORDER_WINDOW];	//payloads which came before the expected one
+	unsigned int sizes[STREAM_REORDER_WINDOW];
+};
+
+struct callback_list_entry {
+	struct sipc_callbacks callbacks;
+	struct sipc_latency_histogram latency[LATENCY_STAGE_COUNT];
+	struct datagram_source sources[DATAGRAM_MAX_SOURCES];
+	unsigned int source_victim;		//slot taken by the next new publisher when all are used
+	struct stream_source *streams;	//STREAM_MAX_SOURCES of them, allocated with the first chunk
+	unsigned int stream_victim;
+	unsigned int refs;				//the list and the listener while it runs the callback
 	char *title;
 	TAILQ_ENTRY(callback_list_entry) entries;
 };
 
 TAILQ_HEAD(callback_list, callback_list_entry);
 
-struct sipc_identifier
+struct option_list_entry {
+	char *title;
+	unsigned char priority;
+	bool compress;
+	bool timestamps;
+	bool direct;
+	bool datagram;
+	unsigned long long sequence;	//of the last datagram of the title
+	struct _packet *report;			//last data sent directly, sipcd hears of it at the next tick
+	unsigned int report_msgs;
+	unsigned long long report_bytes;
+	TAILQ_ENTRY(option_list_entry) entries;
+};
+
+TAILQ_HEAD(option_list, option_list_entry);
+
+struct sipc_stream
+{
+	struct sipc_ctx *ctx;
+	char *title;
+	unsigned int stream_id;
+	unsigned int flags;
+	unsigned long long offset;
+	unsigned int len;
+	char *chunk;
+};
+
+struct pending_list_entry {
+	unsigned int shard;
+	unsigned long long queued;
+	char *data;						//packed packet and the port of this client
+	size_t size;
+	TAILQ_ENTRY(pending_list_entry) entries;
+};
+
+TAILQ_HEAD(pending_list, pending_list_entry);
+
+struct direct_list_entry {
+	char *title;
+	unsigned int shard;
+	bool direct;					//false if the data has to pass through sipcd
+	unsigned int count;
+	unsigned int *ports;			//of the subscribers
+	TAILQ_ENTRY(direct_list_entry) entries;
+};
+
+TAILQ_HEAD(direct_list, direct_list_entry);
+
+struct daemon_link {
+	bool lost;
+	unsigned long long instance;	//from the answers of the pings
+	unsigned long long back_since;	//registered again, the buffer waits for the other clients
+	unsigned int backoff_ms;
+	unsigned long long next_check;
+};
+
+/*
+ * everything of an endpoint, sipc_ctx_create() gives a new one and the calls
+ * without a context use the default one. every context has its own port,
+ * listener thread and supervisor, so the data of several contexts is received
+ * by their threads in parallel
+ */
+struct sipc_ctx
 {
 	bool server_started;
+	bool supervisor_started;
+	bool supervisor_stop;
 	unsigned int port;
+	int listen_fd;
+	int datagram_fd;				//udp socket of the port, -1 if it is not open
+	int cpu;						//of the listener thread, -1 if it is not pinned
+	struct sipc_waiter waiter;		//how the listener thread waits for the data
+	unsigned int stream_count;
+	pthread_t server_thread;
+	pthread_t supervisor_thread;
 	struct callback_list callback_list;
+	struct option_list option_list;
+	pthread_mutex_t lock;			//callback list, links and pending list against the supervisor
+	struct daemon_link links[SHARD_MAX];
+	bool shard_used[SHARD_MAX];		//something is registered to the sipcd of the shard
+	struct pending_list pending_list;
+	size_t pending_bytes;
+	unsigned long pending_dropped;
+	struct direct_list direct_list;
+	unsigned long direct_generation;	//changed by every invalidation, a late lookup answer is not cached
+	struct sipc_idle_table listener_idle;
 };
 
-typedef struct sipc_identifier _sipc_identifier;
+static struct sipc_ctx identifier = {
+	.listen_fd = -1,
+	.datagram_fd = -1,
+	.cpu = -1,
+	.callback_list = TAILQ_HEAD_INITIALIZER(identifier.callback_list),
+	.option_list = TAILQ_HEAD_INITIALIZER(identifier.option_list),
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.pending_list = TAILQ_HEAD_INITIALIZER(identifier.pending_list),
+	.direct_list = TAILQ_HEAD_INITIALIZER(identifier.direct_list),
+};
 
-static _sipc_identifier identifier;
+static unsigned int started_contexts;
 
-static int sipc_send_packet(struct _packet *packet, int fd)
+static int sipc_connect_loopback(unsigned int port)
 {
-	if (!packet || !packet->title || fd < 0) {
-		errorf("args cannot be NULL\n");
-		return NOK;
+	int fd = -1;
+	struct sockaddr_storage address;
+
+	memset((void *)&address, 0, sizeof(address));
+
+	if (sipc_buf_to_sockstorage(IPV6_LOOPBACK_ADDR, port, &address) == NOK) {
+		errorf("sipc_buf_to_sockstorage() failed\n");
+		return -1;
 	}
 
-	errno = 0;
-	if (send(fd, &packet->packet_type, sizeof(packet->packet_type), MSG_NOSIGNAL) == -1) {
-		errorf("send() failed with %d: %s\n", errno, strerror(errno));
-		return NOK;
+	if ((fd = sipc_socket_open_use_buf(IPV6_LOOPBACK_ADDR, SOCK_STREAM, 0)) == -1) {
+		return -1;
 	}
 
-	errno = 0;
-	if (send(fd, &packet->title_size, sizeof(packet->title_size), MSG_NOSIGNAL) == -1) {
-		errorf("send() failed with %d: %s\n", errno, strerror(errno));
-		return NOK;
+	if (sipc_connect_socket(fd, (struct sockaddr *)&address) < 0) {
+		close(fd);
+		return -1;
 	}
 
-	errno = 0;
-	if (packet->title_size && send(fd, packet->title, packet->title_size, MSG_NOSIGNAL) == -1) {
-		errorf("send() failed with %d: %s\n", errno, strerror(errno));
+	return fd;
+}
+
+static int sipc_send_packet(struct sipc_ctx *ctx, struct _packet *packet, int fd)
+{
+	if (sipc_write_packet(packet, fd) == NOK) {
+		errorf("sipc_write_packet() failed\n");
 		return NOK;
 	}
 
 	errno = 0;
-	if (send(fd, &packet->payload_size, sizeof(packet->payload_size), MSG_NOSIGNAL) == -1) {
+	if (send(fd, &(ctx->port), sizeof(ctx->port), MSG_NOSIGNAL) == -1) {
 		errorf("send() failed with %d: %s\n", errno, strerror(errno));
 		return NOK;
 	}
 
-	errno = 0;
-	if (packet->payload_size && packet->payload && send(fd, packet->payload, packet->payload_size, MSG_NOSIGNAL) == -1) {
-		errorf("send() failed with %d: %s\n", errno, strerror(errno));
-		return NOK;
+	return OK;
+}
+
+static void free_direct_entry(struct direct_list_entry *entry)
+{
+	if (!entry) {
+		return;
 	}
 
-	errno = 0;
-	if (send(fd, &(identifier.port), sizeof(identifier.port), MSG_NOSIGNAL) == -1) {
-		errorf("send() failed with %d: %s\n", errno, strerror(errno));
-		return NOK;
+	FREE(entry->title);
+	FREE(entry->ports);
+	FREE(entry);
+}
+
+/*
+ * should be called with the lock held. all the titles of the shard are
+ * dropped if the title is NULL
+ */
+static void delete_direct_entries(struct sipc_ctx *ctx, char *title, unsigned int shard)
+{
+	struct direct_list_entry *entry1 = NULL;
+	struct direct_list_entry *entry2 = NULL;
+
+	entry1 = TAILQ_FIRST(&(ctx->direct_list));
+	while (entry1 != NULL) {
+		entry2 = TAILQ_NEXT(entry1, entries);
+		if (title ? strcmp(entry1->title, title) == 0 : entry1->shard == shard) {
+			TAILQ_REMOVE(&(ctx->direct_list), entry1, entries);
+			free_direct_entry(entry1);
+		}
+		entry1 = entry2;
 	}
 
-	return OK;
+	ctx->direct_generation++;
+}
+
+static void delete_all_direct_list(struct sipc_ctx *ctx)
+{
+	struct direct_list_entry *entry = NULL;
+
+	pthread_mutex_lock(&(ctx->lock));
+	while ((entry = TAILQ_FIRST(&(ctx->direct_list))) != NULL) {
+		TAILQ_REMOVE(&(ctx->direct_list), entry, entries);
+		free_direct_entry(entry);
+	}
+	ctx->direct_generation++;
+	pthread_mutex_unlock(&(ctx->lock));
 }
 
-static struct callback_list_entry * find_callback(char *title)
+static struct callback_list_entry * find_callback(struct sipc_ctx *ctx, char *title)
 {
 	struct callback_list_entry *entry = NULL;
 
@@ -74,7 +243,7 @@ static struct callback_list_entry * find_callback(char *title)
 		return NULL;
 	}
 
-	TAILQ_FOREACH(entry, &(identifier.callback_list), entries) {
+	TAILQ_FOREACH(entry, &(ctx->callback_list), entries) {
 		if (entry->title && strcmp(entry->title, title) == 0) {
 			return entry;
 		}
@@ -83,95 +252,155 @@ static struct callback_list_entry * find_callback(char *title)
 	return NULL;
 }
 
-static int delete_all_callback_list(void)
+/*
+ * called with ctx->lock, an entry which the listener runs is freed by the
+ * listener when its callback returns
+ */
+static void free_stream_source(struct stream_source *source)
+{
+	unsigned int i;
+
+	for (i = 0; i < source->held; i++) {
+		POOL_FREE(source->chunks[i]);
+	}
+
+	memset(source, 0, sizeof(struct stream_source));
+}
+
+static void put_callback(struct callback_list_entry *entry)
+{
+	unsigned int i;
+
+	if (--entry->refs == 0) {
+		for (i = 0; entry->streams && i < STREAM_MAX_SOURCES; i++) {
+			free_stream_source(&(entry->streams[i]));
+		}
+		FREE(entry->streams);
+		FREE(entry->title);
+		FREE(entry);
+	}
+}
+
+static int delete_all_callback_list(struct sipc_ctx *ctx)
 {
 	struct callback_list_entry *entry1 = NULL;
 	struct callback_list_entry *entry2 = NULL;
 
-	entry1 = TAILQ_FIRST(&(identifier.callback_list));
+	entry1 = TAILQ_FIRST(&(ctx->callback_list));
 	while (entry1 != NULL) {
 		entry2 = TAILQ_NEXT(entry1, entries);
-		FREE(entry1->title);
-		FREE(entry1);
+		put_callback(entry1);
 		entry1 = entry2;
 	}
 
-	TAILQ_INIT(&(identifier.callback_list)); 
+	TAILQ_INIT(&(ctx->callback_list)); 
 
 	return OK;
 }
 
-static int sipc_read_data(int sockfd, bool *destroy)
+/*
+ * the header of a datagram title is taken out of the payload, the data comes
+ * over udp, or over tcp if the publisher has no udp socket
+ */
+static int sipc_take_datagram_header(struct _packet *packet)
 {
-	int ret = OK;
-	struct _packet packet;
-	struct callback_list_entry *entry = NULL;
+	struct sipc_datagram_header header;
 
-	if (sockfd < 0 || !destroy) {
-		errorf("args cannot be NULL\n");
-		goto fail;
+	if (!(packet->flags & PACKET_FLAG_DATAGRAM)) {
+		return OK;
 	}
 
-	memset(&packet, 0, sizeof(struct _packet));
-
-	errno = 0;
-	if (recv(sockfd, &packet.packet_type, sizeof(packet.packet_type), 0) < 0) {
-		errorf("recv error from socket %d, errno: %d\n", sockfd, errno);
-		goto fail;
+	if (!packet->payload || packet->payload_size < sizeof(header) + 1) {
+		errorf("datagram of the title '%s' has no header\n", packet->title);
+		return NOK;
 	}
 
-	errno = 0;
-	if (recv(sockfd, &packet.title_size, sizeof(packet.title_size), 0) < 0) {
-		errorf("recv error from socket %d, errno: %d\n", sockfd, errno);
-		goto fail;
-	}
+	memcpy(&header, packet->payload, sizeof(header));
+	packet->payload_size -= sizeof(header);
+	memmove(packet->payload, packet->payload + sizeof(header), packet->payload_size);
+	packet->port = header.port;
+	packet->sequence = header.sequence;
 
-	if (!packet.title_size) {
-		errorf("packet title size should be greater than zero\n");
-		goto out;
-	}
-	packet.title = (char *)calloc(packet.title_size, sizeof(char));
-	if (!packet.title) {
-		errorf("calloc failed\n");
-		goto fail;
-	}
-	errno = 0;
-	if (recv(sockfd, packet.title, packet.title_size, 0) < 0) {
-		errorf("recv error from socket %d, errno: %d\n", sockfd, errno);
-		goto fail;
-	}
+	return OK;
+}
 
-	errno = 0;
-	if (recv(sockfd, &packet.payload_size, sizeof(packet.payload_size), 0) < 0) {
-		errorf("recv error from socket %d, errno: %d\n", sockfd, errno);
-		goto fail;
+/*
+ * the packet is moved into the lanes or handled at once, the caller frees
+ * what is left
+ */
+static int sipc_take_packet(struct sipc_ctx *ctx, struct _packet *packet, bool *destroy, struct packet_lanes *lanes)
+{
+	if (packet->flags & PACKET_FLAG_TIMESTAMPS) {
+		packet->timestamps.client_receive = sipc_monotonic_ns();
 	}
 
-	if (!packet.payload_size) {
-		goto proceed;
+	if (sipc_take_datagram_header(packet) == NOK) {
+		errorf("data of the title '%s' is dropped\n", packet->title);
+		return OK;
 	}
 
-	packet.payload = (char *)calloc(packet.payload_size + 1, sizeof(char));
-	if (!packet.payload) {
-		errorf("calloc failed\n");
-		goto fail;
+	if ((packet->packet_type == SENDATA || packet->packet_type == STREAM) && packet->payload && packet->payload_size) {
+		if (sipc_lanes_push(lanes, packet, 0) == NOK) {
+			errorf("sipc_lanes_push() failed\n");
+			return NOK;
+		}
+	} else if (packet->packet_type == INVALIDATE) {
+		debugf("subscribers of the title '%s' changed\n", packet->title);
+		pthread_mutex_lock(&(ctx->lock));
+		delete_direct_entries(ctx, packet->title, 0);
+		pthread_mutex_unlock(&(ctx->lock));
+	} else if (packet->packet_type == DESTROY) {
+		debugf("thread wants to be destroyed\n");
+		*destroy = true;
 	}
-	errno = 0;
-	if (recv(sockfd, packet.payload, packet.payload_size, 0) < 0) {
-		errorf("recv error from socket %d, errno: %d\n", sockfd, errno);
+
+	return OK;
+}
+
+/*
+ * the packets which have come completely are read without blocking, see
+ * struct sipc_conn_buffer. sipcd sends the retained data of many titles and
+ * the broadcast and the conflated data in one connection, at most
+ * LANE_DRAIN_BUDGET packets are read at a time so the other connections are
+ * not starved. *eof is set when the sender has closed it
+ */
+static int sipc_read_data(struct sipc_ctx *ctx, int sockfd, struct sipc_conn_buffer *conn, bool *destroy, bool *eof,
+	struct packet_lanes *lanes)
+{
+	int ret = OK;
+	unsigned int budget = LANE_DRAIN_BUDGET;
+	size_t packet_size = 0;
+	struct _packet wire;
+	struct _packet packet;
+
+	memset(&packet, 0, sizeof(struct _packet));
+
+	if (sockfd < 0 || !conn || !destroy || !eof || !lanes) {
+		errorf("args cannot be NULL\n");
 		goto fail;
 	}
 
-proceed:
-	if (packet.packet_type == SENDATA && packet.payload && packet.payload_size) {
-		if ((entry = find_callback(packet.title)) == NULL) {
-			errorf("cannot find callback\n");
+	while (budget-- && !*eof && !*destroy) {
+		errno = 0;
+		if (sipc_conn_fill(sockfd, conn, 0, &packet_size, eof) == NOK) {
+			errorf("recv error from socket %d, errno: %d\n", sockfd, errno);
 			goto fail;
 		}
-		entry->callback(packet.payload, packet.payload_size);
-	} else if (packet.packet_type == DESTROY) {
-		debugf("thread wants to be destroyed\n");
-		*destroy = true;
+
+		if (!packet_size) {
+			break;
+		}
+
+		if (sipc_unpack_packet(conn->buffer, packet_size, &wire) == NOK || sipc_copy_packet(&wire, &packet) == NOK) {
+			errorf("invalid packet from socket %d\n", sockfd);
+			goto fail;
+		}
+		sipc_conn_next(conn);
+
+		if (sipc_take_packet(ctx, &packet, destroy, lanes) == NOK) {
+			goto fail;
+		}
+		sipc_free_packet(&packet);
 	}
 
 	goto out;
@@ -180,487 +409,2965 @@ fail:
 	ret = NOK;
 
 out:
-	FREE(packet.title);
-	FREE(packet.payload);
+	sipc_free_packet(&packet);
 
 	return ret;
 }
 
-static void *sipc_create_server(void *arg)
+/*
+ * the title and the payload of a datagram are copied out of the receive
+ * buffer, the packet is then the same as the one read over tcp
+ */
+static int sipc_copy_datagram(char *buffer, size_t size, struct _packet *packet)
 {
-	unsigned int port = 0;
-	int enable = 1;
-	int listen_fd, conn_fd, max_fd = 1, ret_val, i;
-	bool destroy_reuested = false;
-	struct sockaddr_storage client_addr, server_addr;
-	char c_ip_addr[INET6_ADDRSTRLEN] = {0};
-	fd_set backup_set, client_set;
-	struct timeval tv;
+	struct _packet datagram;
 
-	if (!(unsigned int *)arg) {
-		errorf("arg is null\n");
-		goto out;
+	if (sipc_unpack_packet(buffer, size, &datagram) == NOK || datagram.packet_type != SENDATA ||
+			!(datagram.flags & PACKET_FLAG_DATAGRAM) || !datagram.payload) {
+		return NOK;
 	}
 
-	port = *((unsigned int *)arg);
-	memset(c_ip_addr, 0, sizeof(c_ip_addr));
-	memset(&server_addr, 0, sizeof(server_addr));
-	memset(&client_addr, 0, sizeof(client_addr));
-
-	if (sipc_fill_wildcard_sockstorage(port, AF_UNSPEC, &server_addr) != 0) {
-		errorf("sipc_fill_wildcard_sockstorage() failed\n");
-		goto out;
-	}
+	return sipc_copy_packet(&datagram, packet);
+}
 
-	if ((listen_fd = sipc_socket_open_use_sockaddr((struct sockaddr *)&server_addr, SOCK_STREAM, 0)) == -1) {
-		errorf("sipc_socket_open_use_sockaddr() failed\n");
-		goto out;
-	}
+/*
+ * one block for the receive buffers, it is taken with the first datagram
+ */
+static int sipc_datagram_buffers(char **block, char **buffers)
+{
+	unsigned int i;
 
-	if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR , &enable, sizeof(int)) < 0) {
-		errorf("setsockopt reuseport fail\n");
-		goto out;
+	if (*block) {
+		return OK;
 	}
 
-	if (sipc_bind_socket(listen_fd, (struct sockaddr *)&server_addr) == -1) {
-		errorf("sipc_bind_socket() failed\n");
-		goto out;
+	if ((*block = (char *)malloc(DATAGRAM_BATCH * (DATAGRAM_MAX_SIZE + 1))) == NULL) {
+		errorf("malloc failed\n");
+		return NOK;
 	}
 
-	if (sipc_socket_listen(listen_fd, BACKLOG) == -1) {
-		errorf("sipc_socket_listen() failed\n");
-		goto out;
+	for (i = 0; i < DATAGRAM_BATCH; i++) {
+		buffers[i] = *block + i * (DATAGRAM_MAX_SIZE + 1);
 	}
 
-	FD_ZERO(&backup_set);
-	max_fd = listen_fd;
-	FD_SET(listen_fd, &backup_set);
-	tv.tv_usec = 0;
+	return OK;
+}
 
-	while (!destroy_reuested) {
-		tv.tv_sec = RECEIVE_TIMEOUT;
-		memcpy(&client_set, &backup_set, sizeof(backup_set));
+/*
+ * the datagrams which are waiting are read with one recvmmsg(), a datagram
+ * which cannot be parsed is dropped
+ */
+static int sipc_read_datagrams(struct sipc_ctx *ctx, char **buffers, struct packet_lanes *lanes)
+{
+	int i, count;
+	size_t lengths[DATAGRAM_BATCH];
+	struct _packet packet;
 
-		ret_val = select(max_fd + 1, &client_set, NULL, NULL, &tv);
+	if ((count = sipc_recv_datagrams(ctx->datagram_fd, buffers, DATAGRAM_MAX_SIZE + 1, lengths, DATAGRAM_BATCH)) < 0) {
+		errorf("sipc_recv_datagrams() failed with %d: %s\n", errno, strerror(errno));
+		return NOK;
+	}
 
-		if (ret_val < 0) {
-			errorf("select error\n");
-			continue;
-		} else if (ret_val == 0) {
-			for (i = 0; i <= max_fd; i++) {
-				if (FD_ISSET(i, &backup_set) && i != listen_fd) {
-						close(i);
-						FD_CLR(i, &backup_set);
-				}
-			}
-			max_fd = listen_fd;
+	for (i = 0; i < count; i++) {
+		if (lengths[i] > DATAGRAM_MAX_SIZE || sipc_copy_datagram(buffers[i], lengths[i], &packet) == NOK) {
+			debugf("invalid datagram is dropped\n");
 			continue;
 		}
 
-		if (FD_ISSET(listen_fd, &client_set)) {
-			conn_fd = sipc_socket_accept(listen_fd, &client_addr);
-			if (conn_fd < 0) {
-				if (errno == EINTR) {
-					debugf("CRS interrupted, try to accept again\n");
-					continue;
-				}
-				errorf("accept error\n");
-				goto out;
-			}
-
-			FD_SET(conn_fd, &backup_set);
-			if (conn_fd > max_fd) {
-				max_fd = conn_fd;
-			}
-			continue;
+		if (packet.flags & PACKET_FLAG_TIMESTAMPS) {
+			packet.timestamps.client_receive = sipc_monotonic_ns();
 		}
 
-		for (i = 0; i <= max_fd; i++) {
-			if (FD_ISSET(i, &client_set) && i != listen_fd) {
-				if (sipc_read_data(i, &destroy_reuested) == NOK) {
-					errorf("sipc_read_data() failed\n");
-					goto out;
-				}
-				close(i);
-				FD_CLR(i, &backup_set);
-			}
+		if (sipc_take_datagram_header(&packet) == NOK || sipc_lanes_push(lanes, &packet, 0) == NOK) {
+			errorf("datagram of the title '%s' is dropped\n", packet.title);
 		}
+		sipc_free_packet(&packet);
 	}
 
-out:
-	for (i = 0; i <= max_fd; i++) {
-		close(i);
-		FD_CLR(i, &backup_set);
-	}
-
-	debugf("thread destroyed\n");
-	pthread_exit(NULL);
-
-	return NULL;
+	return OK;
 }
 
-static void create_server_thread(void)
+static int sipc_decompress_packet(struct _packet *packet)
 {
-	pthread_t thread_id;
-	pthread_attr_t thread_attr;
+	char *data = NULL;
+	unsigned int size = 0, cap = 0;
 
-	if (pthread_attr_init(&thread_attr) != 0) {
-		errorf("pthread_attr_init failure.\n");
-		goto fail;
+	if (!packet || !packet->payload) {
+		errorf("args cannot be NULL\n");
+		return NOK;
 	}
 
-	if (pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED) != 0 ) {
-		errorf("pthread_attr_setdetachstate failure.\n");
-		goto fail;
+	if (!(packet->flags & PACKET_FLAG_COMPRESSED)) {
+		return OK;
 	}
 
-	errno = 0;
-	if (pthread_create(&thread_id, &thread_attr, sipc_create_server, (void *)(&(identifier.port))) != 0) {
-		errorf("pthread_create failure, errno: %d\n", errno);
-		goto fail;
+	if (sipc_decompressed_size(packet->payload, packet->payload_size, &size) == NOK) {
+		errorf("sipc_decompressed_size() failed\n");
+		return NOK;
 	}
 
-	identifier.server_started = true;
+	//sipc_decompressed_size() keeps 'size' below COMPRESS_MAX_SIZE, so 'cap' does not wrap
+	cap = size + 1;
+	data = (char *)sipc_pool_alloc(cap);
+	if (!data) {
+		errorf("sipc_pool_alloc() failed\n");
+		return NOK;
+	}
 
-	goto out;
+	//the last byte of the buffer is kept for the trailing null
+	if (sipc_decompress(packet->payload, packet->payload_size, data, cap - 1, &size) == NOK) {
+		errorf("sipc_decompress() failed\n");
+		POOL_FREE(data);
+		return NOK;
+	}
+	data[size] = '\0';
 
-fail:
-	errorf("create_server_thread() failed\n");
+	POOL_FREE(packet->payload);
+	packet->payload = data;
+	packet->payload_size = size;
+	packet->flags &= ~PACKET_FLAG_COMPRESSED;
 
-out:
-	return;
+	return OK;
 }
 
-static int delete_callback_from_callback_list(char *title)
+static void record_latency(struct sipc_latency_histogram *histogram, unsigned long long from, unsigned long long to)
 {
-	struct callback_list_entry *entry = NULL;
+	unsigned int bucket = 0;
+	unsigned long long latency = 0;
 
-	if (!title) {
-		errorf("args cannot be NULL\n");
-		return NOK;
+	if (!from || to < from) {
+		return;
 	}
 
-	if (!(&(identifier.callback_list)) || TAILQ_EMPTY(&(identifier.callback_list))) {
-		return OK;
+	latency = to - from;
+	if (latency) {
+		bucket = 63 - __builtin_clzll(latency);
 	}
-
-	TAILQ_FOREACH(entry, &(identifier.callback_list), entries) {
-		if (entry && entry->title && strcmp(title, entry->title) == 0) {
-			TAILQ_REMOVE(&(identifier.callback_list), entry, entries);
-			FREE(entry->title);
-			FREE(entry);
-			break;
-		}
+	if (bucket >= SIPC_LATENCY_BUCKETS) {
+		bucket = SIPC_LATENCY_BUCKETS - 1;
 	}
 
-	if ((&(identifier.callback_list)) && TAILQ_EMPTY(&(identifier.callback_list))) {
-		TAILQ_INIT(&(identifier.callback_list));
+	//only the listener thread writes, atomics let other threads read it anytime
+	__atomic_add_fetch(&(histogram->buckets[bucket]), 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&(histogram->sum), latency, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&(histogram->count), 1, __ATOMIC_RELAXED);
+	if (latency > __atomic_load_n(&(histogram->max), __ATOMIC_RELAXED)) {
+		__atomic_store_n(&(histogram->max), latency, __ATOMIC_RELAXED);
 	}
+}
 
-	return OK;
+static void record_latencies(struct callback_list_entry *entry, struct sipc_timestamps *timestamps)
+{
+	record_latency(&(entry->latency[LATENCY_TO_DAEMON]), timestamps->publish, timestamps->daemon_receive);
+	record_latency(&(entry->latency[LATENCY_IN_DAEMON]), timestamps->daemon_receive, timestamps->daemon_forward);
+	record_latency(&(entry->latency[LATENCY_FROM_DAEMON]), timestamps->daemon_forward, timestamps->client_receive);
+	record_latency(&(entry->latency[LATENCY_END_TO_END]), timestamps->publish, timestamps->client_receive);
 }
 
-static int find_callback_in_callback_list(int (*callback)(void *, unsigned int), char *title)
+/*
+ * the message is taken if it is the message of the callback, in its version
+ * or a newer one. a newer version only appends fields, so the callback reads
+ * the fields it knows in place
+ */
+static int sipc_check_schema(struct callback_list_entry *entry, struct _packet *packet, struct sipc_schema_header *header)
 {
-	struct callback_list_entry *entry = NULL;
+	unsigned int registered = entry->callbacks.schema_id;
 
-	if (!callback || !title) {
-		errorf("args cannot be NULL\n");
+	if (!(packet->flags & PACKET_FLAG_SCHEMA) || packet->payload_size < sizeof(struct sipc_schema_header)) {
+		errorf("data of the title '%s' has no schema\n", packet->title);
 		return NOK;
 	}
 
-	TAILQ_FOREACH(entry, &(identifier.callback_list), entries) {
-		if (entry->title && strcmp(title, entry->title) == 0) {
-			entry->callback = callback; //edit callback
-			return OK;
-		}
+	memcpy(header, packet->payload, sizeof(struct sipc_schema_header));
+
+	if (header->size > packet->payload_size - sizeof(struct sipc_schema_header)) {
+		errorf("message of the title '%s' is cut\n", packet->title);
+		return NOK;
+	}
+
+	if (SIPC_SCHEMA_MESSAGE(header->schema_id) != SIPC_SCHEMA_MESSAGE(registered) ||
+			SIPC_SCHEMA_VERSION(header->schema_id) < SIPC_SCHEMA_VERSION(registered)) {
+		errorf("message %u version %u of the title '%s' does not fit message %u version %u\n",
+			SIPC_SCHEMA_MESSAGE(header->schema_id), SIPC_SCHEMA_VERSION(header->schema_id), packet->title,
+			SIPC_SCHEMA_MESSAGE(registered), SIPC_SCHEMA_VERSION(registered));
+		return NOK;
+	}
+
+	return OK;
+}
+
+/*
+ * 'lost' is the number of the datagrams missing before this one from its
+ * publisher. a late datagram is NOK, the sequence 1 is a restarted publisher
+ */
+static int sipc_check_sequence(struct callback_list_entry *entry, struct _packet *packet, unsigned long *lost)
+{
+	unsigned int i;
+	struct datagram_source *source = NULL;
+
+	*lost = 0;
+
+	for (i = 0; i < DATAGRAM_MAX_SOURCES && !source; i++) {
+		if (entry->sources[i].port == packet->port) {
+			source = &(entry->sources[i]);
+		}
+	}
+
+	//the first datagram of a publisher counts no loss before it
+	for (i = 0; i < DATAGRAM_MAX_SOURCES && !source; i++) {
+		if (!entry->sources[i].port) {
+			source = &(entry->sources[i]);
+		}
+	}
+	if (!source) {
+		source = &(entry->sources[entry->source_victim]);
+		entry->source_victim = (entry->source_victim + 1) % DATAGRAM_MAX_SOURCES;
+	}
+	if (source->port != packet->port || packet->sequence == 1) {
+		source->port = packet->port;
+		source->next = packet->sequence;
+	}
+
+	if (packet->sequence < source->next) {
+		return NOK;
+	}
+
+	*lost = packet->sequence - source->next;
+	source->next = packet->sequence + 1;
+
+	return OK;
+}
+
+static struct stream_source *sipc_find_stream(struct callback_list_entry *entry, unsigned int stream_id)
+{
+	unsigned int i;
+	struct stream_source *source = NULL;
+
+	if (!entry->streams) {
+		entry->streams = (struct stream_source *)calloc(STREAM_MAX_SOURCES, sizeof(struct stream_source));
+		if (!entry->streams) {
+			errorf("calloc failed\n");
+			return NULL;
+		}
+	}
+
+	for (i = 0; i < STREAM_MAX_SOURCES && !source; i++) {
+		if (entry->streams[i].stream_id == stream_id) {
+			source = &(entry->streams[i]);
+		}
+	}
+
+	//every stream starts at the offset 0, even if its first chunk is still on the way
+	for (i = 0; i < STREAM_MAX_SOURCES && !source; i++) {
+		if (!entry->streams[i].stream_id) {
+			source = &(entry->streams[i]);
+		}
+	}
+	if (!source) {
+		source = &(entry->streams[entry->stream_victim]);
+		entry->stream_victim = (entry->stream_victim + 1) % STREAM_MAX_SOURCES;
+		errorf("too many streams of the title, the held chunks of the stream %u are dropped\n", source->stream_id);
+		free_stream_source(source);
+	}
+	if (!source->stream_id) {
+		source->stream_id = stream_id;
+		source->next = 0;
+	}
+
+	return source;
+}
+
+/*
+ * stream chunk payload is the header, the data and the trailing null. the
+ * payload is freed here, the stream may be done after its callback
+ */
+static void sipc_deliver_chunk(struct callback_list_entry *entry, struct stream_source *source, char *payload,
+	unsigned int size)
+{
+	struct _stream_chunk_header header;
+
+	memcpy(&header, payload, sizeof(header));
+	source->next = header.offset + size - sizeof(header) - 1;
+
+	if (entry->callbacks.stream_callback) {
+		entry->callbacks.stream_callback(header.stream_id, header.offset, payload + sizeof(header), size - sizeof(header) - 1,
+			(header.flags & STREAM_CHUNK_LAST) != 0);
+	}
+	POOL_FREE(payload);
+
+	if (header.flags & STREAM_CHUNK_LAST) {
+		free_stream_source(source);
+	}
+}
+
+/*
+ * the held chunk with the lowest offset, -1 if nothing is held
+ */
+static int sipc_first_held_chunk(struct stream_source *source)
+{
+	int first = -1;
+	unsigned int i;
+	struct _stream_chunk_header header, lowest;
+
+	for (i = 0; i < source->held; i++) {
+		memcpy(&header, source->chunks[i], sizeof(header));
+		if (first < 0 || header.offset < lowest.offset) {
+			first = i;
+			lowest = header;
+		}
+	}
+
+	return first;
+}
+
+/*
+ * the held chunks which follow the expected offset are given in order
+ */
+static void sipc_deliver_held_chunks(struct callback_list_entry *entry, struct stream_source *source)
+{
+	int first;
+	char *payload = NULL;
+	unsigned int size;
+	struct _stream_chunk_header held;
+
+	//the stream is freed by its last chunk, then nothing is held
+	while ((first = sipc_first_held_chunk(source)) >= 0) {
+		memcpy(&held, source->chunks[first], sizeof(held));
+		if (held.offset != source->next) {
+			break;
+		}
+		payload = source->chunks[first];
+		size = source->sizes[first];
+		source->held--;
+		source->chunks[first] = source->chunks[source->held];
+		source->sizes[first] = source->sizes[source->held];
+		source->chunks[source->held] = NULL;
+		sipc_deliver_chunk(entry, source, payload, size);
+	}
+}
+
+/*
+ * every chunk goes to sipcd and on to the receiver on a connection of its own,
+ * so they may come out of order. the chunks ahead of the expected one are held,
+ * at most STREAM_REORDER_WINDOW of them. when the window is full the expected
+ * chunk is taken as lost and the callback sees the gap in the offsets
+ */
+static void sipc_order_chunk(struct callback_list_entry *entry, struct _packet *packet)
+{
+	int first;
+	char *payload = NULL;
+	struct _stream_chunk_header header, held;
+	struct stream_source *source = NULL;
+
+	memcpy(&header, packet->payload, sizeof(header));
+
+	if ((source = sipc_find_stream(entry, header.stream_id)) == NULL) {
+		return;
+	}
+
+	if (header.offset < source->next) {
+		errorf("late chunk of the stream %u is dropped\n", header.stream_id);
+		return;
+	}
+
+	if (header.offset > source->next && source->held == STREAM_REORDER_WINDOW) {
+		first = sipc_first_held_chunk(source);
+		memcpy(&held, source->chunks[first], sizeof(held));
+		errorf("chunk at %llu of the stream %u is lost\n", source->next, header.stream_id);
+		source->next = held.offset < header.offset ? held.offset : header.offset;
+		sipc_deliver_held_chunks(entry, source);
+	}
+
+	if (header.offset > source->next) {
+		source->chunks[source->held] = packet->payload;
+		source->sizes[source->held] = packet->payload_size;
+		source->held++;
+		packet->payload = NULL;
+		return;
+	}
+
+	payload = packet->payload;
+	packet->payload = NULL;
+	sipc_deliver_chunk(entry, source, payload, packet->payload_size);
+	sipc_deliver_held_chunks(entry, source);
+}
+
+static int sipc_execute_callback(struct callback_list_entry *entry, struct _packet *packet)
+{
+	unsigned long lost = 0;
+	struct sipc_schema_header schema;
+	struct _stream_chunk_header header;
+
+	if (!entry || !packet || !packet->payload) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	if (packet->flags & PACKET_FLAG_TIMESTAMPS) {
+		record_latencies(entry, &(packet->timestamps));
+	}
+
+	if (packet->packet_type == SENDATA) {
+		if ((packet->flags & PACKET_FLAG_DATAGRAM) && sipc_check_sequence(entry, packet, &lost) == NOK) {
+			debugf("late datagram %llu of the title '%s' is dropped\n", packet->sequence, packet->title);
+			return OK;
+		}
+
+		//loaned callbacks get the receive buffer itself, see sipc_buffer_retain()
+		if (entry->callbacks.datagram_callback) {
+			entry->callbacks.datagram_callback(packet->payload, packet->payload_size, packet->sequence, lost);
+		} else if (entry->callbacks.schema_callback) {
+			if (sipc_check_schema(entry, packet, &schema) == NOK) {
+				return NOK;
+			}
+			entry->callbacks.schema_callback(packet->payload + sizeof(schema), schema.size, schema.schema_id);
+		} else if (entry->callbacks.timed_callback) {
+			entry->callbacks.timed_callback(packet->payload, packet->payload_size, &(packet->timestamps));
+		} else if (entry->callbacks.loaned_callback) {
+			sipc_pool_set_owner(packet->payload, POOL_OWNER_LOANED);
+			entry->callbacks.loaned_callback(packet->payload, packet->payload_size);
+		} else if (entry->callbacks.callback) {
+			entry->callbacks.callback(packet->payload, packet->payload_size);
+		}
+		return OK;
+	}
+
+	//stream chunk payload is the header, the data and the trailing null
+	if (packet->payload_size < sizeof(header) + 1) {
+		errorf("stream chunk is too small\n");
+		return NOK;
+	}
+	sipc_order_chunk(entry, packet);
+
+	return OK;
+}
+
+/*
+ * callbacks of the high priority data are always executed first, see
+ * sipc_drain_lanes_daemon() for the details
+ */
+static int sipc_drain_lanes(struct sipc_ctx *ctx, struct packet_lanes *lanes)
+{
+	unsigned int budget = LANE_DRAIN_BUDGET;
+	struct packet_queue_entry *entry = NULL;
+	struct callback_list_entry *centry = NULL;
+
+	if (!lanes) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	while (budget && (entry = sipc_lanes_pop(lanes)) != NULL) {
+		if (entry->packet.priority != PRIORITY_HIGH) {
+			budget--;
+		}
+
+		//the entry is pinned, the callback may unregister its own title
+		pthread_mutex_lock(&(ctx->lock));
+		if ((centry = find_callback(ctx, entry->packet.title)) != NULL) {
+			centry->refs++;
+		}
+		pthread_mutex_unlock(&(ctx->lock));
+
+		if (!centry) {
+			//unregistered while the data was on the way
+			errorf("cannot find callback, data is dropped\n");
+		} else if (sipc_decompress_packet(&(entry->packet)) == NOK) {
+			errorf("sipc_decompress_packet() failed, data is dropped\n");
+		} else if (sipc_execute_callback(centry, &(entry->packet)) == NOK) {
+			errorf("sipc_execute_callback() failed, data is dropped\n");
+		}
+
+		if (centry) {
+			pthread_mutex_lock(&(ctx->lock));
+			put_callback(centry);
+			pthread_mutex_unlock(&(ctx->lock));
+		}
+
+		sipc_lanes_free_entry(entry);
+	}
+
+	return OK;
+}
+
+/*
+ * the port listens before sipcd is told that it is ready, see
+ * sipc_conn_confirm_daemon() of sipcd
+ */
+static int sipc_open_listener(unsigned int port)
+{
+	int enable = 1;
+	int listen_fd = -1;
+	struct sockaddr_storage server_addr;
+
+	memset(&server_addr, 0, sizeof(server_addr));
+
+	if (sipc_fill_wildcard_sockstorage(port, AF_UNSPEC, &server_addr) != 0) {
+		errorf("sipc_fill_wildcard_sockstorage() failed\n");
+		goto fail;
+	}
+
+	if ((listen_fd = sipc_socket_open_use_sockaddr((struct sockaddr *)&server_addr, SOCK_STREAM, 0)) == -1) {
+		errorf("sipc_socket_open_use_sockaddr() failed\n");
+		goto fail;
+	}
+
+	if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR , &enable, sizeof(int)) < 0) {
+		errorf("setsockopt reuseport fail\n");
+		goto fail;
+	}
+
+	if (sipc_bind_socket(listen_fd, (struct sockaddr *)&server_addr) == -1) {
+		errorf("sipc_bind_socket() failed\n");
+		goto fail;
+	}
+
+	if (sipc_socket_listen(listen_fd, BACKLOG) == -1) {
+		errorf("sipc_socket_listen() failed\n");
+		goto fail;
+	}
+
+	return listen_fd;
+
+fail:
+	if (listen_fd >= 0) {
+		close(listen_fd);
+	}
+
+	return -1;
+}
+
+static void *sipc_create_server(void *arg)
+{
+	int listen_fd = -1, conn_fd, max_fd = 1, ret_val, i;
+	bool destroy_reuested = false;
+	bool eof = false;
+	unsigned long long timeout_ms;
+	char *datagram_block = NULL;
+	char *datagram_buffers[DATAGRAM_BATCH];
+	struct packet_lanes lanes;
+	struct sipc_conn_buffer *conns = NULL;
+	struct sockaddr_storage client_addr;
+	fd_set backup_set, client_set;
+	struct timeval tv;
+	struct sipc_ctx *ctx = (struct sipc_ctx *)arg;
+
+	if (!ctx) {
+		errorf("arg is null\n");
+		return NULL;
+	}
+
+	sipc_lanes_init(&lanes);
+
+	if (ctx->cpu >= 0 && sipc_pin_thread(ctx->cpu) == NOK) {
+		errorf("sipc_pin_thread() failed, the listener is not pinned\n");
+	}
+
+	listen_fd = ctx->listen_fd;
+	memset(&client_addr, 0, sizeof(client_addr));
+
+	FD_ZERO(&backup_set);
+	max_fd = listen_fd;
+	FD_SET(listen_fd, &backup_set);
+	if (ctx->datagram_fd >= 0) {
+		FD_SET(ctx->datagram_fd, &backup_set);
+		max_fd = ctx->datagram_fd > max_fd ? ctx->datagram_fd : max_fd;
+	}
+	sipc_idle_init(&(ctx->listener_idle), IDLE_TIMEOUT_MS, &backup_set);
+
+	//a connection closed as idle is cleared when its descriptor is accepted again
+	if ((conns = (struct sipc_conn_buffer *)calloc(FD_SETSIZE, sizeof(struct sipc_conn_buffer))) == NULL) {
+		errorf("calloc failed\n");
+		goto out;
+	}
+
+	while (!destroy_reuested) {
+		sipc_idle_expire(&(ctx->listener_idle));
+		timeout_ms = sipc_idle_timeout_ms(&(ctx->listener_idle), lanes.depth ? 0 : RECEIVE_TIMEOUT * 1000ULL);
+		tv.tv_sec = timeout_ms / 1000;
+		tv.tv_usec = (timeout_ms % 1000) * 1000;
+		memcpy(&client_set, &backup_set, sizeof(backup_set));
+
+		ret_val = sipc_wait_select(&(ctx->waiter), max_fd + 1, &client_set, &tv);
+
+		if (ret_val < 0) {
+			errorf("select error\n");
+			continue;
+		} else if (ret_val == 0 && lanes.depth) {
+			if (sipc_drain_lanes(ctx, &lanes) == NOK) {
+				errorf("sipc_drain_lanes() failed\n");
+				goto out;
+			}
+			continue;
+		} else if (ret_val == 0) {
+			continue;
+		}
+
+		if (ctx->datagram_fd >= 0 && FD_ISSET(ctx->datagram_fd, &client_set)) {
+			if (sipc_datagram_buffers(&datagram_block, datagram_buffers) == NOK ||
+					sipc_read_datagrams(ctx, datagram_buffers, &lanes) == NOK) {
+				errorf("datagrams cannot be read\n");
+			}
+			FD_CLR(ctx->datagram_fd, &client_set);
+		}
+
+		if (FD_ISSET(listen_fd, &client_set)) {
+			conn_fd = sipc_socket_accept(listen_fd, &client_addr);
+			if (conn_fd < 0) {
+				if (errno == EINTR) {
+					debugf("CRS interrupted, try to accept again\n");
+					continue;
+				}
+				errorf("accept error\n");
+				goto out;
+			}
+			if (conn_fd >= FD_SETSIZE) {
+				errorf("too many connections, %d is refused\n", conn_fd);
+				close(conn_fd);
+				continue;
+			}
+
+			if (ctx->waiter.mode != WAIT_BLOCK) {
+				(void) sipc_socket_busy_poll(conn_fd, WAIT_BUSY_POLL_US);
+			}
+
+			sipc_conn_free(&(conns[conn_fd]));
+			FD_SET(conn_fd, &backup_set);
+			sipc_idle_add(&(ctx->listener_idle), conn_fd);
+			if (conn_fd > max_fd) {
+				max_fd = conn_fd;
+			}
+			continue;
+		}
+
+		//a connection is kept until its sender closes it
+		for (i = 0; i <= max_fd; i++) {
+			if (FD_ISSET(i, &client_set) && i != listen_fd) {
+				eof = false;
+				if (sipc_read_data(ctx, i, &(conns[i]), &destroy_reuested, &eof, &lanes) == NOK) {
+					errorf("sipc_read_data() failed\n");
+					eof = true;
+				}
+				if (eof) {
+					sipc_conn_free(&(conns[i]));
+					sipc_idle_remove(&(ctx->listener_idle), i);
+					close(i);
+					FD_CLR(i, &backup_set);
+				} else {
+					sipc_idle_touch(&(ctx->listener_idle), i);
+				}
+			}
+		}
+
+		if (sipc_drain_lanes(ctx, &lanes) == NOK) {
+			errorf("sipc_drain_lanes() failed\n");
+			goto out;
+		}
+	}
+
+out:
+	//only the sockets of the listener, the descriptors of the application stay open
+	sipc_idle_close_all(&(ctx->listener_idle));
+	if (listen_fd >= 0) {
+		close(listen_fd);
+	}
+	if (ctx->datagram_fd >= 0) {
+		close(ctx->datagram_fd);
+	}
+
+	ctx->listen_fd = -1;
+	ctx->datagram_fd = -1;
+	FREE(datagram_block);
+	for (i = 0; conns && i < FD_SETSIZE; i++) {
+		sipc_conn_free(&(conns[i]));
+	}
+	FREE(conns);
+
+	sipc_lanes_destroy(&lanes);
+
+	debugf("thread destroyed\n");
+	pthread_exit(NULL);
+
+	return NULL;
+}
+
+/*
+ * the thread is joined by sipc_ctx_destroy(), the context is not freed under it
+ */
+static void create_server_thread(struct sipc_ctx *ctx)
+{
+	if ((ctx->listen_fd = sipc_open_listener(ctx->port)) < 0) {
+		errorf("sipc_open_listener() failed\n");
+		goto fail;
+	}
+
+	//without it the context works, the datagrams sent to it are lost and its own go over tcp
+	if ((ctx->datagram_fd = sipc_open_datagram(ctx->port)) < 0) {
+		errorf("sipc_open_datagram() failed, datagrams are not received\n");
+	} else if (ctx->waiter.mode != WAIT_BLOCK) {
+		(void) sipc_socket_busy_poll(ctx->datagram_fd, WAIT_BUSY_POLL_US);
+	}
+
+	errno = 0;
+	if (pthread_create(&(ctx->server_thread), NULL, sipc_create_server, (void *)ctx) != 0) {
+		errorf("pthread_create failure, errno: %d\n", errno);
+		goto fail;
+	}
+
+	ctx->server_started = true;
+	__atomic_add_fetch(&started_contexts, 1, __ATOMIC_RELAXED);
+
+	goto out;
+
+fail:
+	errorf("create_server_thread() failed\n");
+	if (ctx->listen_fd >= 0) {
+		close(ctx->listen_fd);
+		ctx->listen_fd = -1;
+	}
+	if (ctx->datagram_fd >= 0) {
+		close(ctx->datagram_fd);
+		ctx->datagram_fd = -1;
+	}
+
+out:
+	return;
+}
+
+static int delete_callback_from_callback_list(struct sipc_ctx *ctx, char *title)
+{
+	struct callback_list_entry *entry = NULL;
+
+	if (!title) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	if (TAILQ_EMPTY(&(ctx->callback_list))) {
+		return OK;
+	}
+
+	TAILQ_FOREACH(entry, &(ctx->callback_list), entries) {
+		if (entry && entry->title && strcmp(title, entry->title) == 0) {
+			TAILQ_REMOVE(&(ctx->callback_list), entry, entries);
+			put_callback(entry);
+			break;
+		}
+	}
+
+	if (TAILQ_EMPTY(&(ctx->callback_list))) {
+		TAILQ_INIT(&(ctx->callback_list));
+	}
+
+	return OK;
+}
+
+static bool callbacks_empty(struct sipc_callbacks *callbacks)
+{
+	return !callbacks || (!callbacks->callback && !callbacks->stream_callback && !callbacks->loaned_callback &&
+		!callbacks->timed_callback && !callbacks->schema_callback && !callbacks->datagram_callback);
+}
+
+static int find_callback_in_callback_list(struct sipc_ctx *ctx, struct sipc_callbacks *callbacks, char *title)
+{
+	struct callback_list_entry *entry = NULL;
+
+	if (callbacks_empty(callbacks) || !title) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	TAILQ_FOREACH(entry, &(ctx->callback_list), entries) {
+		if (entry->title && strcmp(title, entry->title) == 0) {
+			//edit callback, a data callback replaces the other kind of data callback
+			if (callbacks->callback || callbacks->loaned_callback || callbacks->timed_callback || callbacks->schema_callback ||
+					callbacks->datagram_callback) {
+				entry->callbacks.callback = callbacks->callback;
+				entry->callbacks.loaned_callback = callbacks->loaned_callback;
+				entry->callbacks.timed_callback = callbacks->timed_callback;
+				entry->callbacks.schema_callback = callbacks->schema_callback;
+				entry->callbacks.datagram_callback = callbacks->datagram_callback;
+				entry->callbacks.schema_id = callbacks->schema_id;
+			}
+			if (callbacks->stream_callback) {
+				entry->callbacks.stream_callback = callbacks->stream_callback;
+			}
+			return OK;
+		}
+	}
+
+	return NOK;
+}
+
+static int add_callback_to_callback_list(struct sipc_ctx *ctx, struct sipc_callbacks *callbacks, char *title)
+{
+	struct callback_list_entry *entry = NULL;
+
+	if (callbacks_empty(callbacks) || !title) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	entry = (struct callback_list_entry *)calloc(1, sizeof(struct callback_list_entry));
+	if (!entry) {
+		errorf("calloc failed\n");
+		return NOK;
+	}
+
+	entry->callbacks = *callbacks;
+	entry->refs = 1;
+
+	entry->title = (char *)calloc(1, strlen(title) + 1);
+	if (!entry->title) {
+		errorf("calloc failed\n");
+		FREE(entry);
+		return NOK;
+	}
+	strcpy(entry->title, title);
+
+	TAILQ_INSERT_HEAD(&(ctx->callback_list), entry, entries);
+
+	return OK;
+}
+
+static struct option_list_entry *find_option(struct sipc_ctx *ctx, char *title)
+{
+	struct option_list_entry *entry = NULL;
+
+	if (!title) {
+		errorf("args cannot be NULL\n");
+		return NULL;
+	}
+
+	TAILQ_FOREACH(entry, &(ctx->option_list), entries) {
+		if (entry->title && strcmp(entry->title, title) == 0) {
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+static struct option_list_entry *find_or_add_option(struct sipc_ctx *ctx, char *title)
+{
+	struct option_list_entry *entry = NULL;
+
+	if (!title) {
+		errorf("args cannot be NULL\n");
+		return NULL;
+	}
+
+	if ((entry = find_option(ctx, title)) != NULL) {
+		return entry;
+	}
+
+	entry = (struct option_list_entry *)calloc(1, sizeof(struct option_list_entry));
+	if (!entry) {
+		errorf("calloc failed\n");
+		return NULL;
+	}
+
+	entry->title = strdup(title);
+	if (!entry->title) {
+		errorf("strdup failed\n");
+		FREE(entry);
+		return NULL;
+	}
+	entry->priority = PRIORITY_NORMAL;
+
+	TAILQ_INSERT_HEAD(&(ctx->option_list), entry, entries);
+
+	return entry;
+}
+
+static void delete_all_option_list(struct sipc_ctx *ctx)
+{
+	struct option_list_entry *entry1 = NULL;
+	struct option_list_entry *entry2 = NULL;
+
+	entry1 = TAILQ_FIRST(&(ctx->option_list));
+	while (entry1 != NULL) {
+		entry2 = TAILQ_NEXT(entry1, entries);
+		sipc_free_packet(entry1->report);
+		FREE(entry1->report);
+		FREE(entry1->title);
+		FREE(entry1);
+		entry1 = entry2;
+	}
+
+	TAILQ_INIT(&(ctx->option_list));
+}
+
+/*
+ * the payload is replaced with its compressed form only if it gets smaller
+ */
+static int sipc_compress_packet(struct _packet *packet)
+{
+	char *data = NULL;
+	unsigned int cap = 0, size = 0;
+
+	if (!packet || !packet->payload) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	if (packet->payload_size < COMPRESS_MIN_SIZE) {
+		return OK;
+	}
+
+	cap = sipc_compress_bound(packet->payload_size);
+	data = (char *)sipc_pool_alloc(cap);
+	if (!data) {
+		errorf("sipc_pool_alloc() failed\n");
+		return NOK;
+	}
+
+	if (sipc_compress(packet->payload, packet->payload_size, data, cap, &size) == NOK || size >= packet->payload_size) {
+		POOL_FREE(data);
+		return OK;
+	}
+
+	POOL_FREE(packet->payload);
+	packet->payload = data;
+	packet->payload_size = size;
+	packet->flags |= PACKET_FLAG_COMPRESSED;
+
+	return OK;
+}
+
+static bool sipc_daemon_lost(struct sipc_ctx *ctx, unsigned int shard)
+{
+	bool lost;
+
+	pthread_mutex_lock(&(ctx->lock));
+	lost = shard < SHARD_MAX && ctx->links[shard].lost;
+	pthread_mutex_unlock(&(ctx->lock));
+
+	return lost;
+}
+
+/*
+ * the supervisor tries it at once, then with a growing delay
+ */
+static void sipc_set_daemon_lost(struct sipc_ctx *ctx, unsigned int shard)
+{
+	if (shard >= SHARD_MAX) {
+		return;
+	}
+
+	pthread_mutex_lock(&(ctx->lock));
+	if (!ctx->links[shard].lost) {
+		errorf("sipcd on %u is lost\n", sipc_shard_port_at(shard));
+		ctx->links[shard].lost = true;
+		ctx->links[shard].next_check = 0;
+		delete_direct_entries(ctx, NULL, shard);
+	}
+	pthread_mutex_unlock(&(ctx->lock));
+}
+
+static void free_pending_entry(struct sipc_ctx *ctx, struct pending_list_entry *entry)
+{
+	if (!entry) {
+		return;
+	}
+
+	ctx->pending_bytes -= entry->size;
+	FREE(entry->data);
+	FREE(entry);
+}
+
+/*
+ * should be called with the lock held
+ */
+static void drop_expired_pending(struct sipc_ctx *ctx, unsigned long long now)
+{
+	struct pending_list_entry *entry = NULL;
+
+	while ((entry = TAILQ_FIRST(&(ctx->pending_list))) != NULL &&
+		now - entry->queued > (unsigned long long)SIPC_SEND_BUFFER_MS * 1000000ULL) {
+		TAILQ_REMOVE(&(ctx->pending_list), entry, entries);
+		free_pending_entry(ctx, entry);
+		ctx->pending_dropped++;
+	}
+}
+
+static void delete_all_pending_list(struct sipc_ctx *ctx)
+{
+	struct pending_list_entry *entry = NULL;
+
+	pthread_mutex_lock(&(ctx->lock));
+	while ((entry = TAILQ_FIRST(&(ctx->pending_list))) != NULL) {
+		TAILQ_REMOVE(&(ctx->pending_list), entry, entries);
+		free_pending_entry(ctx, entry);
+	}
+	pthread_mutex_unlock(&(ctx->lock));
+}
+
+/*
+ * the packet is kept as it goes to the wire, with the port of this client
+ */
+static int sipc_buffer_packet(struct sipc_ctx *ctx, unsigned int shard, struct _packet *packet)
+{
+	FILE *fp = NULL;
+	struct pending_list_entry *entry = NULL;
+
+	if (!packet) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	entry = (struct pending_list_entry *)calloc(1, sizeof(struct pending_list_entry));
+	if (!entry) {
+		errorf("calloc failed\n");
+		return NOK;
+	}
+
+	if ((fp = open_memstream(&(entry->data), &(entry->size))) == NULL) {
+		errorf("open_memstream() failed with %d: %s\n", errno, strerror(errno));
+		FREE(entry);
+		return NOK;
+	}
+
+	if (sipc_pack_packet(packet, fp) == NOK || fwrite(&(ctx->port), sizeof(ctx->port), 1, fp) != 1) {
+		errorf("sipc_pack_packet() failed\n");
+		FCLOSE(fp);
+		FREE(entry->data);
+		FREE(entry);
+		return NOK;
+	}
+	FCLOSE(fp);
+
+	entry->shard = shard;
+	entry->queued = sipc_monotonic_ns();
+
+	pthread_mutex_lock(&(ctx->lock));
+	drop_expired_pending(ctx, entry->queued);
+	if (ctx->pending_bytes + entry->size > SIPC_SEND_BUFFER_BYTES) {
+		pthread_mutex_unlock(&(ctx->lock));
+		errorf("send buffer is full while sipcd is away, data is dropped\n");
+		FREE(entry->data);
+		FREE(entry);
+		return NOK;
+	}
+	ctx->pending_bytes += entry->size;
+	TAILQ_INSERT_TAIL(&(ctx->pending_list), entry, entries);
+	pthread_mutex_unlock(&(ctx->lock));
+
+	return OK;
+}
+
+static int sipc_send_all(int fd, const char *data, size_t len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = send(fd, data, len, MSG_NOSIGNAL);
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		} else if (ret <= 0) {
+			return NOK;
+		}
+		data += ret;
+		len -= ret;
+	}
+
+	return OK;
+}
+
+/*
+ * the buffered data of a shard is sent in order, the link is up again only
+ * when nothing is left, so a new data cannot pass the buffered ones
+ */
+static int sipc_flush_pending(struct sipc_ctx *ctx, unsigned int shard)
+{
+	int fd = -1;
+	struct pending_list_entry *entry = NULL;
+
+	for (;;) {
+		pthread_mutex_lock(&(ctx->lock));
+		drop_expired_pending(ctx, sipc_monotonic_ns());
+		TAILQ_FOREACH(entry, &(ctx->pending_list), entries) {
+			if (entry->shard == shard) {
+				break;
+			}
+		}
+		if (!entry) {
+			ctx->links[shard].lost = false;
+			pthread_mutex_unlock(&(ctx->lock));
+			return OK;
+		}
+		TAILQ_REMOVE(&(ctx->pending_list), entry, entries);
+		pthread_mutex_unlock(&(ctx->lock));
+
+		if ((fd = sipc_connect_loopback(sipc_shard_port_at(shard))) < 0 || sipc_send_all(fd, entry->data, entry->size) == NOK) {
+			if (fd >= 0) {
+				close(fd);
+			}
+			pthread_mutex_lock(&(ctx->lock));
+			TAILQ_INSERT_HEAD(&(ctx->pending_list), entry, entries);
+			pthread_mutex_unlock(&(ctx->lock));
+			return NOK;
+		}
+		close(fd);
+
+		pthread_mutex_lock(&(ctx->lock));
+		free_pending_entry(ctx, entry);
+		pthread_mutex_unlock(&(ctx->lock));
+	}
+
+	return OK;
+}
+
+/*
+ * NOK only if nobody listens on the port of sipcd. a busy sipcd may not
+ * answer in time, then the instance is 0
+ */
+static int sipc_ping_daemon(struct sipc_ctx *ctx, unsigned int shard, unsigned long long *instance)
+{
+	int fd = -1;
+	struct timeval tv = { .tv_sec = SIPC_HEARTBEAT_TIMEOUT, .tv_usec = 0 };
+	struct _packet packet;
+
+	*instance = 0;
+
+	if ((fd = sipc_connect_loopback(sipc_shard_port_at(shard))) < 0) {
+		return NOK;
+	}
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	memset(&packet, 0, sizeof(struct _packet));
+	packet.packet_type = PING;
+	packet.priority = PRIORITY_HIGH;
+	packet.title = DUMMY_STRING;
+	packet.title_size = strlen(DUMMY_STRING) + 1;
+
+	if (sipc_send_packet(ctx, &packet, fd) == NOK) {
+		close(fd);
+		return NOK;
+	}
+
+	memset(&packet, 0, sizeof(struct _packet));
+	if (sipc_read_packet(fd, &packet) == OK && packet.packet_type == PING && packet.payload) {
+		*instance = strtoull(packet.payload, NULL, 10);
+	}
+	sipc_free_packet(&packet);
+	close(fd);
+
+	return OK;
+}
+
+static int sipc_replay_registrations(struct sipc_ctx *ctx, unsigned int shard)
+{
+	int ret = OK;
+	int fd = -1;
+	char *buffer = NULL;
+	size_t size = 0;
+	FILE *fp = NULL;
+	struct _packet packet;
+	struct callback_list_entry *entry = NULL;
+
+	if ((fp = open_memstream(&buffer, &size)) == NULL) {
+		errorf("open_memstream() failed with %d: %s\n", errno, strerror(errno));
+		return NOK;
+	}
+
+	pthread_mutex_lock(&(ctx->lock));
+	TAILQ_FOREACH(entry, &(ctx->callback_list), entries) {
+		if (entry->title && sipc_shard_of(entry->title) == shard) {
+			fwrite(entry->title, 1, strlen(entry->title) + 1, fp);
+		}
+	}
+	pthread_mutex_unlock(&(ctx->lock));
+	FCLOSE(fp);
+
+	if (!size) {
+		goto out;
+	}
+
+	if ((fd = sipc_connect_loopback(sipc_shard_port_at(shard))) < 0) {
+		goto fail;
+	}
+
+	memset(&packet, 0, sizeof(struct _packet));
+	packet.packet_type = REGISTER_BULK;
+	packet.priority = PRIORITY_HIGH;
+	packet.title = DUMMY_STRING;
+	packet.title_size = strlen(DUMMY_STRING) + 1;
+	packet.payload = buffer;
+	packet.payload_size = size;
+
+	if (sipc_send_packet(ctx, &packet, fd) == NOK) {
+		errorf("sipc_send_packet() failed\n");
+		goto fail;
+	}
+
+	debugf("titles are registered to the sipcd on %u again\n", sipc_shard_port_at(shard));
+
+	goto out;
+
+fail:
+	ret = NOK;
+
+out:
+	if (fd >= 0) {
+		close(fd);
+	}
+	FREE(buffer);
+
+	return ret;
+}
+
+static void sipc_check_daemon(struct sipc_ctx *ctx, unsigned int shard, unsigned long long now)
+{
+	bool lost;
+	unsigned long long instance = 0;
+	struct daemon_link *link = &(ctx->links[shard]);
+
+	if (now < link->next_check) {
+		return;
+	}
+
+	if (sipc_ping_daemon(ctx, shard, &instance) == NOK) {
+		sipc_set_daemon_lost(ctx, shard);
+		goto down;
+	}
+
+	pthread_mutex_lock(&(ctx->lock));
+	lost = link->lost;
+	pthread_mutex_unlock(&(ctx->lock));
+
+	if (lost && !link->back_since) {
+		if (sipc_replay_registrations(ctx, shard) == NOK) {
+			goto down;
+		}
+		link->back_since = now;
+		link->next_check = now + SIPC_RECONNECT_MAX_MS * 1000000ULL;
+		return;
+	} else if (lost) {
+		if (sipc_flush_pending(ctx, shard) == NOK) {
+			goto down;
+		}
+		errorf("sipcd on %u is back\n", sipc_shard_port_at(shard));
+	} else if (instance && link->instance && instance != link->instance) {
+		//started again between two pings, without a snapshot it does not know this client
+		pthread_mutex_lock(&(ctx->lock));
+		delete_direct_entries(ctx, NULL, shard);
+		pthread_mutex_unlock(&(ctx->lock));
+		if (sipc_replay_registrations(ctx, shard) == NOK) {
+			sipc_set_daemon_lost(ctx, shard);
+			goto down;
+		}
+	}
+	goto up;
+
+down:
+	link->back_since = 0;
+	link->backoff_ms = link->backoff_ms ? link->backoff_ms * 2 : SIPC_RECONNECT_MIN_MS;
+	if (link->backoff_ms > SIPC_RECONNECT_MAX_MS) {
+		link->backoff_ms = SIPC_RECONNECT_MAX_MS;
+	}
+	link->next_check = now + link->backoff_ms * 1000000ULL;
+	return;
+
+up:
+	if (instance) {
+		link->instance = instance;
+	}
+	link->back_since = 0;
+	link->backoff_ms = 0;
+	link->next_check = now + SIPC_HEARTBEAT_MS * 1000000ULL;
+}
+
+static int sipc_send_report(struct sipc_ctx *ctx, struct _packet *packet, struct sipc_direct_report *header)
+{
+	int ret = NOK;
+	int fd = -1;
+	char *data = NULL;
+	unsigned int shard = sipc_shard_of(packet->title);
+
+	data = (char *)sipc_pool_alloc(sizeof(*header) + packet->payload_size);
+	if (!data) {
+		errorf("sipc_pool_alloc() failed\n");
+		return NOK;
+	}
+	memcpy(data, header, sizeof(*header));
+	memcpy(data + sizeof(*header), packet->payload, packet->payload_size);
+
+	POOL_FREE(packet->payload);
+	packet->payload = data;
+	packet->payload_size += sizeof(*header);
+
+	if (sipc_daemon_lost(ctx, shard)) {
+		return sipc_buffer_packet(ctx, shard, packet);
+	}
+
+	if ((fd = sipc_connect_loopback(sipc_shard_port_at(shard))) < 0) {
+		sipc_set_daemon_lost(ctx, shard);
+		return sipc_buffer_packet(ctx, shard, packet);
+	}
+
+	ret = sipc_send_packet(ctx, packet, fd);
+	close(fd);
+
+	return ret;
+}
+
+/*
+ * sipcd does not see the data sent directly, so the last one is reported to it
+ * with the count of the data since the last report. sipcd retains and counts
+ * it as if the data had passed through it. every title is reported if the
+ * title is NULL
+ */
+static void sipc_report_direct(struct sipc_ctx *ctx, char *title)
+{
+	struct _packet *report = NULL;
+	struct sipc_direct_report header;
+	struct option_list_entry *entry = NULL;
+
+	memset(&header, 0, sizeof(header));
+
+	do {
+		report = NULL;
+		pthread_mutex_lock(&(ctx->lock));
+		TAILQ_FOREACH(entry, &(ctx->option_list), entries) {
+			if (entry->report && (!title || strcmp(entry->title, title) == 0)) {
+				report = entry->report;
+				header.msgs = entry->report_msgs;
+				header.bytes = entry->report_bytes;
+				entry->report = NULL;
+				entry->report_msgs = 0;
+				entry->report_bytes = 0;
+				break;
+			}
+		}
+		pthread_mutex_unlock(&(ctx->lock));
+
+		if (report && sipc_send_report(ctx, report, &header) == NOK) {
+			errorf("last direct data of the title '%s' is not reported\n", report->title);
+		}
+		sipc_free_packet(report);
+		FREE(report);
+	} while (report);
+}
+
+static void *sipc_supervisor(void *arg)
+{
+	unsigned int shard;
+	bool lost;
+	struct sipc_ctx *ctx = (struct sipc_ctx *)arg;
+
+	while (!__atomic_load_n(&(ctx->supervisor_stop), __ATOMIC_ACQUIRE)) {
+		for (shard = 0; shard < sipc_shard_count(); shard++) {
+			pthread_mutex_lock(&(ctx->lock));
+			lost = ctx->links[shard].lost;
+			pthread_mutex_unlock(&(ctx->lock));
+
+			if (ctx->shard_used[shard] || lost) {
+				sipc_check_daemon(ctx, shard, sipc_monotonic_ns());
+			}
+		}
+		sipc_report_direct(ctx, NULL);
+		usleep(SIPC_SUPERVISOR_TICK_MS * 1000);
+	}
+
+	debugf("supervisor destroyed\n");
+
+	return NULL;
+}
+
+static void create_supervisor_thread(struct sipc_ctx *ctx)
+{
+	__atomic_store_n(&(ctx->supervisor_stop), false, __ATOMIC_RELEASE);
+	if (pthread_create(&(ctx->supervisor_thread), NULL, sipc_supervisor, (void *)ctx) != 0) {
+		errorf("pthread_create failure, errno: %d\n", errno);
+		return;
+	}
+
+	ctx->supervisor_started = true;
+}
+
+/*
+ * asks the sipcd of the title for its subscribers, see
+ * sipc_send_lookup_reply_daemon() for the answer
+ */
+static struct direct_list_entry *sipc_lookup_direct(struct sipc_ctx *ctx, char *title, unsigned int shard)
+{
+	int fd = -1;
+	unsigned long port = 0;
+	char *ptr = NULL, *end = NULL;
+	struct timeval tv = { .tv_sec = SIPC_HEARTBEAT_TIMEOUT, .tv_usec = 0 };
+	struct _packet packet;
+	struct direct_list_entry *entry = NULL;
+
+	if ((fd = sipc_connect_loopback(sipc_shard_port_at(shard))) < 0) {
+		return NULL;
+	}
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	memset(&packet, 0, sizeof(struct _packet));
+	packet.packet_type = LOOKUP;
+	packet.priority = PRIORITY_HIGH;
+	packet.title = title;
+	packet.title_size = strlen(title) + 1;
+
+	if (sipc_send_packet(ctx, &packet, fd) == NOK) {
+		errorf("sipc_send_packet() failed\n");
+		goto fail;
+	}
+
+	memset(&packet, 0, sizeof(struct _packet));
+	if (sipc_read_packet(fd, &packet) == NOK || packet.packet_type != LOOKUP || !packet.payload) {
+		errorf("no answer to the lookup of the title '%s'\n", title);
+		goto fail;
+	}
+
+	entry = (struct direct_list_entry *)calloc(1, sizeof(struct direct_list_entry));
+	if (!entry) {
+		errorf("calloc failed\n");
+		goto fail;
+	}
+	entry->shard = shard;
+	entry->title = strdup(title);
+	entry->ports = (unsigned int *)calloc(packet.payload_size / 2 + 1, sizeof(unsigned int));
+	if (!entry->title || !entry->ports) {
+		errorf("alloc failed\n");
+		goto fail;
+	}
+
+	entry->direct = strtoul(packet.payload, &ptr, 10) != 0;
+	while (entry->direct && *ptr) {
+		port = strtoul(ptr, &end, 10);
+		if (end == ptr) {
+			break;
+		}
+		if (port && port <= 65535) {
+			entry->ports[entry->count++] = (unsigned int)port;
+		}
+		ptr = end;
+	}
+
+	goto out;
+
+fail:
+	free_direct_entry(entry);
+	entry = NULL;
+
+out:
+	sipc_free_packet(&packet);
+	close(fd);
+
+	return entry;
+}
+
+/*
+ * the ports are copied, an INVALIDATE may drop the cached entry while the
+ * data is sent
+ */
+static int sipc_get_direct_ports(struct sipc_ctx *ctx, char *title, unsigned int shard, unsigned int **ports, unsigned int *count)
+{
+	int ret = NOK;
+	unsigned long generation;
+	struct direct_list_entry *entry = NULL;
+	struct direct_list_entry *fresh = NULL;
+
+	pthread_mutex_lock(&(ctx->lock));
+	TAILQ_FOREACH(entry, &(ctx->direct_list), entries) {
+		if (strcmp(entry->title, title) == 0) {
+			break;
+		}
+	}
+	generation = ctx->direct_generation;
+	if (entry) {
+		goto copy;
+	}
+	pthread_mutex_unlock(&(ctx->lock));
+
+	if ((fresh = sipc_lookup_direct(ctx, title, shard)) == NULL) {
+		return NOK;
+	}
+	entry = fresh;
+
+	pthread_mutex_lock(&(ctx->lock));
+	if (generation == ctx->direct_generation) {
+		TAILQ_INSERT_HEAD(&(ctx->direct_list), fresh, entries);
+		fresh = NULL;
+	}
+
+copy:
+	if (entry->direct && entry->count) {
+		*ports = (unsigned int *)malloc(entry->count * sizeof(unsigned int));
+		if (*ports) {
+			memcpy(*ports, entry->ports, entry->count * sizeof(unsigned int));
+			*count = entry->count;
+			ret = OK;
+		}
+	}
+	pthread_mutex_unlock(&(ctx->lock));
+
+	free_direct_entry(fresh);
+
+	return ret;
+}
+
+/*
+ * the packet goes to the listeners of the subscribers as sipcd would send it.
+ * NOK means it was not sent to anyone and should go through sipcd. when only
+ * some of the subscribers cannot be reached, the data is lost for them since
+ * sipcd would send it to the others again. the list is looked up again for
+ * the next data in both cases
+ */
+static int sipc_send_direct(struct sipc_ctx *ctx, unsigned int shard, struct _packet *packet)
+{
+	int fd = -1;
+	unsigned int i, count = 0, delivered = 0;
+	unsigned int *ports = NULL;
+	bool failed = false;
+
+	if (sipc_get_direct_ports(ctx, packet->title, shard, &ports, &count) == NOK) {
+		return NOK;
+	}
+
+	for (i = 0; i < count; i++) {
+		if ((fd = sipc_connect_loopback(ports[i])) < 0 || sipc_write_packet(packet, fd) == NOK) {
+			errorf("cannot send to the subscriber on %u\n", ports[i]);
+			failed = true;
+		} else {
+			delivered++;
+		}
+		if (fd >= 0) {
+			close(fd);
+		}
+	}
+
+	if (failed) {
+		pthread_mutex_lock(&(ctx->lock));
+		delete_direct_entries(ctx, packet->title, shard);
+		pthread_mutex_unlock(&(ctx->lock));
+	}
+
+	FREE(ports);
+
+	return delivered ? OK : NOK;
+}
+
+/*
+ * the payload is moved into the report of the title, the older one is
+ * replaced. the title stays in the report until it is sent
+ */
+static void sipc_keep_direct_report(struct sipc_ctx *ctx, struct option_list_entry *option, struct _packet *packet)
+{
+	struct _packet *report = NULL;
+
+	pthread_mutex_lock(&(ctx->lock));
+	if (!option->report) {
+		option->report = (struct _packet *)calloc(1, sizeof(struct _packet));
+		if (!option->report || (option->report->title = sipc_pool_strdup(packet->title)) == NULL) {
+			errorf("alloc failed\n");
+			FREE(option->report);
+			goto out;
+		}
+		option->report->title_size = packet->title_size;
+	}
+	report = option->report;
+
+	POOL_FREE(report->key);
+	report->key_size = 0;
+	if (packet->key && (report->key = sipc_pool_strdup(packet->key)) != NULL) {
+		report->key_size = packet->key_size;
+	}
+
+	POOL_FREE(report->payload);
+	report->packet_type = DIRECT_REPORT;
+	report->priority = packet->priority;
+	report->flags = packet->flags;
+	report->timestamps = packet->timestamps;
+	report->payload = packet->payload;
+	report->payload_size = packet->payload_size;
+	packet->payload = NULL;
+
+	option->report_msgs++;
+	option->report_bytes += report->payload_size;
+
+out:
+	pthread_mutex_unlock(&(ctx->lock));
+}
+
+/*
+ * the header is outside of the compressed data, sipcd and the receivers read
+ * it without decompressing
+ */
+static int sipc_add_datagram_header(struct sipc_ctx *ctx, struct option_list_entry *option, struct _packet *packet)
+{
+	char *data = NULL;
+	struct sipc_datagram_header header;
+
+	data = (char *)sipc_pool_alloc(sizeof(header) + packet->payload_size);
+	if (!data) {
+		errorf("sipc_pool_alloc() failed\n");
+		return NOK;
+	}
+
+	header.port = ctx->port;
+	header.reserved = 0;
+	header.sequence = __atomic_add_fetch(&(option->sequence), 1, __ATOMIC_RELAXED);
+	memcpy(data, &header, sizeof(header));
+	memcpy(data + sizeof(header), packet->payload, packet->payload_size);
+
+	POOL_FREE(packet->payload);
+	packet->payload = data;
+	packet->payload_size += sizeof(header);
+	packet->flags |= PACKET_FLAG_DATAGRAM;
+	packet->port = header.port;
+	packet->sequence = header.sequence;
+
+	return OK;
+}
+
+/*
+ * NOK if the packet cannot be a datagram, it is then sent over tcp. a datagram
+ * which the kernel does not take is lost like the ones lost on the way
+ */
+static int sipc_send_datagram(struct sipc_ctx *ctx, unsigned int port, struct _packet *packet)
+{
+	int ret = NOK;
+	FILE *fp = NULL;
+	char *buffer = NULL;
+	size_t size = 0;
+
+	if (ctx->datagram_fd < 0) {
+		return NOK;
+	}
+
+	if ((fp = open_memstream(&buffer, &size)) == NULL) {
+		errorf("open_memstream() failed with %d: %s\n", errno, strerror(errno));
+		return NOK;
+	}
+
+	if (sipc_pack_packet(packet, fp) == NOK) {
+		errorf("sipc_pack_packet() failed\n");
+		goto out;
+	}
+	FCLOSE(fp);
+
+	if (size > DATAGRAM_MAX_SIZE) {
+		debugf("data of the title '%s' is too large for a datagram\n", packet->title);
+		goto out;
+	}
+
+	if (sipc_send_datagrams(ctx->datagram_fd, &buffer, &size, &port, 1) != 1) {
+		debugf("datagram %llu of the title '%s' is dropped\n", packet->sequence, packet->title);
+	}
+	ret = OK;
+
+out:
+	FCLOSE(fp);
+	FREE(buffer);
+
+	return ret;
+}
+
+static int sipc_send(struct sipc_ctx *ctx, char *title, char *key, struct sipc_callbacks *callbacks, enum _packet_type packet_type,
+	void *data, unsigned int len, unsigned int schema_id, unsigned int _port, unsigned long timeout)
+{
+	int ret = NOK;
+	int fd  = - 1;
+	bool data_packet = false;
+	bool added = false;
+	unsigned int shard = 0;
+	unsigned int local_svr_port = 0;
+	unsigned long timeout_cnt = 0;
+	unsigned int offset = 0;
+	unsigned long long publish = sipc_monotonic_ns();
+	struct _packet packet;
+	struct sipc_schema_header header;
+	struct option_list_entry *option = NULL;
+	struct option_list_entry options = { .priority = PRIORITY_NORMAL };
+
+	if (!title) {
+		errorf("title cannot be NULL\n");
+		return NOK;
+	}
+
+	if (packet_type != REGISTER && packet_type != REGISTER_BULK && !ctx->server_started) {
+		return NOK;
+	}
+
+	//the callback is ready before sipcd can send the retained data of the title
+	if (packet_type == REGISTER) {
+		if (callbacks_empty(callbacks)) {
+			errorf("callback cannot be NULL while registering\n");
+			return NOK;
+		}
+		pthread_mutex_lock(&(ctx->lock));
+		if (find_callback_in_callback_list(ctx, callbacks, title) == NOK) {
+			if (add_callback_to_callback_list(ctx, callbacks, title) == NOK) {
+				errorf("add_callback_to_callback_list() failed\n");
+				pthread_mutex_unlock(&(ctx->lock));
+				return NOK;
+			}
+			added = true;
+		}
+		pthread_mutex_unlock(&(ctx->lock));
+	}
+
+	memset(&packet, 0, sizeof(struct _packet));
+
+	local_svr_port = ctx->port;
+	data_packet = (packet_type == SENDATA || packet_type == STREAM) && ctx->server_started;
+	shard = sipc_shard_of(title);
+
+	//title and key are only read while sending, no need to copy them
+	packet.title = title;
+	packet.title_size = strlen(title) + 1;
+	packet.packet_type = (unsigned char)packet_type;
+
+	//the options are read once, the entry lives until the context stops so its sequence is used through it
+	pthread_mutex_lock(&(ctx->lock));
+	if ((option = find_option(ctx, title)) != NULL) {
+		options = *option;
+	}
+	pthread_mutex_unlock(&(ctx->lock));
+	packet.priority = options.priority;
+
+	if ((packet_type == SENDATA || packet_type == STREAM) && options.timestamps) {
+		packet.flags |= PACKET_FLAG_TIMESTAMPS;
+		packet.timestamps.publish = publish;
+	}
+	packet.payload_size = 0;
+	packet.payload = NULL;
+
+	if (key) {
+		packet.key = key;
+		packet.key_size = strlen(key) + 1;
+	}
+
+	if (data && len) {
+		offset = schema_id ? sizeof(struct sipc_schema_header) : 0;
+		packet.payload = (char *)sipc_pool_alloc(offset + len + 1);
+		if (!packet.payload) {
+			errorf("sipc_pool_alloc() failed\n");
+			goto fail;
+		}
+		if (schema_id) {
+			header.schema_id = schema_id;
+			header.size = len;
+			memcpy(packet.payload, &header, sizeof(header));
+			packet.flags |= PACKET_FLAG_SCHEMA;
+		}
+		memcpy(packet.payload + offset, data, len);
+		packet.payload[offset + len] = '\0';
+		packet.payload_size = offset + len + 1;
+
+		if ((packet_type == SENDATA || packet_type == STREAM) && options.compress && sipc_compress_packet(&packet) == NOK) {
+			errorf("sipc_compress_packet() failed\n");
+			goto fail;
+		}
+
+		//data too large for a datagram goes over tcp without a sequence, so it is never late behind them
+		if (packet_type == SENDATA && options.datagram &&
+				sipc_packed_size(&packet) + sizeof(struct sipc_datagram_header) <= DATAGRAM_MAX_SIZE &&
+				sipc_add_datagram_header(ctx, option, &packet) == NOK) {
+			errorf("sipc_add_datagram_header() failed\n");
+			goto fail;
+		}
+	}
+
+	//never buffered nor retried, a datagram is sent even if sipcd is away
+	if (data_packet && (packet.flags & PACKET_FLAG_DATAGRAM) && sipc_send_datagram(ctx, _port, &packet) == OK) {
+		ret = OK;
+		goto out;
+	}
+
+	//the order of the data is kept, it waits behind the buffered data until sipcd is back
+	if (data_packet && sipc_daemon_lost(ctx, shard)) {
+		if (options.report) {
+			sipc_report_direct(ctx, title);
+		}
+		ret = sipc_buffer_packet(ctx, shard, &packet);
+		goto out;
+	}
+
+	if (data_packet && options.direct && sipc_send_direct(ctx, shard, &packet) == OK) {
+		if (packet_type == SENDATA) {
+			sipc_keep_direct_report(ctx, option, &packet);
+		}
+		ret = OK;
+		goto out;
+	}
+
+	//the last direct data goes first, otherwise sipcd would retain it instead of this one
+	if (data_packet && options.report) {
+		sipc_report_direct(ctx, title);
+	}
+
+	while (timeout_cnt <= timeout) {
+		if (timeout_cnt++) {
+			sleep(1);
+		}
+
+		if ((fd = sipc_connect_loopback(_port)) < 0) {
+			errorf("connect() failed with %d: %s\n", errno, strerror(errno));
+			continue;
+		}
+
+		ret = OK;
+		break;
+	}
+
+	if (ret != OK || fd < 0) {
+		debugf("retry failed\n");
+		if (data_packet) {
+			sipc_set_daemon_lost(ctx, shard);
+			ret = sipc_buffer_packet(ctx, shard, &packet);
+			goto out;
+		}
+		goto fail;
+	}
+
+	if (sipc_send_packet(ctx, &packet, fd) == NOK) {
+		errorf("sipc_send_packet() failed with %d: %s\n", errno, strerror(errno));
+		goto fail;
+	}
+
+	if (!ctx->server_started) {
+		if (recv(fd, &local_svr_port, sizeof(unsigned int), 0) == -1) {
+			errorf("recv() failed with %d: %s\n", errno, strerror(errno));
+			goto fail;
+		}
+
+		if (local_svr_port <= _port || local_svr_port > _port + BACKLOG) {
+			debugf("need to register first\n");
+			goto fail;
+		}
+
+		debugf("port %d initialized for this app\n", local_svr_port);
+		ctx->port = local_svr_port;
+		create_server_thread(ctx);
+		if (!ctx->server_started) {
+			goto fail;
+		}
+		create_supervisor_thread(ctx);
+
+		//sipcd waits for it instead of sleeping, see sipc_conn_confirm_daemon()
+		if (send(fd, &(ctx->port), sizeof(ctx->port), MSG_NOSIGNAL) != sizeof(ctx->port)) {
+			errorf("send() failed with %d: %s\n", errno, strerror(errno));
+		}
+	}
+
+	pthread_mutex_lock(&(ctx->lock));
+	if (packet_type == REGISTER || packet_type == REGISTER_BULK) {
+		ctx->shard_used[shard] = true;
+	} else if (packet_type == UNREGISTER) {
+		if (delete_callback_from_callback_list(ctx, title) == NOK) {
+			errorf("delete_callback_from_callback_list() failed\n");
+			pthread_mutex_unlock(&(ctx->lock));
+			goto fail;
+		}
+	} else if (packet_type == UNREGISTER_ALL) {
+		if (delete_all_callback_list(ctx) == NOK) {
+			errorf("delete_all_callback_list() failed\n");
+			pthread_mutex_unlock(&(ctx->lock));
+			goto fail;
+		}
+	}
+	pthread_mutex_unlock(&(ctx->lock));
+
+	goto out;
+
+fail:
+	ret = NOK;
+	if (added) {
+		pthread_mutex_lock(&(ctx->lock));
+		delete_callback_from_callback_list(ctx, title);
+		pthread_mutex_unlock(&(ctx->lock));
+	}
+
+out:
+	if (fd >= 0) {
+		close(fd);
+	}
+	POOL_FREE(packet.payload);
+
+	return ret;
+}
+
+/*
+ * the optional timeout in seconds after the named arguments of a call
+ */
+static unsigned long sipc_timeout_arg(va_list args)
+{
+	const char *fmt = "%d";
+	char buffer[BUFFER_SIZE];
+
+	vsnprintf(buffer, sizeof(buffer) - 1, fmt, args);
+
+	return strtoul(buffer, NULL, 10);
+}
+
+static int register_callbacks(struct sipc_ctx *ctx, char *title, struct sipc_callbacks *callbacks, unsigned long timeout)
+{
+	if (!ctx || !title || callbacks_empty(callbacks)) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	return sipc_send(ctx, title, NULL, callbacks, REGISTER, NULL, 0, 0, sipc_shard_port(title), timeout);
+}
+
+/*
+ * the titles of a sipcd are registered with one REGISTER_BULK, and sipcd
+ * sends their retained data back in one connection
+ */
+static int register_titles(struct sipc_ctx *ctx, struct sipc_registration *registrations, unsigned int count, unsigned long timeout)
+{
+	int ret = OK;
+	char *first = NULL;
+	char *payload = NULL;
+	size_t size = 0;
+	FILE *fp = NULL;
+	bool *added = NULL;
+	unsigned int i, shard;
+	unsigned int failed = 0;			//the titles of this and the next shards are not registered
+	struct sipc_callbacks callbacks;
+
+	if (!ctx || !registrations || !count) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (!registrations[i].title || !registrations[i].callback) {
+			errorf("args cannot be NULL\n");
+			return NOK;
+		}
+	}
+
+	if ((added = (bool *)calloc(count, sizeof(bool))) == NULL) {
+		errorf("calloc failed\n");
+		return NOK;
+	}
+
+	//the callbacks are ready before sipcd can send the retained data
+	pthread_mutex_lock(&(ctx->lock));
+	for (i = 0; i < count; i++) {
+		memset(&callbacks, 0, sizeof(struct sipc_callbacks));
+		callbacks.callback = registrations[i].callback;
+		if (find_callback_in_callback_list(ctx, &callbacks, registrations[i].title) == OK) {
+			continue;
+		}
+		if (add_callback_to_callback_list(ctx, &callbacks, registrations[i].title) == NOK) {
+			errorf("add_callback_to_callback_list() failed\n");
+			ret = NOK;
+			break;
+		}
+		added[i] = true;
+	}
+	pthread_mutex_unlock(&(ctx->lock));
+
+	for (shard = 0; ret == OK && shard < sipc_shard_count(); shard++) {
+		if ((fp = open_memstream(&payload, &size)) == NULL) {
+			errorf("open_memstream() failed with %d: %s\n", errno, strerror(errno));
+			failed = shard;
+			ret = NOK;
+			break;
+		}
+
+		first = NULL;
+		for (i = 0; i < count; i++) {
+			if (sipc_shard_of(registrations[i].title) == shard) {
+				fwrite(registrations[i].title, 1, strlen(registrations[i].title) + 1, fp);
+				first = first ? first : registrations[i].title;
+			}
+		}
+		FCLOSE(fp);
+
+		if (first && sipc_send(ctx, first, NULL, NULL, REGISTER_BULK, payload, size, 0, sipc_shard_port_at(shard), timeout) == NOK) {
+			errorf("sipc_send() failed for the sipcd on %u\n", sipc_shard_port_at(shard));
+			failed = shard;
+			ret = NOK;
+		}
+		FREE(payload);
+	}
+
+	if (ret == NOK) {
+		pthread_mutex_lock(&(ctx->lock));
+		for (i = 0; i < count; i++) {
+			if (added[i] && sipc_shard_of(registrations[i].title) >= failed) {
+				delete_callback_from_callback_list(ctx, registrations[i].title);
+			}
+		}
+		pthread_mutex_unlock(&(ctx->lock));
+	}
+
+	FREE(added);
+
+	return ret;
+}
+
+static int send_title_data(struct sipc_ctx *ctx, char *title, char *key, void *data, unsigned int len, unsigned long timeout)
+{
+	if (!ctx || !title || !data || !len) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	return sipc_send(ctx, title, key, NULL, SENDATA, data, len, 0, sipc_shard_port(title), timeout);
+}
+
+/*
+ * the callback gets the message in the receive buffer, see sipc_check_schema()
+ */
+static int register_schema(struct sipc_ctx *ctx, char *title, unsigned int schema_id,
+	int (*callback)(const void *, unsigned int, unsigned int), unsigned long timeout)
+{
+	struct sipc_callbacks callbacks = { .schema_callback = callback, .schema_id = schema_id };
+
+	if (!SIPC_SCHEMA_MESSAGE(schema_id) || !SIPC_SCHEMA_VERSION(schema_id)) {
+		errorf("schema id %u is not valid\n", schema_id);
+		return NOK;
+	}
+
+	return register_callbacks(ctx, title, &callbacks, timeout);
+}
+
+/*
+ * the message goes as it is in the memory, behind a struct sipc_schema_header
+ */
+static int send_schema(struct sipc_ctx *ctx, char *title, unsigned int schema_id, const void *message, unsigned int size,
+	unsigned long timeout)
+{
+	if (!ctx || !title || !message || !size) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	if (!SIPC_SCHEMA_MESSAGE(schema_id) || !SIPC_SCHEMA_VERSION(schema_id)) {
+		errorf("schema id %u is not valid\n", schema_id);
+		return NOK;
+	}
+
+	return sipc_send(ctx, title, NULL, NULL, SENDATA, (void *)message, size, schema_id, sipc_shard_port(title), timeout);
+}
+
+struct sipc_ctx *sipc_ctx_create(void)
+{
+	struct sipc_ctx *ctx = NULL;
+
+	ctx = (struct sipc_ctx *)calloc(1, sizeof(struct sipc_ctx));
+	if (!ctx) {
+		errorf("calloc failed\n");
+		return NULL;
+	}
+
+	if (pthread_mutex_init(&(ctx->lock), NULL) != 0) {
+		errorf("pthread_mutex_init() failed\n");
+		FREE(ctx);
+		return NULL;
+	}
+
+	ctx->listen_fd = -1;
+	ctx->datagram_fd = -1;
+	ctx->cpu = -1;
+	TAILQ_INIT(&(ctx->callback_list));
+	TAILQ_INIT(&(ctx->option_list));
+	TAILQ_INIT(&(ctx->pending_list));
+	TAILQ_INIT(&(ctx->direct_list));
+
+	return ctx;
+}
+
+/*
+ * every sipcd which has a title of this client forgets its port
+ */
+static int sipc_unregister_all(struct sipc_ctx *ctx)
+{
+	int ret = OK;
+	unsigned int i;
+	char unreg_buf[256] = {0};
+
+	snprintf(unreg_buf, sizeof(unreg_buf), "%d", ctx->port);
+
+	for (i = 0; i < sipc_shard_count(); i++) {
+		if (!ctx->shard_used[i]) {
+			continue;
+		}
+		if (sipc_send(ctx, DUMMY_STRING, NULL, NULL, UNREGISTER_ALL, unreg_buf, strlen(unreg_buf), 0, sipc_shard_port_at(i), 0) == NOK) {
+			errorf("sipc_send() failed for the sipcd on %u\n", sipc_shard_port_at(i));
+			ret = NOK;
+		}
+	}
+
+	return ret;
+}
+
+static bool in_own_callback(struct sipc_ctx *ctx)
+{
+	return ctx->server_started && pthread_equal(pthread_self(), ctx->server_thread);
+}
+
+/*
+ * the threads of the context are joined, so nothing of it is in use when this
+ * returns. the context can register again afterwards
+ */
+static int sipc_ctx_stop(struct sipc_ctx *ctx)
+{
+	int ret = OK;
+
+	if (ctx->server_started) {
+		sipc_report_direct(ctx, NULL);
+		if (sipc_unregister_all(ctx) == NOK) {
+			ret = NOK;
+		}
+		if (sipc_send(ctx, DUMMY_STRING, NULL, NULL, DESTROY, NULL, 0, 0, ctx->port, 0) == NOK) {
+			//the accept of the listener fails, the thread leaves anyway
+			shutdown(ctx->listen_fd, SHUT_RDWR);
+		}
+		pthread_join(ctx->server_thread, NULL);
+		ctx->server_started = false;
+		ctx->port = 0;
+		__atomic_sub_fetch(&started_contexts, 1, __ATOMIC_RELAXED);
+	}
+
+	if (ctx->supervisor_started) {
+		__atomic_store_n(&(ctx->supervisor_stop), true, __ATOMIC_RELEASE);
+		pthread_join(ctx->supervisor_thread, NULL);
+		ctx->supervisor_started = false;
+	}
+
+	pthread_mutex_lock(&(ctx->lock));
+	delete_all_callback_list(ctx);
+	memset(ctx->links, 0, sizeof(ctx->links));
+	memset(ctx->shard_used, 0, sizeof(ctx->shard_used));
+	delete_all_option_list(ctx);
+	pthread_mutex_unlock(&(ctx->lock));
+
+	delete_all_pending_list(ctx);
+	delete_all_direct_list(ctx);
+
+	return ret;
+}
+
+int sipc_ctx_destroy(struct sipc_ctx *ctx)
+{
+	int ret = OK;
+
+	if (!ctx) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	if (ctx == &identifier) {
+		errorf("default context is destroyed by sipc_destroy()\n");
+		return NOK;
 	}
 
-	return NOK;
+	if (in_own_callback(ctx)) {
+		errorf("a context cannot be destroyed by its own callbacks\n");
+		return NOK;
+	}
+
+	ret = sipc_ctx_stop(ctx);
+
+	pthread_mutex_destroy(&(ctx->lock));
+	FREE(ctx);
+
+	return ret;
+}
+
+int sipc_ctx_register(struct sipc_ctx *ctx, char *title, int (*callback)(void *, unsigned int), ...)
+{
+	va_list args;
+	unsigned long timeout = 0;
+	struct sipc_callbacks callbacks = { .callback = callback };
+
+	va_start(args, callback);
+	timeout = sipc_timeout_arg(args);
+	va_end(args);
+
+	return register_callbacks(ctx, title, &callbacks, timeout);
+}
+
+int sipc_ctx_register_many(struct sipc_ctx *ctx, struct sipc_registration *registrations, unsigned int count, ...)
+{
+	va_list args;
+	unsigned long timeout = 0;
+
+	va_start(args, count);
+	timeout = sipc_timeout_arg(args);
+	va_end(args);
+
+	return register_titles(ctx, registrations, count, timeout);
+}
+
+int sipc_ctx_register_loaned(struct sipc_ctx *ctx, char *title, int (*callback)(const void *, unsigned int), ...)
+{
+	va_list args;
+	unsigned long timeout = 0;
+	struct sipc_callbacks callbacks = { .loaned_callback = callback };
+
+	va_start(args, callback);
+	timeout = sipc_timeout_arg(args);
+	va_end(args);
+
+	return register_callbacks(ctx, title, &callbacks, timeout);
+}
+
+int sipc_ctx_register_timed(struct sipc_ctx *ctx, char *title, int (*callback)(void *, unsigned int, const struct sipc_timestamps *), ...)
+{
+	va_list args;
+	unsigned long timeout = 0;
+	struct sipc_callbacks callbacks = { .timed_callback = callback };
+
+	va_start(args, callback);
+	timeout = sipc_timeout_arg(args);
+	va_end(args);
+
+	return register_callbacks(ctx, title, &callbacks, timeout);
+}
+
+/*
+ * the callback also gets the sequence of the data and the number of the data
+ * lost before it, see sipc_check_sequence()
+ */
+int sipc_ctx_register_datagram(struct sipc_ctx *ctx, char *title, int (*callback)(void *, unsigned int, unsigned long long, unsigned long), ...)
+{
+	va_list args;
+	unsigned long timeout = 0;
+	struct sipc_callbacks callbacks = { .datagram_callback = callback };
+
+	va_start(args, callback);
+	timeout = sipc_timeout_arg(args);
+	va_end(args);
+
+	return register_callbacks(ctx, title, &callbacks, timeout);
+}
+
+int sipc_ctx_stream_register(struct sipc_ctx *ctx, char *title, int (*callback)(unsigned int, unsigned long long, void *, unsigned int, bool), ...)
+{
+	va_list args;
+	unsigned long timeout = 0;
+	struct sipc_callbacks callbacks = { .stream_callback = callback };
+
+	va_start(args, callback);
+	timeout = sipc_timeout_arg(args);
+	va_end(args);
+
+	return register_callbacks(ctx, title, &callbacks, timeout);
+}
+
+int sipc_ctx_register_schema(struct sipc_ctx *ctx, char *title, unsigned int schema_id,
+	int (*callback)(const void *, unsigned int, unsigned int), ...)
+{
+	va_list args;
+	unsigned long timeout = 0;
+
+	va_start(args, callback);
+	timeout = sipc_timeout_arg(args);
+	va_end(args);
+
+	return register_schema(ctx, title, schema_id, callback, timeout);
+}
+
+int sipc_ctx_broadcast_register(struct sipc_ctx *ctx, int (*callback)(void *, unsigned int), ...)
+{
+	va_list args;
+	unsigned long timeout = 0;
+	struct sipc_callbacks callbacks = { .callback = callback };
+
+	va_start(args, callback);
+	timeout = sipc_timeout_arg(args);
+	va_end(args);
+
+	return register_callbacks(ctx, BROADCAST_UNIQUE_TITLE, &callbacks, timeout);
+}
+
+int sipc_ctx_unregister(struct sipc_ctx *ctx, char *title)
+{
+	char unreg_buf[256] = {0};
+
+	if (!ctx || !title) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	snprintf(unreg_buf, sizeof(unreg_buf), "%d", ctx->port);
+	return sipc_send(ctx, title, NULL, NULL, UNREGISTER, unreg_buf, strlen(unreg_buf), 0, sipc_shard_port(title), 0);
+}
+
+int sipc_ctx_broadcast_unregister(struct sipc_ctx *ctx)
+{
+	return sipc_ctx_unregister(ctx, BROADCAST_UNIQUE_TITLE);
+}
+
+int sipc_ctx_send_data(struct sipc_ctx *ctx, char *title, void *data, unsigned int len, ...)
+{
+	va_list args;
+	unsigned long timeout = 0;
+
+	va_start(args, len);
+	timeout = sipc_timeout_arg(args);
+	va_end(args);
+
+	return send_title_data(ctx, title, NULL, data, len, timeout);
+}
+
+int sipc_ctx_send_schema(struct sipc_ctx *ctx, char *title, unsigned int schema_id, const void *message, unsigned int size, ...)
+{
+	va_list args;
+	unsigned long timeout = 0;
+
+	va_start(args, size);
+	timeout = sipc_timeout_arg(args);
+	va_end(args);
+
+	return send_schema(ctx, title, schema_id, message, size, timeout);
+}
+
+int sipc_ctx_send_keyed_data(struct sipc_ctx *ctx, char *title, char *key, void *data, unsigned int len, ...)
+{
+	va_list args;
+	unsigned long timeout = 0;
+
+	if (!key) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	va_start(args, len);
+	timeout = sipc_timeout_arg(args);
+	va_end(args);
+
+	return send_title_data(ctx, title, key, data, len, timeout);
+}
+
+int sipc_ctx_send_broadcast_data(struct sipc_ctx *ctx, void *data, unsigned int len, ...)
+{
+	va_list args;
+	unsigned long timeout = 0;
+
+	va_start(args, len);
+	timeout = sipc_timeout_arg(args);
+	va_end(args);
+
+	return send_title_data(ctx, BROADCAST_UNIQUE_TITLE, NULL, data, len, timeout);
+}
+
+int sipc_ctx_set_conflation(struct sipc_ctx *ctx, char *title, bool enable)
+{
+	char conflate_buf[4] = {0};
+
+	if (!ctx || !title) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	snprintf(conflate_buf, sizeof(conflate_buf), "%d", enable ? 1 : 0);
+	return sipc_send(ctx, title, NULL, NULL, CONFLATE, conflate_buf, strlen(conflate_buf), 0, sipc_shard_port(title), 0);
+}
+
+int sipc_ctx_set_priority(struct sipc_ctx *ctx, char *title, enum _packet_priority priority)
+{
+	struct option_list_entry *entry = NULL;
+
+	if (!ctx || !title || priority >= PRIORITY_COUNT) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	pthread_mutex_lock(&(ctx->lock));
+	if ((entry = find_or_add_option(ctx, title)) == NULL) {
+		errorf("find_or_add_option() failed\n");
+		pthread_mutex_unlock(&(ctx->lock));
+		return NOK;
+	}
+
+	entry->priority = (unsigned char)priority;
+	pthread_mutex_unlock(&(ctx->lock));
+
+	return OK;
+}
+
+int sipc_ctx_set_compression(struct sipc_ctx *ctx, char *title, bool enable)
+{
+	struct option_list_entry *entry = NULL;
+
+	if (!ctx || !title) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	pthread_mutex_lock(&(ctx->lock));
+	if ((entry = find_or_add_option(ctx, title)) == NULL) {
+		errorf("find_or_add_option() failed\n");
+		pthread_mutex_unlock(&(ctx->lock));
+		return NOK;
+	}
+
+	entry->compress = enable;
+	pthread_mutex_unlock(&(ctx->lock));
+
+	return OK;
+}
+
+/*
+ * the data of the title is sent to its subscribers without sipcd, see
+ * sipc_send_direct()
+ */
+int sipc_ctx_set_direct(struct sipc_ctx *ctx, char *title, bool enable)
+{
+	struct option_list_entry *entry = NULL;
+
+	if (!ctx || !title) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	pthread_mutex_lock(&(ctx->lock));
+	if ((entry = find_or_add_option(ctx, title)) == NULL) {
+		errorf("find_or_add_option() failed\n");
+		pthread_mutex_unlock(&(ctx->lock));
+		return NOK;
+	}
+
+	entry->direct = enable;
+	pthread_mutex_unlock(&(ctx->lock));
+
+	return OK;
+}
+
+/*
+ * the data of the title is sent as udp datagrams which are never resent nor
+ * buffered, see sipc_send_datagram()
+ */
+int sipc_ctx_set_datagram(struct sipc_ctx *ctx, char *title, bool enable)
+{
+	struct option_list_entry *entry = NULL;
+
+	if (!ctx || !title) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	pthread_mutex_lock(&(ctx->lock));
+	if ((entry = find_or_add_option(ctx, title)) == NULL) {
+		errorf("find_or_add_option() failed\n");
+		pthread_mutex_unlock(&(ctx->lock));
+		return NOK;
+	}
+
+	entry->datagram = enable;
+	pthread_mutex_unlock(&(ctx->lock));
+
+	return OK;
+}
+
+int sipc_ctx_set_timestamps(struct sipc_ctx *ctx, char *title, bool enable)
+{
+	struct option_list_entry *entry = NULL;
+
+	if (!ctx || !title) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	pthread_mutex_lock(&(ctx->lock));
+	if ((entry = find_or_add_option(ctx, title)) == NULL) {
+		errorf("find_or_add_option() failed\n");
+		pthread_mutex_unlock(&(ctx->lock));
+		return NOK;
+	}
+
+	entry->timestamps = enable;
+	pthread_mutex_unlock(&(ctx->lock));
+
+	return OK;
+}
+
+/*
+ * see enum sipc_wait_mode, a spin_us of 0 is WAIT_SPIN_US. the cpu of the
+ * listener thread is not changed if it is -1
+ */
+int sipc_ctx_set_receive_mode(struct sipc_ctx *ctx, enum sipc_wait_mode mode, unsigned int spin_us, int cpu)
+{
+	if (!ctx || mode > WAIT_ADAPTIVE || cpu < -1) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	if (ctx->server_started) {
+		errorf("receive mode cannot be changed after registering\n");
+		return NOK;
+	}
+
+	ctx->waiter.mode = mode;
+	ctx->waiter.spin_us = spin_us ? spin_us : WAIT_SPIN_US;
+	ctx->cpu = cpu;
+
+	return OK;
+}
+
+int sipc_ctx_get_latency_histogram(struct sipc_ctx *ctx, char *title, enum sipc_latency_stage stage, struct sipc_latency_histogram *histogram)
+{
+	unsigned int i;
+	struct callback_list_entry *entry = NULL;
+	struct sipc_latency_histogram *latency = NULL;
+
+	if (!ctx || !title || !histogram || stage >= LATENCY_STAGE_COUNT) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	pthread_mutex_lock(&(ctx->lock));
+	if (!ctx->server_started || (entry = find_callback(ctx, title)) == NULL) {
+		errorf("title is not registered\n");
+		pthread_mutex_unlock(&(ctx->lock));
+		return NOK;
+	}
+
+	latency = &(entry->latency[stage]);
+	histogram->count = __atomic_load_n(&(latency->count), __ATOMIC_RELAXED);
+	histogram->sum = __atomic_load_n(&(latency->sum), __ATOMIC_RELAXED);
+	histogram->max = __atomic_load_n(&(latency->max), __ATOMIC_RELAXED);
+	for (i = 0; i < SIPC_LATENCY_BUCKETS; i++) {
+		histogram->buckets[i] = __atomic_load_n(&(latency->buckets[i]), __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&(ctx->lock));
+
+	return OK;
+}
+
+/*
+ * returns the upper bound of the bucket that holds the given percentile,
+ * eg 99.9 for p999
+ */
+unsigned long long sipc_latency_percentile(const struct sipc_latency_histogram *histogram, double percentile)
+{
+	unsigned int i;
+	unsigned long seen = 0;
+	unsigned long long bound = 0;
+	double rank;
+
+	if (!histogram || !histogram->count) {
+		return 0;
+	}
+
+	rank = histogram->count * percentile / 100.0;
+	for (i = 0; i < SIPC_LATENCY_BUCKETS; i++) {
+		seen += histogram->buckets[i];
+		if (seen && seen >= rank) {
+			break;
+		}
+	}
+
+	bound = i < SIPC_LATENCY_BUCKETS - 1 ? (2ULL << i) - 1 : histogram->max;
+
+	return bound < histogram->max ? bound : histogram->max;
+}
+
+/*
+ * data passed to a loaned callback is the receive buffer of the library, it
+ * is released when the callback returns unless it is retained. any other
+ * pointer is refused, see sipc_pool_check()
+ */
+int sipc_buffer_retain(const void *data)
+{
+	if (!data) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	if (sipc_pool_check(data, POOL_OWNER_LOANED) == NOK) {
+		errorf("%p is not a loaned buffer\n", data);
+		return NOK;
+	}
+
+	sipc_pool_retain((void *)data);
+
+	return OK;
+}
+
+int sipc_buffer_release(const void *data)
+{
+	if (!data) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	if (sipc_pool_check(data, POOL_OWNER_LOANED) == NOK) {
+		errorf("%p is not a loaned buffer\n", data);
+		return NOK;
+	}
+
+	sipc_pool_free((void *)data);
+
+	return OK;
 }
 
-static int add_callback_to_callback_list(int (*callback)(void *, unsigned int), char *title)
+/*
+ * titles are spread over the given sipcd ports, see sipc_shard.h. the ports
+ * are shared by all the contexts
+ */
+int sipc_set_daemon_ports(const char *ports)
 {
-	struct callback_list_entry *entry = NULL;
-
-	if (!callback || !title) {
+	if (!ports) {
 		errorf("args cannot be NULL\n");
 		return NOK;
 	}
 
-	entry = (struct callback_list_entry *)calloc(1, sizeof(struct callback_list_entry));
-	if (!entry) {
-		errorf("calloc failed\n");
+	if (__atomic_load_n(&started_contexts, __ATOMIC_RELAXED)) {
+		errorf("sipcd ports cannot be changed after registering\n");
 		return NOK;
 	}
 
-	entry->callback = callback;
+	return sipc_shard_configure(ports);
+}
 
-	entry->title = (char *)calloc(1, strlen(title) + 1);
-	if (!entry->title) {
-		errorf("calloc failed\n");
-		FREE(entry->callback);
-		FREE(entry);
+int sipc_destroy(void)
+{
+	if (!identifier.server_started) {
 		return NOK;
 	}
-	strcpy(entry->title, title);
 
-	TAILQ_INSERT_HEAD(&(identifier.callback_list), entry, entries);
+	if (in_own_callback(&identifier)) {
+		errorf("a context cannot be destroyed by its own callbacks\n");
+		return NOK;
+	}
 
-	return OK;
+	return sipc_ctx_stop(&identifier);
 }
 
-static int sipc_send(char *title, int (*callback)(void *, unsigned int), enum _packet_type packet_type,
-	void *data, unsigned int len, unsigned int _port, unsigned long timeout)
+int sipc_register(char *title, int (*callback)(void *, unsigned int), ...)
 {
-	int ret = NOK;
-	int fd  = - 1;
-	unsigned int local_svr_port = 0;
-	unsigned long timeout_cnt = 0;
-	struct sockaddr_storage address;
-	struct _packet packet;
+	va_list args;
+	unsigned long timeout = 0;
+	struct sipc_callbacks callbacks = { .callback = callback };
 
-	if (!title) {
-		errorf("title cannot be NULL\n");
-		return NOK;
-	}
+	va_start(args, callback);
+	timeout = sipc_timeout_arg(args);
+	va_end(args);
 
-	if (packet_type != REGISTER && !identifier.server_started) {
-		return NOK;
-	}
+	return register_callbacks(&identifier, title, &callbacks, timeout);
+}
 
-	memset((void *)&address, 0, sizeof(struct sockaddr_in6));
-	memset(&packet, 0, sizeof(struct _packet));
+int sipc_register_many(struct sipc_registration *registrations, unsigned int count, ...)
+{
+	va_list args;
+	unsigned long timeout = 0;
 
-	local_svr_port = identifier.port;
+	va_start(args, count);
+	timeout = sipc_timeout_arg(args);
+	va_end(args);
 
-	if (sipc_buf_to_sockstorage(IPV6_LOOPBACK_ADDR, _port, &address) == NOK) {
-		errorf("sipc_buf_to_sockstorage() failed\n");
-		return NOK;
-	}
+	return register_titles(&identifier, registrations, count, timeout);
+}
 
-	while (timeout_cnt <= timeout) {
-		close(fd);
-		sleep(1);
-		timeout_cnt++;
+int sipc_register_loaned(char *title, int (*callback)(const void *, unsigned int), ...)
+{
+	va_list args;
+	unsigned long timeout = 0;
+	struct sipc_callbacks callbacks = { .loaned_callback = callback };
 
-		fd = sipc_socket_open_use_buf(IPV6_LOOPBACK_ADDR, SOCK_STREAM, 0);
-		if (fd == -1) {
-			errorf("socket() failed with %d: %s\n", errno, strerror(errno));
-			continue;
-		}
+	va_start(args, callback);
+	timeout = sipc_timeout_arg(args);
+	va_end(args);
 
-		if (sipc_connect_socket(fd, (struct sockaddr*)&address) < 0) {
-			errorf("connect() failed with %d: %s\n", errno, strerror(errno));
-			continue;
-		}
+	return register_callbacks(&identifier, title, &callbacks, timeout);
+}
 
-		ret = OK;
-		break;
-	}
+int sipc_register_timed(char *title, int (*callback)(void *, unsigned int, const struct sipc_timestamps *), ...)
+{
+	va_list args;
+	unsigned long timeout = 0;
+	struct sipc_callbacks callbacks = { .timed_callback = callback };
 
-	if (ret != OK || fd < 0) {
-		debugf("retry failed\n");
-		goto fail;
-	}
+	va_start(args, callback);
+	timeout = sipc_timeout_arg(args);
+	va_end(args);
 
-	packet.title = strdup(title);
-	if (!packet.title) {
-		errorf("strdup failed\n");
-		goto fail;
-	}
-	packet.title_size = strlen(title) + 1;
-	packet.packet_type = (unsigned char)packet_type;
-	packet.payload_size = 0;
-	packet.payload = NULL;
+	return register_callbacks(&identifier, title, &callbacks, timeout);
+}
 
-	if (data && len) {
-		packet.payload = (void *)calloc(1, len + 1);
-		if (!packet.payload) {
-			errorf("calloc failed\n");
-			goto fail;
-		}
-		strncpy(packet.payload, data, len);
-		packet.payload_size = len + 1;
-	}
+int sipc_register_schema(char *title, unsigned int schema_id, int (*callback)(const void *, unsigned int, unsigned int), ...)
+{
+	va_list args;
+	unsigned long timeout = 0;
 
-	if (sipc_send_packet(&packet, fd) == NOK) {
-		errorf("sipc_send_packet() failed with %d: %s\n", errno, strerror(errno));
-		goto fail;
-	}
+	va_start(args, callback);
+	timeout = sipc_timeout_arg(args);
+	va_end(args);
 
-	if (!identifier.server_started) {
-		if (recv(fd, &local_svr_port, sizeof(unsigned int), 0) == -1) {
-			errorf("recv() failed with %d: %s\n", errno, strerror(errno));
-			goto fail;
-		}
+	return register_schema(&identifier, title, schema_id, callback, timeout);
+}
 
-		if (local_svr_port < STARTING_PORT || local_svr_port > STARTING_PORT + BACKLOG) {
-			debugf("need to register first\n");
-		} else {
-			debugf("port %d initialized for this app\n", local_svr_port);
-			identifier.port = local_svr_port;
-			TAILQ_INIT(&(identifier.callback_list));
-			create_server_thread();
-		}
-	}
+int sipc_send_schema(char *title, unsigned int schema_id, const void *message, unsigned int size, ...)
+{
+	va_list args;
+	unsigned long timeout = 0;
 
-	if (packet_type == REGISTER) {
-		if (!callback) {
-			errorf("callback cannot be NULL while registering\n");
-			goto fail;
-		}
-		if (find_callback_in_callback_list(callback, title) == NOK) {
-			if (add_callback_to_callback_list(callback, title) == NOK) {
-				errorf("add_callback_to_callback_list() failed\n");
-				goto fail;
-			}
-		}
-	} else if (packet_type == UNREGISTER) {
-		if (delete_callback_from_callback_list(title) == NOK) {
-			errorf("delete_callback_from_callback_list() failed\n");
-			goto fail;
-		}
-	} else if (packet_type == UNREGISTER_ALL) {
-		if (delete_all_callback_list() == NOK) {
-			errorf("delete_all_callback_list() failed\n");
-			goto fail;
-		}
-	}
+	va_start(args, size);
+	timeout = sipc_timeout_arg(args);
+	va_end(args);
 
-	goto out;
+	return send_schema(&identifier, title, schema_id, message, size, timeout);
+}
 
-fail:
-	ret = NOK;
+int sipc_register_datagram(char *title, int (*callback)(void *, unsigned int, unsigned long long, unsigned long), ...)
+{
+	va_list args;
+	unsigned long timeout = 0;
+	struct sipc_callbacks callbacks = { .datagram_callback = callback };
 
-out:
-	close(fd);
-	FREE(packet.title);
-	FREE(packet.payload);
+	va_start(args, callback);
+	timeout = sipc_timeout_arg(args);
+	va_end(args);
 
-	return ret;
+	return register_callbacks(&identifier, title, &callbacks, timeout);
 }
 
-int sipc_register(char *title, int (*callback)(void *, unsigned int), ...)
+int sipc_get_latency_histogram(char *title, enum sipc_latency_stage stage, struct sipc_latency_histogram *histogram)
+{
+	return sipc_ctx_get_latency_histogram(&identifier, title, stage, histogram);
+}
+
+int sipc_unregister(char *title)
+{
+	return sipc_ctx_unregister(&identifier, title);
+}
+
+int sipc_send_data(char *title, void *data, unsigned int len, ...)
+{
+	va_list args;
+	unsigned long timeout = 0;
+
+	va_start(args, len);
+	timeout = sipc_timeout_arg(args);
+	va_end(args);
+
+	return send_title_data(&identifier, title, NULL, data, len, timeout);
+}
+
+int sipc_send_keyed_data(char *title, char *key, void *data, unsigned int len, ...)
 {
 	va_list args;
-	const char *fmt = "%d";
-	char buffer[BUFFER_SIZE];
-	char *ptr = NULL;
 	unsigned long timeout = 0;
 
-	if (!title || !callback) {
+	if (!key) {
 		errorf("args cannot be NULL\n");
 		return NOK;
 	}
 
-	va_start(args, fmt);
-	vsnprintf(buffer, sizeof(buffer) - 1, fmt, args);
+	va_start(args, len);
+	timeout = sipc_timeout_arg(args);
 	va_end(args);
 
-	timeout = strtoul(buffer, &ptr, 10);
+	return send_title_data(&identifier, title, key, data, len, timeout);
+}
 
-	return sipc_send(title, callback, REGISTER, NULL, 0, PORT, timeout);
+int sipc_set_conflation(char *title, bool enable)
+{
+	return sipc_ctx_set_conflation(&identifier, title, enable);
 }
 
-static int sipc_unregister_all(void)
+int sipc_set_priority(char *title, enum _packet_priority priority)
 {
-	char unreg_buf[256] = {0};
+	return sipc_ctx_set_priority(&identifier, title, priority);
+}
 
-	snprintf(unreg_buf, sizeof(unreg_buf), "%d", identifier.port);
+int sipc_set_compression(char *title, bool enable)
+{
+	return sipc_ctx_set_compression(&identifier, title, enable);
+}
 
-	return sipc_send(DUMMY_STRING, NULL, UNREGISTER_ALL, unreg_buf, strlen(unreg_buf), PORT, 0);
+int sipc_set_direct(char *title, bool enable)
+{
+	return sipc_ctx_set_direct(&identifier, title, enable);
 }
 
-int sipc_destroy(void)
+int sipc_set_datagram(char *title, bool enable)
 {
-	if (sipc_unregister_all() == NOK) {
-		return NOK;
-	}
-	if (sipc_send(DUMMY_STRING, NULL, DESTROY, NULL, 0, identifier.port, 0) == NOK) {
-		return NOK;
-	}
+	return sipc_ctx_set_datagram(&identifier, title, enable);
+}
 
-	sleep(2);	//this is here for observing data release for valgrind
+int sipc_set_timestamps(char *title, bool enable)
+{
+	return sipc_ctx_set_timestamps(&identifier, title, enable);
+}
 
-	return OK;
+int sipc_set_receive_mode(enum sipc_wait_mode mode, unsigned int spin_us, int cpu)
+{
+	return sipc_ctx_set_receive_mode(&identifier, mode, spin_us, cpu);
 }
 
-int sipc_unregister(char *title)
+int sipc_send_bradcast_data(void *data, unsigned int len, ...)
 {
-	char unreg_buf[256] = {0};
+	va_list args;
+	unsigned long timeout = 0;
 
-	if (!title) {
-		errorf("args cannot be NULL\n");
-		return NOK;
-	}
+	va_start(args, len);
+	timeout = sipc_timeout_arg(args);
+	va_end(args);
 
-	snprintf(unreg_buf, sizeof(unreg_buf), "%d", identifier.port);
-	return sipc_send(title, NULL, UNREGISTER, unreg_buf, strlen(unreg_buf), PORT, 0);
+	return send_title_data(&identifier, BROADCAST_UNIQUE_TITLE, NULL, data, len, timeout);
 }
 
-int sipc_send_data(char *title, void *data, unsigned int len, ...)
+int sipc_broadcast_register(int (*callback)(void *, unsigned int), ...)
 {
 	va_list args;
-	const char *fmt = "%d";
-	char buffer[BUFFER_SIZE];
-	char *ptr = NULL;
 	unsigned long timeout = 0;
+	struct sipc_callbacks callbacks = { .callback = callback };
 
-	if (!title || !data || !len) {
-		errorf("args cannot be NULL\n");
-		return NOK;
-	}
-
-	va_start(args, fmt);
-	vsnprintf(buffer, sizeof(buffer) - 1, fmt, args);
+	va_start(args, callback);
+	timeout = sipc_timeout_arg(args);
 	va_end(args);
 
-	timeout = strtoul(buffer, &ptr, 10);
+	return register_callbacks(&identifier, BROADCAST_UNIQUE_TITLE, &callbacks, timeout);
+}
 
-	return sipc_send(title, NULL, SENDATA, data, len, PORT, timeout);
+int sipc_broadcast_unregister(void)
+{
+	return sipc_ctx_unregister(&identifier, BROADCAST_UNIQUE_TITLE);
 }
 
-int sipc_send_bradcast_data(void *data, unsigned int len, ...)
+int sipc_stream_register(char *title, int (*callback)(unsigned int, unsigned long long, void *, unsigned int, bool), ...)
 {
 	va_list args;
-	const char *fmt = "%d";
-	char buffer[BUFFER_SIZE];
-	char *ptr = NULL;
 	unsigned long timeout = 0;
+	struct sipc_callbacks callbacks = { .stream_callback = callback };
+
+	va_start(args, callback);
+	timeout = sipc_timeout_arg(args);
+	va_end(args);
 
-	if (!data || !len) {
+	return register_callbacks(&identifier, title, &callbacks, timeout);
+}
+
+struct sipc_stream *sipc_ctx_stream_open(struct sipc_ctx *ctx, char *title)
+{
+	struct sipc_stream *stream = NULL;
+
+	if (!ctx || !title) {
+		errorf("args cannot be NULL\n");
+		return NULL;
+	}
+
+	if (!ctx->server_started) {
+		errorf("need to register first\n");
+		return NULL;
+	}
+
+	stream = (struct sipc_stream *)calloc(1, sizeof(struct sipc_stream));
+	if (!stream) {
+		errorf("calloc failed\n");
+		return NULL;
+	}
+
+	stream->title = strdup(title);
+	if (!stream->title) {
+		errorf("strdup failed\n");
+		FREE(stream);
+		return NULL;
+	}
+
+	stream->chunk = (char *)calloc(1, sizeof(struct _stream_chunk_header) + STREAM_CHUNK_SIZE);
+	if (!stream->chunk) {
+		errorf("calloc failed\n");
+		FREE(stream->title);
+		FREE(stream);
+		return NULL;
+	}
+
+	stream->ctx = ctx;
+	stream->stream_id = (ctx->port << 16) | (__atomic_fetch_add(&(ctx->stream_count), 1, __ATOMIC_RELAXED) & 0xffff);
+	stream->flags = STREAM_CHUNK_FIRST;
+
+	return stream;
+}
+
+struct sipc_stream *sipc_stream_open(char *title)
+{
+	return sipc_ctx_stream_open(&identifier, title);
+}
+
+static int sipc_stream_flush(struct sipc_stream *stream, bool last)
+{
+	struct _stream_chunk_header header;
+
+	if (!stream) {
 		errorf("args cannot be NULL\n");
 		return NOK;
 	}
 
-	va_start(args, fmt);
-	vsnprintf(buffer, sizeof(buffer) - 1, fmt, args);
-	va_end(args);
+	memset(&header, 0, sizeof(header));
+	header.stream_id = stream->stream_id;
+	header.flags = stream->flags | (last ? STREAM_CHUNK_LAST : 0);
+	header.offset = stream->offset;
+	memcpy(stream->chunk, &header, sizeof(header));
+
+	if (sipc_send(stream->ctx, stream->title, NULL, NULL, STREAM, stream->chunk, sizeof(header) + stream->len, 0, sipc_shard_port(stream->title), 0) == NOK) {
+		errorf("sipc_send() failed\n");
+		return NOK;
+	}
 
-	timeout = strtoul(buffer, &ptr, 10);
+	stream->offset += stream->len;
+	stream->len = 0;
+	stream->flags = 0;
 
-	return sipc_send(BROADCAST_UNIQUE_TITLE, NULL, SENDATA, data, len, PORT, timeout);
+	return OK;
 }
 
-int sipc_broadcast_register(int (*callback)(void *, unsigned int), ...)
+/*
+ * data is sent in chunks of STREAM_CHUNK_SIZE, so neither the sender nor
+ * sipcd holds more than one chunk of it at a time, see sipc_order_chunk() for
+ * the receivers
+ */
+int sipc_stream_write(struct sipc_stream *stream, void *data, unsigned int len)
 {
-	va_list args;
-	const char *fmt = "%d";
-	char buffer[BUFFER_SIZE];
-	char *ptr = NULL;
-	unsigned long timeout = 0;
+	unsigned int size = 0;
 
-	va_start(args, fmt);
-	vsnprintf(buffer, sizeof(buffer) - 1, fmt, args);
-	va_end(args);
+	if (!stream || !data || !len) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	while (len) {
+		size = STREAM_CHUNK_SIZE - stream->len;
+		if (size > len) {
+			size = len;
+		}
+
+		memcpy(stream->chunk + sizeof(struct _stream_chunk_header) + stream->len, data, size);
+		stream->len += size;
+		data = (char *)data + size;
+		len -= size;
 
-	timeout = strtoul(buffer, &ptr, 10);
+		if (stream->len == STREAM_CHUNK_SIZE && sipc_stream_flush(stream, false) == NOK) {
+			errorf("sipc_stream_flush() failed\n");
+			return NOK;
+		}
+	}
 
-	return sipc_register(BROADCAST_UNIQUE_TITLE, callback, timeout);
+	return OK;
 }
 
-int sipc_broadcast_unregister(void)
+int sipc_stream_close(struct sipc_stream *stream)
 {
-	return sipc_unregister(BROADCAST_UNIQUE_TITLE);
+	int ret = OK;
+
+	if (!stream) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	if (sipc_stream_flush(stream, true) == NOK) {
+		errorf("sipc_stream_flush() failed\n");
+		ret = NOK;
+	}
+
+	FREE(stream->chunk);
+	FREE(stream->title);
+	FREE(stream);
+
+	return ret;
 }
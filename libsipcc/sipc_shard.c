@@ -0,0 +1,207 @@
+#include "sipc_shard.h"
+
+static struct shard_ring shard_ring;
+static pthread_once_t shard_once = PTHREAD_ONCE_INIT;
+
+/*
+ * fnv-1a with the murmur3 finalizer, the points of a shard differ in the last
+ * characters only and they should still spread over the whole ring
+ */
+static unsigned int shard_hash(const char *data)
+{
+	unsigned int hash = 2166136261U;
+
+	for (; *data; data++) {
+		hash ^= (unsigned char)*data;
+		hash *= 16777619U;
+	}
+
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bU;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35U;
+	hash ^= hash >> 16;
+
+	return hash;
+}
+
+static int compare_points(const void *first, const void *second)
+{
+	const struct shard_point *a = (const struct shard_point *)first;
+	const struct shard_point *b = (const struct shard_point *)second;
+
+	if (a->hash != b->hash) {
+		return a->hash < b->hash ? -1 : 1;
+	}
+
+	return a->shard < b->shard ? -1 : a->shard > b->shard;
+}
+
+static int shard_add_port(struct shard_ring *ring, unsigned long port)
+{
+	unsigned int i;
+
+	if (!port || port + BACKLOG + 1 > 65535) {
+		errorf("'%lu' is not a valid sipcd port\n", port);
+		return NOK;
+	}
+
+	if (ring->count == SHARD_MAX) {
+		errorf("at most %d sipcd can be used\n", SHARD_MAX);
+		return NOK;
+	}
+
+	//the client ports of a sipcd follow its own port, the ranges cannot overlap
+	for (i = 0; i < ring->count; i++) {
+		if ((port > ring->ports[i] ? port - ring->ports[i] : ring->ports[i] - port) <= BACKLOG) {
+			errorf("sipcd ports %u and %lu are closer than %d\n", ring->ports[i], port, BACKLOG + 1);
+			return NOK;
+		}
+	}
+
+	ring->ports[ring->count++] = (unsigned short)port;
+
+	return OK;
+}
+
+/*
+ * the points depend on the ports only, so the order of the list does not
+ * change the shard of a title
+ */
+static int shard_build(struct shard_ring *ring, const char *ports)
+{
+	unsigned int i, j;
+	unsigned long port = 0;
+	char *end = NULL;
+	char name[32];
+
+	if (!ring || !ports) {
+		errorf("args cannot be NULL\n");
+		return NOK;
+	}
+
+	memset(ring, 0, sizeof(struct shard_ring));
+
+	while (*ports) {
+		errno = 0;
+		port = strtoul(ports, &end, 10);
+		if (errno || end == ports) {
+			errorf("cannot parse the sipcd ports '%s'\n", ports);
+			return NOK;
+		}
+		if (shard_add_port(ring, port) == NOK) {
+			return NOK;
+		}
+
+		ports = end + strspn(end, " \t");
+		if (*ports == ',') {
+			ports++;
+		} else if (*ports) {
+			errorf("cannot parse the sipcd ports '%s'\n", ports);
+			return NOK;
+		}
+	}
+
+	if (!ring->count) {
+		errorf("no sipcd port is given\n");
+		return NOK;
+	}
+
+	for (i = 0; i < ring->count; i++) {
+		for (j = 0; j < SHARD_VIRTUAL_NODES; j++) {
+			snprintf(name, sizeof(name), "sipcd-%u-%u", ring->ports[i], j);
+			ring->points[ring->point_count].hash = shard_hash(name);
+			ring->points[ring->point_count].shard = i;
+			ring->point_count++;
+		}
+	}
+
+	qsort(ring->points, ring->point_count, sizeof(struct shard_point), compare_points);
+
+	return OK;
+}
+
+static void shard_init(void)
+{
+	char *env = getenv("SIPC_DAEMON_PORTS");
+
+	if (env && shard_build(&shard_ring, env) == OK) {
+		return;
+	}
+
+	if (env) {
+		errorf("SIPC_DAEMON_PORTS is ignored\n");
+	}
+
+	memset(&shard_ring, 0, sizeof(struct shard_ring));
+	shard_ring.count = 1;
+	shard_ring.ports[0] = sipc_daemon_port();
+}
+
+/*
+ * replaces the shards given with SIPC_DAEMON_PORTS, it should be called before
+ * anything is registered
+ */
+int sipc_shard_configure(const char *ports)
+{
+	struct shard_ring ring;
+
+	pthread_once(&shard_once, shard_init);
+
+	if (shard_build(&ring, ports) == NOK) {
+		errorf("shard_build() failed\n");
+		return NOK;
+	}
+
+	memcpy(&shard_ring, &ring, sizeof(struct shard_ring));
+
+	return OK;
+}
+
+/*
+ * the shard of a title is the first point at or after its hash, wrapping
+ * around to the first point of the ring
+ */
+unsigned int sipc_shard_of(const char *title)
+{
+	unsigned int hash;
+	unsigned int low = 0, high, middle;
+
+	pthread_once(&shard_once, shard_init);
+
+	if (!title || shard_ring.count == 1) {
+		return 0;
+	}
+
+	hash = shard_hash(title);
+	high = shard_ring.point_count;
+	while (low < high) {
+		middle = low + (high - low) / 2;
+		if (shard_ring.points[middle].hash < hash) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+
+	return shard_ring.points[low == shard_ring.point_count ? 0 : low].shard;
+}
+
+unsigned short sipc_shard_port(const char *title)
+{
+	return shard_ring.ports[sipc_shard_of(title)];
+}
+
+unsigned int sipc_shard_count(void)
+{
+	pthread_once(&shard_once, shard_init);
+
+	return shard_ring.count;
+}
+
+unsigned short sipc_shard_port_at(unsigned int shard)
+{
+	pthread_once(&shard_once, shard_init);
+
+	return shard < shard_ring.count ? shard_ring.ports[shard] : 0;
+}
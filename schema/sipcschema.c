@@ -0,0 +1,502 @@
+#include <ctype.h>
+#include "sipc_common.h"
+
+#define VERSION		"00.01"
+
+#define SCHEMA_NAME_SIZE		64
+#define SCHEMA_MAX_FIELDS		128		//with the padding
+#define SCHEMA_MAX_MESSAGES		64
+#define SCHEMA_MAX_VERSION		0xffff
+#define SCHEMA_LINE_SIZE		512
+
+/*
+ * a schema file has messages of fixed size fields, eg
+ *
+ *	message quote 1
+ *		u64 time
+ *		f64 price
+ *		char symbol 16
+ *		u32 venue @2
+ *	end
+ *
+ * a field is '<type> <name> [count] [@version]', its version is 1 if it is
+ * not given. a new version appends its fields after the older ones, so the
+ * layout of the older versions never changes. every field is placed at its
+ * natural alignment with explicit padding, the header has no layout left to
+ * the compiler
+ */
+
+struct schema_type {
+	const char *name;
+	const char *ctype;
+	unsigned int size;
+};
+
+struct schema_field {
+	char name[SCHEMA_NAME_SIZE];
+	const struct schema_type *type;
+	unsigned int count;				//0 if it is not an array
+	unsigned int version;
+	unsigned int offset;
+	bool padding;
+};
+
+struct schema_message {
+	char name[SCHEMA_NAME_SIZE];
+	unsigned int id;
+	unsigned int version;			//the newest version of its fields
+	unsigned int size;
+	unsigned int field_count;
+	struct schema_field fields[SCHEMA_MAX_FIELDS];
+};
+
+static const struct schema_type schema_types[] = {
+	{ "i8",		"int8_t",	1 },
+	{ "u8",		"uint8_t",	1 },
+	{ "i16",	"int16_t",	2 },
+	{ "u16",	"uint16_t",	2 },
+	{ "i32",	"int32_t",	4 },
+	{ "u32",	"uint32_t",	4 },
+	{ "i64",	"int64_t",	8 },
+	{ "u64",	"uint64_t",	8 },
+	{ "f32",	"float",	4 },
+	{ "f64",	"double",	8 },
+	{ "char",	"char",		1 },
+	{ NULL,		NULL,		0 },
+};
+
+static struct schema_message messages[SCHEMA_MAX_MESSAGES];
+static unsigned int message_count = 0;
+
+static struct option parameters[] = {
+	{ "help",				no_argument,		0,	'h'	},
+	{ "version",			no_argument,		0,	'v'	},
+	{ "input",				required_argument,	0,	'i'	},
+	{ "output",				required_argument,	0,	'o'	},
+	{ NULL,					0,					0, 	0 	},
+};
+
+static void print_help_exit (char *arg)
+{
+	if (!arg) {
+		return;
+	}
+	printf("\n%s help:\n\n", arg);
+
+	printf("--version:\t('v')\n\t\treturns version\n\n");
+	printf("--input:\t('i')\n\t\tschema file to read, see schema/example.schema\n\n");
+	printf("--output:\t('o')\n\t\theader to generate, the standard output by default\n\n");
+
+	exit(OK);
+}
+
+static const struct schema_type *find_type(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; schema_types[i].name; i++) {
+		if (strcmp(schema_types[i].name, name) == 0) {
+			return &(schema_types[i]);
+		}
+	}
+
+	return NULL;
+}
+
+static bool is_identifier(const char *name)
+{
+	const char *ptr = name;
+
+	if (!name || strlen(name) >= SCHEMA_NAME_SIZE || (!isalpha((unsigned char)*ptr) && *ptr != '_')) {
+		return false;
+	}
+
+	for (ptr++; *ptr; ptr++) {
+		if (!isalnum((unsigned char)*ptr) && *ptr != '_') {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static int parse_number(const char *token, unsigned int max, unsigned int *value)
+{
+	char *end = NULL;
+	unsigned long number;
+
+	errno = 0;
+	number = strtoul(token, &end, 10);
+	if (errno || end == token || *end || !number || number > max) {
+		return NOK;
+	}
+
+	*value = (unsigned int)number;
+
+	return OK;
+}
+
+static int add_field(struct schema_message *message, const char *name, const struct schema_type *type,
+	unsigned int count, unsigned int version, bool padding)
+{
+	struct schema_field *field = NULL;
+
+	if (message->field_count >= SCHEMA_MAX_FIELDS) {
+		errorf("message '%s' has more than %d fields\n", message->name, SCHEMA_MAX_FIELDS);
+		return NOK;
+	}
+
+	field = &(message->fields[message->field_count++]);
+	memset(field, 0, sizeof(struct schema_field));
+	snprintf(field->name, sizeof(field->name), "%s", name);
+	field->type = type;
+	field->count = count;
+	field->version = version;
+	field->padding = padding;
+
+	return OK;
+}
+
+/*
+ * every field is aligned to its own size, the message to SCHEMA_ALIGNMENT
+ */
+static int layout_message(struct schema_message *message)
+{
+	unsigned int i, pad, pad_count = 0, offset = 0;
+	char name[SCHEMA_NAME_SIZE];
+	struct schema_message laid;
+	struct schema_field *field = NULL;
+
+	memcpy(&laid, message, sizeof(struct schema_message));
+	laid.field_count = 0;
+
+	for (i = 0; i < message->field_count; i++) {
+		field = &(message->fields[i]);
+		pad = (field->type->size - offset % field->type->size) % field->type->size;
+		if (pad) {
+			snprintf(name, sizeof(name), "_pad%u", pad_count++);
+			if (add_field(&laid, name, find_type("u8"), pad, field->version, true) == NOK) {
+				return NOK;
+			}
+			laid.fields[laid.field_count - 1].offset = offset;
+			offset += pad;
+		}
+
+		if (add_field(&laid, field->name, field->type, field->count, field->version, false) == NOK) {
+			return NOK;
+		}
+		laid.fields[laid.field_count - 1].offset = offset;
+		offset += field->type->size * (field->count ? field->count : 1);
+	}
+
+	pad = (SCHEMA_ALIGNMENT - offset % SCHEMA_ALIGNMENT) % SCHEMA_ALIGNMENT;
+	if (pad) {
+		snprintf(name, sizeof(name), "_pad%u", pad_count++);
+		if (add_field(&laid, name, find_type("u8"), pad, laid.version, true) == NOK) {
+			return NOK;
+		}
+		laid.fields[laid.field_count - 1].offset = offset;
+		offset += pad;
+	}
+
+	laid.size = offset;
+	memcpy(message, &laid, sizeof(struct schema_message));
+
+	return OK;
+}
+
+static int check_message(struct schema_message *message)
+{
+	unsigned int i;
+
+	if (!message->field_count) {
+		errorf("message '%s' has no field\n", message->name);
+		return NOK;
+	}
+
+	for (i = 0; i < message_count; i++) {
+		if (strcmp(messages[i].name, message->name) == 0 || messages[i].id == message->id) {
+			errorf("message '%s' %u is given twice\n", message->name, message->id);
+			return NOK;
+		}
+	}
+
+	return OK;
+}
+
+static int parse_field(struct schema_message *message, char **tokens, unsigned int token_count)
+{
+	unsigned int i, count = 0, version = 1;
+	const struct schema_type *type = NULL;
+
+	if (token_count < 2 || token_count > 4) {
+		errorf("a field is '<type> <name> [count] [@version]'\n");
+		return NOK;
+	}
+
+	if ((type = find_type(tokens[0])) == NULL) {
+		errorf("type '%s' is not known\n", tokens[0]);
+		return NOK;
+	}
+
+	if (!is_identifier(tokens[1]) || tokens[1][0] == '_') {
+		errorf("field name '%s' is not valid\n", tokens[1]);
+		return NOK;
+	}
+
+	for (i = 2; i < token_count; i++) {
+		if (tokens[i][0] == '@') {
+			if (parse_number(tokens[i] + 1, SCHEMA_MAX_VERSION, &version) == NOK) {
+				errorf("version '%s' is not valid\n", tokens[i]);
+				return NOK;
+			}
+		} else if (parse_number(tokens[i], 0xffff, &count) == NOK) {
+			errorf("count '%s' is not valid\n", tokens[i]);
+			return NOK;
+		}
+	}
+
+	//the older versions keep their layout
+	if (version < message->version) {
+		errorf("field '%s' of version %u comes after the fields of version %u\n", tokens[1], version, message->version);
+		return NOK;
+	}
+	message->version = version;
+
+	for (i = 0; i < message->field_count; i++) {
+		if (strcmp(message->fields[i].name, tokens[1]) == 0) {
+			errorf("field '%s' is given twice\n", tokens[1]);
+			return NOK;
+		}
+	}
+
+	return add_field(message, tokens[1], type, count, version, false);
+}
+
+static int parse_schema(const char *path)
+{
+	int ret = OK;
+	unsigned int line_number = 0, token_count = 0;
+	char line[SCHEMA_LINE_SIZE];
+	char *tokens[8];
+	char *token = NULL;
+	char *save = NULL;
+	FILE *fp = NULL;
+	struct schema_message *message = NULL;
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		errorf("fopen() failed for '%s' with %d: %s\n", path, errno, strerror(errno));
+		return NOK;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		line_number++;
+		if ((token = strchr(line, '#')) != NULL) {
+			*token = '\0';
+		}
+
+		token_count = 0;
+		for (token = strtok_r(line, " \t\r\n", &save); token && token_count < 8; token = strtok_r(NULL, " \t\r\n", &save)) {
+			tokens[token_count++] = token;
+		}
+		if (!token_count) {
+			continue;
+		}
+
+		if (strcmp(tokens[0], "message") == 0) {
+			if (message) {
+				errorf("%s:%u: message '%s' has no end\n", path, line_number, message->name);
+				goto fail;
+			}
+			if (message_count >= SCHEMA_MAX_MESSAGES) {
+				errorf("%s:%u: more than %d messages\n", path, line_number, SCHEMA_MAX_MESSAGES);
+				goto fail;
+			}
+			message = &(messages[message_count]);
+			memset(message, 0, sizeof(struct schema_message));
+			if (token_count != 3 || !is_identifier(tokens[1]) || parse_number(tokens[2], 0xffff, &(message->id)) == NOK) {
+				errorf("%s:%u: a message is 'message <name> <id>', the id is 1 to 65535\n", path, line_number);
+				goto fail;
+			}
+			snprintf(message->name, sizeof(message->name), "%s", tokens[1]);
+			message->version = 1;
+		} else if (strcmp(tokens[0], "end") == 0) {
+			if (!message) {
+				errorf("%s:%u: end without a message\n", path, line_number);
+				goto fail;
+			}
+			if (check_message(message) == NOK || layout_message(message) == NOK) {
+				errorf("%s:%u: message '%s' is not valid\n", path, line_number, message->name);
+				goto fail;
+			}
+			message_count++;
+			message = NULL;
+		} else if (!message) {
+			errorf("%s:%u: '%s' is out of a message\n", path, line_number, tokens[0]);
+			goto fail;
+		} else if (parse_field(message, tokens, token_count) == NOK) {
+			errorf("%s:%u: field is not valid\n", path, line_number);
+			goto fail;
+		}
+	}
+
+	if (message) {
+		errorf("%s: message '%s' has no end\n", path, message->name);
+		goto fail;
+	}
+
+	goto out;
+
+fail:
+	ret = NOK;
+
+out:
+	FCLOSE(fp);
+
+	return ret;
+}
+
+static void upper_case(const char *from, char *to, size_t size)
+{
+	size_t i;
+
+	for (i = 0; from[i] && i < size - 1; i++) {
+		to[i] = isalnum((unsigned char)from[i]) ? toupper((unsigned char)from[i]) : '_';
+	}
+	to[i] = '\0';
+}
+
+/*
+ * the size of a version is the end of its last field, a receiver of that
+ * version reads no byte after it
+ */
+static unsigned int version_size(struct schema_message *message, unsigned int version)
+{
+	unsigned int i, size = 0;
+	struct schema_field *field = NULL;
+
+	for (i = 0; i < message->field_count; i++) {
+		field = &(message->fields[i]);
+		if (!field->padding && field->version <= version) {
+			size = field->offset + field->type->size * (field->count ? field->count : 1);
+		}
+	}
+
+	return size;
+}
+
+static void write_message(FILE *fp, struct schema_message *message)
+{
+	unsigned int i, version;
+	char upper[SCHEMA_NAME_SIZE];
+	char declaration[SCHEMA_NAME_SIZE * 2];
+	struct schema_field *field = NULL;
+
+	upper_case(message->name, upper, sizeof(upper));
+
+	fprintf(fp, "/*\n * %s, message %u version %u\n */\n", message->name, message->id, message->version);
+	fprintf(fp, "#define %s_MESSAGE\t\t%u\n", upper, message->id);
+	fprintf(fp, "#define %s_VERSION\t\t%u\n", upper, message->version);
+	fprintf(fp, "#define %s_SCHEMA_ID\t\tSIPC_SCHEMA_ID(%u, %u)\n", upper, message->id, message->version);
+	for (version = 1; version <= message->version; version++) {
+		fprintf(fp, "#define %s_SIZE_V%u\t\t%u\n", upper, version, version_size(message, version));
+	}
+
+	fprintf(fp, "\nstruct %s\n{\n", message->name);
+	for (i = 0; i < message->field_count; i++) {
+		field = &(message->fields[i]);
+		if (field->count) {
+			snprintf(declaration, sizeof(declaration), "%s %s[%u];", field->type->ctype, field->name, field->count);
+		} else {
+			snprintf(declaration, sizeof(declaration), "%s %s;", field->type->ctype, field->name);
+		}
+		fprintf(fp, "\t%-40s//offset %u, version %u\n", declaration, field->offset, field->version);
+	}
+	fprintf(fp, "} __attribute__((aligned(SCHEMA_ALIGNMENT)));\n\n");
+
+	fprintf(fp, "_Static_assert(sizeof(struct %s) == %u, \"layout of %s\");\n", message->name, message->size, message->name);
+	for (i = 0; i < message->field_count; i++) {
+		field = &(message->fields[i]);
+		fprintf(fp, "_Static_assert(offsetof(struct %s, %s) == %u, \"layout of %s\");\n", message->name, field->name,
+			field->offset, message->name);
+	}
+	fprintf(fp, "\n");
+}
+
+static int write_header(const char *input, const char *output)
+{
+	unsigned int i;
+	const char *base = NULL;
+	char guard[SCHEMA_NAME_SIZE * 2];
+	FILE *fp = stdout;
+
+	if (output && (fp = fopen(output, "w")) == NULL) {
+		errorf("fopen() failed for '%s' with %d: %s\n", output, errno, strerror(errno));
+		return NOK;
+	}
+
+	base = strrchr(output ? output : input, '/');
+	base = base ? base + 1 : (output ? output : input);
+	upper_case(base, guard, sizeof(guard));
+
+	fprintf(fp, "/*\n * generated by sipcschema from %s, do not edit\n */\n", input);
+	fprintf(fp, "#ifndef __SIPC_SCHEMA_%s_\n#define __SIPC_SCHEMA_%s_\n\n", guard, guard);
+	fprintf(fp, "#include <stdint.h>\n#include <stddef.h>\n#include \"sipc_common.h\"\n\n");
+
+	for (i = 0; i < message_count; i++) {
+		write_message(fp, &(messages[i]));
+	}
+
+	fprintf(fp, "#endif //__SIPC_SCHEMA_%s_\n", guard);
+
+	if (fp != stdout) {
+		FCLOSE(fp);
+	}
+
+	return OK;
+}
+
+int main(int argc, char **argv)
+{
+	int c, o;
+	char *input = NULL;
+	char *output = NULL;
+
+	while ((c = getopt_long(argc, argv, "hvi:o:", parameters, &o)) != -1) {
+		switch (c) {
+			case 'h':
+				print_help_exit(argv[0]);
+				break;
+			case 'v':
+				printf("%s version %s\n", argv[0], VERSION);
+				return OK;
+				break;
+			case 'i':
+				input = optarg;
+				break;
+			case 'o':
+				output = optarg;
+				break;
+			default:
+				errorf("unknown argument\n");
+				return NOK;
+		}
+	}
+
+	if (!input) {
+		errorf("schema file is not given, see --help\n");
+		return NOK;
+	}
+
+	if (parse_schema(input) == NOK) {
+		errorf("parse_schema() failed\n");
+		return NOK;
+	}
+
+	if (write_header(input, output) == NOK) {
+		errorf("write_header() failed\n");
+		return NOK;
+	}
+
+	return OK;
+}
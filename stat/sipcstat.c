@@ -0,0 +1,232 @@
+#include "sipc_common.h"
+
+#define VERSION		"00.01"
+
+#define MAX_FIELDS		16
+#define TITLE_WIDTH		32
+
+struct stat_record {
+	char *type;
+	char *name;
+	unsigned int field_count;
+	char *keys[MAX_FIELDS];
+	unsigned long values[MAX_FIELDS];
+};
+
+static bool raw_output = false;
+static char *sort_key = NULL;
+
+static struct option parameters[] = {
+	{ "help",				no_argument,		0,	'h'	},
+	{ "version",			no_argument,		0,	'v'	},
+	{ "raw",				no_argument,		0,	'r'	},
+	{ "interval",			required_argument,	0,	'i'	},
+	{ "sort",				required_argument,	0,	's'	},
+	{ NULL,					0,					0, 	0 	},
+};
+
+static void print_help_exit (char *arg)
+{
+	if (!arg) {
+		return;
+	}
+	printf("\n%s help:\n\n", arg);
+
+	printf("--version:\t('v')\n\t\treturns version\n\n");
+	printf("--raw:\t\t('r')\n\t\tprints the stats as sipcd sends them\n\n");
+	printf("--interval:\t('i')\n\t\trefreshes the stats in every given seconds\n\n");
+	printf("--sort:\t\t('s')\n\t\tsorts the titles and the clients by the given counter, eg msgs_in, send_errors\n\n");
+
+	exit(OK);
+}
+
+/*
+ * parses one 'type key=value ... [name=rest of the line]' record in place
+ */
+static int parse_record(char *line, struct stat_record *record)
+{
+	char *token = NULL;
+	char *value = NULL;
+	char *save = NULL;
+
+	memset(record, 0, sizeof(struct stat_record));
+
+	if ((record->type = strtok_r(line, " ", &save)) == NULL) {
+		return NOK;
+	}
+
+	while ((token = strtok_r(NULL, " ", &save)) != NULL) {
+		if (strncmp(token, "name=", 5) == 0) {
+			//name is the last field and may contain spaces
+			if (*save) {
+				token[strlen(token)] = ' ';
+			}
+			record->name = token + 5;
+			break;
+		}
+		if ((value = strchr(token, '=')) == NULL || record->field_count == MAX_FIELDS) {
+			continue;
+		}
+		*value++ = '\0';
+		record->keys[record->field_count] = token;
+		record->values[record->field_count++] = strtoul(value, NULL, 10);
+	}
+
+	return OK;
+}
+
+static unsigned long record_value(struct stat_record *record, const char *key)
+{
+	unsigned int i;
+
+	for (i = 0; i < record->field_count; i++) {
+		if (strcmp(record->keys[i], key) == 0) {
+			return record->values[i];
+		}
+	}
+
+	return 0;
+}
+
+static int compare_records(const void *a, const void *b)
+{
+	unsigned long va = record_value((struct stat_record *)a, sort_key);
+	unsigned long vb = record_value((struct stat_record *)b, sort_key);
+
+	return va < vb ? 1 : (va > vb ? -1 : 0);
+}
+
+static void render_stats(char *stats)
+{
+	unsigned int i, line_count = 0, record_count = 0;
+	char *line = NULL;
+	char *save = NULL;
+	const char *default_sort = sort_key;
+	struct stat_record *records = NULL;
+	struct stat_record *record = NULL;
+
+	for (line = stats; *line; line++) {
+		line_count += *line == '\n';
+	}
+
+	records = (struct stat_record *)calloc(line_count + 1, sizeof(struct stat_record));
+	if (!records) {
+		errorf("calloc failed\n");
+		return;
+	}
+
+	for (line = strtok_r(stats, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+		if (parse_record(line, &(records[record_count])) == OK) {
+			record_count++;
+		}
+	}
+
+	for (i = 0; i < record_count; i++) {
+		record = &(records[i]);
+		if (strcmp(record->type, "daemon") != 0) {
+			continue;
+		}
+		printf("sipcd: uptime %lus, %lu loops, %lu packets in, %lu conflated, lanes high/normal/low %lu/%lu/%lu\n",
+			record_value(record, "uptime"), record_value(record, "loops"), record_value(record, "packets_in"),
+			record_value(record, "conflated"), record_value(record, "lane_high"), record_value(record, "lane_normal"),
+			record_value(record, "lane_low"));
+		printf("pool:  %lu allocs, %lu frees, %lu heap allocs, %lu arenas\n\n", record_value(record, "pool_allocs"),
+			record_value(record, "pool_frees"), record_value(record, "pool_heap_allocs"), record_value(record, "pool_arenas"));
+	}
+
+	//titles and clients are grouped since sipcd sends them in that order
+	sort_key = default_sort ? (char *)default_sort : "msgs_in";
+	for (i = 0; i < record_count && strcmp(records[i].type, "title") != 0; i++);
+	line_count = i;
+	for (; i < record_count && strcmp(records[i].type, "title") == 0; i++);
+	qsort(&(records[line_count]), i - line_count, sizeof(struct stat_record), compare_records);
+
+	printf("%-*s %6s %8s %12s %12s %14s %14s\n", TITLE_WIDTH, "TITLE", "SUBS", "RETAINED",
+		"MSGS IN", "MSGS OUT", "BYTES IN", "BYTES OUT");
+	for (i = line_count; i < record_count && strcmp(records[i].type, "title") == 0; i++) {
+		record = &(records[i]);
+		printf("%-*.*s %6lu %8lu %12lu %12lu %14lu %14lu\n", TITLE_WIDTH, TITLE_WIDTH, record->name ? record->name : "",
+			record_value(record, "subscribers"), record_value(record, "retained"), record_value(record, "msgs_in"),
+			record_value(record, "msgs_out"), record_value(record, "bytes_in"), record_value(record, "bytes_out"));
+	}
+
+	sort_key = default_sort ? (char *)default_sort : "pending";
+	line_count = i;
+	for (; i < record_count && strcmp(records[i].type, "client") == 0; i++);
+	qsort(&(records[line_count]), i - line_count, sizeof(struct stat_record), compare_records);
+
+	printf("\n%-6s %10s %8s %12s %14s %12s\n", "PORT", "REGISTERED", "PENDING", "MSGS OUT", "BYTES OUT", "SEND ERRORS");
+	for (i = line_count; i < record_count && strcmp(records[i].type, "client") == 0; i++) {
+		record = &(records[i]);
+		printf("%-6lu %10s %8lu %12lu %14lu %12lu\n", record_value(record, "port"),
+			record_value(record, "registered") ? "yes" : "no", record_value(record, "pending"),
+			record_value(record, "msgs_out"), record_value(record, "bytes_out"), record_value(record, "send_errors"));
+	}
+
+	sort_key = (char *)default_sort;
+	FREE(records);
+}
+
+int main(int argc, char **argv)
+{
+	int ret = OK;
+	int c, o;
+	unsigned int interval = 0;
+	char *stats = NULL;
+
+	while ((c = getopt_long(argc, argv, "hvri:s:", parameters, &o)) != -1) {
+		switch (c) {
+			case 'h':
+				print_help_exit(argv[0]);
+				break;
+			case 'v':
+				printf("%s version %s\n", argv[0], VERSION);
+				return OK;
+				break;
+			case 'r':
+				raw_output = true;
+				break;
+			case 'i':
+				interval = strtoul(optarg, NULL, 10);
+				break;
+			case 's':
+				sort_key = optarg;
+				break;
+			default:
+				errorf("unknown argument\n");
+				goto fail;
+		}
+	}
+
+	do {
+		if ((stats = sipc_request_stats()) == NULL) {
+			errorf("sipc_request_stats() failed\n");
+			goto fail;
+		}
+
+		if (raw_output) {
+			printf("%s", stats);
+		} else {
+			if (interval) {
+				printf("\033[H\033[2J");
+			}
+			render_stats(stats);
+		}
+		fflush(stdout);
+		FREE(stats);
+
+		if (interval) {
+			sleep(interval);
+		}
+	} while (interval);
+
+	goto out;
+
+fail:
+	ret = NOK;
+
+out:
+	FREE(stats);
+
+	return ret;
+}
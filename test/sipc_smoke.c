@@ -0,0 +1,2040 @@
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sipc_lib.h>
+#include <sipc_shard.h>
+
+#define VERSION		"00.01"
+
+#define SMOKE_WAIT_MS			3000	//for the expected data
+#define SMOKE_RECOVERY_MS		15000	//for the data which waits for a sipcd
+#define SMOKE_QUIET_MS			300		//no more data may come meanwhile
+#define SMOKE_POLL_MS			10
+#define SMOKE_CASE_TIMEOUT		60		//seconds
+#define SMOKE_DATA_SIZE			64
+#define SMOKE_UPDATES			500
+#define SMOKE_DATAGRAMS			100
+#define SMOKE_MAX_RECORDS		16
+#define SMOKE_FAKE_PORT			1		//publisher of the datagrams written by hand
+#define SMOKE_LARGE_SIZE		(4 * STREAM_CHUNK_SIZE + 1000)
+#define SMOKE_TITLES			32
+#define SMOKE_SLOW_SIZE			(64 * 1024)	//data of the slow subscriber, a few of them fill its socket
+#define SMOKE_SLOW_US			2000		//the slow subscriber spends so long on every data
+#define SMOKE_MAX_ARGS			8
+
+//the sipcd instances of a case, the ports of their clients follow them
+#define SMOKE_SHARD_PORT		(PORT + 255)
+#define SMOKE_PEER_PORT			(PORT + 2 * 255)
+#define SMOKE_SNAPSHOT_PORT		(PORT + 3 * 255)
+#define SMOKE_RESTART_PORT		(PORT + 4 * 255)
+
+#define SMOKE_SELF_TITLE		"smoke/self"
+
+/*
+ * every case runs in a process of its own, so the library starts clean for
+ * it. a case prints why it fails and returns NOK
+ */
+struct smoke_case {
+	const char *name;
+	int (*run)(void);
+};
+
+/*
+ * what a subscriber got, the callbacks run on the listener threads and the
+ * cases read it with atomic loads
+ */
+struct smoke_inbox {
+	unsigned int count;
+	unsigned int errors;
+	char last[SMOKE_DATA_SIZE];
+	char keys[2][SMOKE_DATA_SIZE];		//newest data of the keys 'a' and 'b'
+	unsigned char seen[2][SMOKE_UPDATES + 1];
+	unsigned long long sequences[SMOKE_MAX_RECORDS];
+	unsigned long losts[SMOKE_MAX_RECORDS];
+	unsigned long long last_sequence;
+	unsigned long lost;
+	unsigned int schema_ids[SMOKE_MAX_RECORDS];
+	pthread_t thread;
+};
+
+static char *daemon_path = "../daemon/sipcd";
+static char *case_name = NULL;
+static bool verbose = false;
+
+static struct smoke_inbox watch_inbox;
+static struct smoke_inbox late_inbox;
+static struct smoke_inbox datagram_inbox;
+
+static char large_data[SMOKE_LARGE_SIZE];
+static char stream_data[SMOKE_LARGE_SIZE];
+static unsigned int stream_bytes = 0;
+static unsigned int stream_last = 0;
+static const void *loaned_data = NULL;
+
+static struct option parameters[] = {
+	{ "help",				no_argument,		0,	'h'	},
+	{ "version",			no_argument,		0,	'v'	},
+	{ "daemon",				required_argument,	0,	'd'	},
+	{ "case",				required_argument,	0,	'c'	},
+	{ "verbose",			no_argument,		0,	'V'	},
+	{ NULL,					0,					0, 	0 	},
+};
+
+static void print_help_exit (char *arg)
+{
+	if (!arg) {
+		return;
+	}
+	printf("\n%s help:\n\n", arg);
+
+	printf("--version:\t('v')\n\t\treturns version\n\n");
+	printf("--daemon:\t('d')\n\t\tpath of sipcd, default %s\n\n", daemon_path);
+	printf("--case:\t\t('c')\n\t\truns only the named case\n\n");
+	printf("--verbose:\t('V')\n\t\tkeeps the logs of sipcd and of the library\n\n");
+	printf("every case prints PASS or FAIL, the exit code is NOK if a case fails\n\n");
+
+	exit(OK);
+}
+
+static unsigned int smoke_load(unsigned int *value)
+{
+	return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * OK once '*counter' reaches 'want'
+ */
+static int smoke_wait_ms(unsigned int *counter, unsigned int want, unsigned int wait_ms)
+{
+	unsigned int waited;
+
+	for (waited = 0; waited < wait_ms; waited += SMOKE_POLL_MS) {
+		if (smoke_load(counter) >= want) {
+			return OK;
+		}
+		usleep(SMOKE_POLL_MS * 1000);
+	}
+
+	return smoke_load(counter) >= want ? OK : NOK;
+}
+
+static int smoke_wait(unsigned int *counter, unsigned int want)
+{
+	return smoke_wait_ms(counter, want, SMOKE_WAIT_MS);
+}
+
+/*
+ * OK if exactly 'want' data comes, a retained data is sent only once
+ */
+static int smoke_wait_exactly(unsigned int *counter, unsigned int want, const char *what)
+{
+	if (want && smoke_wait(counter, want) == NOK) {
+		printf("\t%s: got %u data, expected %u\n", what, smoke_load(counter), want);
+		return NOK;
+	}
+
+	usleep(SMOKE_QUIET_MS * 1000);
+	if (smoke_load(counter) != want) {
+		printf("\t%s: got %u data, expected %u\n", what, smoke_load(counter), want);
+		return NOK;
+	}
+
+	return OK;
+}
+
+static void smoke_reset(struct smoke_inbox *inbox)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	memset(inbox, 0, sizeof(struct smoke_inbox));
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static void smoke_record(struct smoke_inbox *inbox, void *data, unsigned int len)
+{
+	unsigned int key;
+	unsigned long number;
+	char *value = (char *)data;
+
+	snprintf(inbox->last, sizeof(inbox->last), "%.*s", (int)len, value);
+
+	//a keyed data is "<key>:<number>", every number of a key comes once at most
+	if (len > 2 && value[1] == ':' && (value[0] == 'a' || value[0] == 'b')) {
+		key = value[0] - 'a';
+		number = strtoul(value + 2, NULL, 10);
+		if (number > SMOKE_UPDATES || inbox->seen[key][number]) {
+			inbox->errors++;
+		} else {
+			inbox->seen[key][number] = 1;
+		}
+		if (number >= strtoul(inbox->keys[key] + 2, NULL, 10)) {
+			snprintf(inbox->keys[key], sizeof(inbox->keys[0]), "%.*s", (int)len, value);
+		}
+	}
+
+	inbox->thread = pthread_self();
+	__atomic_add_fetch(&(inbox->count), 1, __ATOMIC_RELEASE);
+}
+
+static int ignore_callback(void *data, unsigned int len)
+{
+	(void) data;
+	(void) len;
+
+	return OK;
+}
+
+static int watch_callback(void *data, unsigned int len)
+{
+	smoke_record(&watch_inbox, data, len);
+
+	return OK;
+}
+
+static int slow_callback(void *data, unsigned int len)
+{
+	smoke_record(&late_inbox, data, len);
+	usleep(SMOKE_SLOW_US);
+
+	return OK;
+}
+
+static int late_callback(void *data, unsigned int len)
+{
+	smoke_record(&late_inbox, data, len);
+
+	return OK;
+}
+
+static int datagram_callback(void *data, unsigned int len, unsigned long long sequence, unsigned long lost)
+{
+	unsigned int count = datagram_inbox.count;
+
+	if (count < SMOKE_MAX_RECORDS) {
+		datagram_inbox.sequences[count] = sequence;
+		datagram_inbox.losts[count] = lost;
+	}
+	datagram_inbox.last_sequence = sequence;
+	datagram_inbox.lost += lost;
+	smoke_record(&datagram_inbox, data, len);
+
+	return OK;
+}
+
+static int large_callback(void *data, unsigned int len)
+{
+	//the trailing null of the library is a part of 'len'
+	if (len != SMOKE_LARGE_SIZE + 1 || memcmp(data, large_data, SMOKE_LARGE_SIZE) != 0) {
+		watch_inbox.errors++;
+	}
+	__atomic_add_fetch(&(watch_inbox.count), 1, __ATOMIC_RELEASE);
+
+	return OK;
+}
+
+static int stream_callback(unsigned int id, unsigned long long offset, void *data, unsigned int len, bool last)
+{
+	(void) id;
+
+	//the chunks come in order, each one starts where the one before ended
+	if (offset != smoke_load(&stream_bytes) || smoke_load(&stream_last) || offset + len > SMOKE_LARGE_SIZE) {
+		watch_inbox.errors++;
+	} else {
+		memcpy(stream_data + offset, data, len);
+	}
+	if (last) {
+		__atomic_store_n(&stream_last, 1, __ATOMIC_RELEASE);
+	}
+	__atomic_add_fetch(&stream_bytes, len, __ATOMIC_RELEASE);
+
+	return OK;
+}
+
+static int loaned_callback(const void *data, unsigned int len)
+{
+	//the first buffer is kept after the callback returns
+	if (!loaned_data && sipc_buffer_retain(data) == OK) {
+		loaned_data = data;
+	}
+	smoke_record(&watch_inbox, (void *)data, len);
+
+	return OK;
+}
+
+static int timed_callback(void *data, unsigned int len, const struct sipc_timestamps *timestamps)
+{
+	if (!timestamps->publish || timestamps->publish > timestamps->daemon_receive ||
+			timestamps->daemon_receive > timestamps->daemon_forward || timestamps->daemon_forward > timestamps->client_receive) {
+		watch_inbox.errors++;
+	}
+	smoke_record(&watch_inbox, data, len);
+
+	return OK;
+}
+
+/*
+ * the messages of the schema case, version 3 appends a field to version 2
+ */
+struct smoke_quote {
+	unsigned long long time;
+	double bid;
+	unsigned int size;
+	unsigned int venue;
+};
+
+struct smoke_quote_v3 {
+	struct smoke_quote quote;
+	unsigned long long sequence;
+};
+
+static int schema_callback(const void *data, unsigned int size, unsigned int schema_id)
+{
+	const struct smoke_quote *quote = (const struct smoke_quote *)data;
+	unsigned int count = watch_inbox.count;
+
+	if ((unsigned long)data % SCHEMA_ALIGNMENT || size < sizeof(struct smoke_quote) || quote->size != 100 ||
+			quote->bid != 1.5) {
+		watch_inbox.errors++;
+	}
+	if (count < SMOKE_MAX_RECORDS) {
+		watch_inbox.schema_ids[count] = schema_id;
+		watch_inbox.sequences[count] = quote->time;
+	}
+	__atomic_add_fetch(&(watch_inbox.count), 1, __ATOMIC_RELEASE);
+
+	return OK;
+}
+
+static int smoke_send(char *title, char *key, const char *fmt, unsigned int value)
+{
+	char data[SMOKE_DATA_SIZE];
+
+	snprintf(data, sizeof(data), fmt, value);
+
+	return key ? sipc_send_keyed_data(title, key, data, strlen(data)) : sipc_send_data(title, data, strlen(data));
+}
+
+/*
+ * every data is sent on a connection of its own, so the data sent at once may
+ * reach sipcd in any order. a data which has to be the newest one is sent
+ * after the data before it is delivered
+ */
+static int smoke_send_delivered(char *title, char *key, const char *fmt, unsigned int value)
+{
+	unsigned int want = smoke_load(&(watch_inbox.count)) + 1;
+
+	if (smoke_send(title, key, fmt, value) == NOK) {
+		printf("\tsending '%s' %u failed\n", title, value);
+		return NOK;
+	}
+	if (smoke_wait(&(watch_inbox.count), want) == NOK) {
+		printf("\tthe data %u of '%s' is not delivered\n", value, title);
+		return NOK;
+	}
+
+	return OK;
+}
+
+/*
+ * a context which registers the title now gets only the retained data of it
+ */
+static int smoke_late_register(char *title, unsigned int want, const char *what)
+{
+	int ret = OK;
+	struct sipc_ctx *late = NULL;
+
+	smoke_reset(&late_inbox);
+
+	if ((late = sipc_ctx_create()) == NULL || sipc_ctx_register(late, title, late_callback, 10) == NOK) {
+		printf("\t%s: the late subscriber cannot register\n", what);
+		ret = NOK;
+	} else {
+		ret = smoke_wait_exactly(&(late_inbox.count), want, what);
+	}
+
+	if (late) {
+		sipc_ctx_destroy(late);
+	}
+
+	return ret;
+}
+
+/*
+ * a counter of a record of "sipcstat -r", a title record is found by its name.
+ * 0 if sipcd has no such record
+ */
+static unsigned long smoke_counter(const char *record, const char *title, const char *counter)
+{
+	unsigned long value = 0;
+	char *stats = NULL, *line = NULL, *save = NULL, *found = NULL;
+	char name[SMOKE_DATA_SIZE], key[SMOKE_DATA_SIZE];
+
+	snprintf(name, sizeof(name), " name=%s", title ? title : "");
+	snprintf(key, sizeof(key), " %s=", counter);
+
+	if ((stats = sipc_request_stats()) == NULL) {
+		return 0;
+	}
+
+	for (line = strtok_r(stats, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+		if (strncmp(line, record, strlen(record)) != 0 || line[strlen(record)] != ' ') {
+			continue;
+		}
+		if (title && ((found = strstr(line, name)) == NULL || strcmp(found, name) != 0)) {
+			continue;
+		}
+		if ((found = strstr(line, key)) != NULL) {
+			value = strtoul(found + strlen(key), NULL, 10);
+		}
+	}
+	FREE(stats);
+
+	return value;
+}
+
+/*
+ * sipcd takes a registration in one of its loops after sipc_register()
+ * returns, the data which is not retained needs the subscriber to be there
+ */
+static int smoke_wait_subscribers(char *title, unsigned int want)
+{
+	unsigned int waited;
+	unsigned long subscribers = 0;
+
+	for (waited = 0; waited < SMOKE_WAIT_MS; waited += SMOKE_POLL_MS) {
+		if ((subscribers = smoke_counter("title", title, "subscribers")) >= want) {
+			return OK;
+		}
+		usleep(SMOKE_POLL_MS * 1000);
+	}
+
+	printf("\tsipcd has %lu subscribers of the title '%s' instead of %u\n", subscribers, title, want);
+
+	return NOK;
+}
+
+/*
+ * a setting of a title goes to sipcd on a connection of its own, it is taken
+ * before a registration which comes later
+ */
+static int smoke_set_conflation(char *title, bool enable)
+{
+	if (sipc_set_conflation(title, enable) == NOK) {
+		printf("\tsipc_set_conflation() failed\n");
+		return NOK;
+	}
+	usleep(SMOKE_QUIET_MS * 1000);
+
+	return OK;
+}
+
+/*
+ * 'args' are given to sipcd after its path, NULL ends them
+ */
+static pid_t start_daemon(char *const args[])
+{
+	int fd;
+	unsigned int i;
+	pid_t pid;
+	char *argv[SMOKE_MAX_ARGS] = { daemon_path };
+
+	for (i = 0; args && args[i] && i + 2 < SMOKE_MAX_ARGS; i++) {
+		argv[i + 1] = args[i];
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		errorf("fork() failed with %d: %s\n", errno, strerror(errno));
+		return -1;
+	} else if (pid == 0) {
+		if (!verbose && (fd = open("/dev/null", O_WRONLY)) >= 0) {
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+			close(fd);
+		}
+		execv(daemon_path, argv);
+		_exit(NOK);
+	}
+
+	sleep(1);
+	if (waitpid(pid, NULL, WNOHANG) == pid) {
+		printf("\t%s exited, is another sipcd running?\n", daemon_path);
+		return -1;
+	}
+
+	return pid;
+}
+
+static void stop_daemon(pid_t pid)
+{
+	if (pid > 0) {
+		kill(pid, SIGINT);
+		waitpid(pid, NULL, 0);
+	}
+}
+
+/*
+ * a sipcd of a case on 'port', 'option' and 'value' are an extra argument
+ */
+static pid_t start_case_daemon(unsigned int port, char *option, char *value)
+{
+	char port_arg[16];
+	char *args[] = { "--port", port_arg, option, value, NULL };
+
+	snprintf(port_arg, sizeof(port_arg), "%u", port);
+
+	return start_daemon(args);
+}
+
+/*
+ * OK if the process exits OK in 'wait_ms', it is killed otherwise
+ */
+static int smoke_reap(pid_t pid, unsigned int wait_ms)
+{
+	int status = 0;
+	unsigned int waited;
+
+	for (waited = 0; waitpid(pid, &status, WNOHANG) != pid; waited += SMOKE_POLL_MS) {
+		if (waited >= wait_ms) {
+			kill(pid, SIGKILL);
+			waitpid(pid, &status, 0);
+			return NOK;
+		}
+		usleep(SMOKE_POLL_MS * 1000);
+	}
+
+	return WIFEXITED(status) && WEXITSTATUS(status) == OK ? OK : NOK;
+}
+
+/*
+ * a subscriber in a process of its own on the sipcd of 'port', it is
+ * registered when this returns and it exits OK once 'want' data comes
+ */
+static pid_t smoke_fork_subscriber(unsigned int port, char *title, unsigned int want)
+{
+	int fds[2], ret;
+	char ready = 0;
+	pid_t pid;
+
+	if (pipe(fds) == -1) {
+		printf("\tpipe() failed with %d: %s\n", errno, strerror(errno));
+		return -1;
+	}
+
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0) {
+		printf("\tfork() failed with %d: %s\n", errno, strerror(errno));
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	} else if (pid == 0) {
+		close(fds[0]);
+		sipc_set_daemon_port(port);
+		if (sipc_register(title, watch_callback, 10) == NOK || write(fds[1], &ready, 1) != 1) {
+			_exit(NOK);
+		}
+		ret = smoke_wait_ms(&(watch_inbox.count), want, SMOKE_RECOVERY_MS);
+		sipc_destroy();
+		_exit(ret);
+	}
+
+	close(fds[1]);
+	if (read(fds[0], &ready, 1) != 1) {
+		printf("\tthe subscriber process cannot register\n");
+		smoke_reap(pid, 0);
+		pid = -1;
+	}
+	close(fds[0]);
+
+	return pid;
+}
+
+/*
+ * the publisher has to be registered to send
+ */
+static int smoke_start(void)
+{
+	if (sipc_register(SMOKE_SELF_TITLE, ignore_callback, 10) == NOK) {
+		printf("\tsipc_register() failed, is sipcd running?\n");
+		return NOK;
+	}
+
+	return OK;
+}
+
+/*
+ * a subscriber which is slower than its publisher gets the newest data of
+ * every key, the older data waiting for it is replaced by sipcd
+ */
+static int smoke_slow_conflation(void)
+{
+	int ret = NOK;
+	unsigned int i;
+	unsigned long replaced = smoke_counter("conflation", NULL, "replaced");
+	char *title = "smoke/conflation/slow";
+	static char data[SMOKE_SLOW_SIZE];
+	struct sipc_ctx *slow = NULL;
+
+	smoke_reset(&late_inbox);
+
+	if (smoke_set_conflation(title, true) == NOK) {
+		return NOK;
+	}
+	if ((slow = sipc_ctx_create()) == NULL || sipc_ctx_register(slow, title, slow_callback, 10) == NOK ||
+			smoke_wait_subscribers(title, 1) == NOK) {
+		printf("\tthe slow subscriber cannot register\n");
+		goto out;
+	}
+
+	for (i = 1; i <= SMOKE_UPDATES; i++) {
+		//the newest data is sent after the others have reached sipcd
+		if (i == SMOKE_UPDATES) {
+			usleep(SMOKE_QUIET_MS * 1000);
+		}
+		snprintf(data, sizeof(data), "a:%u", i);
+		if (sipc_send_keyed_data(title, "a", data, sizeof(data)) == NOK) {
+			printf("\tsipc_send_keyed_data() failed\n");
+			goto out;
+		}
+		snprintf(data, sizeof(data), "b:%u", i);
+		if (sipc_send_keyed_data(title, "b", data, sizeof(data)) == NOK) {
+			printf("\tsipc_send_keyed_data() failed\n");
+			goto out;
+		}
+	}
+
+	for (i = 0; i < SMOKE_WAIT_MS / SMOKE_POLL_MS; i++) {
+		if (strtoul(late_inbox.keys[0] + 2, NULL, 10) == SMOKE_UPDATES &&
+				strtoul(late_inbox.keys[1] + 2, NULL, 10) == SMOKE_UPDATES) {
+			break;
+		}
+		usleep(SMOKE_POLL_MS * 1000);
+	}
+
+	if (strtoul(late_inbox.keys[0] + 2, NULL, 10) != SMOKE_UPDATES ||
+			strtoul(late_inbox.keys[1] + 2, NULL, 10) != SMOKE_UPDATES) {
+		printf("\tthe slow subscriber got '%s' and '%s' as the newest data\n", late_inbox.keys[0], late_inbox.keys[1]);
+		goto out;
+	}
+
+	if (smoke_load(&(late_inbox.errors)) || smoke_load(&(late_inbox.count)) >= 2 * SMOKE_UPDATES ||
+			smoke_counter("conflation", NULL, "replaced") <= replaced) {
+		printf("\tthe slow subscriber got %u data for %u sent, %u duplicated\n", late_inbox.count, 2 * SMOKE_UPDATES,
+			late_inbox.errors);
+		goto out;
+	}
+
+	ret = OK;
+
+out:
+	if (slow) {
+		sipc_ctx_destroy(slow);
+	}
+
+	return ret;
+}
+
+/*
+ * user-026, a subscriber gets the newest data of every key and never a data
+ * twice, the conflated title retains one data per key for the late subscribers
+ */
+static int case_conflation(void)
+{
+	int ret = NOK;
+	unsigned int i;
+	char *title = "smoke/conflation";
+	struct sipc_ctx *watch = NULL;
+
+	smoke_reset(&watch_inbox);
+
+	if (smoke_start() == NOK || smoke_set_conflation(title, true) == NOK) {
+		goto out;
+	}
+
+	if ((watch = sipc_ctx_create()) == NULL || sipc_ctx_register(watch, title, watch_callback, 10) == NOK) {
+		printf("\tthe subscriber cannot register\n");
+		goto out;
+	}
+	if (smoke_wait_subscribers(title, 1) == NOK) {
+		goto out;
+	}
+
+	for (i = 1; i < SMOKE_UPDATES; i++) {
+		if (smoke_send(title, "a", "a:%u", i) == NOK || smoke_send(title, "b", "b:%u", i) == NOK) {
+			printf("\tsipc_send_keyed_data() failed\n");
+			goto out;
+		}
+	}
+	usleep(SMOKE_QUIET_MS * 1000);
+
+	if (smoke_send(title, "a", "a:%u", SMOKE_UPDATES) == NOK || smoke_send(title, "b", "b:%u", SMOKE_UPDATES) == NOK) {
+		printf("\tsipc_send_keyed_data() failed\n");
+		goto out;
+	}
+
+	for (i = 0; i < SMOKE_WAIT_MS / SMOKE_POLL_MS; i++) {
+		if (smoke_load(&(watch_inbox.count)) && strtoul(watch_inbox.keys[0] + 2, NULL, 10) == SMOKE_UPDATES &&
+				strtoul(watch_inbox.keys[1] + 2, NULL, 10) == SMOKE_UPDATES) {
+			break;
+		}
+		usleep(SMOKE_POLL_MS * 1000);
+	}
+
+	if (strtoul(watch_inbox.keys[0] + 2, NULL, 10) != SMOKE_UPDATES ||
+			strtoul(watch_inbox.keys[1] + 2, NULL, 10) != SMOKE_UPDATES) {
+		printf("\tthe newest data of the keys is not delivered, got '%s' and '%s'\n", watch_inbox.keys[0],
+			watch_inbox.keys[1]);
+		goto out;
+	}
+
+	if (smoke_load(&(watch_inbox.errors)) || smoke_load(&(watch_inbox.count)) > 2 * SMOKE_UPDATES) {
+		printf("\t%u data duplicated, %u data for %u sent\n", watch_inbox.errors, watch_inbox.count, 2 * SMOKE_UPDATES);
+		goto out;
+	}
+
+	if (smoke_late_register(title, 2, "late subscriber of a conflated title") == NOK) {
+		goto out;
+	}
+
+	if (strtoul(late_inbox.keys[0] + 2, NULL, 10) != SMOKE_UPDATES ||
+			strtoul(late_inbox.keys[1] + 2, NULL, 10) != SMOKE_UPDATES) {
+		printf("\tthe retained data is '%s' and '%s'\n", late_inbox.keys[0], late_inbox.keys[1]);
+		goto out;
+	}
+
+	if (smoke_slow_conflation() == NOK) {
+		goto out;
+	}
+
+	ret = OK;
+
+out:
+	if (watch) {
+		sipc_ctx_destroy(watch);
+	}
+	sipc_destroy();
+
+	return ret;
+}
+
+/*
+ * user-027, only the newest data of a title is retained. switching the
+ * conflation drops it, a conflated title retains the newest data per key
+ */
+static int case_retained(void)
+{
+	int ret = NOK;
+	unsigned int i;
+	char *title = "smoke/retained";
+	struct sipc_ctx *watch = NULL;
+
+	smoke_reset(&watch_inbox);
+
+	if (smoke_start() == NOK) {
+		goto out;
+	}
+
+	if ((watch = sipc_ctx_create()) == NULL || sipc_ctx_register(watch, title, watch_callback, 10) == NOK) {
+		printf("\tthe subscriber cannot register\n");
+		goto out;
+	}
+	if (smoke_wait_subscribers(title, 1) == NOK) {
+		goto out;
+	}
+
+	//the data is retained once it is delivered
+	for (i = 1; i <= 5; i++) {
+		if (smoke_send_delivered(title, NULL, "plain %u", i) == NOK) {
+			goto out;
+		}
+	}
+
+	if (smoke_late_register(title, 1, "late subscriber") == NOK) {
+		goto out;
+	}
+	if (strcmp(late_inbox.last, "plain 5") != 0) {
+		printf("\tthe retained data is '%s' instead of 'plain 5'\n", late_inbox.last);
+		goto out;
+	}
+
+	if (smoke_set_conflation(title, true) == NOK) {
+		goto out;
+	}
+	if (smoke_late_register(title, 0, "late subscriber after enabling the conflation") == NOK) {
+		goto out;
+	}
+
+	if (smoke_send_delivered(title, "a", "a:%u", 1) == NOK || smoke_send_delivered(title, "b", "b:%u", 1) == NOK ||
+			smoke_send_delivered(title, "a", "a:%u", 2) == NOK) {
+		goto out;
+	}
+	if (strcmp(watch_inbox.keys[0], "a:2") != 0 || strcmp(watch_inbox.keys[1], "b:1") != 0) {
+		printf("\tthe subscriber got '%s' and '%s' instead of 'a:2' and 'b:1'\n", watch_inbox.keys[0],
+			watch_inbox.keys[1]);
+		goto out;
+	}
+
+	if (smoke_late_register(title, 2, "late subscriber of the keys") == NOK) {
+		goto out;
+	}
+	if (strcmp(late_inbox.keys[0], "a:2") != 0 || strcmp(late_inbox.keys[1], "b:1") != 0) {
+		printf("\tthe retained data is '%s' and '%s' instead of 'a:2' and 'b:1'\n", late_inbox.keys[0],
+			late_inbox.keys[1]);
+		goto out;
+	}
+
+	if (smoke_set_conflation(title, false) == NOK) {
+		goto out;
+	}
+	if (smoke_late_register(title, 0, "late subscriber after disabling the conflation") == NOK) {
+		goto out;
+	}
+
+	ret = OK;
+
+out:
+	if (watch) {
+		sipc_ctx_destroy(watch);
+	}
+	sipc_destroy();
+
+	return ret;
+}
+
+/*
+ * a context of its own subscribes the title, as another application would
+ */
+static struct sipc_ctx *smoke_subscribe(char *title, int (*callback)(void *, unsigned int))
+{
+	struct sipc_ctx *ctx = NULL;
+
+	if ((ctx = sipc_ctx_create()) == NULL || sipc_ctx_register(ctx, title, callback, 10) == NOK ||
+			smoke_wait_subscribers(title, 1) == NOK) {
+		printf("\tthe subscriber of the title '%s' cannot register\n", title);
+		if (ctx) {
+			sipc_ctx_destroy(ctx);
+		}
+		return NULL;
+	}
+
+	return ctx;
+}
+
+/*
+ * the data "a:1" to "a:<count>"
+ */
+static int smoke_publish(char *title, unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 1; i <= count; i++) {
+		if (smoke_send(title, NULL, "a:%u", i) == NOK) {
+			printf("\tsending the data %u to the title '%s' failed\n", i, title);
+			return NOK;
+		}
+	}
+
+	return OK;
+}
+
+/*
+ * OK if every data of smoke_publish() comes once
+ */
+static int smoke_check_published(struct smoke_inbox *inbox, unsigned int count, const char *what)
+{
+	if (smoke_wait_exactly(&(inbox->count), count, what) == NOK) {
+		return NOK;
+	}
+
+	if (inbox->errors || strtoul(inbox->keys[0] + 2, NULL, 10) != count) {
+		printf("\t%s: %u data duplicated, the newest one is '%s'\n", what, inbox->errors, inbox->keys[0]);
+		return NOK;
+	}
+
+	return OK;
+}
+
+/*
+ * user-028, the data of every priority class comes once
+ */
+static int case_priority(void)
+{
+	int ret = NOK;
+	unsigned int i;
+	char *high = "smoke/priority/high", *low = "smoke/priority/low";
+	struct sipc_ctx *watch = NULL;
+
+	smoke_reset(&watch_inbox);
+
+	if (smoke_start() == NOK || sipc_set_priority(high, PRIORITY_HIGH) == NOK || sipc_set_priority(low, PRIORITY_LOW) == NOK) {
+		goto out;
+	}
+
+	if ((watch = smoke_subscribe(low, watch_callback)) == NULL || sipc_ctx_register(watch, high, watch_callback, 10) == NOK ||
+			smoke_wait_subscribers(high, 1) == NOK) {
+		goto out;
+	}
+
+	for (i = 1; i <= 50; i++) {
+		if (smoke_send(low, NULL, "a:%u", i) == NOK || smoke_send(high, NULL, "b:%u", i) == NOK) {
+			printf("\tsipc_send_data() failed\n");
+			goto out;
+		}
+	}
+
+	if (smoke_wait_exactly(&(watch_inbox.count), 100, "data of two priorities") == NOK) {
+		goto out;
+	}
+	if (watch_inbox.errors || strcmp(watch_inbox.keys[0], "a:50") != 0 || strcmp(watch_inbox.keys[1], "b:50") != 0) {
+		printf("\t%u data duplicated, the newest ones are '%s' and '%s'\n", watch_inbox.errors, watch_inbox.keys[0],
+			watch_inbox.keys[1]);
+		goto out;
+	}
+
+	ret = OK;
+
+out:
+	if (watch) {
+		sipc_ctx_destroy(watch);
+	}
+	sipc_destroy();
+
+	return ret;
+}
+
+/*
+ * user-029, a compressed data comes as it is sent and sipcd carries it with
+ * its compressed size
+ */
+static int case_compression(void)
+{
+	int ret = NOK;
+	unsigned int i;
+	unsigned long bytes_in;
+	char *title = "smoke/compression";
+	struct sipc_ctx *watch = NULL;
+
+	smoke_reset(&watch_inbox);
+	for (i = 0; i < SMOKE_LARGE_SIZE; i++) {
+		large_data[i] = 'a' + (i / 64) % 16;
+	}
+
+	if (smoke_start() == NOK || sipc_set_compression(title, true) == NOK ||
+			(watch = smoke_subscribe(title, large_callback)) == NULL) {
+		goto out;
+	}
+
+	if (sipc_send_data(title, large_data, SMOKE_LARGE_SIZE) == NOK) {
+		printf("\tsipc_send_data() failed\n");
+		goto out;
+	}
+
+	if (smoke_wait_exactly(&(watch_inbox.count), 1, "compressed data") == NOK) {
+		goto out;
+	}
+	if (watch_inbox.errors) {
+		printf("\tthe data differs from the sent one\n");
+		goto out;
+	}
+
+	if ((bytes_in = smoke_counter("title", title, "bytes_in")) == 0 || bytes_in >= SMOKE_LARGE_SIZE) {
+		printf("\tsipcd got %lu bytes for %u bytes of data\n", bytes_in, SMOKE_LARGE_SIZE);
+		goto out;
+	}
+
+	ret = OK;
+
+out:
+	if (watch) {
+		sipc_ctx_destroy(watch);
+	}
+	sipc_destroy();
+
+	return ret;
+}
+
+/*
+ * user-030, a stream larger than a few chunks comes complete and in order
+ */
+static int case_stream(void)
+{
+	int ret = NOK;
+	unsigned int i, len;
+	char *title = "smoke/stream";
+	struct sipc_ctx *sub = NULL;
+	struct sipc_stream *stream = NULL;
+
+	smoke_reset(&watch_inbox);
+	for (i = 0; i < SMOKE_LARGE_SIZE; i++) {
+		large_data[i] = (char)(i * 7);
+	}
+
+	if (smoke_start() == NOK) {
+		goto out;
+	}
+
+	if ((sub = sipc_ctx_create()) == NULL || sipc_ctx_stream_register(sub, title, stream_callback, 10) == NOK ||
+			smoke_wait_subscribers(title, 1) == NOK) {
+		printf("\tthe subscriber cannot register\n");
+		goto out;
+	}
+
+	if ((stream = sipc_stream_open(title)) == NULL) {
+		printf("\tsipc_stream_open() failed\n");
+		goto out;
+	}
+	for (i = 0; i < SMOKE_LARGE_SIZE; i += len) {
+		len = SMOKE_LARGE_SIZE - i < 10000 ? SMOKE_LARGE_SIZE - i : 10000;
+		if (sipc_stream_write(stream, large_data + i, len) == NOK) {
+			printf("\tsipc_stream_write() failed\n");
+			goto out;
+		}
+	}
+	ret = sipc_stream_close(stream);
+	stream = NULL;
+	if (ret == NOK) {
+		printf("\tsipc_stream_close() failed\n");
+		goto out;
+	}
+	ret = NOK;
+
+	for (i = 0; i < SMOKE_WAIT_MS / SMOKE_POLL_MS; i++) {
+		if (smoke_load(&stream_last) && smoke_load(&stream_bytes) >= SMOKE_LARGE_SIZE) {
+			break;
+		}
+		usleep(SMOKE_POLL_MS * 1000);
+	}
+
+	if (!smoke_load(&stream_last) || smoke_load(&stream_bytes) != SMOKE_LARGE_SIZE || watch_inbox.errors ||
+			memcmp(stream_data, large_data, SMOKE_LARGE_SIZE) != 0) {
+		printf("\tgot %u bytes of %u, %u chunks out of order, the last chunk %s\n", stream_bytes, SMOKE_LARGE_SIZE,
+			watch_inbox.errors, stream_last ? "came" : "did not come");
+		goto out;
+	}
+
+	ret = OK;
+
+out:
+	if (stream) {
+		sipc_stream_close(stream);
+	}
+	if (sub) {
+		sipc_ctx_destroy(sub);
+	}
+	sipc_destroy();
+
+	return ret;
+}
+
+/*
+ * user-032, a retained receive buffer stays valid after its callback, and a
+ * buffer which is not loaned cannot be retained
+ */
+static int case_loaned(void)
+{
+	int ret = NOK;
+	char *title = "smoke/loaned";
+	struct sipc_ctx *sub = NULL;
+
+	smoke_reset(&watch_inbox);
+
+	if (smoke_start() == NOK) {
+		goto out;
+	}
+
+	if ((sub = sipc_ctx_create()) == NULL || sipc_ctx_register_loaned(sub, title, loaned_callback, 10) == NOK ||
+			smoke_wait_subscribers(title, 1) == NOK) {
+		printf("\tthe subscriber cannot register\n");
+		goto out;
+	}
+
+	if (smoke_publish(title, 10) == NOK || smoke_check_published(&watch_inbox, 10, "loaned data") == NOK) {
+		goto out;
+	}
+
+	if (!loaned_data || strcmp((const char *)loaned_data, "a:1") != 0) {
+		printf("\tthe retained buffer is '%s' instead of 'a:1'\n", loaned_data ? (const char *)loaned_data : "");
+		goto out;
+	}
+	if (sipc_buffer_release(loaned_data) == NOK) {
+		printf("\tsipc_buffer_release() failed\n");
+		goto out;
+	}
+	if (sipc_buffer_retain(large_data) == OK) {
+		printf("\tthe memory of the application is retained\n");
+		goto out;
+	}
+
+	ret = OK;
+
+out:
+	if (sub) {
+		sipc_ctx_destroy(sub);
+	}
+	sipc_destroy();
+
+	return ret;
+}
+
+/*
+ * user-033, sipcd counts the data of a title
+ */
+static int case_stats(void)
+{
+	int ret = NOK;
+	unsigned long msgs_in, msgs_out;
+	char *title = "smoke/stats";
+	struct sipc_ctx *watch = NULL;
+
+	smoke_reset(&watch_inbox);
+
+	if (smoke_start() == NOK || (watch = smoke_subscribe(title, watch_callback)) == NULL) {
+		goto out;
+	}
+
+	if (smoke_publish(title, 10) == NOK || smoke_check_published(&watch_inbox, 10, "counted data") == NOK) {
+		goto out;
+	}
+
+	msgs_in = smoke_counter("title", title, "msgs_in");
+	msgs_out = smoke_counter("title", title, "msgs_out");
+	if (msgs_in != 10 || msgs_out != 10 || !smoke_counter("daemon", NULL, "loops")) {
+		printf("\tsipcd counts %lu data in and %lu data out instead of 10\n", msgs_in, msgs_out);
+		goto out;
+	}
+
+	ret = OK;
+
+out:
+	if (watch) {
+		sipc_ctx_destroy(watch);
+	}
+	sipc_destroy();
+
+	return ret;
+}
+
+/*
+ * user-034, the stamped data has its timestamps in order and the latency
+ * histogram counts every data
+ */
+static int case_timestamps(void)
+{
+	int ret = NOK;
+	char *title = "smoke/timestamps";
+	struct sipc_ctx *sub = NULL;
+	struct sipc_latency_histogram histogram;
+
+	smoke_reset(&watch_inbox);
+
+	if (smoke_start() == NOK || sipc_set_timestamps(title, true) == NOK) {
+		goto out;
+	}
+
+	if ((sub = sipc_ctx_create()) == NULL || sipc_ctx_register_timed(sub, title, timed_callback, 10) == NOK ||
+			smoke_wait_subscribers(title, 1) == NOK) {
+		printf("\tthe subscriber cannot register\n");
+		goto out;
+	}
+
+	if (smoke_publish(title, 20) == NOK || smoke_check_published(&watch_inbox, 20, "stamped data") == NOK) {
+		goto out;
+	}
+
+	if (sipc_ctx_get_latency_histogram(sub, title, LATENCY_END_TO_END, &histogram) == NOK || histogram.count != 20) {
+		printf("\tthe histogram counts %lu data instead of 20\n", histogram.count);
+		goto out;
+	}
+
+	ret = OK;
+
+out:
+	if (sub) {
+		sipc_ctx_destroy(sub);
+	}
+	sipc_destroy();
+
+	return ret;
+}
+
+/*
+ * user-039, a data sent to this sipcd reaches a subscriber of a linked one.
+ * the data is sent again until the link carries the interest of the title
+ */
+static int case_federation(void)
+{
+	int ret = NOK;
+	unsigned int i;
+	char peer[32];
+	char *title = "smoke/federation";
+	pid_t peer_pid = -1, sub_pid = -1;
+
+	snprintf(peer, sizeof(peer), "[%s]:%u", IPV6_LOOPBACK_ADDR, PORT);
+
+	if ((peer_pid = start_case_daemon(SMOKE_PEER_PORT, "--peer", peer)) < 0) {
+		goto out;
+	}
+
+	if ((sub_pid = smoke_fork_subscriber(SMOKE_PEER_PORT, title, 1)) < 0 || smoke_start() == NOK) {
+		goto out;
+	}
+
+	for (i = 0; i < SMOKE_RECOVERY_MS / 100 && waitpid(sub_pid, NULL, WNOHANG) == 0; i++) {
+		if (smoke_send(title, NULL, "federated %u", i) == NOK) {
+			printf("\tsipc_send_data() failed\n");
+			goto out;
+		}
+		usleep(100 * 1000);
+	}
+
+	//the loop has reaped it if it is done
+	if (i == SMOKE_RECOVERY_MS / 100) {
+		printf("\tthe subscriber of the linked sipcd got nothing\n");
+		goto out;
+	}
+	sub_pid = -1;
+
+	ret = OK;
+
+out:
+	if (sub_pid > 0) {
+		smoke_reap(sub_pid, 0);
+	}
+	sipc_destroy();
+	stop_daemon(peer_pid);
+
+	return ret;
+}
+
+/*
+ * user-040, the titles are spread over two sipcd instances and every one of
+ * them is delivered
+ */
+static int case_sharding(void)
+{
+	int ret = NOK;
+	unsigned int i, second = 0;
+	char ports[32];
+	char titles[SMOKE_TITLES][SMOKE_DATA_SIZE];
+	pid_t shard_pid = -1;
+	struct sipc_ctx *watch = NULL;
+
+	smoke_reset(&watch_inbox);
+
+	snprintf(ports, sizeof(ports), "%u,%u", PORT, SMOKE_SHARD_PORT);
+	if ((shard_pid = start_case_daemon(SMOKE_SHARD_PORT, NULL, NULL)) < 0 || sipc_set_daemon_ports(ports) == NOK) {
+		goto out;
+	}
+
+	if (smoke_start() == NOK || (watch = sipc_ctx_create()) == NULL) {
+		goto out;
+	}
+
+	for (i = 0; i < SMOKE_TITLES; i++) {
+		snprintf(titles[i], sizeof(titles[i]), "smoke/sharding/%u", i);
+		second += sipc_shard_port(titles[i]) == SMOKE_SHARD_PORT;
+		if (sipc_ctx_register(watch, titles[i], watch_callback, 10) == NOK) {
+			printf("\tregistering the title '%s' failed\n", titles[i]);
+			goto out;
+		}
+	}
+
+	if (!second || second == SMOKE_TITLES) {
+		printf("\t%u titles of %u belong to the second sipcd\n", second, SMOKE_TITLES);
+		goto out;
+	}
+
+	//a data which comes before the registration is retained for it
+	for (i = 0; i < SMOKE_TITLES; i++) {
+		if (smoke_send(titles[i], NULL, "shard %u", i) == NOK) {
+			printf("\tsending to the title '%s' failed\n", titles[i]);
+			goto out;
+		}
+	}
+
+	if (smoke_wait_exactly(&(watch_inbox.count), SMOKE_TITLES, "data of the sharded titles") == NOK) {
+		goto out;
+	}
+
+	ret = OK;
+
+out:
+	if (watch) {
+		sipc_ctx_destroy(watch);
+	}
+	sipc_destroy();
+	stop_daemon(shard_pid);
+
+	return ret;
+}
+
+/*
+ * user-041, a sipcd which is killed and started with its snapshot knows the
+ * subscriber at once. the subscriber is stopped meanwhile, so it cannot
+ * register again by itself
+ */
+static int case_snapshot(void)
+{
+	int ret = NOK;
+	char path[64];
+	char *title = "smoke/snapshot";
+	pid_t daemon_pid = -1, sub_pid = -1;
+
+	snprintf(path, sizeof(path), "/tmp/sipc_smoke_%d.snapshot", (int)getpid());
+	unlink(path);
+	sipc_set_daemon_port(SMOKE_SNAPSHOT_PORT);
+
+	if ((daemon_pid = start_case_daemon(SMOKE_SNAPSHOT_PORT, "--snapshot", path)) < 0) {
+		goto out;
+	}
+
+	if ((sub_pid = smoke_fork_subscriber(SMOKE_SNAPSHOT_PORT, title, 1)) < 0 || smoke_wait_subscribers(title, 1) == NOK) {
+		goto out;
+	}
+
+	kill(sub_pid, SIGSTOP);
+	kill(daemon_pid, SIGKILL);
+	waitpid(daemon_pid, NULL, 0);
+
+	if ((daemon_pid = start_case_daemon(SMOKE_SNAPSHOT_PORT, "--snapshot", path)) < 0) {
+		goto out;
+	}
+	if (smoke_wait_subscribers(title, 1) == NOK) {
+		printf("\tthe snapshot does not keep the subscriber\n");
+		goto out;
+	}
+	kill(sub_pid, SIGCONT);
+
+	if (smoke_start() == NOK || smoke_send(title, NULL, "snapshot %u", 1) == NOK) {
+		goto out;
+	}
+
+	ret = smoke_reap(sub_pid, SMOKE_RECOVERY_MS);
+	sub_pid = -1;
+	if (ret == NOK) {
+		printf("\tthe subscriber got nothing after the restart\n");
+	}
+
+out:
+	if (sub_pid > 0) {
+		kill(sub_pid, SIGCONT);
+		smoke_reap(sub_pid, 0);
+	}
+	sipc_destroy();
+	stop_daemon(daemon_pid);
+	unlink(path);
+
+	return ret;
+}
+
+/*
+ * user-042, the data sent while sipcd is away waits in the library and comes
+ * once the application has registered again
+ */
+static int case_reconnect(void)
+{
+	int ret = NOK;
+	char *title = "smoke/reconnect";
+	pid_t daemon_pid = -1;
+	struct sipc_ctx *watch = NULL;
+
+	smoke_reset(&watch_inbox);
+	sipc_set_daemon_port(SMOKE_RESTART_PORT);
+
+	if ((daemon_pid = start_case_daemon(SMOKE_RESTART_PORT, NULL, NULL)) < 0) {
+		goto out;
+	}
+
+	if (smoke_start() == NOK || (watch = smoke_subscribe(title, watch_callback)) == NULL) {
+		goto out;
+	}
+
+	kill(daemon_pid, SIGKILL);
+	waitpid(daemon_pid, NULL, 0);
+
+	if (smoke_publish(title, 5) == NOK) {
+		goto out;
+	}
+
+	if ((daemon_pid = start_case_daemon(SMOKE_RESTART_PORT, NULL, NULL)) < 0) {
+		goto out;
+	}
+
+	if (smoke_wait_ms(&(watch_inbox.count), 5, SMOKE_RECOVERY_MS) == NOK) {
+		printf("\tgot %u data of 5 after the restart\n", watch_inbox.count);
+		goto out;
+	}
+	if (smoke_check_published(&watch_inbox, 5, "data of the restart") == NOK) {
+		goto out;
+	}
+
+	ret = OK;
+
+out:
+	if (watch) {
+		sipc_ctx_destroy(watch);
+	}
+	sipc_destroy();
+	stop_daemon(daemon_pid);
+
+	return ret;
+}
+
+/*
+ * user-043, a direct title reaches its subscriber once, sipcd is only asked
+ * for the subscribers but still counts and retains the data
+ */
+static int case_direct(void)
+{
+	int ret = NOK;
+	unsigned int waited;
+	unsigned long lookups, msgs_in;
+	char *title = "smoke/direct";
+	struct sipc_ctx *watch = NULL;
+
+	smoke_reset(&watch_inbox);
+
+	if (smoke_start() == NOK || sipc_set_direct(title, true) == NOK || (watch = smoke_subscribe(title, watch_callback)) == NULL) {
+		goto out;
+	}
+
+	lookups = smoke_counter("daemon", NULL, "lookups");
+	if (smoke_publish(title, 50) == NOK || smoke_check_published(&watch_inbox, 50, "direct data") == NOK) {
+		goto out;
+	}
+
+	if (smoke_counter("daemon", NULL, "lookups") <= lookups) {
+		printf("\tthe publisher did not ask sipcd for the subscribers\n");
+		goto out;
+	}
+
+	//sipcd hears of the direct data at the next tick of the supervisor
+	for (waited = 0; waited < SMOKE_WAIT_MS && smoke_counter("title", title, "msgs_in") < 50; waited += SMOKE_POLL_MS) {
+		usleep(SMOKE_POLL_MS * 1000);
+	}
+	if ((msgs_in = smoke_counter("title", title, "msgs_in")) != 50) {
+		printf("\tsipcd counted %lu data instead of 50\n", msgs_in);
+		goto out;
+	}
+
+	if (smoke_late_register(title, 1, "late subscriber of the direct title") == NOK) {
+		goto out;
+	}
+	if (strcmp(late_inbox.last, "a:50") != 0) {
+		printf("\tthe retained data is '%s' instead of 'a:50'\n", late_inbox.last);
+		goto out;
+	}
+
+	ret = OK;
+
+out:
+	if (watch) {
+		sipc_ctx_destroy(watch);
+	}
+	sipc_destroy();
+
+	return ret;
+}
+
+/*
+ * user-044, the titles of a single registration are all delivered
+ */
+static int case_bulk(void)
+{
+	int ret = NOK;
+	unsigned int i;
+	char titles[SMOKE_TITLES][SMOKE_DATA_SIZE];
+	struct sipc_registration registrations[SMOKE_TITLES];
+	struct sipc_ctx *watch = NULL;
+
+	smoke_reset(&watch_inbox);
+
+	for (i = 0; i < SMOKE_TITLES; i++) {
+		snprintf(titles[i], sizeof(titles[i]), "smoke/bulk/%u", i);
+		registrations[i].title = titles[i];
+		registrations[i].callback = watch_callback;
+	}
+
+	if (smoke_start() == NOK) {
+		goto out;
+	}
+
+	if ((watch = sipc_ctx_create()) == NULL || sipc_ctx_register_many(watch, registrations, SMOKE_TITLES, 10) == NOK) {
+		printf("\tsipc_ctx_register_many() failed\n");
+		goto out;
+	}
+
+	for (i = 0; i < SMOKE_TITLES; i++) {
+		if (smoke_send(titles[i], NULL, "bulk %u", i) == NOK) {
+			printf("\tsending to the title '%s' failed\n", titles[i]);
+			goto out;
+		}
+	}
+
+	if (smoke_wait_exactly(&(watch_inbox.count), SMOKE_TITLES, "data of the bulk titles") == NOK) {
+		goto out;
+	}
+
+	ret = OK;
+
+out:
+	if (watch) {
+		sipc_ctx_destroy(watch);
+	}
+	sipc_destroy();
+
+	return ret;
+}
+
+/*
+ * half of a packet is left on a connection to every registered client port,
+ * the fds of the connections are returned in 'fds'
+ */
+static unsigned int smoke_stall_clients(int *fds, unsigned int max)
+{
+	int fd = -1;
+	unsigned int port, count = 0;
+	char *stats = NULL, *line = NULL, *save = NULL;
+	char partial[3] = { SENDATA, PRIORITY_NORMAL, 0 };
+	struct sockaddr_storage address;
+
+	if ((stats = sipc_request_stats()) == NULL) {
+		return 0;
+	}
+
+	for (line = strtok_r(stats, "\n", &save); line && count < max; line = strtok_r(NULL, "\n", &save)) {
+		if (sscanf(line, "client port=%u registered=1", &port) != 1) {
+			continue;
+		}
+		memset(&address, 0, sizeof(address));
+		if (sipc_buf_to_sockstorage(IPV6_LOOPBACK_ADDR, port, &address) == NOK ||
+				(fd = sipc_socket_open_use_buf(IPV6_LOOPBACK_ADDR, SOCK_STREAM, 0)) < 0) {
+			continue;
+		}
+		if (sipc_connect_socket(fd, (struct sockaddr *)&address) < 0 || send(fd, partial, sizeof(partial), 0) != sizeof(partial)) {
+			close(fd);
+			continue;
+		}
+		fds[count++] = fd;
+	}
+	FREE(stats);
+
+	return count;
+}
+
+/*
+ * user-045, a sender which stops in the middle of a packet holds only its own
+ * connection, the listener still reads the others
+ */
+static int case_stalled(void)
+{
+	int ret = NOK;
+	int fds[SMOKE_MAX_RECORDS];
+	unsigned int i, count = 0;
+	char *title = "smoke/stalled";
+	struct sipc_ctx *watch = NULL;
+
+	smoke_reset(&watch_inbox);
+
+	if (smoke_start() == NOK || (watch = smoke_subscribe(title, watch_callback)) == NULL) {
+		goto out;
+	}
+
+	if ((count = smoke_stall_clients(fds, SMOKE_MAX_RECORDS)) < 2) {
+		printf("\tonly %u clients are stalled\n", count);
+		goto out;
+	}
+
+	if (smoke_publish(title, 50) == NOK || smoke_check_published(&watch_inbox, 50, "data behind a stalled sender") == NOK) {
+		goto out;
+	}
+
+	ret = OK;
+
+out:
+	for (i = 0; i < count; i++) {
+		close(fds[i]);
+	}
+	if (watch) {
+		sipc_ctx_destroy(watch);
+	}
+	sipc_destroy();
+
+	return ret;
+}
+
+/*
+ * user-046, two contexts of a process get the data of a title on their own
+ * listener threads
+ */
+static int case_contexts(void)
+{
+	int ret = NOK;
+	char *title = "smoke/contexts";
+	struct sipc_ctx *first = NULL, *second = NULL;
+
+	smoke_reset(&watch_inbox);
+	smoke_reset(&late_inbox);
+
+	if (smoke_start() == NOK || (first = smoke_subscribe(title, watch_callback)) == NULL) {
+		goto out;
+	}
+	if ((second = sipc_ctx_create()) == NULL || sipc_ctx_register(second, title, late_callback, 10) == NOK ||
+			smoke_wait_subscribers(title, 2) == NOK) {
+		printf("\tthe second context cannot register\n");
+		goto out;
+	}
+
+	if (smoke_publish(title, 20) == NOK || smoke_check_published(&watch_inbox, 20, "first context") == NOK ||
+			smoke_check_published(&late_inbox, 20, "second context") == NOK) {
+		goto out;
+	}
+
+	if (pthread_equal(watch_inbox.thread, late_inbox.thread) || pthread_equal(watch_inbox.thread, pthread_self())) {
+		printf("\tthe callbacks of the contexts run on the same thread\n");
+		goto out;
+	}
+
+	ret = OK;
+
+out:
+	if (first) {
+		sipc_ctx_destroy(first);
+	}
+	if (second) {
+		sipc_ctx_destroy(second);
+	}
+	sipc_destroy();
+
+	return ret;
+}
+
+/*
+ * user-047, the spinning and the adaptive listeners get all data
+ */
+static int case_receive_mode(void)
+{
+	int ret = NOK;
+	char *title = "smoke/receive_mode";
+	struct sipc_ctx *spin = NULL, *adaptive = NULL;
+
+	smoke_reset(&watch_inbox);
+	smoke_reset(&late_inbox);
+
+	if (smoke_start() == NOK) {
+		goto out;
+	}
+
+	if ((spin = sipc_ctx_create()) == NULL || sipc_ctx_set_receive_mode(spin, WAIT_SPIN, 0, -1) == NOK ||
+			sipc_ctx_register(spin, title, watch_callback, 10) == NOK) {
+		printf("\tthe spinning context cannot register\n");
+		goto out;
+	}
+	if ((adaptive = sipc_ctx_create()) == NULL || sipc_ctx_set_receive_mode(adaptive, WAIT_ADAPTIVE, 50, 0) == NOK ||
+			sipc_ctx_register(adaptive, title, late_callback, 10) == NOK) {
+		printf("\tthe adaptive context cannot register\n");
+		goto out;
+	}
+	if (smoke_wait_subscribers(title, 2) == NOK) {
+		goto out;
+	}
+
+	if (smoke_publish(title, 100) == NOK || smoke_check_published(&watch_inbox, 100, "spinning listener") == NOK ||
+			smoke_check_published(&late_inbox, 100, "adaptive listener") == NOK) {
+		goto out;
+	}
+
+	ret = OK;
+
+out:
+	if (spin) {
+		sipc_ctx_destroy(spin);
+	}
+	if (adaptive) {
+		sipc_ctx_destroy(adaptive);
+	}
+	sipc_destroy();
+
+	return ret;
+}
+
+/*
+ * user-048, a message of the registered version or a newer one is read in
+ * place, an older version and another message are dropped
+ */
+static int case_schema(void)
+{
+	int ret = NOK;
+	char *title = "smoke/schema";
+	struct sipc_ctx *sub = NULL;
+	struct smoke_quote quote = { .time = 1, .bid = 1.5, .size = 100, .venue = 7 };
+	struct smoke_quote_v3 quote_v3 = { .quote = { .time = 4, .bid = 1.5, .size = 100, .venue = 7 }, .sequence = 9 };
+
+	smoke_reset(&watch_inbox);
+
+	if (smoke_start() == NOK) {
+		goto out;
+	}
+
+	if ((sub = sipc_ctx_create()) == NULL || sipc_ctx_register_schema(sub, title, SIPC_SCHEMA_ID(1, 2), schema_callback, 10) == NOK ||
+			smoke_wait_subscribers(title, 1) == NOK) {
+		printf("\tthe subscriber cannot register\n");
+		goto out;
+	}
+
+	if (sipc_send_schema(title, SIPC_SCHEMA_ID(1, 2), &quote, sizeof(quote)) == NOK) {
+		goto out;
+	}
+	quote.time = 2;
+	if (sipc_send_schema(title, SIPC_SCHEMA_ID(1, 1), &quote, sizeof(quote)) == NOK) {
+		goto out;
+	}
+	quote.time = 3;
+	if (sipc_send_schema(title, SIPC_SCHEMA_ID(2, 2), &quote, sizeof(quote)) == NOK) {
+		goto out;
+	}
+	if (sipc_send_schema(title, SIPC_SCHEMA_ID(1, 3), &quote_v3, sizeof(quote_v3)) == NOK) {
+		printf("\tsipc_send_schema() failed\n");
+		goto out;
+	}
+
+	if (smoke_wait_exactly(&(watch_inbox.count), 2, "messages of the schema") == NOK) {
+		goto out;
+	}
+
+	if (watch_inbox.errors || watch_inbox.sequences[0] != 1 || watch_inbox.schema_ids[0] != SIPC_SCHEMA_ID(1, 2) ||
+			watch_inbox.sequences[1] != 4 || watch_inbox.schema_ids[1] != SIPC_SCHEMA_ID(1, 3)) {
+		printf("\tgot the messages %llu and %llu of the versions %u and %u\n", watch_inbox.sequences[0],
+			watch_inbox.sequences[1], SIPC_SCHEMA_VERSION(watch_inbox.schema_ids[0]),
+			SIPC_SCHEMA_VERSION(watch_inbox.schema_ids[1]));
+		goto out;
+	}
+
+	ret = OK;
+
+out:
+	if (sub) {
+		sipc_ctx_destroy(sub);
+	}
+	sipc_destroy();
+
+	return ret;
+}
+
+/*
+ * user-049, every subscriber of the broadcast data gets all of it over its
+ * link of sipcd
+ */
+static int case_broadcast(void)
+{
+	int ret = NOK;
+	unsigned int i;
+	char data[SMOKE_DATA_SIZE];
+	char *name = "<broadcast>";
+	struct sipc_ctx *first = NULL, *second = NULL;
+
+	smoke_reset(&watch_inbox);
+	smoke_reset(&late_inbox);
+
+	if (smoke_start() == NOK) {
+		goto out;
+	}
+
+	if ((first = sipc_ctx_create()) == NULL || sipc_ctx_broadcast_register(first, watch_callback, 10) == NOK ||
+			(second = sipc_ctx_create()) == NULL || sipc_ctx_broadcast_register(second, late_callback, 10) == NOK ||
+			smoke_wait_subscribers(name, 2) == NOK) {
+		printf("\tthe subscribers cannot register\n");
+		goto out;
+	}
+
+	for (i = 1; i <= 200; i++) {
+		snprintf(data, sizeof(data), "a:%u", i);
+		if (sipc_send_bradcast_data(data, strlen(data)) == NOK) {
+			printf("\tsending the broadcast data failed\n");
+			goto out;
+		}
+	}
+
+	if (smoke_check_published(&watch_inbox, 200, "first subscriber") == NOK ||
+			smoke_check_published(&late_inbox, 200, "second subscriber") == NOK) {
+		goto out;
+	}
+
+	if (!smoke_counter("broadcast", NULL, "batches") || smoke_counter("broadcast", NULL, "errors")) {
+		printf("\tsipcd has no broadcast batches or has errors\n");
+		goto out;
+	}
+
+	ret = OK;
+
+out:
+	if (first) {
+		sipc_ctx_destroy(first);
+	}
+	if (second) {
+		sipc_ctx_destroy(second);
+	}
+	sipc_destroy();
+
+	return ret;
+}
+
+/*
+ * a datagram of SMOKE_FAKE_PORT, as sipc_send_datagram() of the library
+ * writes it
+ */
+static int smoke_send_datagram(int fd, char *title, unsigned long long sequence)
+{
+	int ret = NOK;
+	FILE *fp = NULL;
+	char *buffer = NULL;
+	size_t size = 0;
+	unsigned int port = sipc_daemon_port();
+	char payload[sizeof(struct sipc_datagram_header) + SMOKE_DATA_SIZE];
+	struct sipc_datagram_header header;
+	struct _packet packet;
+
+	memset(&header, 0, sizeof(header));
+	header.port = SMOKE_FAKE_PORT;
+	header.sequence = sequence;
+	memcpy(payload, &header, sizeof(header));
+	snprintf(payload + sizeof(header), SMOKE_DATA_SIZE, "datagram %llu", sequence);
+
+	memset(&packet, 0, sizeof(packet));
+	packet.packet_type = SENDATA;
+	packet.priority = PRIORITY_NORMAL;
+	packet.flags = PACKET_FLAG_DATAGRAM;
+	packet.title = title;
+	packet.title_size = strlen(title) + 1;
+	packet.payload = payload;
+	packet.payload_size = sizeof(header) + strlen(payload + sizeof(header)) + 1;
+
+	if ((fp = open_memstream(&buffer, &size)) == NULL || sipc_pack_packet(&packet, fp) == NOK) {
+		printf("\tpacking the datagram failed\n");
+		goto out;
+	}
+	FCLOSE(fp);
+
+	if (sipc_send_datagrams(fd, &buffer, &size, &port, 1) != 1) {
+		printf("\tsending the datagram failed\n");
+		goto out;
+	}
+	ret = OK;
+
+out:
+	FCLOSE(fp);
+	FREE(buffer);
+
+	return ret;
+}
+
+/*
+ * user-050, a subscriber is told the datagrams lost before a datagram, and a
+ * datagram older than the last one is dropped
+ */
+static int case_datagram(void)
+{
+	int ret = NOK;
+	int fd = -1;
+	unsigned int i;
+	char *title = "smoke/datagram";
+	struct sipc_ctx *sub = NULL;
+	unsigned long long sent[] = { 1, 2, 5, 3, 6 };
+	unsigned long long sequences[] = { 1, 2, 5, 6 };
+	unsigned long losts[] = { 0, 0, 2, 0 };
+
+	smoke_reset(&datagram_inbox);
+
+	if (smoke_start() == NOK) {
+		goto out;
+	}
+
+	if ((sub = sipc_ctx_create()) == NULL || sipc_ctx_register_datagram(sub, title, datagram_callback, 10) == NOK) {
+		printf("\tthe subscriber cannot register\n");
+		goto out;
+	}
+	if (smoke_wait_subscribers(title, 1) == NOK) {
+		goto out;
+	}
+
+	if ((fd = sipc_open_datagram(0)) < 0) {
+		printf("\tsipc_open_datagram() failed\n");
+		goto out;
+	}
+
+	for (i = 0; i < sizeof(sent) / sizeof(sent[0]); i++) {
+		if (smoke_send_datagram(fd, title, sent[i]) == NOK) {
+			goto out;
+		}
+		usleep(SMOKE_POLL_MS * 1000);
+	}
+
+	if (smoke_wait_exactly(&(datagram_inbox.count), 4, "datagrams with a gap") == NOK) {
+		goto out;
+	}
+
+	for (i = 0; i < 4; i++) {
+		if (datagram_inbox.sequences[i] != sequences[i] || datagram_inbox.losts[i] != losts[i]) {
+			printf("\tdatagram %u is %llu with %lu lost, expected %llu with %lu lost\n", i, datagram_inbox.sequences[i],
+				datagram_inbox.losts[i], sequences[i], losts[i]);
+			goto out;
+		}
+	}
+
+	//the datagrams of the library, every one is either delivered or counted as lost
+	smoke_reset(&datagram_inbox);
+	if (sipc_set_datagram(title, true) == NOK) {
+		goto out;
+	}
+
+	for (i = 1; i <= SMOKE_DATAGRAMS; i++) {
+		if (smoke_send(title, NULL, "datagram %u", i) == NOK) {
+			printf("\tsipc_send_data() failed\n");
+			goto out;
+		}
+	}
+
+	for (i = 0; i < SMOKE_WAIT_MS / SMOKE_POLL_MS && __atomic_load_n(&(datagram_inbox.last_sequence), __ATOMIC_ACQUIRE) <
+			SMOKE_DATAGRAMS; i++) {
+		usleep(SMOKE_POLL_MS * 1000);
+	}
+
+	if (datagram_inbox.last_sequence != SMOKE_DATAGRAMS || datagram_inbox.count + datagram_inbox.lost != SMOKE_DATAGRAMS) {
+		printf("\tlast datagram %llu, %u delivered and %lu lost of %u\n", datagram_inbox.last_sequence,
+			datagram_inbox.count, datagram_inbox.lost, SMOKE_DATAGRAMS);
+		goto out;
+	}
+
+	ret = OK;
+
+out:
+	if (fd >= 0) {
+		close(fd);
+	}
+	if (sub) {
+		sipc_ctx_destroy(sub);
+	}
+	sipc_destroy();
+
+	return ret;
+}
+
+static struct smoke_case cases[] = {
+	{ "conflation",		case_conflation		},
+	{ "retained",		case_retained		},
+	{ "priority",		case_priority		},
+	{ "compression",	case_compression	},
+	{ "stream",			case_stream			},
+	{ "loaned",			case_loaned			},
+	{ "stats",			case_stats			},
+	{ "timestamps",		case_timestamps		},
+	{ "federation",		case_federation		},
+	{ "sharding",		case_sharding		},
+	{ "snapshot",		case_snapshot		},
+	{ "reconnect",		case_reconnect		},
+	{ "direct",			case_direct			},
+	{ "bulk",			case_bulk			},
+	{ "stalled",		case_stalled		},
+	{ "contexts",		case_contexts		},
+	{ "receive_mode",	case_receive_mode	},
+	{ "schema",			case_schema			},
+	{ "broadcast",		case_broadcast		},
+	{ "datagram",		case_datagram		},
+};
+
+/*
+ * the case gets a process group, so the sipcd instances it starts go with it
+ * when it hangs
+ */
+static int run_case(struct smoke_case *smoke)
+{
+	int fd, status = 0;
+	unsigned int waited;
+	pid_t pid;
+
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0) {
+		errorf("fork() failed with %d: %s\n", errno, strerror(errno));
+		return NOK;
+	} else if (pid == 0) {
+		setpgid(0, 0);
+		if (!verbose && (fd = open("/dev/null", O_WRONLY)) >= 0) {
+			dup2(fd, STDERR_FILENO);
+			close(fd);
+		}
+		status = smoke->run();
+		fflush(stdout);
+		_exit(status);
+	}
+
+	for (waited = 0; waitpid(pid, &status, WNOHANG) != pid; waited += SMOKE_POLL_MS) {
+		if (waited >= SMOKE_CASE_TIMEOUT * 1000) {
+			printf("\tno result in %d seconds\n", SMOKE_CASE_TIMEOUT);
+			kill(-pid, SIGKILL);
+			waitpid(pid, &status, 0);
+			return NOK;
+		}
+		usleep(SMOKE_POLL_MS * 1000);
+	}
+
+	return WIFEXITED(status) && WEXITSTATUS(status) == OK ? OK : NOK;
+}
+
+int main(int argc, char **argv)
+{
+	int ret = OK;
+	int c, o;
+	unsigned int i, run = 0, failed = 0;
+	pid_t daemon_pid = -1;
+
+	while ((c = getopt_long(argc, argv, "hvd:c:V", parameters, &o)) != -1) {
+		switch (c) {
+			case 'h':
+				print_help_exit(argv[0]);
+				break;
+			case 'v':
+				printf("%s version %s\n", argv[0], VERSION);
+				return OK;
+				break;
+			case 'd':
+				daemon_path = optarg;
+				break;
+			case 'c':
+				case_name = optarg;
+				break;
+			case 'V':
+				verbose = true;
+				break;
+			default:
+				errorf("unknown argument\n");
+				return NOK;
+		}
+	}
+
+	if ((daemon_pid = start_daemon(NULL)) < 0) {
+		errorf("start_daemon() failed\n");
+		return NOK;
+	}
+
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		if (case_name && strcmp(case_name, cases[i].name) != 0) {
+			continue;
+		}
+		run++;
+		if (run_case(&(cases[i])) == OK) {
+			printf("PASS %s\n", cases[i].name);
+		} else {
+			printf("FAIL %s\n", cases[i].name);
+			failed++;
+		}
+	}
+
+	stop_daemon(daemon_pid);
+
+	printf("%u of %u cases passed\n", run - failed, run);
+	if (!run || failed) {
+		ret = NOK;
+	}
+
+	return ret;
+}